@@ -0,0 +1,18 @@
+// Minimal stand-in for the simulator's svdpi.h, so that uart_dpi.cpp can be built without Verilator.
+// It only declares what uart_dpi.cpp uses. The open array routines are implemented in uart_dpi_bench_common.h .
+
+#ifndef UART_DPI_BENCH_SVDPI_H_INCLUDED
+#define UART_DPI_BENCH_SVDPI_H_INCLUDED
+
+#include <stdint.h>
+
+typedef uint8_t svBit;
+typedef void * svOpenArrayHandle;
+
+extern "C"
+{
+  void * svGetArrayPtr ( const svOpenArrayHandle h );
+  int svSize ( const svOpenArrayHandle h, int d );
+}
+
+#endif  // Include this header file only once.
@@ -0,0 +1,371 @@
+// Micro-benchmarks for the C++ side of the UART DPI module.
+//
+// This program drives uart_dpi.cpp through its DPI entry points, just like uart_dpi.v would,
+// but without Verilator or any simulated SoC. It prints the results as a JSON object to stdout,
+// so that they can be compared between versions. Build it from the top-level directory like this:
+//
+//   g++ -O2 -std=c++11 -D_GNU_SOURCE -pthread -Ibench bench/uart_dpi_bench.cpp -o uart_dpi_bench
+//
+// Add -DUART_DPI_USE_IO_URING to measure the io_uring backend.
+//
+// Usage: uart_dpi_bench [--quick] [--port <tcp port>]
+//
+// The benchmark listens on the given TCP port (default 23700) on localhost, and connects to it itself.
+// Option --quick runs fewer iterations, which is enough to check that everything works,
+// but the numbers are then less stable.
+
+#define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_bench"
+
+#include "../uart_dpi.cpp"
+#include "uart_dpi_bench_common.h"
+
+#include <netinet/tcp.h>  // For TCP_NODELAY.
+
+#include <chrono>
+#include <string>
+
+
+// ---------------------------- Helpers ----------------------------
+
+// Like the transmit staging buffer in uart_dpi.v .
+static const int SEND_BLOCK_SIZE = 16;
+
+
+static double get_elapsed_seconds ( const std::chrono::steady_clock::time_point & start )
+{
+  return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+}
+
+
+// Keeps ticking until the I/O thread has accepted the client connection, which is not synchronous.
+
+static int connect_client ( const long long obj, const int tcp_port )
+{
+  const int s = connect_to_localhost( tcp_port );
+
+  const int yes = 1;
+  setsockopt( s, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof( yes ) );
+
+  // Wait until the client is in control, so that the first bytes sent are not discarded.
+  const char probe = 'p';
+
+  if ( send( s, &probe, 1, 0 ) != 1 )
+    fail( "Error sending the probe byte." );
+
+  for ( ; ; )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( obj, &received_byte_count, &transmit_blocked );
+
+    if ( received_byte_count != 0 )
+    {
+      char c;
+      uart_dpi_receive( obj, &c );
+      break;
+    }
+
+    usleep( 100 );
+  }
+
+  return s;
+}
+
+
+static double measure_idle_tick_ns ( const long long obj, const long tick_count )
+{
+  int received_byte_count;
+  svBit transmit_blocked;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for ( long i = 0; i < tick_count; ++i )
+    tick( obj, &received_byte_count, &transmit_blocked );
+
+  return get_elapsed_seconds( start ) * 1e9 / double( tick_count );
+}
+
+
+// Without a client, the transmit buffer just keeps overwriting its oldest bytes, so this measures
+// the cost of the DPI call alone. There are no ticks in between, so the I/O thread is never woken up.
+
+static double measure_send_char_ns ( const long long obj, const long byte_count )
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for ( long i = 0; i < byte_count; ++i )
+  {
+    if ( 0 != uart_dpi_send( obj, char( i ) ) )
+      fail( "Error sending data." );
+  }
+
+  return get_elapsed_seconds( start ) * 1e9 / double( byte_count );
+}
+
+
+// The client floods the simulation with data, and the simulation reads it byte by byte on every tick.
+
+static void measure_receive ( const long long obj,
+                              const int client_socket,
+                              const long byte_count,
+                              double * const receive_ns,
+                              double * const mb_per_s )
+{
+  std::thread sender( [ client_socket, byte_count ] ( void )
+  {
+    static char block[ 64 * 1024 ];
+    long sent = 0;
+
+    while ( sent < byte_count )
+    {
+      const ssize_t res = send( client_socket, block, size_t( std::min( long( sizeof( block ) ), byte_count - sent ) ), 0 );
+
+      if ( res <= 0 )
+        fail( "Error sending data from the client." );
+
+      sent += res;
+    }
+  } );
+
+  double receive_seconds = 0;
+  long received = 0;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while ( received < byte_count )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( obj, &received_byte_count, &transmit_blocked );
+
+    if ( received_byte_count == 0 )
+      continue;
+
+    const std::chrono::steady_clock::time_point receive_start = std::chrono::steady_clock::now();
+
+    for ( int i = 0; i < received_byte_count; ++i )
+    {
+      char c;
+
+      if ( 0 != uart_dpi_receive( obj, &c ) )
+        fail( "Error receiving data." );
+    }
+
+    receive_seconds += get_elapsed_seconds( receive_start );
+    received += received_byte_count;
+  }
+
+  const double total_seconds = get_elapsed_seconds( start );
+
+  sender.join();
+
+  *receive_ns = receive_seconds * 1e9 / double( received );
+  *mb_per_s   = double( received ) / total_seconds / 1e6;
+}
+
+
+// The simulation sends blocks of SEND_BLOCK_SIZE bytes, one per tick, like uart_dpi.v does with its staging buffer.
+// The instance is in lossless transmit mode, so all data must arrive.
+
+static double measure_transmit_mb_per_s ( const long long obj, const int client_socket, const long byte_count )
+{
+  std::atomic< bool > is_done( false );
+
+  std::thread receiver( [ client_socket, byte_count, &is_done ] ( void )
+  {
+    static char block[ 64 * 1024 ];
+    long received = 0;
+
+    while ( received < byte_count )
+    {
+      const ssize_t res = recv( client_socket, block, sizeof( block ), 0 );
+
+      if ( res <= 0 )
+        fail( "Error receiving data in the client." );
+
+      received += res;
+    }
+
+    is_done = true;
+  } );
+
+  char data[ SEND_BLOCK_SIZE ];
+  memset( data, 'x', sizeof( data ) );
+  bench_open_array array = { data, SEND_BLOCK_SIZE };
+
+  long sent = 0;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // Keep ticking until the client has got everything, as the simulation would.
+  while ( !is_done )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( obj, &received_byte_count, &transmit_blocked );
+
+    if ( transmit_blocked || sent == byte_count )
+      continue;
+
+    const int count = int( std::min( long( SEND_BLOCK_SIZE ), byte_count - sent ) );
+
+    if ( 0 != uart_dpi_send_block( obj, &array, count ) )
+      fail( "Error sending data." );
+
+    sent += count;
+  }
+
+  const double seconds = get_elapsed_seconds( start );
+
+  receiver.join();
+
+  return double( byte_count ) / seconds / 1e6;
+}
+
+
+// The client sends one byte, the simulation sends it back as soon as it sees it, and the client waits for it.
+// The simulation keeps ticking as fast as it can, like a fast simulated SoC with a polling console.
+
+static void measure_round_trip ( const long long obj,
+                                 const int client_socket,
+                                 const int round_trip_count,
+                                 double * const median_us,
+                                 double * const p99_us )
+{
+  std::vector< double > times_us;
+  times_us.reserve( round_trip_count );
+
+  std::atomic< bool > is_done( false );
+
+  std::thread client( [ client_socket, round_trip_count, &times_us, &is_done ] ( void )
+  {
+    for ( int i = 0; i < round_trip_count; ++i )
+    {
+      const char out = char( i );
+      char in;
+
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      if ( send( client_socket, &out, 1, 0 ) != 1 || recv( client_socket, &in, 1, MSG_WAITALL ) != 1 )
+        fail( "Error in the round trip client." );
+
+      times_us.push_back( get_elapsed_seconds( start ) * 1e6 );
+
+      if ( in != out )
+        fail( "The round trip data does not match." );
+    }
+
+    is_done = true;
+  } );
+
+  while ( !is_done )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( obj, &received_byte_count, &transmit_blocked );
+
+    for ( int i = 0; i < received_byte_count; ++i )
+    {
+      char c;
+
+      if ( 0 != uart_dpi_receive( obj, &c ) || 0 != uart_dpi_send( obj, c ) )
+        fail( "Error echoing data." );
+    }
+  }
+
+  client.join();
+
+  std::sort( times_us.begin(), times_us.end() );
+  *median_us = times_us[ times_us.size() / 2 ];
+  *p99_us    = times_us[ times_us.size() * 99 / 100 ];
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  bool is_quick = false;
+  int tcp_port = 23700;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--quick" )
+      is_quick = true;
+    else if ( arg == "--port" && i + 1 < argc )
+      tcp_port = atoi( argv[ ++i ] );
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  // The client sockets may be closed while the I/O thread is still sending.
+  signal( SIGPIPE, SIG_IGN );
+
+  const long scale = is_quick ? 1 : 10;
+
+  bench_instance_parameters parameters;
+  parameters.tcp_port = tcp_port;
+
+  // Default transmit mode, where send_char never fails.
+  const long long lossy_obj = create_instance( parameters );
+
+  io_reactor * const reactor = io_reactor::acquire();
+  const char * const io_backend = reactor->is_using_io_uring() ? "io_uring" : "epoll";
+  io_reactor::release();
+
+  const double idle_tick_ns = measure_idle_tick_ns( lossy_obj, 2000000 * scale );
+
+  const int idle_client_socket = connect_client( lossy_obj, tcp_port );
+  const double idle_tick_with_client_ns = measure_idle_tick_ns( lossy_obj, 2000000 * scale );
+  close( idle_client_socket );
+
+  const double send_char_ns = measure_send_char_ns( lossy_obj, 2000000 * scale );
+
+  uart_dpi_destroy( lossy_obj );
+
+  // Lossless transmit mode, so that the throughput figures include no lost data.
+  parameters.lossless_transmit = true;
+  const long long obj = create_instance( parameters );
+  const int client_socket = connect_client( obj, tcp_port );
+
+  double receive_ns;
+  double receive_mb_per_s;
+  measure_receive( obj, client_socket, 8 * 1024 * 1024 * scale, &receive_ns, &receive_mb_per_s );
+
+  const double transmit_mb_per_s = measure_transmit_mb_per_s( obj, client_socket, 16 * 1024 * 1024 * scale );
+
+  double round_trip_median_us;
+  double round_trip_p99_us;
+  measure_round_trip( obj, client_socket, int( 2000 * scale ), &round_trip_median_us, &round_trip_p99_us );
+
+  close( client_socket );
+  uart_dpi_destroy( obj );
+
+  printf( "{\n"
+          "  \"benchmark\": \"uart_dpi\",\n"
+          "  \"io_backend\": \"%s\",\n"
+          "  \"quick\": %s,\n"
+          "  \"results\": {\n"
+          "    \"idle_tick_ns\": %.2f,\n"
+          "    \"idle_tick_with_client_ns\": %.2f,\n"
+          "    \"send_char_ns\": %.2f,\n"
+          "    \"receive_ns\": %.2f,\n"
+          "    \"receive_mb_per_s\": %.2f,\n"
+          "    \"transmit_mb_per_s\": %.2f,\n"
+          "    \"round_trip_median_us\": %.2f,\n"
+          "    \"round_trip_p99_us\": %.2f\n"
+          "  }\n"
+          "}\n",
+          io_backend,
+          is_quick ? "true" : "false",
+          idle_tick_ns,
+          idle_tick_with_client_ns,
+          send_char_ns,
+          receive_ns,
+          receive_mb_per_s,
+          transmit_mb_per_s,
+          round_trip_median_us,
+          round_trip_p99_us );
+
+  return 0;
+}
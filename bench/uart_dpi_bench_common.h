@@ -0,0 +1,178 @@
+// Helpers shared by the programs in this directory, which drive uart_dpi.cpp through its DPI entry points
+// without Verilator. Include this header right after uart_dpi.cpp itself, like this:
+//
+//   #define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_bench"
+//
+//   #include "../uart_dpi.cpp"
+//   #include "uart_dpi_bench_common.h"
+//
+// It implements the open array routines declared in svdpi.h, so each program must consist of a single
+// translation unit.
+
+#ifndef UART_DPI_BENCH_COMMON_H_INCLUDED
+#define UART_DPI_BENCH_COMMON_H_INCLUDED
+
+#ifndef UART_DPI_BENCH_PROGRAM_NAME
+  #error "Define UART_DPI_BENCH_PROGRAM_NAME before including this header."
+#endif
+
+#include <string>
+
+
+// ---------------------------- svdpi.h stand-in ----------------------------
+
+// The open arrays are just a pointer and an element count.
+
+struct bench_open_array
+{
+  void * data;
+  int    size;
+};
+
+void * svGetArrayPtr ( const svOpenArrayHandle h )
+{
+  return ( (bench_open_array *) h )->data;
+}
+
+int svSize ( const svOpenArrayHandle h, const int d )
+{
+  assert( d == 1 );
+  (void) d;
+  return ( (bench_open_array *) h )->size;
+}
+
+
+// ---------------------------- Helpers ----------------------------
+
+static inline void fail ( const std::string & message )
+{
+  fprintf( stderr, "%s: %s\n", UART_DPI_BENCH_PROGRAM_NAME, message.c_str() );
+  exit( 1 );
+}
+
+
+// The arguments of uart_dpi_create(). The defaults are those of the parameters in uart_dpi.v ,
+// except that no informational messages are printed.
+
+struct bench_instance_parameters
+{
+  int         tcp_port                     = 0;
+  std::string endpoint;
+  bool        listen_on_local_addr_only    = true;
+  int         transmit_buffer_size         = 100 * 1024;
+  int         receive_buffer_size          = 100 * 1024;
+  bool        lossless_transmit            = false;
+  int         transmit_low_watermark       = -1;
+  int         max_client_count             = 1;
+  int         slow_client_policy           = 0;
+  int         transmit_flush_policy        = 0;
+  int         transmit_flush_threshold     = -1;
+  int         transmit_flush_latency_ms    = 100;
+  int         socket_profile               = 0;
+  int         socket_send_buffer_size      = 0;
+  int         socket_receive_buffer_size   = 0;
+  std::string capture_file_name;
+  std::string transmit_stamp_file_name;
+  bool        transmit_stamp_per_byte      = false;
+  std::string finish_pass_patterns;
+  std::string finish_fail_patterns;
+  std::string script_file_name;
+  std::string receive_record_file_name;
+  std::string receive_replay_file_name;
+  std::string stats_file_name;
+  std::string port_name;
+  std::string welcome_message;
+  std::string informational_message_prefix;  // Informational messages are only printed if this is not empty.
+  int         tick_all_index               = -1;
+};
+
+
+// Returns false if uart_dpi_create() rejects the parameters, after it has printed the reason.
+
+static inline bool try_create_instance ( const bench_instance_parameters & p, long long * const obj )
+{
+  return 0 == uart_dpi_create( p.tcp_port,
+                               p.endpoint.c_str(),
+                               p.listen_on_local_addr_only ? 1 : 0,
+                               p.transmit_buffer_size,
+                               p.receive_buffer_size,
+                               p.lossless_transmit ? 1 : 0,
+                               p.transmit_low_watermark,
+                               p.max_client_count,
+                               p.slow_client_policy,
+                               p.transmit_flush_policy,
+                               p.transmit_flush_threshold,
+                               p.transmit_flush_latency_ms,
+                               p.socket_profile,
+                               p.socket_send_buffer_size,
+                               p.socket_receive_buffer_size,
+                               p.capture_file_name.c_str(),
+                               p.transmit_stamp_file_name.c_str(),
+                               p.transmit_stamp_per_byte ? 1 : 0,
+                               p.finish_pass_patterns.c_str(),
+                               p.finish_fail_patterns.c_str(),
+                               p.script_file_name.c_str(),
+                               p.receive_record_file_name.c_str(),
+                               p.receive_replay_file_name.c_str(),
+                               p.stats_file_name.c_str(),
+                               p.port_name.c_str(),
+                               p.welcome_message.c_str(),
+                               p.informational_message_prefix.empty() ? 0 : 1,
+                               p.informational_message_prefix.c_str(),
+                               p.tick_all_index,
+                               obj );
+}
+
+
+static inline long long create_instance ( const bench_instance_parameters & p )
+{
+  long long obj;
+
+  if ( !try_create_instance( p, &obj ) )
+    fail( "Error creating a UART DPI instance." );
+
+  return obj;
+}
+
+
+static inline void tick ( const long long obj, int * const received_byte_count, svBit * const transmit_blocked )
+{
+  if ( 0 != uart_dpi_tick( obj, received_byte_count, transmit_blocked ) )
+    fail( "Error ticking a UART DPI instance." );
+}
+
+
+static inline long long get_stat ( const long long obj, const int index )
+{
+  long long counters[ UART_DPI_STAT_COUNT ];
+  bench_open_array array = { counters, UART_DPI_STAT_COUNT };
+
+  if ( 0 != uart_dpi_get_stats( obj, &array ) )
+    fail( "Error reading the performance counters." );
+
+  return counters[ index ];
+}
+
+
+// Returns a blocking client socket connected to the given TCP port on localhost.
+
+static inline int connect_to_localhost ( const int tcp_port )
+{
+  const int s = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+  if ( s == -1 )
+    fail( get_error_message( "Error creating a client socket: ", errno ) );
+
+  sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( uint16_t( tcp_port ) );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  if ( 0 != connect( s, (const sockaddr *) &addr, sizeof( addr ) ) )
+    fail( get_error_message( "Error connecting to a UART DPI instance: ", errno ) );
+
+  return s;
+}
+
+#endif  // Include this header file only once.
@@ -0,0 +1,521 @@
+// Functional check of the simulation checkpoints of the UART DPI module, see section "Simulation checkpoints"
+// in README.pod .
+//
+// Each scenario runs twice, once straight through, and once with a checkpoint saved and restored in the middle,
+// and both runs must end the same way. The checks cover:
+//
+//   - Saving again right after restoring produces the same checkpoint data, if there is no I/O thread involved.
+//   - The data in the transmit and receive buffers, the tick count and the performance counters survive.
+//   - A finish pattern split across the checkpoint still matches.
+//   - A script carries on with the same step, the same wait and a partially matched expected text.
+//   - Truncated or corrupt checkpoint data is rejected, and the existing instances remain untouched.
+//   - If re-creating an instance fails, no instances remain, rather than some of them.
+//   - Saving a checkpoint while the I/O thread is sending and releasing the transmitted data works.
+//
+// Build it from the top-level directory like this, preferably with AddressSanitizer:
+//
+//   g++ -O1 -g -std=c++11 -D_GNU_SOURCE -fsanitize=address,undefined -pthread -Ibench bench/uart_dpi_checkpoint_check.cpp -o uart_dpi_checkpoint_check
+//
+// Usage: uart_dpi_checkpoint_check [--port <tcp port>]
+//
+// The script instance listens on the given TCP port (default 23990) on localhost, and another instance on the next one.
+// The error messages from the UART DPI module along the way are expected.
+// The program prints "OK" and exits with status 0 if all checks pass.
+
+#define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_checkpoint_check"
+
+#include "../uart_dpi.cpp"
+#include "uart_dpi_bench_common.h"
+
+#include <poll.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+
+// ---------------------------- Helpers ----------------------------
+
+static const int BUFFER_SIZE = 4096;
+
+static int s_tcp_port = 23990;
+
+
+static void send_string ( const long long obj, const std::string & data )
+{
+  for ( const char c : data )
+  {
+    if ( 0 != uart_dpi_send( obj, c ) )
+      fail( "Error sending data." );
+  }
+}
+
+
+static std::string receive_string ( const long long obj, const size_t byte_count )
+{
+  std::string received;
+
+  for ( size_t i = 0; i < byte_count; ++i )
+  {
+    char c;
+
+    if ( 0 != uart_dpi_receive( obj, &c ) )
+      fail( "Error receiving data." );
+
+    received += c;
+  }
+
+  return received;
+}
+
+
+// Ticks once and returns whether a finish pattern or the script has decided the outcome.
+
+static bool tick_once ( const long long obj )
+{
+  int received_byte_count;
+  svBit transmit_blocked;
+  const int res = uart_dpi_tick( obj, &received_byte_count, &transmit_blocked );
+
+  if ( res != 0 && res != RET_PATTERN_MATCHED )
+    fail( "Error ticking a UART DPI instance." );
+
+  return res == RET_PATTERN_MATCHED;
+}
+
+
+static int get_pattern_match ( const long long obj )
+{
+  int pattern_kind;
+
+  if ( 0 != uart_dpi_get_pattern_match( obj, &pattern_kind ) )
+    fail( "Error reading the pattern match." );
+
+  return pattern_kind;
+}
+
+
+static std::string peek_transmitted ( const long long obj )
+{
+  const char * data;
+  size_t byte_count;
+
+  if ( 0 != uart_dpi_peek_transmitted( obj, &data, &byte_count ) )
+    fail( "Error peeking at the transmitted data." );
+
+  return std::string( data == NULL ? "" : data, byte_count );
+}
+
+
+static std::string save_checkpoint ( void )
+{
+  std::string data;
+
+  if ( 0 != uart_dpi_save_checkpoint( &data ) )
+    fail( "Error saving a checkpoint." );
+
+  return data;
+}
+
+
+// Saves a checkpoint, restores it, and checks that the instance looks the same afterwards.
+// The background I/O thread serves the re-created sockets straight away, so with an endpoint that uses it,
+// its counters may only have grown, and saving again may produce different data.
+
+static void save_and_restore ( const long long obj, const bool has_io_thread, const char * const what )
+{
+  long long counters_before[ UART_DPI_STAT_COUNT ];
+
+  for ( int i = 0; i < UART_DPI_STAT_COUNT; ++i )
+    counters_before[ i ] = get_stat( obj, i );
+
+  const std::string data = save_checkpoint();
+
+  if ( 0 != uart_dpi_restore_checkpoint( data ) )
+    fail( std::string( what ) + ": error restoring the checkpoint." );
+
+  if ( !has_io_thread && save_checkpoint() != data )
+    fail( std::string( what ) + ": saving again after restoring produces different checkpoint data." );
+
+  for ( int i = 0; i < UART_DPI_STAT_COUNT; ++i )
+  {
+    const long long counter = get_stat( obj, i );
+    const bool is_io_thread_counter = i >= UART_DPI_STAT_IO_SERVICE_COUNT;
+
+    if ( ( is_io_thread_counter && has_io_thread ) ? counter < counters_before[ i ] : counter != counters_before[ i ] )
+      fail( std::string( what ) + ": performance counter " + std::to_string( i ) + " has not been restored." );
+  }
+}
+
+
+// ---------------------------- Checks ----------------------------
+
+struct harness_result
+{
+  std::string transmitted;
+  std::string received;
+  long long   match_tick_count;
+};
+
+
+// A testbench pushes data to the simulated software, which reads some of it, and transmits a finish pass pattern
+// in two pieces. Optionally with a checkpoint between the pieces.
+
+static harness_result run_harness_scenario ( const bool with_checkpoint )
+{
+  bench_instance_parameters parameters;
+  parameters.endpoint             = "harness";
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+  parameters.finish_pass_patterns = "PASS-MARK";
+
+  const long long obj = create_instance( parameters );
+
+  size_t pushed_byte_count;
+
+  if ( 0 != uart_dpi_push_received( obj, "hello", 5, &pushed_byte_count ) || pushed_byte_count != 5 )
+    fail( "Error pushing the received data." );
+
+  harness_result result;
+  result.received = receive_string( obj, 2 );
+
+  send_string( obj, "abc PASS-" );
+
+  for ( int i = 0; i < 10; ++i )
+  {
+    if ( tick_once( obj ) )
+      fail( "Harness scenario: the finish pattern matched too early." );
+  }
+
+  if ( with_checkpoint )
+  {
+    const long long tick_count = get_stat( obj, UART_DPI_STAT_TICK_COUNT );
+
+    save_and_restore( obj, false, "Harness scenario" );
+
+    if ( peek_transmitted( obj ) != "abc PASS-" )
+      fail( "Harness scenario: the transmit buffer has not been restored." );
+
+    if ( get_stat( obj, UART_DPI_STAT_TICK_COUNT ) != tick_count )
+      fail( "Harness scenario: the tick count has not been restored." );
+  }
+
+  result.received += receive_string( obj, 3 );
+
+  send_string( obj, "MARK" );
+
+  while ( !tick_once( obj ) )
+  {
+    if ( get_stat( obj, UART_DPI_STAT_TICK_COUNT ) > 100 )
+      fail( "Harness scenario: the finish pattern did not match." );
+  }
+
+  if ( get_pattern_match( obj ) != PATTERN_KIND_PASS )
+    fail( "Harness scenario: the wrong kind of pattern matched." );
+
+  result.transmitted      = peek_transmitted( obj );
+  result.match_tick_count = get_stat( obj, UART_DPI_STAT_TICK_COUNT );
+
+  uart_dpi_destroy( obj );
+  return result;
+}
+
+
+static void check_harness_scenario ( void )
+{
+  const harness_result expected = run_harness_scenario( false );
+  const harness_result actual   = run_harness_scenario( true );
+
+  if ( actual.transmitted != expected.transmitted || actual.received != expected.received )
+    fail( "Harness scenario: the data differs after restoring the checkpoint." );
+
+  if ( actual.match_tick_count != expected.match_tick_count )
+    fail( "Harness scenario: the finish pattern matched at a different clock tick after restoring the checkpoint." );
+}
+
+
+static const char SCRIPT_TEXT[] =
+  "timeout 1000\n"
+  "expect \"login: \"\n"
+  "send \"root\\n\"\n"
+  "wait 50\n"
+  "expect \"done\"\n";
+
+
+// The simulated software prompts for a login, the script answers and waits, and the software transmits
+// the next expected text in two pieces during the wait. Optionally with a checkpoint between the pieces.
+// Returns the clock tick at which the script completed.
+
+static long long run_script_scenario ( const std::string & script_file_name, const bool with_checkpoint )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port             = s_tcp_port;
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+  parameters.script_file_name     = script_file_name;
+
+  const long long obj = create_instance( parameters );
+
+  send_string( obj, "login: " );
+
+  for ( int i = 0; i < 20; ++i )
+  {
+    if ( tick_once( obj ) )
+      fail( "Script scenario: the script ended too early." );
+  }
+
+  if ( receive_string( obj, 2 ) != "ro" )
+    fail( "Script scenario: the script has not sent the expected text." );
+
+  send_string( obj, "do" );
+
+  if ( with_checkpoint )
+    save_and_restore( obj, true, "Script scenario" );
+
+  if ( receive_string( obj, 3 ) != "ot\n" )
+    fail( "Script scenario: the receive buffer has not been restored." );
+
+  send_string( obj, "ne" );
+
+  while ( !tick_once( obj ) )
+  {
+    if ( get_stat( obj, UART_DPI_STAT_TICK_COUNT ) > 500 )
+      fail( "Script scenario: the script did not complete." );
+  }
+
+  if ( get_pattern_match( obj ) != PATTERN_KIND_PASS )
+    fail( "Script scenario: the script failed." );
+
+  const long long tick_count = get_stat( obj, UART_DPI_STAT_TICK_COUNT );
+
+  uart_dpi_destroy( obj );
+  return tick_count;
+}
+
+
+static void check_script_scenario ( void )
+{
+  char script_file_name[] = "/tmp/uart_dpi_checkpoint_check_XXXXXX";
+
+  const int fd = mkstemp( script_file_name );
+
+  if ( fd == -1 )
+    fail( get_error_message( "Error creating the script file: ", errno ) );
+
+  const ssize_t written = write( fd, SCRIPT_TEXT, sizeof( SCRIPT_TEXT ) - 1 );
+  close( fd );
+
+  if ( written != ssize_t( sizeof( SCRIPT_TEXT ) - 1 ) )
+    fail( "Error writing the script file." );
+
+  const long long expected = run_script_scenario( script_file_name, false );
+  const long long actual   = run_script_scenario( script_file_name, true );
+
+  unlink( script_file_name );
+
+  if ( actual != expected )
+    fail( "Script scenario: the script completed at clock tick " + std::to_string( actual ) +
+          " after restoring the checkpoint, instead of " + std::to_string( expected ) + "." );
+}
+
+
+// Reads the length prefix and the data like VerilatedDeserialize.
+
+struct memory_stream
+{
+  const char * pos;
+
+  void read ( void * const data, const size_t byte_count )
+  {
+    memcpy( data, pos, byte_count );
+    pos += byte_count;
+  }
+};
+
+
+static void check_rejected_data ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.endpoint             = "harness";
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+
+  const long long obj = create_instance( parameters );
+  send_string( obj, "kept" );
+
+  const std::string data = save_checkpoint();
+
+  if ( 0 == uart_dpi_restore_checkpoint( data.substr( 0, data.size() - 1 ) ) )
+    fail( "Truncated checkpoint data has been accepted." );
+
+  if ( 0 == uart_dpi_restore_checkpoint( data + '\0' ) )
+    fail( "Checkpoint data with trailing garbage has been accepted." );
+
+  if ( 0 == uart_dpi_restore_checkpoint( "x" + data.substr( 1 ) ) )
+    fail( "Checkpoint data with an invalid signature has been accepted." );
+
+  if ( 0 == uart_dpi_restore_checkpoint( std::string() ) )
+    fail( "Empty checkpoint data has been accepted." );
+
+  const uint64_t huge_length = uint64_t( 1 ) << 62;
+  memory_stream stream = { (const char *) &huge_length };
+
+  if ( 0 == uart_dpi_restore_checkpoint_from( stream ) )
+    fail( "A checkpoint stream with an implausible length has been accepted." );
+
+  if ( peek_transmitted( obj ) != "kept" )
+    fail( "Rejecting the checkpoint data has touched the existing instance." );
+
+  uart_dpi_destroy( obj );
+}
+
+
+// The checkpoint holds a harness instance and a TCP instance, whose TCP port is taken by the time of restoring.
+
+static void check_failed_restore ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.endpoint             = "harness";
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+
+  const long long harness_obj = create_instance( parameters );
+
+  parameters.endpoint = std::string();
+  parameters.tcp_port = s_tcp_port + 1;
+
+  const long long tcp_obj = create_instance( parameters );
+
+  const std::string data = save_checkpoint();
+  uart_dpi_destroy( tcp_obj );
+
+  const int s = socket( AF_INET, SOCK_STREAM, 0 );
+
+  if ( s == -1 )
+    fail( get_error_message( "Error creating a socket: ", errno ) );
+
+  const int enable = 1;
+  sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( uint16_t( s_tcp_port + 1 ) );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  if ( setsockopt( s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof( enable ) ) != 0 ||
+       bind( s, (const sockaddr *) &addr, sizeof( addr ) ) != 0 ||
+       listen( s, 1 ) != 0 )
+  {
+    fail( get_error_message( "Error taking the TCP port of the checkpointed instance: ", errno ) );
+  }
+
+  if ( 0 == uart_dpi_restore_checkpoint( data ) )
+    fail( "Failed restore: restoring has succeeded, although the TCP port was taken." );
+
+  close( s );
+
+  long long counters[ UART_DPI_STAT_COUNT ];
+  bench_open_array array = { counters, UART_DPI_STAT_COUNT };
+
+  if ( 0 == uart_dpi_get_stats( harness_obj, &array ) )
+    fail( "Failed restore: the harness instance remains." );
+}
+
+
+static std::atomic< bool > s_should_stop_draining( false );
+
+
+static void drain_thread_main ( const int s, long long * const drained_byte_count )
+{
+  long long byte_count = 0;
+
+  while ( !s_should_stop_draining )
+  {
+    pollfd poll_fd = { s, POLLIN, 0 };
+
+    if ( poll( &poll_fd, 1, 100 ) == -1 && errno != EINTR )
+      fail( get_error_message( "Error polling the client socket: ", errno ) );
+
+    if ( ( poll_fd.revents & ( POLLIN | POLLHUP | POLLERR ) ) == 0 )
+      continue;
+
+    char buffer[ 4096 ];
+    const ssize_t res = recv( s, buffer, sizeof( buffer ), 0 );
+
+    if ( res == 0 )
+      fail( "The UART DPI instance has closed the client connection." );
+
+    if ( res == -1 )
+    {
+      if ( errno != EINTR )
+        fail( get_error_message( "Error receiving data: ", errno ) );
+
+      continue;
+    }
+
+    byte_count += res;
+  }
+
+  *drained_byte_count = byte_count;
+}
+
+
+// A client keeps draining the transmit buffer while the simulated software keeps transmitting,
+// and a checkpoint gets saved on every clock tick. The I/O thread then releases transmitted data
+// at any point while the checkpoint is being saved.
+
+static void check_concurrent_save ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port             = s_tcp_port + 1;
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+
+  const long long obj = create_instance( parameters );
+  const int s = connect_to_localhost( parameters.tcp_port );
+
+  long long drained_byte_count = 0;
+  std::thread drain_thread( drain_thread_main, s, &drained_byte_count );
+
+  for ( int i = 0; i < 100000; ++i )
+  {
+    send_string( obj, "0123456789" );
+
+    if ( tick_once( obj ) )
+      fail( "Concurrent save: a pattern has matched unexpectedly." );
+
+    if ( save_checkpoint().empty() )
+      fail( "Concurrent save: the checkpoint data is empty." );
+  }
+
+  s_should_stop_draining = true;
+  drain_thread.join();
+  close( s );
+
+  if ( drained_byte_count == 0 )
+    fail( "Concurrent save: the client has not received anything." );
+
+  uart_dpi_destroy( obj );
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--port" && i + 1 < argc )
+      s_tcp_port = atoi( argv[ ++i ] );
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  check_harness_scenario();
+  check_script_scenario();
+  check_rejected_data();
+  check_failed_restore();
+  check_concurrent_save();
+
+  printf( "OK\n" );
+  return 0;
+}
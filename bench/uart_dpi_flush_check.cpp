@@ -0,0 +1,359 @@
+// Functional check of the transmit flush policies and socket profiles of the UART DPI module,
+// see section "Coalescing the transmitted data" in README.pod .
+//
+// Each check creates an instance with its own TCP port, connects a client and looks at when the transmitted data
+// arrives. The checks only rely on data not arriving too early, and give it plenty of time to arrive afterwards,
+// so that they do not fail on a busy computer. They cover:
+//
+//   - The immediate policy, with the interactive socket profile.
+//   - The line-buffered policy, including the time limit for the data after the last end-of-line character.
+//   - The size threshold policy without a time limit, with the bulk socket profile, whose TCP_CORK must not keep
+//     the data back for long.
+//   - The timer policy, with explicit socket buffer sizes.
+//   - Lossless transmit mode, where the held back data goes out as soon as the simulation has to wait.
+//   - The parameter combinations that are rejected.
+//
+// Build it from the top-level directory like this, preferably with AddressSanitizer:
+//
+//   g++ -O1 -g -std=c++11 -D_GNU_SOURCE -fsanitize=address,undefined -pthread -Ibench bench/uart_dpi_flush_check.cpp -o uart_dpi_flush_check
+//
+// Usage: uart_dpi_flush_check [--port <tcp port>]
+//
+// The instances listen on consecutive TCP ports on localhost, starting at the given one (default 23960).
+// The error messages from the UART DPI module along the way are expected.
+// The program prints "OK" and exits with status 0 if all checks pass.
+
+#define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_flush_check"
+
+#include "../uart_dpi.cpp"
+#include "uart_dpi_bench_common.h"
+
+#include <chrono>
+#include <string>
+
+
+// ---------------------------- Helpers ----------------------------
+
+static const int BUFFER_SIZE = 4096;
+
+// How long to wait for data that should arrive, before giving up.
+static const int TIMEOUT_MS = 10000;
+
+static int s_next_tcp_port = 23960;
+
+
+struct flush_check_connection
+{
+  long long obj;
+  int       client_socket;
+};
+
+
+static void send_string ( const long long obj, const std::string & data )
+{
+  for ( const char c : data )
+  {
+    if ( 0 != uart_dpi_send( obj, c ) )
+      fail( "Error sending data." );
+  }
+}
+
+
+// Creates the instance on the next free TCP port, connects a client to it and waits until the connection
+// has been accepted, so that the client does not miss any data.
+
+static flush_check_connection connect_instance ( bench_instance_parameters parameters )
+{
+  parameters.tcp_port             = s_next_tcp_port++;
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+
+  flush_check_connection conn;
+  conn.obj = create_instance( parameters );
+  conn.client_socket = connect_to_localhost( parameters.tcp_port );
+
+  if ( fcntl( conn.client_socket, F_SETFL, O_NONBLOCK ) != 0 )
+    fail( get_error_message( "Error making the client socket non-blocking: ", errno ) );
+
+  const auto start = std::chrono::steady_clock::now();
+
+  while ( get_stat( conn.obj, UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT ) == 0 )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( conn.obj, &received_byte_count, &transmit_blocked );
+
+    if ( std::chrono::steady_clock::now() - start > std::chrono::milliseconds( TIMEOUT_MS ) )
+      fail( "Timeout waiting for the connection to be accepted." );
+
+    usleep( 1000 );
+  }
+
+  return conn;
+}
+
+
+static void disconnect_instance ( const flush_check_connection & conn )
+{
+  close( conn.client_socket );
+  uart_dpi_destroy( conn.obj );
+}
+
+
+// Keeps ticking the instance for the given time, or until the client has received the given number of bytes,
+// and returns what the client has received.
+
+static std::string receive_for ( const flush_check_connection & conn, const int ms, const size_t byte_count = SIZE_MAX )
+{
+  std::string received;
+  const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds( ms );
+
+  while ( received.size() < byte_count && std::chrono::steady_clock::now() < end )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( conn.obj, &received_byte_count, &transmit_blocked );
+
+    char data[ BUFFER_SIZE ];
+    const ssize_t count = recv( conn.client_socket, data, sizeof( data ), 0 );
+
+    if ( count > 0 )
+      received.append( data, size_t( count ) );
+    else if ( count == 0 )
+      fail( "The instance has closed the connection." );
+    else if ( errno != EAGAIN && errno != EWOULDBLOCK )
+      fail( get_error_message( "Error receiving data: ", errno ) );
+
+    usleep( 500 );
+  }
+
+  return received;
+}
+
+
+static void expect_nothing_for ( const flush_check_connection & conn, const int ms, const char * const what )
+{
+  const std::string received = receive_for( conn, ms );
+
+  if ( !received.empty() )
+    fail( std::string( what ) + ": \"" + received + "\" arrived too early." );
+}
+
+
+static void expect_data ( const flush_check_connection & conn, const std::string & expected, const char * const what )
+{
+  const std::string received = receive_for( conn, TIMEOUT_MS, expected.size() );
+
+  if ( received != expected )
+    fail( std::string( what ) + ": expected \"" + expected + "\", but got \"" + received + "\"." );
+}
+
+
+static double get_elapsed_ms ( const std::chrono::steady_clock::time_point & start )
+{
+  return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+}
+
+
+// ---------------------------- Checks ----------------------------
+
+static void check_immediate_policy ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.socket_profile = SOCKET_PROFILE_INTERACTIVE;
+
+  const flush_check_connection conn = connect_instance( parameters );
+
+  send_string( conn.obj, "hi" );
+  expect_data( conn, "hi", "Immediate policy" );
+
+  disconnect_instance( conn );
+}
+
+
+static void check_line_policy ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.transmit_flush_policy     = TRANSMIT_FLUSH_LINE;
+  parameters.transmit_flush_latency_ms = 400;
+
+  const flush_check_connection conn = connect_instance( parameters );
+
+  const auto start = std::chrono::steady_clock::now();
+
+  send_string( conn.obj, "abc" );
+  expect_nothing_for( conn, 100, "Line policy before the end of line" );
+
+  send_string( conn.obj, "\nde" );
+  expect_data( conn, "abc\n", "Line policy at the end of line" );
+
+  // The rest goes out when transmit_flush_latency_ms has passed since the first byte was held back.
+  expect_data( conn, "de", "Line policy after the time limit" );
+
+  if ( get_elapsed_ms( start ) < 350 )
+    fail( "Line policy: the data after the last end of line arrived before the time limit." );
+
+  disconnect_instance( conn );
+}
+
+
+static void check_size_policy ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.transmit_flush_policy     = TRANSMIT_FLUSH_SIZE;
+  parameters.transmit_flush_threshold  = 10;
+  parameters.transmit_flush_latency_ms = 0;  // No time limit.
+  parameters.socket_profile            = SOCKET_PROFILE_BULK;
+
+  const flush_check_connection conn = connect_instance( parameters );
+
+  send_string( conn.obj, "123456789" );
+  expect_nothing_for( conn, 300, "Size policy below the threshold" );
+
+  // TCP_CORK holds a partial segment back for up to 200 ms, which expect_data() waits for.
+  send_string( conn.obj, "0ab" );
+  expect_data( conn, "1234567890", "Size policy at the threshold" );
+  expect_nothing_for( conn, 300, "Size policy after the threshold" );
+
+  disconnect_instance( conn );
+}
+
+
+static void check_timer_policy ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.transmit_flush_policy      = TRANSMIT_FLUSH_TIMER;
+  parameters.transmit_flush_latency_ms  = 200;
+  parameters.socket_send_buffer_size    = 64 * 1024;
+  parameters.socket_receive_buffer_size = 64 * 1024;
+
+  const flush_check_connection conn = connect_instance( parameters );
+
+  const auto start = std::chrono::steady_clock::now();
+
+  send_string( conn.obj, "x" );
+  expect_nothing_for( conn, 50, "Timer policy" );
+
+  send_string( conn.obj, "yz\n" );
+  expect_data( conn, "xyz\n", "Timer policy" );
+
+  if ( get_elapsed_ms( start ) < 150 )
+    fail( "Timer policy: the data arrived before the flush latency." );
+
+  disconnect_instance( conn );
+}
+
+
+static void check_lossless_flush ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.lossless_transmit         = true;
+  parameters.transmit_flush_policy     = TRANSMIT_FLUSH_TIMER;
+  parameters.transmit_flush_latency_ms = 60 * 1000;
+  parameters.socket_send_buffer_size   = 4096;
+
+  const flush_check_connection conn = connect_instance( parameters );
+
+  // The client does not read yet, so the socket buffers fill up, and then the transmit buffer,
+  // until the simulation has to wait.
+  std::string sent;
+
+  for ( ; ; )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( conn.obj, &received_byte_count, &transmit_blocked );
+
+    if ( transmit_blocked )
+      break;
+
+    if ( sent.size() > 16 * 1024 * 1024 )
+      fail( "Lossless flush: the simulation never had to wait." );
+
+    const char c = char( 'a' + sent.size() % 26 );
+    send_string( conn.obj, std::string( 1, c ) );
+    sent += c;
+  }
+
+  // Everything arrives well before the flush latency, which is longer than the timeout.
+  expect_data( conn, sent, "Lossless flush" );
+
+  disconnect_instance( conn );
+}
+
+
+static void expect_rejected ( const bench_instance_parameters & parameters, const char * const what )
+{
+  long long obj;
+
+  if ( try_create_instance( parameters, &obj ) )
+    fail( std::string( "The module has accepted " ) + what + "." );
+}
+
+
+static void check_rejected_parameters ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port             = s_next_tcp_port;
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+
+  bench_instance_parameters p = parameters;
+  p.transmit_flush_policy = 4;
+  expect_rejected( p, "an unknown flush policy" );
+
+  p = parameters;
+  p.transmit_flush_policy     = TRANSMIT_FLUSH_TIMER;
+  p.transmit_flush_latency_ms = 0;
+  expect_rejected( p, "the timer policy without a flush latency" );
+
+  p = parameters;
+  p.transmit_flush_policy    = TRANSMIT_FLUSH_SIZE;
+  p.transmit_flush_threshold = BUFFER_SIZE / 2 + 1;
+  expect_rejected( p, "a flush threshold above half the transmit buffer" );
+
+  p = parameters;
+  p.socket_profile = 3;
+  expect_rejected( p, "an unknown socket profile" );
+
+  p = parameters;
+  p.endpoint              = "mux:flush";
+  p.transmit_flush_policy = TRANSMIT_FLUSH_LINE;
+  expect_rejected( p, "a flush policy with the multiplexing transport" );
+
+  p = parameters;
+  p.endpoint              = "harness";
+  p.transmit_flush_policy = TRANSMIT_FLUSH_TIMER;
+  expect_rejected( p, "a flush policy with the harness transport" );
+
+  p = parameters;
+  p.endpoint       = "pty";
+  p.socket_profile = SOCKET_PROFILE_INTERACTIVE;
+  expect_rejected( p, "a socket profile with the pseudo-terminal transport" );
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--port" && i + 1 < argc )
+      s_next_tcp_port = atoi( argv[ ++i ] );
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  // The I/O thread may still be writing to a client that has disconnected.
+  signal( SIGPIPE, SIG_IGN );
+
+  check_rejected_parameters();
+  check_immediate_policy();
+  check_line_policy();
+  check_size_policy();
+  check_timer_policy();
+  check_lossless_flush();
+
+  printf( "OK\n" );
+  return 0;
+}
@@ -0,0 +1,527 @@
+// Functional check of the multiplexing server of the UART DPI module, see uart_dpi_mux.h .
+//
+// Several instances share one TCP port as channels, and this program connects to them as two clients
+// that speak the framed protocol. It checks that:
+//
+//   - Unsupported parameter combinations are rejected.
+//   - Each client gets an OPEN frame per channel, also for channels created later,
+//     and then the data of all channels, including the data transmitted before it connected.
+//   - A large lossless transfer arrives intact at both clients, while the other channels keep going.
+//   - Only the client that has been connected the longest can send data, and a full receive buffer
+//     pauses reading from it without losing anything.
+//   - A channel destroyed with unsent data sends that data before its CLOSE frame.
+//   - The other client takes over the input when the first one disconnects.
+//   - An invalid frame closes the connection, and the TCP port is free again after the last channel is gone.
+//
+// Build it from the top-level directory like this, preferably with AddressSanitizer:
+//
+//   g++ -O1 -g -std=c++11 -D_GNU_SOURCE -fsanitize=address,undefined -pthread -Ibench bench/uart_dpi_mux_check.cpp -o uart_dpi_mux_check
+//
+// Usage: uart_dpi_mux_check [--port <tcp port>]
+//
+// The server listens on the given TCP port (default 23900) on localhost.
+// The error messages from the UART DPI module along the way are expected.
+// The program prints "OK" and exits with status 0 if all checks pass.
+
+#define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_mux_check"
+
+#include "../uart_dpi.cpp"
+#include "uart_dpi_bench_common.h"
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+
+// ---------------------------- Helpers ----------------------------
+
+static const int BUFFER_SIZE = 1024;
+
+// How long to wait for something that should happen, before giving up.
+static const double TIMEOUT_SECONDS = 10;
+
+static int s_tcp_port = 23900;
+
+
+struct channel_instance
+{
+  long long   obj;
+  std::string name;
+  std::string received;  // What the clients have sent to this instance so far.
+};
+
+
+struct mux_client
+{
+  int fd;
+  bool is_signature_received;
+  bool is_connection_closed;
+  std::string input;
+  std::map< uint16_t, std::string > channel_names;
+  std::map< uint16_t, std::string > channel_data;
+  std::set< uint16_t > closed_channels;
+};
+
+
+static channel_instance create_channel ( const std::string & name, const bool lossless_transmit )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port             = s_tcp_port;
+  parameters.endpoint             = "mux:" + name;
+  parameters.transmit_buffer_size = BUFFER_SIZE;
+  parameters.receive_buffer_size  = BUFFER_SIZE;
+  parameters.lossless_transmit    = lossless_transmit;
+
+  channel_instance channel;
+  channel.obj  = create_instance( parameters );
+  channel.name = name;
+  return channel;
+}
+
+
+// Ticks the instance and collects whatever it has received, unless told to leave it in the receive buffer.
+
+static void tick_channel ( channel_instance * const channel, const bool should_receive = true )
+{
+  int received_byte_count;
+  svBit transmit_blocked;
+  tick( channel->obj, &received_byte_count, &transmit_blocked );
+
+  if ( !should_receive || received_byte_count == 0 )
+    return;
+
+  char data[ BUFFER_SIZE ];
+  bench_open_array array = { data, BUFFER_SIZE };
+  int count;
+
+  if ( 0 != uart_dpi_receive_block( channel->obj, &array, BUFFER_SIZE, &count ) )
+    fail( "Error receiving data." );
+
+  channel->received.append( data, size_t( count ) );
+}
+
+
+static void connect_client ( mux_client * const client )
+{
+  client->fd = connect_to_localhost( s_tcp_port );
+  client->is_signature_received = false;
+  client->is_connection_closed  = false;
+
+  if ( fcntl( client->fd, F_SETFL, O_NONBLOCK ) != 0 )
+    fail( get_error_message( "Error making a client socket non-blocking: ", errno ) );
+}
+
+
+static void parse_frames ( mux_client * const client )
+{
+  if ( !client->is_signature_received )
+  {
+    if ( client->input.size() < UART_DPI_MUX_SIGNATURE_LEN )
+      return;
+
+    if ( 0 != client->input.compare( 0, UART_DPI_MUX_SIGNATURE_LEN, UART_DPI_MUX_SIGNATURE ) )
+      fail( "The server has sent a wrong signature." );
+
+    client->input.erase( 0, UART_DPI_MUX_SIGNATURE_LEN );
+    client->is_signature_received = true;
+  }
+
+  while ( client->input.size() >= UART_DPI_MUX_FRAME_HEADER_SIZE )
+  {
+    const uint8_t * const header = (const uint8_t *) client->input.data();
+    const uint16_t channel = uart_dpi_mux_get_channel( header );
+    const uint32_t length  = uart_dpi_mux_get_length( header );
+
+    if ( length > UART_DPI_MUX_MAX_PAYLOAD_SIZE )
+      fail( "The server has sent a frame that is too long." );
+
+    if ( client->input.size() < UART_DPI_MUX_FRAME_HEADER_SIZE + length )
+      return;
+
+    const std::string payload = client->input.substr( UART_DPI_MUX_FRAME_HEADER_SIZE, length );
+
+    switch ( header[0] )
+    {
+    case UART_DPI_MUX_FRAME_OPEN:
+      if ( client->channel_names.count( channel ) != 0 )
+        fail( "The server has opened channel " + std::to_string( channel ) + " twice." );
+
+      client->channel_names[ channel ] = payload;
+      break;
+
+    case UART_DPI_MUX_FRAME_DATA:
+      if ( client->channel_names.count( channel ) == 0 || client->closed_channels.count( channel ) != 0 )
+        fail( "The server has sent data for channel " + std::to_string( channel ) + ", which is not open." );
+
+      client->channel_data[ channel ] += payload;
+      break;
+
+    case UART_DPI_MUX_FRAME_CLOSE:
+      client->closed_channels.insert( channel );
+      break;
+
+    default:
+      fail( "The server has sent a frame of an unknown type." );
+    }
+
+    client->input.erase( 0, UART_DPI_MUX_FRAME_HEADER_SIZE + length );
+  }
+}
+
+
+static void poll_client ( mux_client * const client )
+{
+  if ( client->is_connection_closed )
+    return;
+
+  for ( ; ; )
+  {
+    char data[ 64 * 1024 ];
+    const ssize_t count = recv( client->fd, data, sizeof( data ), 0 );
+
+    if ( count == 0 )
+    {
+      client->is_connection_closed = true;
+      break;
+    }
+
+    if ( count == -1 )
+    {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        break;
+
+      if ( errno == ECONNRESET )
+      {
+        client->is_connection_closed = true;
+        break;
+      }
+
+      fail( get_error_message( "Error receiving from the server: ", errno ) );
+    }
+
+    client->input.append( data, size_t( count ) );
+  }
+
+  parse_frames( client );
+}
+
+
+static uint16_t find_channel ( const mux_client & client, const std::string & name )
+{
+  for ( const auto & entry : client.channel_names )
+  {
+    if ( entry.second == name )
+      return entry.first;
+  }
+
+  fail( "The server has not opened channel \"" + name + "\"." );
+  return 0;
+}
+
+
+static void send_data_frame ( const mux_client & client, const uint16_t channel, const std::string & payload )
+{
+  uint8_t header[ UART_DPI_MUX_FRAME_HEADER_SIZE ];
+  uart_dpi_mux_encode_header( header, UART_DPI_MUX_FRAME_DATA, channel, uint32_t( payload.size() ) );
+
+  std::string frame( (const char *) header, sizeof( header ) );
+  frame += payload;
+
+  // The frames are small, so the socket buffer always has room for them.
+  if ( send( client.fd, frame.data(), frame.size(), 0 ) != ssize_t( frame.size() ) )
+    fail( "Error sending a frame to the server." );
+}
+
+
+// Keeps ticking the instances and polling the clients until the given condition is met.
+
+template < typename condition_type >
+static void run_until ( const std::vector< channel_instance * > & channels,
+                        const std::vector< mux_client * > & clients,
+                        const char * const what,
+                        const condition_type & condition )
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  for ( ; ; )
+  {
+    for ( channel_instance * const channel : channels )
+      tick_channel( channel );
+
+    for ( mux_client * const client : clients )
+      poll_client( client );
+
+    if ( condition() )
+      return;
+
+    if ( std::chrono::steady_clock::now() - start > std::chrono::duration< double >( TIMEOUT_SECONDS ) )
+      fail( std::string( "Timeout waiting for " ) + what + "." );
+
+    usleep( 1000 );
+  }
+}
+
+
+static void run_for_ms ( const std::vector< channel_instance * > & channels,
+                         const std::vector< mux_client * > & clients,
+                         const int ms )
+{
+  const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds( ms );
+
+  run_until( channels, clients, "a fixed time", [ & ] { return std::chrono::steady_clock::now() >= end; } );
+}
+
+
+// ---------------------------- Checks ----------------------------
+
+static void expect_rejected ( const bench_instance_parameters & parameters, const char * const what )
+{
+  long long obj;
+
+  if ( try_create_instance( parameters, &obj ) )
+    fail( std::string( "The multiplexing transport has accepted " ) + what + "." );
+}
+
+
+static void check_rejected_parameters ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port = s_tcp_port;
+  parameters.endpoint = "mux:rejected";
+
+  bench_instance_parameters p = parameters;
+  p.capture_file_name = "uart_dpi_mux_check_capture.txt";
+  expect_rejected( p, "a capture file" );
+
+  p = parameters;
+  p.transmit_stamp_file_name = "uart_dpi_mux_check_stamps.bin";
+  expect_rejected( p, "a transmit stamp file" );
+
+  p = parameters;
+  p.slow_client_policy = 1;
+  expect_rejected( p, "a slow client policy" );
+
+  // The channel names must be unique per port, and all channels must agree on the listening address.
+  const channel_instance first = create_channel( "duplicate", false );
+
+  p = parameters;
+  p.endpoint = "mux:duplicate";
+  expect_rejected( p, "a duplicate channel name" );
+
+  p = parameters;
+  p.listen_on_local_addr_only = false;
+  expect_rejected( p, "a different listen_on_local_addr_only value" );
+
+  uart_dpi_destroy( first.obj );
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--port" && i + 1 < argc )
+      s_tcp_port = atoi( argv[ ++i ] );
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  // The server may still be writing to a client that has disconnected.
+  signal( SIGPIPE, SIG_IGN );
+
+  check_rejected_parameters();
+
+  // Data transmitted before any client connects waits in the transmit buffers.
+  channel_instance alpha = create_channel( "alpha", true  );
+  channel_instance beta  = create_channel( "beta" , true  );
+  channel_instance gamma = create_channel( "gamma", false );
+
+  if ( 0 != uart_dpi_send( alpha.obj, 'A' ) ||
+       0 != uart_dpi_send( gamma.obj, 'C' ) )
+  {
+    fail( "Error sending data." );
+  }
+
+  std::vector< channel_instance * > channels = { &alpha, &beta, &gamma };
+
+  mux_client controller;
+  connect_client( &controller );
+  std::vector< mux_client * > clients = { &controller };
+
+  run_until( channels, clients, "the first channels", [ & ]
+  {
+    return controller.channel_names.size() == 3 &&
+           controller.channel_data[ find_channel( controller, "alpha" ) ] == "A" &&
+           controller.channel_data[ find_channel( controller, "gamma" ) ] == "C";
+  } );
+
+  const uint16_t alpha_channel = find_channel( controller, "alpha" );
+  const uint16_t beta_channel  = find_channel( controller, "beta"  );
+  const uint16_t gamma_channel = find_channel( controller, "gamma" );
+
+  // The second client connects later, so its input is discarded.
+  mux_client watcher;
+  connect_client( &watcher );
+  clients.push_back( &watcher );
+
+  run_until( channels, clients, "the second client", [ & ] { return watcher.channel_names.size() == 3; } );
+
+  if ( get_stat( beta.obj, UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT ) != 2 )
+    fail( "The accepted connection count is wrong." );
+
+  send_data_frame( watcher, alpha_channel, "ignored" );
+  send_data_frame( controller, alpha_channel, "to alpha" );
+
+  // Much more than fits into gamma's receive buffer, so the server has to stop reading from the controller
+  // until gamma catches up.
+  const std::string gamma_input( 3 * BUFFER_SIZE, 'g' );
+
+  for ( size_t i = 0; i < gamma_input.size(); i += 1000 )
+    send_data_frame( controller, gamma_channel, gamma_input.substr( i, 1000 ) );
+
+  // A large lossless transfer through beta, while alpha keeps transmitting single bytes
+  // and gamma only empties its receive buffer every now and then.
+  const size_t beta_byte_count = 300 * 1024;
+  std::string beta_output;
+  std::string alpha_output = "A";
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for ( unsigned iteration = 0; ; ++iteration )
+  {
+    int received_byte_count;
+    svBit transmit_blocked;
+    tick( beta.obj, &received_byte_count, &transmit_blocked );
+
+    if ( !transmit_blocked && beta_output.size() < beta_byte_count )
+    {
+      char block[ 16 ];
+
+      for ( size_t i = 0; i < sizeof( block ); ++i )
+        block[ i ] = char( 'a' + ( beta_output.size() + i ) % 26 );
+
+      bench_open_array array = { block, int( sizeof( block ) ) };
+
+      if ( 0 != uart_dpi_send_block( beta.obj, &array, int( sizeof( block ) ) ) )
+        fail( "Error sending data." );
+
+      beta_output.append( block, sizeof( block ) );
+    }
+
+    if ( iteration % 8 == 0 )
+    {
+      const char c = char( '0' + iteration % 10 );
+
+      if ( 0 != uart_dpi_send( alpha.obj, c ) )
+        fail( "Error sending data." );
+
+      alpha_output += c;
+    }
+
+    tick_channel( &alpha );
+    tick_channel( &gamma, iteration % 4 == 0 );
+
+    if ( iteration % 4 == 0 )
+    {
+      poll_client( &controller );
+      poll_client( &watcher );
+    }
+
+    if ( beta_output.size() == beta_byte_count &&
+         controller.channel_data[ beta_channel ].size() == beta_byte_count &&
+         watcher.channel_data[ beta_channel ].size() == beta_byte_count &&
+         gamma.received.size() == gamma_input.size() )
+    {
+      break;
+    }
+
+    if ( std::chrono::steady_clock::now() - start > std::chrono::duration< double >( TIMEOUT_SECONDS ) )
+      fail( "Timeout during the large transfer." );
+
+    if ( iteration % 64 == 0 )
+      usleep( 100 );
+  }
+
+  // The watcher connected after the controller had already got the first byte.
+  const std::string alpha_output_for_watcher = alpha_output.substr( 1 );
+
+  run_until( channels, clients, "the rest of alpha's data", [ & ]
+  {
+    return controller.channel_data[ alpha_channel ].size() == alpha_output.size() &&
+           watcher.channel_data[ alpha_channel ].size() == alpha_output_for_watcher.size();
+  } );
+
+  if ( controller.channel_data[ beta_channel ] != beta_output || watcher.channel_data[ beta_channel ] != beta_output )
+    fail( "The data of the large transfer is wrong." );
+
+  if ( controller.channel_data[ alpha_channel ] != alpha_output || watcher.channel_data[ alpha_channel ] != alpha_output_for_watcher )
+    fail( "The data transmitted by alpha is wrong." );
+
+  if ( alpha.received != "to alpha" )
+    fail( "Alpha has received \"" + alpha.received + "\", instead of only the controlling client's data." );
+
+  if ( gamma.received != gamma_input )
+    fail( "The data received by gamma is wrong." );
+
+  // Destroying a channel sends the rest of its data first.
+  for ( int i = 0; i < 10; ++i )
+  {
+    if ( 0 != uart_dpi_send( gamma.obj, 'z' ) )
+      fail( "Error sending data." );
+  }
+
+  uart_dpi_destroy( gamma.obj );
+  channels = { &alpha, &beta };
+
+  run_until( channels, clients, "gamma's CLOSE frame", [ & ] { return controller.closed_channels.count( gamma_channel ) != 0; } );
+
+  if ( controller.channel_data[ gamma_channel ] != "Czzzzzzzzzz" )
+    fail( "Gamma's data before its CLOSE frame is wrong." );
+
+  // A channel created later gets announced to the connected clients.
+  channel_instance delta = create_channel( "delta", false );
+  channels.push_back( &delta );
+
+  if ( 0 != uart_dpi_send( delta.obj, 'D' ) )
+    fail( "Error sending data." );
+
+  run_until( channels, clients, "the late channel", [ & ]
+  {
+    return controller.channel_names.size() == 4 &&
+           controller.channel_data[ find_channel( controller, "delta" ) ] == "D";
+  } );
+
+  // When the controlling client disconnects, the other one takes over. Give the server some time to notice,
+  // so that the data below is not discarded.
+  close( controller.fd );
+  clients = { &watcher };
+  run_for_ms( channels, clients, 200 );
+
+  alpha.received.clear();
+  send_data_frame( watcher, alpha_channel, "hand-over" );
+
+  run_until( channels, clients, "the data from the new controlling client", [ & ] { return alpha.received == "hand-over"; } );
+
+  // A frame of an unknown type is a protocol error.
+  const char invalid_frame[] = "Xinvalid";
+
+  if ( send( watcher.fd, invalid_frame, sizeof( invalid_frame ) - 1, 0 ) != ssize_t( sizeof( invalid_frame ) - 1 ) )
+    fail( "Error sending the invalid frame." );
+
+  run_until( channels, clients, "the server to close the connection", [ & ] { return watcher.is_connection_closed; } );
+  close( watcher.fd );
+
+  uart_dpi_destroy( alpha.obj );
+  uart_dpi_destroy( beta.obj );
+  uart_dpi_destroy( delta.obj );
+
+  // The last channel has stopped the server, so a new one can listen on the same port.
+  const channel_instance again = create_channel( "again", false );
+  uart_dpi_destroy( again.obj );
+
+  printf( "OK\n" );
+  return 0;
+}
@@ -0,0 +1,924 @@
+// Multithreaded stress test for the C++ side of the UART DPI module.
+//
+// With Verilator's --threads and --threads-dpi all options, uart_dpi instances in different threads
+// call the C++ side at the same time. This program mimics that without Verilator: several simulation threads
+// each drive their own instances, one thread ticks a few more through uart_dpi_tick_all(), another one keeps
+// creating and destroying instances, and yet another one keeps reading all performance counters.
+// Every instance echoes back whatever it receives, and the clients check every byte of the echoed data.
+// Two more instances without lossless_transmit send faster than their clients take the data, and the clients
+// check that what arrives is a clean subsequence of what was sent, despite the transmit buffer overflowing.
+// Build it from the top-level directory like this, preferably with ThreadSanitizer:
+//
+//   g++ -O1 -g -std=c++11 -D_GNU_SOURCE -fsanitize=thread -pthread -Ibench bench/uart_dpi_stress.cpp -o uart_dpi_stress
+//
+// Usage: uart_dpi_stress [--threads <count>] [--seconds <count>] [--port <tcp port>]
+//
+// The instances listen on consecutive TCP ports on localhost, starting at the given one (default 23800).
+// The program prints a summary and exits with status 0 if all data arrived intact, apart from the gaps
+// the overflowing transmit buffers leave.
+
+#define UART_DPI_BENCH_PROGRAM_NAME "uart_dpi_stress"
+
+#include "../uart_dpi.cpp"
+#include "uart_dpi_bench_common.h"
+
+#include <poll.h>
+
+#include <chrono>
+#include <string>
+
+
+// ---------------------------- Helpers ----------------------------
+
+static const int BUFFER_SIZE = 64 * 1024;
+
+// Like the staging buffers in uart_dpi.v .
+static const int ECHO_BLOCK_SIZE = 16;
+
+// How many bytes a client may send ahead of the echo. This is well below the buffer sizes,
+// so that the simulation can always take the data and the client can always take the echo.
+static const uint64_t CLIENT_WINDOW = 8 * 1024;
+
+// The instances ticked by uart_dpi_tick_all(), plus the one the churn thread adds later.
+static const int TICK_ALL_INSTANCE_COUNT = 3;
+
+static std::atomic< bool > s_should_stop( false );
+static std::atomic< bool > s_may_destroy( false );
+static std::atomic< int  > s_ready_thread_count( 0 );
+static std::atomic< int  > s_stopped_thread_count( 0 );  // How many threads have stopped ticking.
+
+
+static long long create_stress_instance ( const int tcp_port,
+                                          const std::string & endpoint,
+                                          const int tick_all_index,
+                                          const std::string & message_prefix )
+{
+  bench_instance_parameters parameters;
+  parameters.tcp_port                     = tcp_port;
+  parameters.endpoint                     = endpoint;
+  parameters.transmit_buffer_size         = BUFFER_SIZE;
+  parameters.receive_buffer_size          = BUFFER_SIZE;
+  parameters.lossless_transmit            = true;
+  parameters.informational_message_prefix = message_prefix;
+  parameters.tick_all_index               = tick_all_index;
+
+  return create_instance( parameters );
+}
+
+
+// The data each client sends, which is different for every stream and position.
+
+static uint8_t get_stream_byte ( const int stream_index, const uint64_t position )
+{
+  return uint8_t( position * 131 + uint64_t( stream_index ) * 7 + ( position >> 8 ) );
+}
+
+
+// Echoes back what the simulated UART has received, like simulated software would. It takes
+// no more than it can send straight away, so nothing needs to be kept between clock ticks.
+
+static void echo ( const long long obj, const int received_byte_count, const svBit transmit_blocked )
+{
+  if ( transmit_blocked || received_byte_count == 0 )
+    return;
+
+  char data[ ECHO_BLOCK_SIZE ];
+  bench_open_array array = { data, ECHO_BLOCK_SIZE };
+
+  int count;
+
+  if ( 0 != uart_dpi_receive_block( obj, &array, std::min( received_byte_count, ECHO_BLOCK_SIZE ), &count ) ||
+       0 != uart_dpi_send_block( obj, &array, count ) )
+  {
+    fail( "Error echoing data." );
+  }
+}
+
+
+// ---------------------------- Instances ----------------------------
+
+// Each simulation thread drives one instance with its own TCP port and one channel of the multiplexing server.
+
+struct instance_info
+{
+  int         tcp_port;
+  std::string endpoint;
+  std::string mux_channel_name;  // Empty if not a channel.
+  int         tick_all_index;
+  std::atomic< long long > obj;
+};
+
+
+static int s_thread_count  = 4;
+static int s_base_tcp_port = 23800;
+
+static std::vector< instance_info > * s_instances;  // Simulation threads first, then the uart_dpi_tick_all() ones.
+
+
+static int get_mux_tcp_port ( void )
+{
+  return s_base_tcp_port + s_thread_count + TICK_ALL_INSTANCE_COUNT;
+}
+
+
+static int get_churn_tcp_port ( void )
+{
+  return get_mux_tcp_port() + 1;
+}
+
+
+static int get_lossy_tcp_port ( void )
+{
+  return get_churn_tcp_port() + 2;
+}
+
+
+static void create_instances ( const size_t first, const size_t count )
+{
+  for ( size_t i = first; i < first + count; ++i )
+  {
+    instance_info & info = ( *s_instances )[ i ];
+    info.obj = create_stress_instance( info.tcp_port, info.endpoint, info.tick_all_index, "[instance " + std::to_string( i ) + "] " );
+  }
+}
+
+
+static void destroy_instances ( const size_t first, const size_t count )
+{
+  for ( size_t i = first; i < first + count; ++i )
+    uart_dpi_destroy( ( *s_instances )[ i ].obj );
+}
+
+
+static void simulation_thread_main ( const int thread_index )
+{
+  const size_t first = size_t( thread_index ) * 2;
+
+  create_instances( first, 2 );
+  ++s_ready_thread_count;
+
+  while ( !s_should_stop )
+  {
+    for ( size_t i = first; i < first + 2; ++i )
+    {
+      const long long obj = ( *s_instances )[ i ].obj;
+      int received_byte_count;
+      svBit transmit_blocked;
+
+      if ( 0 != uart_dpi_tick( obj, &received_byte_count, &transmit_blocked ) )
+        fail( "Error ticking a UART DPI instance." );
+
+      echo( obj, received_byte_count, transmit_blocked );
+    }
+  }
+
+  ++s_stopped_thread_count;
+
+  while ( !s_may_destroy )
+    usleep( 1000 );
+
+  destroy_instances( first, 2 );
+}
+
+
+// Like module uart_dpi_tick_all, which ticks on the falling clock edge, followed by the uart_dpi instances,
+// which use the results on the rising edge. Verilator orders both, so a single thread does both here.
+
+static void tick_all_thread_main ( void )
+{
+  const size_t first = size_t( s_thread_count ) * 2;
+
+  create_instances( first, TICK_ALL_INSTANCE_COUNT - 1 );
+  ++s_ready_thread_count;
+
+  int   counts[ TICK_ALL_INSTANCE_COUNT ];
+  svBit flags [ TICK_ALL_INSTANCE_COUNT ];
+  bench_open_array count_array = { counts, TICK_ALL_INSTANCE_COUNT };
+  bench_open_array flag_array  = { flags,  TICK_ALL_INSTANCE_COUNT };
+
+  while ( !s_should_stop )
+  {
+    if ( 0 != uart_dpi_tick_all( &count_array, &flag_array ) )
+      fail( "Error calling uart_dpi_tick_all()." );
+
+    for ( int i = 0; i < TICK_ALL_INSTANCE_COUNT - 1; ++i )
+      echo( ( *s_instances )[ first + size_t( i ) ].obj, counts[ i ], flags[ i ] );
+  }
+
+  ++s_stopped_thread_count;
+
+  while ( !s_may_destroy )
+    usleep( 1000 );
+
+  destroy_instances( first, TICK_ALL_INSTANCE_COUNT - 1 );
+}
+
+
+// Adds an instance to uart_dpi_tick_all() while it is running, and then keeps creating and destroying
+// a TCP instance and a multiplexing channel, which shares the server with the simulation threads.
+
+static void churn_thread_main ( long long * const churn_cycle_count )
+{
+  usleep( 100000 );
+
+  const long long late_tick_all_obj = create_stress_instance( get_churn_tcp_port() + 1, "", TICK_ALL_INSTANCE_COUNT - 1, "" );
+
+  long long cycle_count = 0;
+
+  while ( !s_should_stop )
+  {
+    const long long tcp_obj = create_stress_instance( get_churn_tcp_port(), "", -1, "" );
+    const long long mux_obj = create_stress_instance( get_mux_tcp_port(), "mux:churn", -1, "" );
+
+    for ( int i = 0; i < 100; ++i )
+    {
+      int received_byte_count;
+      svBit transmit_blocked;
+
+      if ( 0 != uart_dpi_tick( tcp_obj, &received_byte_count, &transmit_blocked ) ||
+           0 != uart_dpi_tick( mux_obj, &received_byte_count, &transmit_blocked ) ||
+           0 != uart_dpi_send( mux_obj, 'c' ) )
+      {
+        fail( "Error ticking a churn instance." );
+      }
+    }
+
+    uart_dpi_destroy( mux_obj );
+    uart_dpi_destroy( tcp_obj );
+    ++cycle_count;
+  }
+
+  while ( !s_may_destroy )
+    usleep( 1000 );
+
+  uart_dpi_destroy( late_tick_all_obj );
+  *churn_cycle_count = cycle_count;
+}
+
+
+// Reads the counters of all instances, like a Verilog task in another thread calling get_stats would.
+
+static void monitor_thread_main ( long long * const read_count )
+{
+  long long counters[ UART_DPI_STAT_COUNT ];
+  bench_open_array array = { counters, UART_DPI_STAT_COUNT };
+
+  long long count = 0;
+
+  while ( !s_should_stop )
+  {
+    for ( size_t i = 0; i < s_instances->size(); ++i )
+    {
+      if ( 0 != uart_dpi_get_stats( ( *s_instances )[ i ].obj, &array ) )
+        fail( "Error reading the performance counters." );
+
+      ++count;
+    }
+  }
+
+  *read_count = count;
+}
+
+
+// ---------------------------- Lossy transmission ----------------------------
+
+// The lossy thread drives an instance with its own TCP port and a multiplexing channel, both without lossless_transmit,
+// and sends as fast as it can, alternating between uart_dpi_send_block() and uart_dpi_send(). When a client
+// falls behind, the transmit buffer overflows, and the client must then see a gap in the data, but never
+// a byte that the simulation has overwritten while the I/O thread was sending it.
+
+static const int LOSSY_BUFFER_SIZE = 4 * 1024;
+
+// How many bytes after a gap must match the sent data at some later position.
+static const size_t LOSSY_RESYNC_LENGTH = 8;
+
+static const char LOSSY_MUX_CHANNEL_NAME[] = "lossy";
+
+enum lossy_stream_index
+{
+  LOSSY_STREAM_TCP,
+  LOSSY_STREAM_MUX,
+  LOSSY_STREAM_COUNT
+};
+
+
+struct lossy_stream
+{
+  std::atomic< uint64_t > sent_position;  // Updated by the lossy thread before sending, so the clients never see data beyond it.
+  uint64_t    position;                   // Where the client expects the next byte.
+  uint64_t    received_byte_count;
+  uint64_t    gap_count;
+  std::string pending;                    // The bytes after a gap, until there are enough to find their position.
+};
+
+static lossy_stream s_lossy_streams[ LOSSY_STREAM_COUNT ];
+
+
+// Unlike get_stream_byte(), no short sequence repeats, so that a few bytes tell the position after a gap.
+
+static uint8_t get_lossy_byte ( const int stream_index, const uint64_t position )
+{
+  uint64_t x = ( position + 1 ) * 0x9E3779B97F4A7C15ULL + uint64_t( stream_index );
+  x ^= x >> 31;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 29;
+  return uint8_t( x );
+}
+
+
+static void lossy_thread_main ( void )
+{
+  bench_instance_parameters parameters;
+  parameters.transmit_buffer_size    = LOSSY_BUFFER_SIZE;
+  parameters.receive_buffer_size     = LOSSY_BUFFER_SIZE;
+  parameters.socket_send_buffer_size = LOSSY_BUFFER_SIZE;
+
+  long long objs[ LOSSY_STREAM_COUNT ];
+
+  parameters.tcp_port                = get_lossy_tcp_port();
+  objs[ LOSSY_STREAM_TCP ] = create_instance( parameters );
+
+  parameters.tcp_port                = get_mux_tcp_port();
+  parameters.endpoint                = std::string( "mux:" ) + LOSSY_MUX_CHANNEL_NAME;
+  parameters.socket_send_buffer_size = 0;  // The multiplexing server owns the socket.
+  objs[ LOSSY_STREAM_MUX ] = create_instance( parameters );
+
+  ++s_ready_thread_count;
+
+  bool should_send_block = true;
+
+  while ( !s_should_stop )
+  {
+    for ( int i = 0; i < LOSSY_STREAM_COUNT; ++i )
+    {
+      int received_byte_count;
+      svBit transmit_blocked;
+
+      if ( 0 != uart_dpi_tick( objs[ i ], &received_byte_count, &transmit_blocked ) )
+        fail( "Error ticking a lossy instance." );
+
+      lossy_stream & stream = s_lossy_streams[ i ];
+      const uint64_t position = stream.sent_position;
+
+      char data[ ECHO_BLOCK_SIZE ];
+
+      for ( int j = 0; j < ECHO_BLOCK_SIZE; ++j )
+        data[ j ] = char( get_lossy_byte( i, position + uint64_t( j ) ) );
+
+      stream.sent_position = position + ECHO_BLOCK_SIZE;
+
+      if ( should_send_block )
+      {
+        bench_open_array array = { data, ECHO_BLOCK_SIZE };
+
+        if ( 0 != uart_dpi_send_block( objs[ i ], &array, ECHO_BLOCK_SIZE ) )
+          fail( "Error sending a block of lossy data." );
+      }
+      else
+      {
+        for ( int j = 0; j < ECHO_BLOCK_SIZE; ++j )
+        {
+          if ( 0 != uart_dpi_send( objs[ i ], data[ j ] ) )
+            fail( "Error sending lossy data." );
+        }
+      }
+    }
+
+    should_send_block = !should_send_block;
+  }
+
+  ++s_stopped_thread_count;
+
+  while ( !s_may_destroy )
+    usleep( 1000 );
+
+  for ( int i = 0; i < LOSSY_STREAM_COUNT; ++i )
+    uart_dpi_destroy( objs[ i ] );
+}
+
+
+// Returns the first position from the given one onwards where the sent data matches LOSSY_RESYNC_LENGTH bytes,
+// or the end position if there is none before it.
+
+static uint64_t find_lossy_position ( const int stream_index,
+                                      const char * const data,
+                                      const uint64_t start_position,
+                                      const uint64_t end_position )
+{
+  for ( uint64_t candidate = start_position; candidate + LOSSY_RESYNC_LENGTH <= end_position; ++candidate )
+  {
+    size_t i = 0;
+
+    while ( i < LOSSY_RESYNC_LENGTH && uint8_t( data[ i ] ) == get_lossy_byte( stream_index, candidate + i ) )
+      ++i;
+
+    if ( i == LOSSY_RESYNC_LENGTH )
+      return candidate;
+  }
+
+  return end_position;
+}
+
+
+// Whether the given bytes were sent in this order somewhere between the given positions.
+
+static bool is_lossy_subsequence ( const int stream_index,
+                                   const char * const data,
+                                   const size_t byte_count,
+                                   uint64_t position,
+                                   const uint64_t end_position )
+{
+  for ( size_t i = 0; i < byte_count; ++i )
+  {
+    while ( position < end_position && uint8_t( data[ i ] ) != get_lossy_byte( stream_index, position ) )
+      ++position;
+
+    if ( position == end_position )
+      return false;
+
+    ++position;
+  }
+
+  return true;
+}
+
+
+// Follows the sent data. After a gap, the data must carry on at a later position, but not beyond what has been sent.
+// When the socket only takes a few bytes at a time, there may be runs between the gaps that are too short
+// to tell their position. Those must at least fit in between, in the right order. A byte from the wrong lap
+// of the transmit buffer in the middle of the data, or a position going backwards, leaves no such place.
+
+static void check_lossy_data ( const int stream_index, const uint8_t * const data, const size_t byte_count )
+{
+  lossy_stream & stream = s_lossy_streams[ stream_index ];
+
+  stream.pending.append( (const char *) data, byte_count );
+  stream.received_byte_count += byte_count;
+
+  size_t pos = 0;
+
+  while ( pos < stream.pending.size() )
+  {
+    if ( uint8_t( stream.pending[ pos ] ) == get_lossy_byte( stream_index, stream.position ) )
+    {
+      ++pos;
+      ++stream.position;
+      continue;
+    }
+
+    // The first run that is long enough after the short ones, if any.
+    const uint64_t sent_position = stream.sent_position;
+    uint64_t next_position = sent_position;
+    size_t short_byte_count = 0;
+
+    for ( ; pos + short_byte_count + LOSSY_RESYNC_LENGTH <= stream.pending.size(); ++short_byte_count )
+    {
+      next_position = find_lossy_position( stream_index,
+                                           stream.pending.data() + pos + short_byte_count,
+                                           stream.position + 1 + short_byte_count,
+                                           sent_position );
+      if ( next_position != sent_position )
+        break;
+    }
+
+    if ( next_position == sent_position )
+    {
+      // Waits for more data, unless there has been plenty already.
+      if ( stream.pending.size() - pos < LOSSY_RESYNC_LENGTH * 8 )
+        break;
+
+      fail( "Lossy stream " + std::to_string( stream_index ) + " has received data that was never sent there after position " +
+            std::to_string( stream.position ) + "." );
+    }
+
+    if ( !is_lossy_subsequence( stream_index, stream.pending.data() + pos, short_byte_count, stream.position + 1, next_position ) )
+    {
+      fail( "Lossy stream " + std::to_string( stream_index ) + " has received data out of order after position " +
+            std::to_string( stream.position ) + "." );
+    }
+
+    pos += short_byte_count;
+    stream.position = next_position;
+    ++stream.gap_count;
+  }
+
+  stream.pending.erase( 0, pos );
+}
+
+
+// Reads slowly from the lossy instance with its own TCP port, so that its transmit buffer keeps overflowing.
+
+static void lossy_client_thread_main ( void )
+{
+  const int s = connect_to_localhost( get_lossy_tcp_port() );
+
+  const int receive_buffer_size = LOSSY_BUFFER_SIZE;
+
+  if ( setsockopt( s, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof( receive_buffer_size ) ) != 0 )
+    fail( get_error_message( "Error setting the lossy client's receive buffer size: ", errno ) );
+
+  while ( !s_should_stop )
+  {
+    pollfd poll_fd = { s, POLLIN, 0 };
+
+    if ( poll( &poll_fd, 1, 100 ) == -1 && errno != EINTR )
+      fail( get_error_message( "Error polling the lossy client socket: ", errno ) );
+
+    if ( ( poll_fd.revents & ( POLLIN | POLLHUP | POLLERR ) ) == 0 )
+      continue;
+
+    uint8_t buffer[ 256 ];
+    const ssize_t res = recv( s, buffer, sizeof( buffer ), 0 );
+
+    if ( res == 0 )
+      fail( "The lossy instance has closed the client connection." );
+
+    if ( res == -1 )
+    {
+      if ( errno != EINTR )
+        fail( get_error_message( "Error receiving lossy data: ", errno ) );
+
+      continue;
+    }
+
+    check_lossy_data( LOSSY_STREAM_TCP, buffer, size_t( res ) );
+    usleep( 100 );
+  }
+
+  close( s );
+}
+
+
+// ---------------------------- Clients ----------------------------
+
+// A stream is the data going through one instance and back.
+
+struct client_stream
+{
+  int      instance_index;
+  uint16_t mux_channel;
+  bool     is_open;
+  uint64_t sent_position;
+  uint64_t echoed_position;
+};
+
+
+struct client_connection_state
+{
+  int fd;
+  bool is_mux;
+  bool is_signature_received;
+  int lossy_mux_channel;                 // -1 until the lossy thread's channel is open.
+  std::vector< client_stream > streams;  // A single one, unless is_mux.
+  std::string input;
+  std::string output;
+};
+
+
+static int connect_to ( const int tcp_port )
+{
+  const int s = connect_to_localhost( tcp_port );
+
+  if ( fcntl( s, F_SETFL, O_NONBLOCK ) != 0 )
+    fail( get_error_message( "Error making a client socket non-blocking: ", errno ) );
+
+  return s;
+}
+
+
+static void check_echo ( client_stream * const stream, const uint8_t * const data, const size_t byte_count )
+{
+  for ( size_t i = 0; i < byte_count; ++i )
+  {
+    if ( stream->echoed_position == stream->sent_position ||
+         data[ i ] != get_stream_byte( stream->instance_index, stream->echoed_position ) )
+    {
+      fail( "Instance " + std::to_string( stream->instance_index ) + " has echoed wrong data at position " +
+            std::to_string( stream->echoed_position ) + "." );
+    }
+
+    ++stream->echoed_position;
+  }
+}
+
+
+static void generate_output ( client_connection_state * const conn )
+{
+  if ( !conn->output.empty() )
+    return;
+
+  for ( size_t i = 0; i < conn->streams.size(); ++i )
+  {
+    client_stream & stream = conn->streams[ i ];
+
+    if ( !stream.is_open || stream.sent_position - stream.echoed_position >= CLIENT_WINDOW )
+      continue;
+
+    const uint32_t byte_count = uint32_t( CLIENT_WINDOW - ( stream.sent_position - stream.echoed_position ) );
+
+    if ( conn->is_mux )
+    {
+      uint8_t header[ UART_DPI_MUX_FRAME_HEADER_SIZE ];
+      uart_dpi_mux_encode_header( header, UART_DPI_MUX_FRAME_DATA, stream.mux_channel, byte_count );
+      conn->output.append( (const char *) header, sizeof( header ) );
+    }
+
+    for ( uint32_t j = 0; j < byte_count; ++j )
+      conn->output += char( get_stream_byte( stream.instance_index, stream.sent_position++ ) );
+  }
+}
+
+
+static void process_mux_input ( client_connection_state * const conn )
+{
+  size_t pos = 0;
+
+  if ( !conn->is_signature_received )
+  {
+    if ( conn->input.size() < UART_DPI_MUX_SIGNATURE_LEN )
+      return;
+
+    if ( 0 != memcmp( conn->input.data(), UART_DPI_MUX_SIGNATURE, UART_DPI_MUX_SIGNATURE_LEN ) )
+      fail( "Wrong multiplexing server signature." );
+
+    conn->is_signature_received = true;
+    pos = UART_DPI_MUX_SIGNATURE_LEN;
+  }
+
+  while ( conn->input.size() - pos >= UART_DPI_MUX_FRAME_HEADER_SIZE )
+  {
+    const uint8_t * const header = (const uint8_t *) conn->input.data() + pos;
+    const uint32_t payload_len = uart_dpi_mux_get_length( header );
+
+    if ( conn->input.size() - pos - UART_DPI_MUX_FRAME_HEADER_SIZE < payload_len )
+      break;
+
+    const uint8_t * const payload = header + UART_DPI_MUX_FRAME_HEADER_SIZE;
+    const std::string name( (const char *) payload, payload_len );
+
+    if ( header[0] == UART_DPI_MUX_FRAME_OPEN && name == LOSSY_MUX_CHANNEL_NAME )
+      conn->lossy_mux_channel = uart_dpi_mux_get_channel( header );
+    else if ( header[0] == UART_DPI_MUX_FRAME_DATA && conn->lossy_mux_channel == int( uart_dpi_mux_get_channel( header ) ) )
+      check_lossy_data( LOSSY_STREAM_MUX, payload, payload_len );
+
+    for ( size_t i = 0; i < conn->streams.size(); ++i )
+    {
+      client_stream & stream = conn->streams[ i ];
+
+      if ( header[0] == UART_DPI_MUX_FRAME_OPEN && name == ( *s_instances )[ stream.instance_index ].mux_channel_name )
+      {
+        stream.mux_channel = uart_dpi_mux_get_channel( header );
+        stream.is_open = true;
+      }
+      else if ( header[0] == UART_DPI_MUX_FRAME_DATA && stream.is_open &&
+                stream.mux_channel == uart_dpi_mux_get_channel( header ) )
+      {
+        check_echo( &stream, payload, payload_len );
+      }
+    }
+
+    // Everything else, like the data from the churn thread's channel, is ignored.
+    pos += UART_DPI_MUX_FRAME_HEADER_SIZE + payload_len;
+  }
+
+  conn->input.erase( 0, pos );
+}
+
+
+static void client_thread_main ( std::vector< client_connection_state > * const conns )
+{
+  std::vector< pollfd > poll_fds( conns->size() );
+
+  while ( !s_should_stop )
+  {
+    for ( size_t i = 0; i < conns->size(); ++i )
+    {
+      generate_output( &( *conns )[ i ] );
+
+      poll_fds[ i ].fd     = ( *conns )[ i ].fd;
+      poll_fds[ i ].events = POLLIN | ( ( *conns )[ i ].output.empty() ? 0 : POLLOUT );
+    }
+
+    if ( poll( &poll_fds[0], poll_fds.size(), 100 ) == -1 && errno != EINTR )
+      fail( get_error_message( "Error polling the client sockets: ", errno ) );
+
+    for ( size_t i = 0; i < conns->size(); ++i )
+    {
+      client_connection_state & conn = ( *conns )[ i ];
+
+      if ( poll_fds[ i ].revents & POLLOUT )
+      {
+        const ssize_t res = send( conn.fd, conn.output.data(), conn.output.size(), 0 );
+
+        if ( res == -1 && errno != EAGAIN && errno != EINTR )
+          fail( get_error_message( "Error sending client data: ", errno ) );
+
+        if ( res > 0 )
+          conn.output.erase( 0, size_t( res ) );
+      }
+
+      if ( poll_fds[ i ].revents & ( POLLIN | POLLHUP | POLLERR ) )
+      {
+        uint8_t buffer[ 64 * 1024 ];
+        const ssize_t res = recv( conn.fd, buffer, sizeof( buffer ), 0 );
+
+        if ( res == 0 )
+          fail( "A UART DPI instance has closed a client connection." );
+
+        if ( res == -1 )
+        {
+          if ( errno != EAGAIN && errno != EINTR )
+            fail( get_error_message( "Error receiving client data: ", errno ) );
+
+          continue;
+        }
+
+        if ( conn.is_mux )
+        {
+          conn.input.append( (const char *) buffer, size_t( res ) );
+          process_mux_input( &conn );
+        }
+        else
+        {
+          check_echo( &conn.streams[0], buffer, size_t( res ) );
+        }
+      }
+    }
+  }
+}
+
+
+// ---------------------------- Main ----------------------------
+
+int main ( const int argc, char ** const argv )
+{
+  int seconds = 5;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--threads" && i + 1 < argc )
+      s_thread_count = atoi( argv[ ++i ] );
+    else if ( arg == "--seconds" && i + 1 < argc )
+      seconds = atoi( argv[ ++i ] );
+    else if ( arg == "--port" && i + 1 < argc )
+      s_base_tcp_port = atoi( argv[ ++i ] );
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  if ( s_thread_count < 1 || seconds < 1 )
+    fail( "Invalid command-line arguments." );
+
+  signal( SIGPIPE, SIG_IGN );
+
+  // Two instances per simulation thread, the first one with its own TCP port and the second one as a multiplexing channel.
+  s_instances = new std::vector< instance_info >( size_t( s_thread_count ) * 2 + TICK_ALL_INSTANCE_COUNT - 1 );
+
+  for ( int t = 0; t < s_thread_count; ++t )
+  {
+    instance_info & own_port = ( *s_instances )[ size_t( t ) * 2 ];
+    own_port.tcp_port       = s_base_tcp_port + t;
+    own_port.tick_all_index = -1;
+
+    instance_info & channel = ( *s_instances )[ size_t( t ) * 2 + 1 ];
+    channel.tcp_port         = get_mux_tcp_port();
+    channel.mux_channel_name = "thread" + std::to_string( t );
+    channel.endpoint         = "mux:" + channel.mux_channel_name;
+    channel.tick_all_index   = -1;
+  }
+
+  for ( int i = 0; i < TICK_ALL_INSTANCE_COUNT - 1; ++i )
+  {
+    instance_info & info = ( *s_instances )[ size_t( s_thread_count ) * 2 + size_t( i ) ];
+    info.tcp_port       = s_base_tcp_port + s_thread_count + i;
+    info.tick_all_index = i;
+  }
+
+  // All instances get created at the same time.
+  std::vector< std::thread > simulation_threads;
+
+  for ( int t = 0; t < s_thread_count; ++t )
+    simulation_threads.push_back( std::thread( simulation_thread_main, t ) );
+
+  std::thread tick_all_thread( tick_all_thread_main );
+  std::thread lossy_thread( lossy_thread_main );
+
+  while ( s_ready_thread_count != s_thread_count + 2 )
+    usleep( 1000 );
+
+  // One client per instance with its own TCP port, and one for the multiplexing server.
+  std::vector< client_connection_state > conns;
+
+  for ( size_t i = 0; i < s_instances->size(); ++i )
+  {
+    const instance_info & info = ( *s_instances )[ i ];
+
+    client_stream stream;
+    stream.instance_index  = int( i );
+    stream.mux_channel     = 0;
+    stream.is_open         = info.mux_channel_name.empty();
+    stream.sent_position   = 0;
+    stream.echoed_position = 0;
+
+    if ( !info.mux_channel_name.empty() )
+    {
+      if ( conns.empty() || !conns.back().is_mux )
+      {
+        conns.push_back( client_connection_state() );
+        conns.back().fd = connect_to( get_mux_tcp_port() );
+        conns.back().is_mux = true;
+        conns.back().is_signature_received = false;
+        conns.back().lossy_mux_channel = -1;
+      }
+
+      // The mux connection always comes last, see above.
+      conns.back().streams.push_back( stream );
+      continue;
+    }
+
+    client_connection_state conn;
+    conn.fd = connect_to( info.tcp_port );
+    conn.is_mux = false;
+    conn.is_signature_received = false;
+    conn.lossy_mux_channel = -1;
+    conn.streams.push_back( stream );
+
+    if ( !conns.empty() && conns.back().is_mux )
+      conns.insert( conns.end() - 1, conn );
+    else
+      conns.push_back( conn );
+  }
+
+  long long churn_cycle_count = 0;
+  long long stats_read_count  = 0;
+
+  std::thread client_thread ( client_thread_main,  &conns );
+  std::thread lossy_client_thread( lossy_client_thread_main );
+  std::thread churn_thread  ( churn_thread_main,   &churn_cycle_count );
+  std::thread monitor_thread( monitor_thread_main, &stats_read_count );
+
+  sleep( unsigned( seconds ) );
+
+  s_should_stop = true;
+
+  client_thread.join();
+  lossy_client_thread.join();
+  monitor_thread.join();
+
+  while ( s_stopped_thread_count != s_thread_count + 2 )
+    usleep( 1000 );
+
+  // The instances are destroyed concurrently too, once nothing ticks them any more.
+  s_may_destroy = true;
+
+  for ( size_t t = 0; t < simulation_threads.size(); ++t )
+    simulation_threads[ t ].join();
+
+  tick_all_thread.join();
+  lossy_thread.join();
+  churn_thread.join();
+
+  uint64_t total_echoed = 0;
+
+  for ( size_t i = 0; i < conns.size(); ++i )
+  {
+    for ( size_t j = 0; j < conns[ i ].streams.size(); ++j )
+    {
+      const client_stream & stream = conns[ i ].streams[ j ];
+
+      if ( stream.echoed_position == 0 )
+        fail( "Instance " + std::to_string( stream.instance_index ) + " has not echoed anything." );
+
+      total_echoed += stream.echoed_position;
+    }
+
+    close( conns[ i ].fd );
+  }
+
+  uint64_t total_lossy = 0;
+  uint64_t total_gaps  = 0;
+
+  for ( int i = 0; i < LOSSY_STREAM_COUNT; ++i )
+  {
+    if ( s_lossy_streams[ i ].received_byte_count == 0 )
+      fail( "Lossy stream " + std::to_string( i ) + " has not received anything." );
+
+    total_lossy += s_lossy_streams[ i ].received_byte_count;
+    total_gaps  += s_lossy_streams[ i ].gap_count;
+  }
+
+  printf( "uart_dpi_stress: OK, %d simulation threads, %zu instances, %.1f MB echoed, %.1f MB lossy with %llu gaps, "
+          "%lld churn cycles, %lld counter reads.\n",
+          s_thread_count,
+          s_instances->size(),
+          double( total_echoed ) / 1e6,
+          double( total_lossy ) / 1e6,
+          (unsigned long long) total_gaps,
+          churn_cycle_count,
+          stats_read_count );
+
+  delete s_instances;
+  return 0;
+}
@@ -0,0 +1,257 @@
+// Main routine of the Verilator throughput testbench for the UART DPI module, see uart_dpi_tb.sv .
+//
+// It clocks the simulation for a fixed number of cycles, while it feeds and drains the shared memory
+// regions of all uart_dpi instances every few cycles. At the end, it prints the results as a JSON object
+// to stdout, like bench/uart_dpi_bench.cpp does:
+//
+//   - The simulated clock cycles per second.
+//   - Which share of the wall time went into uart_dpi_tick(), according to the performance counters.
+//     This does not include the less frequent block transfers, nor the DPI call overhead on the Verilator side.
+//   - Which share of the wall time went into this testbench's own shared memory work.
+//   - The bytes per second the Wishbone masters have written to the THRs and read from the RBRs.
+//
+// Build and run it with the Makefile in this directory.
+//
+// Usage: Vuart_dpi_tb [--cycles <count>] [--service-interval <cycles>]
+
+#include "Vuart_dpi_tb.h"
+#include "verilated.h"
+
+#include "../../uart_dpi_shm_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Passed by the Makefile, and must match the INSTANCE_COUNT parameter of module uart_dpi_tb.
+#ifndef UART_DPI_TB_INSTANCE_COUNT
+  #error "UART_DPI_TB_INSTANCE_COUNT is not defined."
+#endif
+
+#ifndef UART_DPI_TB_USE_TICK_ALL
+  #define UART_DPI_TB_USE_TICK_ALL 0
+#endif
+
+static const int RESET_CYCLE_COUNT = 4;
+
+
+static void fail ( const std::string & message )
+{
+  fprintf( stderr, "uart_dpi_tb: %s\n", message.c_str() );
+  exit( 1 );
+}
+
+
+// The testbench side of one uart_dpi instance.
+
+struct tb_channel
+{
+  uart_dpi_shm_client client;
+  uint8_t next_transmitted_byte;  // The next byte expected from the Wishbone master.
+  uint8_t next_received_byte;     // The next byte to send to the Wishbone master.
+  uint64_t transmit_error_count;
+};
+
+
+static void open_channel ( tb_channel * const channel, const int index )
+{
+  char name[ 64 ];
+  snprintf( name, sizeof( name ), "/uart_dpi_tb_%02d", index );
+
+  const int error_code = uart_dpi_shm_open( &channel->client, name );
+
+  if ( error_code != 0 )
+    fail( std::string( "Cannot open shared memory region \"" ) + name + "\": " + strerror( error_code ) );
+
+  channel->next_transmitted_byte = 0;
+  channel->next_received_byte    = 0;
+  channel->transmit_error_count  = 0;
+}
+
+
+// Checks all data the instance has transmitted and refills its receive buffer.
+
+static void service_channel ( tb_channel * const channel )
+{
+  uint8_t block[ 4096 ];
+
+  for ( ; ; )
+  {
+    const size_t read_count = uart_dpi_shm_read( &channel->client, block, sizeof( block ) );
+
+    for ( size_t i = 0; i < read_count; ++i )
+    {
+      if ( block[ i ] != channel->next_transmitted_byte )
+        ++channel->transmit_error_count;
+
+      channel->next_transmitted_byte = uint8_t( block[ i ] + 1 );
+    }
+
+    if ( read_count < sizeof( block ) )
+      break;
+  }
+
+  // The Wishbone master reads much less than a block between two calls, so refill in smaller steps.
+  const size_t refill_block_size = 256;
+
+  for ( ; ; )
+  {
+    for ( size_t i = 0; i < refill_block_size; ++i )
+      block[ i ] = uint8_t( channel->next_received_byte + i );
+
+    const size_t written_count = uart_dpi_shm_write( &channel->client, block, refill_block_size );
+
+    channel->next_received_byte = uint8_t( channel->next_received_byte + written_count );
+
+    if ( written_count < refill_block_size )
+      break;
+  }
+}
+
+
+static void clock_cycle ( VerilatedContext * const context, Vuart_dpi_tb * const top )
+{
+  top->clk = 1;
+  top->eval();
+  context->timeInc( 1 );
+
+  top->clk = 0;
+  top->eval();
+  context->timeInc( 1 );
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  long long cycle_count = 20000000;
+  // Not a multiple of the tick sampling interval in uart_dpi.cpp, so that the timed ticks
+  // do not always fall right after the shared memory work.
+  int service_interval = 1000;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    const std::string arg = argv[i];
+
+    if ( arg == "--cycles" && i + 1 < argc )
+      cycle_count = atoll( argv[ ++i ] );
+    else if ( arg == "--service-interval" && i + 1 < argc )
+      service_interval = atoi( argv[ ++i ] );
+    else if ( arg.compare( 0, 1, "+" ) == 0 )
+      ;  // A plusarg for the simulation.
+    else
+      fail( "Invalid command-line argument \"" + arg + "\"." );
+  }
+
+  if ( cycle_count <= 0 || service_interval <= 0 )
+    fail( "The cycle count and the service interval must be positive." );
+
+  // See the installation instructions in README.pod .
+  signal( SIGPIPE, SIG_IGN );
+
+  const std::unique_ptr< VerilatedContext > context( new VerilatedContext );
+  context->commandArgs( argc, argv );
+
+  const std::unique_ptr< Vuart_dpi_tb > top( new Vuart_dpi_tb( context.get() ) );
+
+  top->clk          = 0;
+  top->rst          = 1;
+  top->sample_stats = 0;
+
+  // The first evaluation runs the initial blocks, which create the shared memory regions.
+  top->eval();
+
+  std::vector< tb_channel > channels( UART_DPI_TB_INSTANCE_COUNT );
+
+  for ( int i = 0; i < UART_DPI_TB_INSTANCE_COUNT; ++i )
+    open_channel( &channels[ i ], i );
+
+  for ( int i = 0; i < RESET_CYCLE_COUNT; ++i )
+    clock_cycle( context.get(), top.get() );
+
+  top->rst = 0;
+
+  typedef std::chrono::steady_clock tb_clock;
+
+  const tb_clock::time_point start_time = tb_clock::now();
+  tb_clock::duration service_time = tb_clock::duration::zero();
+
+  long long simulated_cycle_count = 0;
+
+  while ( simulated_cycle_count < cycle_count && !context->gotFinish() )
+  {
+    for ( int i = 0; i < service_interval; ++i )
+      clock_cycle( context.get(), top.get() );
+
+    simulated_cycle_count += service_interval;
+
+    const tb_clock::time_point service_start_time = tb_clock::now();
+
+    for ( size_t i = 0; i < channels.size(); ++i )
+      service_channel( &channels[ i ] );
+
+    service_time += tb_clock::now() - service_start_time;
+  }
+
+  const double elapsed_seconds = std::chrono::duration< double >( tb_clock::now() - start_time ).count();
+  const double service_seconds = std::chrono::duration< double >( service_time ).count();
+
+  if ( context->gotFinish() )
+    fail( "The simulation has finished prematurely." );
+
+  // The counters are copied to the top-level outputs on the next clock edge.
+  top->sample_stats = 1;
+  clock_cycle( context.get(), top.get() );
+  top->sample_stats = 0;
+
+  const double dpi_tick_seconds = double( top->dpi_tick_time_ns ) / 1e9;
+
+  uint64_t transmit_error_count = 0;
+  uint64_t lost_byte_count = 0;
+
+  for ( size_t i = 0; i < channels.size(); ++i )
+  {
+    transmit_error_count += channels[ i ].transmit_error_count;
+    lost_byte_count      += channels[ i ].client.lost_byte_count;
+  }
+
+  printf( "{\n"
+          "  \"benchmark\": \"uart_dpi_verilator\",\n"
+          "  \"instance_count\": %d,\n"
+          "  \"tick_all\": %s,\n"
+          "  \"simulated_cycles\": %lld,\n"
+          "  \"results\": {\n"
+          "    \"cycles_per_s\": %.0f,\n"
+          "    \"dpi_tick_time_share\": %.4f,\n"
+          "    \"testbench_time_share\": %.4f,\n"
+          "    \"transmitted_bytes_per_s\": %.0f,\n"
+          "    \"received_bytes_per_s\": %.0f,\n"
+          "    \"transmit_error_count\": %llu,\n"
+          "    \"receive_error_count\": %llu\n"
+          "  }\n"
+          "}\n",
+          UART_DPI_TB_INSTANCE_COUNT,
+          UART_DPI_TB_USE_TICK_ALL ? "true" : "false",
+          simulated_cycle_count,
+          double( simulated_cycle_count ) / elapsed_seconds,
+          dpi_tick_seconds / elapsed_seconds,
+          service_seconds / elapsed_seconds,
+          double( top->transmitted_byte_count ) / elapsed_seconds,
+          double( top->received_byte_count ) / elapsed_seconds,
+          (unsigned long long) ( transmit_error_count + lost_byte_count ),
+          (unsigned long long) top->error_count );
+
+  // Runs the final blocks, which destroy the UART DPI instances. The shared memory mappings remain valid until closed.
+  top->final();
+
+  for ( size_t i = 0; i < channels.size(); ++i )
+    uart_dpi_shm_close( &channels[ i ].client );
+
+  return transmit_error_count + lost_byte_count + top->error_count == 0 ? 0 : 1;
+}
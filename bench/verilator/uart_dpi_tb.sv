@@ -0,0 +1,317 @@
+// Throughput testbench for the UART DPI module, see uart_dpi_tb.cpp and the Makefile in this directory.
+//
+// Each uart_dpi instance gets a synthetic Wishbone master that behaves like a simple polling 16550 driver:
+// it writes bursts of 16 bytes to the THR whenever LSR.THRE is set, and reads the RBR for as long as LSR.DR is set.
+// The transmitted and received data are incrementing byte sequences, which the master and the C++ side
+// check at the other end.
+//
+// The instances use the shared memory transport, so that the C++ side can feed and drain all of them
+// from the simulation thread, without any sockets.
+
+module uart_dpi_tb_master
+              ( input  wire        clk,
+                input  wire        rst,
+
+                output reg  [4:0]  wb_adr_o,
+                output reg  [31:0] wb_dat_o,
+                input  wire [31:0] wb_dat_i,
+                output reg         wb_we_o,
+                output reg         wb_stb_o,
+                output reg         wb_cyc_o,
+                input  wire        wb_ack_i,
+                input  wire        wb_err_i,
+                output wire [3:0]  wb_sel_o,
+
+                output longint     transmitted_byte_count,
+                output longint     received_byte_count,
+                output longint     error_count  // Received bytes out of sequence.
+              );
+
+   // Register addresses, like in uart_dpi.v .
+   localparam REG_RBR = 0;
+   localparam REG_THR = 0;
+   localparam REG_FCR = 2;
+   localparam REG_LCR = 3;
+   localparam REG_LSR = 5;
+
+   // The size of the 16550 transmit FIFO, which a driver may fill every time LSR.THRE is set.
+   localparam TX_BURST_SIZE = 16;
+
+   // How many bytes the master reads in a row, before it gives the transmitter a chance.
+   localparam RX_BURST_SIZE = 16;
+
+   localparam STATE_WRITE_LCR = 0;
+   localparam STATE_WRITE_FCR = 1;
+   localparam STATE_READ_LSR  = 2;
+   localparam STATE_READ_RBR  = 3;
+   localparam STATE_WRITE_THR = 4;
+
+   int       state;
+   int       tx_burst_left;
+   int       rx_burst_left;
+   bit [7:0] next_tx_byte;
+   bit [7:0] next_rx_byte;
+
+   // uart_dpi.v only looks at wb_sel_i to choose the byte lane, so the master always uses the lowest one.
+   assign wb_sel_o = 4'b0001;
+
+
+   task automatic start_access;
+      input int next_state;
+      begin
+         state    <= next_state;
+         wb_cyc_o <= 1;
+         wb_stb_o <= 1;
+         wb_dat_o <= 0;
+
+         case ( next_state )
+           STATE_WRITE_LCR:
+             begin
+                wb_adr_o <= REG_LCR;
+                wb_we_o  <= 1;
+                wb_dat_o <= 32'h03;  // 8 data bits, no parity, 1 stop bit. The UART DPI module ignores these.
+             end
+           STATE_WRITE_FCR:
+             begin
+                wb_adr_o <= REG_FCR;
+                wb_we_o  <= 1;
+                wb_dat_o <= 32'h01 << `UART_DPI_FCR_FIFO_ENABLE_BIT;
+             end
+           STATE_READ_LSR:
+             begin
+                wb_adr_o <= REG_LSR;
+                wb_we_o  <= 0;
+             end
+           STATE_READ_RBR:
+             begin
+                wb_adr_o <= REG_RBR;
+                wb_we_o  <= 0;
+             end
+           STATE_WRITE_THR:
+             begin
+                wb_adr_o     <= REG_THR;
+                wb_we_o      <= 1;
+                wb_dat_o     <= { 24'b0, next_tx_byte };
+                next_tx_byte <= next_tx_byte + 1;
+             end
+           default:
+             begin
+                $display( "Testbench error: Invalid Wishbone master state %0d.", next_state );
+                $finish;
+             end
+         endcase;
+      end
+   endtask
+
+
+   always @(posedge clk)
+   begin
+      if ( rst )
+        begin
+           state    <= STATE_WRITE_LCR;
+           wb_adr_o <= 0;
+           wb_dat_o <= 0;
+           wb_we_o  <= 0;
+           wb_stb_o <= 0;
+           wb_cyc_o <= 0;
+
+           tx_burst_left <= 0;
+           rx_burst_left <= RX_BURST_SIZE;
+           next_tx_byte  <= 0;
+           next_rx_byte  <= 0;
+
+           transmitted_byte_count <= 0;
+           received_byte_count    <= 0;
+           error_count            <= 0;
+        end
+      else if ( !wb_cyc_o )
+        start_access( STATE_WRITE_LCR );
+      else if ( wb_err_i )
+        begin
+           $display( "Testbench error: The UART DPI module answered with a Wishbone error in state %0d.", state );
+           $finish;
+        end
+      else if ( wb_ack_i )
+        begin
+           // The next access starts straight away. uart_dpi.v clears wb_ack_o in the next clock cycle
+           // and answers the new access in the cycle after that.
+           case ( state )
+             STATE_WRITE_LCR: start_access( STATE_WRITE_FCR );
+             STATE_WRITE_FCR: start_access( STATE_READ_LSR  );
+
+             STATE_READ_LSR:
+               if ( wb_dat_i[ `UART_DPI_LSR_DR ] && rx_burst_left != 0 )
+                 begin
+                    rx_burst_left <= rx_burst_left - 1;
+                    start_access( STATE_READ_RBR );
+                 end
+               else if ( wb_dat_i[ `UART_DPI_LSR_THRE ] )
+                 begin
+                    rx_burst_left <= RX_BURST_SIZE;
+                    tx_burst_left <= TX_BURST_SIZE;
+                    start_access( STATE_WRITE_THR );
+                 end
+               else
+                 begin
+                    rx_burst_left <= RX_BURST_SIZE;
+                    start_access( STATE_READ_LSR );
+                 end
+
+             STATE_READ_RBR:
+               begin
+                  if ( wb_dat_i[7:0] != next_rx_byte )
+                    error_count <= error_count + 1;
+
+                  next_rx_byte        <= wb_dat_i[7:0] + 1;
+                  received_byte_count <= received_byte_count + 1;
+                  start_access( STATE_READ_LSR );
+               end
+
+             STATE_WRITE_THR:
+               begin
+                  transmitted_byte_count <= transmitted_byte_count + 1;
+                  tx_burst_left          <= tx_burst_left - 1;
+
+                  if ( tx_burst_left == 1 )
+                    start_access( STATE_READ_LSR );
+                  else
+                    start_access( STATE_WRITE_THR );
+               end
+
+             default:
+               begin
+                  $display( "Testbench error: Invalid Wishbone master state %0d.", state );
+                  $finish;
+               end
+           endcase;
+        end;
+   end;
+
+endmodule
+
+
+module uart_dpi_tb
+              #(
+                parameter INSTANCE_COUNT = 1,  // Up to 100, because of the 2-digit instance names below.
+                parameter USE_TICK_ALL   = 0   // Whether the instances are ticked together by module uart_dpi_tick_all.
+               )
+               ( input  wire    clk,
+                 input  wire    rst,
+                 input  wire    sample_stats,  // The dpi_tick_time_ns output is updated on every clock edge where this is set.
+
+                 // The sums over all instances.
+                 output longint transmitted_byte_count,
+                 output longint received_byte_count,
+                 output longint error_count,
+                 output longint dpi_tick_time_ns
+               );
+
+   wire [63:0] unit_transmitted_byte_counts [INSTANCE_COUNT];
+   wire [63:0] unit_received_byte_counts    [INSTANCE_COUNT];
+   wire [63:0] unit_error_counts            [INSTANCE_COUNT];
+   wire [63:0] unit_dpi_tick_time_ns        [INSTANCE_COUNT];
+
+   genvar i;
+
+   generate
+      for ( i = 0; i < INSTANCE_COUNT; i = i + 1 )
+        begin : unit
+           // The shared memory names are "/uart_dpi_tb_00", "/uart_dpi_tb_01" and so on, see uart_dpi_tb.cpp .
+           localparam [15:0] INDEX_DIGITS = { 8'( "0" + i / 10 ), 8'( "0" + i % 10 ) };
+
+           wire [4:0]  wb_adr;
+           wire [31:0] wb_dat_to_uart;
+           wire [31:0] wb_dat_from_uart;
+           wire        wb_we;
+           wire        wb_stb;
+           wire        wb_cyc;
+           wire        wb_ack;
+           wire        wb_err;
+           wire [3:0]  wb_sel;
+           wire        uart_int;
+
+           longint     tick_time_ns;
+
+           uart_dpi_tb_master master
+             (
+              .clk      ( clk ),
+              .rst      ( rst ),
+              .wb_adr_o ( wb_adr ),
+              .wb_dat_o ( wb_dat_to_uart ),
+              .wb_dat_i ( wb_dat_from_uart ),
+              .wb_we_o  ( wb_we ),
+              .wb_stb_o ( wb_stb ),
+              .wb_cyc_o ( wb_cyc ),
+              .wb_ack_i ( wb_ack ),
+              .wb_err_i ( wb_err ),
+              .wb_sel_o ( wb_sel ),
+              .transmitted_byte_count ( unit_transmitted_byte_counts[i] ),
+              .received_byte_count    ( unit_received_byte_counts   [i] ),
+              .error_count            ( unit_error_counts           [i] )
+             );
+
+           uart_dpi
+             #( .port_name( { "UART DPI testbench ", INDEX_DIGITS } ),
+                .endpoint ( { "shm:/uart_dpi_tb_", INDEX_DIGITS } ),
+                .welcome_message( "" ),
+                .transmit_buffer_size( 64 * 1024 ),
+                .receive_buffer_size ( 64 * 1024 ),
+                .transmit_flow_control( 1 ),  // Lossless, so that the C++ side can check every transmitted byte.
+                .print_informational_messages( 0 ),
+                .tick_all_index( USE_TICK_ALL ? i : -1 )
+              )
+           uart
+             (
+              .wb_clk_i ( clk ),
+              .wb_rst_i ( rst ),
+              .wb_adr_i ( wb_adr ),
+              .wb_dat_i ( wb_dat_to_uart ),
+              .wb_dat_o ( wb_dat_from_uart ),
+              .wb_we_i  ( wb_we  ),
+              .wb_stb_i ( wb_stb ),
+              .wb_cyc_i ( wb_cyc ),
+              .wb_ack_o ( wb_ack ),
+              .wb_err_o ( wb_err ),
+              .wb_sel_i ( wb_sel ),
+              .int_o    ( uart_int )
+             );
+
+           always @(posedge clk)
+           begin
+              if ( sample_stats )
+                begin
+                   longint counters[ uart_dpi_pkg::UART_DPI_STAT_COUNT ];
+
+                   uart.get_stats( counters );
+                   tick_time_ns <= counters[ uart_dpi_pkg::UART_DPI_STAT_TICK_TIME_NS ];
+                end;
+           end;
+
+           assign unit_dpi_tick_time_ns[i] = tick_time_ns;
+        end
+   endgenerate
+
+   generate
+      if ( USE_TICK_ALL )
+        begin : tick_all
+           uart_dpi_tick_all uart_dpi_tick_all_instance ( .clk_i( clk ) );
+        end
+   endgenerate
+
+   always_comb
+   begin
+      transmitted_byte_count = 0;
+      received_byte_count    = 0;
+      error_count            = 0;
+      dpi_tick_time_ns       = 0;
+
+      for ( int j = 0; j < INSTANCE_COUNT; j = j + 1 )
+        begin
+           transmitted_byte_count = transmitted_byte_count + unit_transmitted_byte_counts[j];
+           received_byte_count    = received_byte_count    + unit_received_byte_counts   [j];
+           error_count            = error_count            + unit_error_counts           [j];
+           dpi_tick_time_ns       = dpi_tick_time_ns       + unit_dpi_tick_time_ns       [j];
+        end;
+   end
+
+endmodule
@@ -32,20 +32,60 @@
 //       you will have to include here the apropriate Verilator-generated header file.
 //       Example:  #include "Vminsoc_bench_core__Dpi.h"
 
+#include "svdpi.h"  // For svOpenArrayHandle.
+
+#include "uart_dpi_shm.h"
+#include "uart_dpi_stats.h"
+#include "uart_dpi_mux.h"
+#include "uart_dpi.h"
+#include "uart_dpi_stamps.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 #include <unistd.h>  // For close().
 #include <sys/socket.h>
+#include <sys/un.h>  // For sockaddr_un.
 #include <netinet/in.h>
+#include <netinet/tcp.h>  // For TCP_NODELAY and TCP_CORK.
 #include <arpa/inet.h>
 #include <errno.h>
-#include <poll.h>
+#include <signal.h>
+#include <sys/uio.h>  // For writev() and readv().
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>  // For fstat().
+#include <fcntl.h>  // For open().
+#include <termios.h>  // For cfmakeraw().
+#include <time.h>   // For clock_gettime().
+#include <limits.h>  // For INT_MAX.
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef UART_DPI_USE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#ifdef UART_DPI_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef UART_DPI_USE_LZ4
+#include <lz4frame.h>
+#endif
 
 #include <stdexcept>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 // We may have more error codes in the future, that's why the success value is zero.
@@ -54,856 +94,8921 @@
 static const int RET_SUCCESS = 0;
 static const int RET_FAILURE = 1;
 
+// Returned by uart_dpi_tick() and uart_dpi_tick_all() instead of RET_SUCCESS when a finish pattern
+// has just matched, see uart_dpi_get_pattern_match().
+static const int RET_PATTERN_MATCHED = 2;
+
 static const char ERROR_MSG_PREFIX[] = "Error in the UART DPI module: ";
 
+// The multiplexing server serves several instances, so it does not use their informational message prefixes.
+static const char MUX_MSG_PREFIX[] = "UART DPI multiplexing server: ";
 
-class uart_dpi
-{
-private:
-  uint16_t m_listening_tcp_port;
-  int      m_listening_socket;  // -1 means no listening socket.
-  bool     m_listen_on_local_addr_only;
+// In lossless transmit mode, the simulation must stop sending when the free space in the transmit buffer
+// drops below this value. uart_dpi.v stages up to 16 bytes before handing them over in one go,
+// and this reserve guarantees that a staged block always fits.
+static const unsigned LOSSLESS_TRANSMIT_RESERVE = 32;
 
-  unsigned m_receive_buffer_size;
-  unsigned m_transmit_buffer_size;
+// See uart_dpi::m_transmit_wakeup_position.
+static const uint64_t NO_TRANSMIT_WAKEUP = UINT64_MAX;
 
-  uint8_t * m_receive_buffer;
-  uint8_t * m_transmit_buffer;
+// See byte_ring::set_protected_position().
+static const uint64_t NO_READ_PROTECTION = UINT64_MAX;
 
-  unsigned m_receive_write_pointer;
-  unsigned m_receive_read_pointer;
-  unsigned m_transmit_write_pointer;
-  unsigned m_transmit_read_pointer;
+// While the simulation is waiting in lossless transmit mode, the I/O thread checks the slow clients
+// again after this many clock ticks.
+static const unsigned SLOW_CLIENT_CHECK_TICK_COUNT = 10000;
 
-  bool m_print_informational_messages;
-  std::string m_informational_message_prefix;
-  bool m_listening_message_already_printed;
+// The capture file is written in chunks of this size, or half the transmit buffer if that is smaller.
+// Whatever is left over gets written on the next periodic service.
+static const unsigned CAPTURE_WRITE_SIZE = 64 * 1024;
 
-  std::string m_welcome_message;
-  int m_welcome_message_pos;  // -1 means no message or already sent for this connection.
-
-  int m_connectionSocket;  // -1 means no connection.
-
-  bool is_receive_buffer_empty ( void );
-  bool is_receive_buffer_full ( void );
-  void enqueue_receive_byte ( uint8_t character );
-  uint8_t deque_receive_byte ( void );
-  int get_received_byte_count ( void );
-  bool is_transmit_buffer_full ( void );
-  bool is_transmit_buffer_empty ( void );
-  uint8_t deque_transmit_byte ( void );
-  
-  void close_current_connection ( void );
-  void close_listening_socket ( void );
-  void create_listening_socket ( void );
-  void accept_connection ( void );
-  void accept_eventual_incoming_connection ( void );
-  void send_byte ( uint8_t data );
+static const unsigned PERIODIC_SERVICE_INTERVAL_MS = 1000;
 
-  void transmit_data ( void );
-  void receive_data ( void );
+// See uart_dpi::m_flush_deadline.
+static const uint64_t NO_FLUSH_DEADLINE = UINT64_MAX;
 
-public:
-  uart_dpi ( int tcp_port,
-             unsigned char listen_on_local_addr_only,
-             int transmit_buffer_size,
-             int receive_buffer_size,
-             const char * welcome_message,
-             unsigned char print_informational_messages,
-             const char * informational_message_prefix );
-  ~uart_dpi ( void );
+// With the bulk socket profile, the socket buffers default to this size, see socket_profile_type.
+static const int BULK_SOCKET_BUFFER_SIZE = 1024 * 1024;
 
-  void send_char ( char character );
-  char receive ( void );
-  void tick ( int * received_byte_count );
-};
+// Timing every clock tick would cost more than the tick itself, so only one tick in this many is timed,
+// and the total time is estimated from that sample. Must be a power of two.
+static const uint64_t TICK_TIME_SAMPLE_INTERVAL = 256;
 
+// A timed tick that takes longer than this was most probably interrupted by the operating system.
+// Such a sample is discarded, because it would otherwise count TICK_TIME_SAMPLE_INTERVAL times.
+static const uint64_t TICK_TIME_SAMPLE_MAX_NS = 100000;
 
-static std::string get_error_message ( const char * const prefix_msg,
-                                       const int errno_val )
-{
-  std::ostringstream str;
-  
-  if ( prefix_msg != NULL )
-    str << prefix_msg;
-  
-  str << "Error code " << errno_val << ": ";
+// Receive record files start with this signature. See class receive_record_file for the format.
+static const char RECEIVE_RECORD_FILE_SIGNATURE[] = "UARTRX01";
+static const size_t RECEIVE_RECORD_FILE_SIGNATURE_LEN = sizeof( RECEIVE_RECORD_FILE_SIGNATURE ) - 1;
 
-  char buffer[ 2048 ];
+static const uint64_t NO_REPLAY_TICK = UINT64_MAX;
 
-  #if (_POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600) && ! _GNU_SOURCE
-  #error "The call to strerror_r() below will not compile properly. The easiest thing to do is to define _GNU_SOURCE when compiling this module."
-  #endif
-  
-  const char * const err_msg = strerror_r( errno_val, buffer, sizeof(buffer) );
-  
-  if ( err_msg == NULL )
-  {
-    str << "<no error message available>";
-  }
-  else
-  {
-    // According to the strerror_r() documentation, if the string lands in the buffer,
-    // it may be truncated, but it always includes a terminating null byte.
-    str << err_msg;
-  }
-  
-  return str.str();
-}
+// The simulation thread appends the transmit stamp entries to a ring buffer of this size,
+// and the I/O thread writes them to the file in chunks of half that size. See class transmit_stamp_file.
+static const unsigned TRANSMIT_STAMP_BUFFER_SIZE = 256 * 1024;
 
+// Longer lines span several entries in the transmit stamp file.
+static const unsigned TRANSMIT_STAMP_MAX_ENTRY_SIZE = 4096;
 
-static void close_a ( const int fd )
-{
-  for ( ; ; )
-  {
-    const int res = close( fd );
+// Separates the patterns in parameters finish_pass_patterns and finish_fail_patterns.
+static const char FINISH_PATTERN_SEPARATOR = '|';
 
-    if ( res == -1 && errno == EINTR )
-        continue;
+// The size of the instance table for uart_dpi_tick_all(). Like in uart_dpi.v , define this symbol
+// when compiling in order to raise it. The table has a fixed size, so that ticking needs no lock.
+#ifndef UART_DPI_TICK_ALL_MAX_INSTANCES
+  #define UART_DPI_TICK_ALL_MAX_INSTANCES 256
+#endif
 
-    assert( res == 0 );
-    
-    break;
-  }
-}
+// The size of the instance handle table, see uart_dpi::from_handle(). Define this symbol when compiling in order to raise it.
+#ifndef UART_DPI_MAX_INSTANCES
+  #define UART_DPI_MAX_INSTANCES 1024
+#endif
 
+// Simulation checkpoints start with this signature, see uart_dpi_save_checkpoint().
+static const char CHECKPOINT_SIGNATURE[] = "UARTCKP1";
+static const size_t CHECKPOINT_SIGNATURE_LEN = sizeof( CHECKPOINT_SIGNATURE ) - 1;
 
-static ssize_t send_eintr ( const int sockfd,
-                            const void * const buf,
-                            const size_t len,
-                            const int flags )
-{
-  for ( ; ; )
-  {
-    const ssize_t ret = send( sockfd, buf, len, flags );
+// The multiplexing server sends DATA frames of up to this size. If the socket only takes part of a frame,
+// the rest gets copied aside, so this also limits that copy.
+static const uint32_t MUX_FRAME_PAYLOAD_SIZE = 16 * 1024;
+static_assert( MUX_FRAME_PAYLOAD_SIZE <= UART_DPI_MUX_MAX_PAYLOAD_SIZE, "The multiplexing frames are too big." );
 
-    if ( ret == -1 && errno == EINTR )
-      continue;
+// How many DATA frames the multiplexing server sends with a single writev() call, at most one per channel.
+static const unsigned MUX_MAX_FRAMES_PER_SEND = 32;
 
-    return ret;
-  }
-}
+// Further clients of the multiplexing server are disconnected straight away.
+static const unsigned MUX_MAX_CONNECTION_COUNT = 16;
+
+// Each client of the multiplexing server reads its frames into a buffer of this size.
+static const unsigned MUX_INPUT_BUFFER_SIZE = 16 * 1024;
 
 
-static ssize_t recv_eintr ( const int sockfd,
-                            void * const buf,
-                            const size_t len,
-                            const int flags )
+// Byte ring buffer shared between exactly one producer thread and one consumer thread.
+// Each side only writes its own counter. The counters are 64-bit wide and never wrap,
+// so the buffer position is the counter masked with the storage size, and the whole buffer can be filled up
+// (there is no need to leave one slot unused in order to tell a full buffer from an empty one).
+//
+// The storage is a power of two in size, at least one memory page, and it is mapped twice back to back
+// in the virtual address space. Any stretch of data or free space is therefore contiguous,
+// even if it wraps around the end of the buffer, and can be handed to the kernel in one piece.
+// The capacity is still the size the user asked for, which can be smaller than the storage.
+//
+// The consumer may serve several readers, each with its own read position. It then keeps track
+// of the positions itself, and only releases the bytes that all readers have seen.
+//
+// If the producer overwrites unread data, a consumer in another thread must protect the data it reads,
+// see protect_used_segments_from(). The producer then drops new bytes instead of overwriting that data.
+
+class byte_ring
 {
-  for ( ; ; )
-  {
-    const ssize_t ret = recv( sockfd, buf, len, flags );
+private:
+  uint8_t * m_buffer;        // The first of the 2 mappings.
+  unsigned  m_size;          // The capacity.
+  unsigned  m_storage_size;  // A power of two.
+  unsigned  m_mask;
 
-    if ( ret == -1 && errno == EINTR )
-      continue;
+  // The counters live either here or in a shared memory region, see map_shared().
+  std::atomic< uint64_t > m_local_write_count;
+  std::atomic< uint64_t > m_local_read_count;
+  std::atomic< uint64_t > * m_write_count;  // Only written by the producer.
+  std::atomic< uint64_t > * m_read_count;   // Only written by the consumer.
 
-    return ret;
-  }
-}
+  // See protect_used_segments_from(). These are always local, as the consumer in another process
+  // of the shared memory transport cannot protect anything.
+  std::atomic< uint64_t > m_overwritten_position;  // Only written by the producer. The data before it may be garbage.
+  std::atomic< uint64_t > m_protected_position;    // Only written by the consumer. The data from it onwards is being read.
 
+  static uint8_t * map_twice ( int fd, off_t offset, size_t storage_size );
+  unsigned claim_overwritten_bytes ( uint64_t write_count, unsigned byte_count );
 
-static int accept4_eintr ( const int sockfd,
-                           struct sockaddr * const addr,
-                           socklen_t * const addrlen,
-                           const int flags )
-{
-  for ( ; ; )
-  {
-    const ssize_t ret = accept4( sockfd, addr, addrlen, flags );
+  byte_ring ( const byte_ring & );  // Not copyable.
+  byte_ring & operator= ( const byte_ring & );
 
-    if ( ret == -1 && errno == EINTR )
-      continue;
+public:
+  byte_ring ( void );
+  ~byte_ring ( void );
+
+  static size_t get_storage_size ( unsigned size );
+
+  void allocate ( unsigned size );
+  void map_shared ( int fd, off_t offset, unsigned size, uint64_t * write_count, uint64_t * read_count );
+
+  unsigned get_size ( void ) const { return m_size; }
+  unsigned get_used_byte_count ( void ) const;
+  bool is_empty ( void ) const { return get_used_byte_count() == 0; }
+  bool is_full  ( void ) const { return get_used_byte_count() >= m_size; }
+
+  // Producer side.
+  bool overwrite_byte ( uint8_t data );
+  unsigned overwrite_bytes ( const uint8_t * data, unsigned byte_count );
+  int get_free_segments ( iovec * segments ) const;
+  void commit_written_bytes ( unsigned byte_count );
+
+  // Consumer side.
+  uint8_t read_byte ( void );
+  unsigned read_bytes ( uint8_t * data, unsigned max_byte_count );
+  uint64_t skip_overwritten_bytes ( void );
+
+  // Consumer side, for several readers. A position is the number of bytes written since the beginning.
+  uint64_t get_read_position  ( void ) const { return m_read_count->load( std::memory_order_relaxed ); }
+  uint64_t get_write_position ( void ) const { return m_write_count->load( std::memory_order_acquire ); }
+  int get_used_segments_from ( uint64_t read_position, iovec * segments ) const;
+  int get_unread_segments ( iovec * segments ) const;
+  void release_bytes_up_to ( uint64_t read_position );
+
+  // Consumer side, for readers in another thread than the producer.
+  int protect_used_segments_from ( uint64_t * read_position, iovec * segments );
+  void set_protected_position ( uint64_t read_position );
+  uint64_t skip_bytes_up_to ( uint64_t read_position );
+};
 
-    return ret;
-  }
-}
 
+// The performance counters of a UART DPI instance. They live in a memory page of their own,
+// which is mapped to the statistics file if there is one, see uart_dpi_stats.h .
+// Each counter has a single writer, so there is no need for atomic read-modify-write operations,
+// but the relaxed atomic stores make sure that readers never see a torn value.
 
-void uart_dpi::close_current_connection ( void )
+class stats_page
 {
-  assert( m_connectionSocket != -1 );
-  
-  close_a( m_connectionSocket );
-  
-  m_connectionSocket = -1;
-}
+private:
+  uart_dpi_stats * m_stats;
 
+  stats_page ( const stats_page & );  // Not copyable.
+  stats_page & operator= ( const stats_page & );
 
-void uart_dpi::send_byte ( const uint8_t data )
-{
-  if ( -1 == send_eintr( m_connectionSocket,
-                         &data,
-                         sizeof(data),
-                         0  // No special flags. MSG_DONTWAIT not needed, for the socket is in SOCK_NONBLOCK mode.
-                         ) )
+public:
+  stats_page ( void );
+  ~stats_page ( void );
+
+  void create ( const char * file_name );
+  void set_endpoint ( const std::string & endpoint );
+
+  void set ( const uart_dpi_stat_index index, const uint64_t value )
   {
-    throw std::runtime_error( get_error_message( "Error sending data: ", errno ) );
+    __atomic_store_n( &m_stats->counters[ index ], value, __ATOMIC_RELAXED );
   }
-}
 
+  void add ( const uart_dpi_stat_index index, const uint64_t value )
+  {
+    set( index, m_stats->counters[ index ] + value );
+  }
 
-static std::string ip_address_to_text ( const in_addr * const addr )
-{
-  char ip_addr_buffer[80];
-  
-  const char * const str = inet_ntop( AF_INET,
-                                      addr,
-                                      ip_addr_buffer,
-                                      sizeof(ip_addr_buffer) );
-  if ( str == NULL )
+  void update_peak ( const uart_dpi_stat_index index, const uint64_t value )
   {
-    throw std::runtime_error( get_error_message( "Error formatting the IP address: ", errno ) );
+    if ( value > m_stats->counters[ index ] )
+      set( index, value );
   }
 
-  assert( strlen(str) <= strlen("123.123.123.123") );
-  assert( strlen(str) <= sizeof(ip_addr_buffer) );
+  uint64_t get ( const uart_dpi_stat_index index ) const
+  {
+    return __atomic_load_n( &m_stats->counters[ index ], __ATOMIC_RELAXED );
+  }
+};
 
-  return str;
-}
 
+// Streams the transmitted data to a file. If the file name ends in ".zst" or ".lz4", the data is compressed
+// on the fly, which needs compiler flag -DUART_DPI_USE_ZSTD or -DUART_DPI_USE_LZ4 respectively.
+// The file is written by the I/O thread, so a slow disk never stalls the simulation thread.
 
-void uart_dpi::close_listening_socket ( void )
+class capture_file
 {
-  assert( m_listening_socket != -1 );
-
-  close_a( m_listening_socket );
-
-  m_listening_socket = -1;
-}
-
+private:
+  enum compression_type
+  {
+    COMPRESSION_NONE,
+    COMPRESSION_ZSTD,
+    COMPRESSION_LZ4
+  };
+
+  int m_fd;  // -1 means not open.
+  compression_type m_compression;
+  bool m_is_flush_needed;
+  std::vector< uint8_t > m_compressed_data;
+
+  #ifdef UART_DPI_USE_ZSTD
+  ZSTD_CCtx * m_zstd_context;
+  void compress_zstd ( const uint8_t * data, size_t byte_count, ZSTD_EndDirective end_directive );
+  #endif
 
-void uart_dpi::create_listening_socket ( void )
-{
-  assert( m_listening_socket == -1 );
+  #ifdef UART_DPI_USE_LZ4
+  LZ4F_cctx * m_lz4_context;
+  #endif
 
-  m_listening_socket = socket( PF_INET,
-                               SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
-                               0 );
+  capture_file ( const capture_file & );  // Not copyable.
+  capture_file & operator= ( const capture_file & );
 
-  if ( m_listening_socket == -1 )
-  {
-    throw std::runtime_error( get_error_message( "Error creating the listening socket: ", errno ) );
-  }
+  void write_all ( const uint8_t * data, size_t byte_count );
 
-  try
-  {
-    // If this process terminates abruptly, the TCP/IP stack does not release
-    // the listening ports immediately, at least under Linux (I've seen comments
-    // about this issue under Windows too). Therefore, if you restart the simulation
-    // whithin a few seconds, you'll get an annoying "address already in use" error message.
-    // The SO_REUSEADDR prevents this from happening.
-    const int set_reuse_to_yes = 1;
-    if ( setsockopt( m_listening_socket,
-                     SOL_SOCKET,
-                     SO_REUSEADDR,
-                     &set_reuse_to_yes,
-                     sizeof(set_reuse_to_yes) ) == -1 )
-    {
-      throw std::runtime_error( get_error_message( "Error setting the listen socket options: ", errno ) );
-    }
-    
-    sockaddr_in addr;
-    memset( &addr, 0, sizeof(addr) );
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons( m_listening_tcp_port );
-    addr.sin_addr.s_addr = ntohl( m_listen_on_local_addr_only ? INADDR_LOOPBACK : INADDR_ANY );
+public:
+  capture_file ( void );
+  ~capture_file ( void );
 
-    if ( bind( m_listening_socket,
-               (struct sockaddr *)&addr,
-               sizeof(addr) ) == -1 )
-    {
-      throw std::runtime_error( get_error_message( "Error binding the socket: ", errno ) );
-    }
+  void open ( const std::string & filename );
+  bool is_open ( void ) const { return m_fd != -1; }
 
-    // The listening IP address and listening port do not change, so print this information
-    // only once at the beginning. Printing the message again just clutters
-    // the screen with unnecessary information.
-    if ( !m_listening_message_already_printed )
-    {
-      m_listening_message_already_printed = true;
+  void write ( const uint8_t * data, size_t byte_count );
+  void flush ( void );
+  void finish ( void );
+};
 
-      if ( m_print_informational_messages )
-      {
-        const std::string addr_str = ip_address_to_text( &addr.sin_addr );
-        
-        printf( "%sListening on IP address %s (%s), TCP port %d.\n",
-                m_informational_message_prefix.c_str(),
-                addr_str.c_str(),
-                m_listen_on_local_addr_only ? "local only" : "all",
-                m_listening_tcp_port );
-        fflush( stdout );
-      }
-    }
-  
-    if ( listen( m_listening_socket, 1 ) == -1 )
-    {
-      throw std::runtime_error( get_error_message( "Error listening on the socket: ", errno ) );
-    }
-  }
-  catch ( ... )
-  {
-    close_listening_socket();
-    throw;
-  }
-}
 
+// Records the bytes the simulation receives, together with the tick count at which they become visible
+// to the simulation, see uart_dpi::tick(). After the signature, the file contains one entry per tick
+// with new data: the number of ticks since the previous entry, the number of bytes,
+// and the bytes themselves. Both numbers are LEB128-encoded, so they normally take just one byte each.
+// Only used by the simulation thread.
 
-void uart_dpi::accept_connection ( void )
+class receive_record_file
 {
-  assert( m_listening_socket != -1 );
+private:
+  int m_fd;  // -1 means not open.
+  uint64_t m_last_tick;
+  std::vector< uint8_t > m_entry;
 
-  for ( ; ; )
-  {
-    pollfd polled_fd;
+  receive_record_file ( const receive_record_file & );  // Not copyable.
+  receive_record_file & operator= ( const receive_record_file & );
 
-    polled_fd.fd      = m_listening_socket;
-    polled_fd.events  = POLLIN | POLLERR;
-    polled_fd.revents = 0;
+public:
+  receive_record_file ( void );
+  ~receive_record_file ( void );
 
-    const int poll_res = poll( &polled_fd, 1, 0 );
+  void open ( const std::string & filename );
+  bool is_open ( void ) const { return m_fd != -1; }
 
-    if ( poll_res == 0 )
-    {
-      // No incoming connection is yet there.
-      return;
-    }
-  
-    if ( poll_res == -1 )
-    {
-      if ( errno == EINTR )
-        continue;
-      
-      throw std::runtime_error( get_error_message( "Error polling the listening socket: ", errno ) );
-    }
+  void record ( uint64_t tick, const uint8_t * data, size_t byte_count );
+};
 
-    assert( poll_res == 1 );
-    
-    break;
-  }
 
-  if ( m_print_informational_messages )
-  {
-    // printf( "%sPoll result flags: 0x%02X\n", polled_fd.revents, m_informational_message_prefix.c_str() );
-    // fflush( stdout );
-  }
+// Reads a file written by receive_record_file. The file is memory-mapped, and the next entry
+// is decoded in advance, so that uart_dpi::tick() only needs to compare its tick count
+// with get_next_tick(). Only used by the simulation thread.
 
-  sockaddr_in remoteAddr;
-  socklen_t remoteAddrLen = sizeof( remoteAddr );
+class receive_replay_file
+{
+private:
+  const uint8_t * m_data;  // NULL means not open.
+  size_t m_size;
+  size_t m_pos;
 
-  const int connectionSocket = accept4_eintr( m_listening_socket,
-                                              (sockaddr *) &remoteAddr,
-                                              &remoteAddrLen,
-                                              SOCK_NONBLOCK | SOCK_CLOEXEC );
+  uint64_t m_next_tick;  // NO_REPLAY_TICK means no more entries.
+  const uint8_t * m_next_data;
+  size_t m_next_byte_count;
 
-  // Any errors accepting a connection are considered non-critical and do not normally stop the simulation,
-  // as the remote client can try to reconnect at a later point in time.
-  try
-  {
-    if ( connectionSocket == -1 )
-    {
-      throw std::runtime_error( get_error_message( NULL, errno ) );
-    }
-    
-    if ( remoteAddrLen > sizeof( remoteAddr ) )
-    {
-      throw std::runtime_error( "The address buffer is too small." );
-    }
+  receive_replay_file ( const receive_replay_file & );  // Not copyable.
+  receive_replay_file & operator= ( const receive_replay_file & );
 
-    if ( m_print_informational_messages )
-    {
-      const std::string addr_str = ip_address_to_text( &remoteAddr.sin_addr );
-      
-      printf( "%sAccepted an incoming connection from IP address %s, TCP port %d.\n",
-              m_informational_message_prefix.c_str(),
-              addr_str.c_str(),
-              ntohs( remoteAddr.sin_port ) );
-      fflush( stdout );
-    }
-  }
-  catch ( const std::exception & e )
-  {
-    fprintf( stderr,
-             "%sError accepting a connection on the listening socket: %s\n",
-             ERROR_MSG_PREFIX,
-             e.what() );
-    fflush( stderr );
-    
-    if ( connectionSocket != -1 )
-    {
-      close_a( connectionSocket );
-    }
+  uint64_t read_number ( void );
 
-    return;
-  }
+public:
+  receive_replay_file ( void );
+  ~receive_replay_file ( void );
 
-  m_connectionSocket = connectionSocket;
-  m_welcome_message_pos = m_welcome_message.empty() ? -1 : 0;
+  void open ( const std::string & filename );
+  bool is_open ( void ) const { return m_data != NULL; }
 
-  // If somebody else attempts to connect, he should get an error straight away.
-  // However, if the listening socket is still active, the client will land in the accept queue
-  // and he'll hopefully time-out eventually.
-  close_listening_socket();
-}
+  uint64_t get_next_tick ( void ) const { return m_next_tick; }
+  const uint8_t * get_next_data ( void ) const { return m_next_data; }
+  size_t get_next_byte_count ( void ) const { return m_next_byte_count; }
+  void advance ( void );
+};
 
 
-void uart_dpi::accept_eventual_incoming_connection ( void )
+// Writes the transmitted data together with the clock ticks at which the simulation wrote it,
+// see uart_dpi_stamps.h for the file format.
+//
+// The simulation thread collects each entry, and appends it to a ring buffer when it is complete.
+// The I/O thread writes the ring buffer to the file in large chunks, like the capture file,
+// so stamping costs the simulation just a few stores per byte and no system calls.
+
+class transmit_stamp_file
 {
-  if ( m_connectionSocket == -1 )
-  {
-    if ( m_listening_socket == -1 )
-    {
-      create_listening_socket();
-    }
+private:
+  int m_fd;  // -1 means not open.
+  bool m_is_per_byte;
+  byte_ring m_ring;  // The simulation thread produces, the I/O thread consumes.
 
-    accept_connection();
-  }
-}
+  // The simulation thread must wake up the I/O thread when the ring buffer grows past this position.
+  // NO_TRANSMIT_WAKEUP means that no wake-up is needed.
+  std::atomic< uint64_t > m_wakeup_position;
 
+  // ---- These members are only used by the simulation thread.
 
-bool uart_dpi::is_receive_buffer_empty ( void )
-{
-  return m_receive_read_pointer == m_receive_write_pointer;
-}
+  std::vector< uint8_t > m_entry;  // The bytes of the entry being collected.
+  uint64_t m_entry_tick;
+  uint64_t m_last_tick;
+  uint64_t m_lost_byte_count;
 
-bool uart_dpi::is_receive_buffer_full ( void )
-{
-  return ((m_receive_write_pointer + 1) % m_receive_buffer_size) == m_receive_read_pointer;
-}
+  transmit_stamp_file ( const transmit_stamp_file & );  // Not copyable.
+  transmit_stamp_file & operator= ( const transmit_stamp_file & );
 
-void uart_dpi::enqueue_receive_byte ( const uint8_t character )
-{
-  assert( !is_receive_buffer_full() );
+public:
+  transmit_stamp_file ( void );
+  ~transmit_stamp_file ( void );
 
-  assert( m_receive_write_pointer < m_receive_buffer_size );
-  m_receive_buffer[ m_receive_write_pointer ] = character;
+  void open ( const std::string & filename, bool is_per_byte );
+  bool is_open ( void ) const { return m_fd != -1; }
 
-  ++m_receive_write_pointer;
-  m_receive_write_pointer %= m_receive_buffer_size;
+  // Simulation thread. These return whether the I/O thread must be woken up.
+  bool add ( uint64_t tick, uint8_t data );
+  bool close_entry ( void );
+  uint64_t get_lost_byte_count ( void ) const { return m_lost_byte_count; }
+
+  // I/O thread.
+  void write ( bool should_flush );
+  void finish ( void );
+};
+
+
+// Finds a set of byte patterns in the transmitted data. It is an Aho-Corasick automaton turned into
+// a full transition table, so each byte costs a single table lookup, whatever the number of patterns.
+// The table has 256 entries per state, which is fine for the handful of short patterns it is meant for.
+
+class pattern_matcher
+{
+private:
+  std::vector< uint16_t > m_transitions;  // 256 entries per state. State 0 is the start state.
+  std::vector< int > m_matches;  // Per state, the index of the pattern that ends there, or -1.
+  unsigned m_state;
+
+public:
+  pattern_matcher ( void ) : m_state( 0 ) {}
+
+  void build ( const std::vector< std::string > & patterns );
+  bool is_empty ( void ) const { return m_matches.empty(); }
+
+  // Returns the index of the first pattern found, or -1. The search can carry on
+  // in the next call, so a pattern may straddle several calls. If match_end is not NULL,
+  // it gets how many of the bytes were searched, up to and including the end of the match.
+  int find ( const uint8_t * data, size_t byte_count, size_t * match_end );
+
+  // For simulation checkpoints.
+  unsigned get_state ( void ) const { return m_state; }
+  void set_state ( unsigned state );
+};
+
+
+// Where a console script is, for simulation checkpoints.
+
+struct console_script_state
+{
+  bool     is_running;
+  unsigned step_index;         // The step being executed.
+  unsigned expect_step_index;  // The next expect step whose text has not arrived yet.
+  unsigned pattern_state;      // See pattern_matcher::get_state().
+  uint64_t step_start_tick;
+  unsigned send_offset;        // How much of the current send step's text is already in the receive buffer.
+};
+
+
+// Drives the console from a script file, see section "Scripted console interaction" in README.pod.
+// Everything happens in the simulation thread: the expect steps search the transmitted data as it enters
+// the transmit buffer, and the send steps write straight into the receive buffer. The expect steps
+// are matched ahead of time, so that the text that arrives during a wait or a send step is not missed.
+
+class console_script
+{
+public:
+  enum result_type
+  {
+    RESULT_RUNNING,
+    RESULT_PASSED,
+    RESULT_FAILED
+  };
+
+private:
+  enum step_type
+  {
+    STEP_EXPECT,  // Wait until the text has been transmitted, or fail after 'tick_count' ticks, if not 0.
+    STEP_SEND,    // Receive the text, as if a client had typed it.
+    STEP_WAIT     // Wait for 'tick_count' ticks.
+  };
+
+  struct step
+  {
+    step_type   type;
+    std::string text;
+    uint64_t    tick_count;
+    unsigned    line_number;
+  };
+
+  std::string m_filename;
+  std::vector< step > m_steps;
+  console_script_state m_state;
+  pattern_matcher m_expect_matcher;  // For the step at m_state.expect_step_index.
+  std::string m_failure_message;
+
+  void parse_line ( const std::string & line, unsigned line_number, uint64_t * timeout );
+  void prepare_expect_step ( unsigned first_step_index );
+  void begin_step ( unsigned step_index, uint64_t tick );
+
+public:
+  console_script ( void );
+
+  void load ( const std::string & filename );
+  bool is_running ( void ) const { return m_state.is_running; }
+
+  // Whether the transmitted data still has to go through on_transmit().
+  bool is_expecting ( void ) const { return m_state.is_running && m_state.expect_step_index < m_steps.size(); }
+  void on_transmit ( const uint8_t * data, size_t byte_count );
+
+  result_type run ( uint64_t tick, byte_ring * receive_ring );
+  const std::string & get_failure_message ( void ) const { return m_failure_message; }
+
+  console_script_state get_state ( void ) const;
+  void set_state ( const console_script_state & state );
+};
+
+
+class uart_dpi;
+struct client_connection;
+
+
+#ifdef UART_DPI_USE_IO_URING
+
+// A minimal io_uring wrapper on top of the raw system calls, so that liburing is not needed.
+// It is only used by the I/O thread.
+
+class io_uring_queue
+{
+private:
+  int m_ring_fd;  // -1 means not set up.
+
+  void * m_sq_ring;
+  size_t m_sq_ring_size;
+  void * m_cq_ring;
+  size_t m_cq_ring_size;
+  io_uring_sqe * m_sqes;
+  size_t m_sqes_size;
+
+  unsigned * m_sq_head;
+  unsigned * m_sq_tail;
+  unsigned   m_sq_ring_mask;
+  unsigned   m_sq_entry_count;
+  unsigned * m_sq_array;
+  unsigned   m_sqe_tail;  // Submission queue entries up to here have been handed out, but maybe not submitted yet.
+
+  unsigned * m_cq_head;
+  unsigned * m_cq_tail;
+  unsigned   m_cq_ring_mask;
+  io_uring_cqe * m_cqes;
+
+  io_uring_queue ( const io_uring_queue & );  // Not copyable.
+  io_uring_queue & operator= ( const io_uring_queue & );
+
+  void tear_down ( void );
+  void enter ( unsigned wait_count );
+
+public:
+  io_uring_queue ( void );
+  ~io_uring_queue ( void );
+
+  bool set_up ( unsigned entry_count );
+  bool is_set_up ( void ) const { return m_ring_fd != -1; }
+
+  io_uring_sqe * get_sqe ( void );
+  void submit_and_wait ( unsigned wait_count ) { enter( wait_count ); }
+  bool pop_cqe ( io_uring_cqe * cqe );
+};
+
+
+// An asynchronous operation an instance has queued in the io_uring.
+// Its address is the user_data of the submission, so it must not move while it is pending.
+
+struct io_uring_operation
+{
+  enum operation_type
+  {
+    OPERATION_ACCEPT,
+    OPERATION_SEND,
+    OPERATION_RECEIVE
+  };
+
+  uart_dpi *          instance;
+  client_connection * client;  // NULL for OPERATION_ACCEPT.
+  operation_type      type;
+  bool                is_pending;
+};
+
+#endif  // #ifdef UART_DPI_USE_IO_URING
+
+
+// There is a single I/O thread per process, which serves the sockets of all uart_dpi instances.
+// It blocks in epoll_wait() until some socket becomes ready, or until a simulation thread
+// wakes it up through an eventfd, see uart_dpi::tick().
+//
+// If compiled with UART_DPI_USE_IO_URING, the I/O thread uses io_uring instead of epoll
+// whenever the kernel supports it. The instances then keep their socket operations queued
+// in the io_uring, and the I/O thread blocks waiting for their completions.
+//
+// Instances that need periodic attention, like flushing a capture file, get serviced
+// every PERIODIC_SERVICE_INTERVAL_MS too, and instances that hold back transmit data
+// get serviced again when their flush deadline expires.
+
+class io_reactor
+{
+private:
+  enum request_type
+  {
+    REQUEST_ADD_INSTANCE,
+    REQUEST_REMOVE_INSTANCE,
+    REQUEST_STOP
+  };
+
+  struct request
+  {
+    request_type type;
+    uart_dpi *   instance;
+  };
+
+  int m_epoll_fd;   // -1 if io_uring is used instead.
+  int m_wakeup_fd;  // An eventfd.
+
+  #ifdef UART_DPI_USE_IO_URING
+  io_uring_queue m_io_uring;
+  uint64_t m_wakeup_counter;  // Where the queued read of m_wakeup_fd lands.
+  bool m_wake_up_received;
+  bool m_is_multishot_accept_supported;
+  __kernel_timespec m_periodic_timeout;
+  uint64_t m_periodic_timeout_time;  // When the last timeout queued expires. UINT64_MAX means none is pending.
+  #endif
+
+  std::thread m_thread;
+
+  // This instance list belongs to the I/O thread. Other threads post requests
+  // and wait until the I/O thread has processed them, so that the I/O thread never
+  // touches an instance that has already been destroyed.
+  std::vector< uart_dpi * > m_instances;
+
+  unsigned m_periodic_instance_count;  // How many instances in m_instances need periodic service.
+  uint64_t m_next_periodic_service_time;
+  uint64_t m_next_flush_time;  // The earliest flush deadline of the instances, NO_FLUSH_DEADLINE if none.
+
+  std::mutex m_request_mutex;
+  std::condition_variable m_request_completed;
+  std::vector< request > m_pending_requests;
+  uint64_t m_posted_request_count;
+  uint64_t m_completed_request_count;
+
+  static std::mutex   s_mutex;  // Protects the 2 variables below.
+  static io_reactor * s_reactor;
+  static unsigned     s_instance_count;
+
+  io_reactor ( void );
+  ~io_reactor ( void );
+
+  void post_request ( request_type type, uart_dpi * instance );
+  bool process_requests ( void );
+  void service_requested_instances ( void );
+  int get_periodic_wait_time ( void ) const;
+  void service_periodic_instances ( void );
+  void thread_main ( void );
+  void thread_main_epoll ( void );
+
+  #ifdef UART_DPI_USE_IO_URING
+  void queue_wakeup_read ( void );
+  void queue_periodic_timeout ( int wait_time );
+  void reap_io_uring_completions ( void );
+  void thread_main_io_uring ( void );
+  #endif
+
+public:
+  static io_reactor * acquire ( void );
+  static void release ( void );
+
+  void add_instance ( uart_dpi * instance );
+  void remove_instance ( uart_dpi * instance );
+
+  void wake_up ( void );
+
+  // I/O thread only.
+  void schedule_flush ( uint64_t deadline ) { m_next_flush_time = std::min( m_next_flush_time, deadline ); }
+
+  bool is_using_io_uring ( void ) const { return m_epoll_fd == -1; }
+
+  // epoll backend.
+  void register_fd ( int fd, uint32_t events, uart_dpi * instance );
+  void modify_fd ( int fd, uint32_t events, uart_dpi * instance );
+  void unregister_fd ( int fd );
+
+  #ifdef UART_DPI_USE_IO_URING
+  // io_uring backend.
+  void queue_accept ( int fd, io_uring_operation * operation );
+  void queue_sendmsg ( int fd, const msghdr * msg, io_uring_operation * operation );
+  void queue_recvmsg ( int fd, msghdr * msg, io_uring_operation * operation );
+  void queue_writev ( int fd, const iovec * segments, int segment_count, io_uring_operation * operation );
+  void queue_readv ( int fd, const iovec * segments, int segment_count, io_uring_operation * operation );
+  void queue_cancel ( io_uring_operation * operation );
+  void wait_for_operations ( uart_dpi * instance );
+  bool disable_multishot_accept ( void );
+  #endif
+};
+
+
+// A TCP client connected to a uart_dpi instance. All clients send from the same transmit buffer,
+// each one from its own position, so the data is never copied per client.
+// Only used by the I/O thread.
+
+struct client_connection
+{
+  int      socket;               // For the pseudo-terminal transport, this is the master side of the pty.
+  bool     is_socket;            // A pty never disconnects, and needs read() and write() instead of recv() and send().
+  uint64_t transmit_position;    // The next byte to send, see byte_ring::get_read_position().
+  uint64_t send_start_position;  // The transmit_position when the last send operation started.
+  int      welcome_message_pos;  // -1 means no message or already sent.
+  uint32_t socket_events;        // The epoll events registered for the socket, 0 means not registered.
+  bool     is_send_stalled;      // The socket send buffer was full at the last send attempt, or the send operation is still pending.
+
+  #ifdef UART_DPI_USE_IO_URING
+  // The kernel accesses these structures while the corresponding operation is pending.
+  io_uring_operation send_operation;
+  io_uring_operation receive_operation;
+  iovec  send_segments[2];
+  msghdr send_msg;
+  size_t send_welcome_message_len;
+  iovec  receive_segments[1];
+  msghdr receive_msg;
+  bool   is_receive_discarded;  // Whether the pending receive operation lands in uart_dpi::m_discard_buffer.
+
+  bool is_closing;  // The socket is closed as soon as no operations are pending on it.
+  #endif
+};
+
+
+// A uart_dpi instance with a "mux:" endpoint, as seen by its mux_server. The instance fills it in,
+// and only the server's I/O thread uses it afterwards, until the instance removes it again.
+
+struct mux_channel
+{
+  uint16_t     id;  // Assigned by mux_server::acquire().
+  std::string  name;
+  byte_ring *  transmit_ring;
+  byte_ring *  receive_ring;
+  stats_page * stats;
+
+  // See uart_dpi::m_transmit_wakeup_position and uart_dpi::m_receive_wakeup_needed.
+  std::atomic< uint64_t > * transmit_wakeup_position;
+  std::atomic< bool >     * receive_wakeup_needed;
+};
+
+
+// A TCP client of a mux_server. Like client_connection, it sends from the transmit buffers
+// of all channels, each one from its own position. Only used by the server's I/O thread.
+
+struct mux_connection
+{
+  int      socket;
+  uint32_t socket_events;    // The epoll events registered for the socket, 0 means not registered.
+  bool     is_send_stalled;  // The socket send buffer was full at the last send attempt.
+
+  std::vector< uint64_t > transmit_positions;  // Parallel to mux_server::m_channels.
+
+  // Bytes that must go out before any more DATA frames: the signature, the OPEN and CLOSE frames,
+  // and the rest of a DATA frame that the socket only took in part.
+  std::vector< uint8_t > pending_output;
+  size_t pending_output_pos;
+
+  size_t next_channel_index;  // Where the next send starts, so that all channels get their turn.
+
+  // The frames received are parsed straight from this buffer, and the payloads are copied in one go
+  // to the receive buffers.
+  uint8_t  input_buffer[ MUX_INPUT_BUFFER_SIZE ];
+  size_t   input_pos;
+  size_t   input_len;
+  uint8_t  header[ UART_DPI_MUX_FRAME_HEADER_SIZE ];
+  unsigned header_len;
+  uint32_t payload_left;      // 0 means that the next byte belongs to a frame header.
+  uint16_t payload_channel_id;
+  bool     is_receive_paused; // The receive buffer of channel payload_channel_id is full.
+};
+
+
+// Serves all uart_dpi instances in the process with a "mux:" endpoint and the same TCP port
+// over a single listening socket, see uart_dpi_mux.h for the wire protocol.
+//
+// Each server has its own I/O thread, which always uses epoll. Like with io_reactor, other threads post requests
+// and wait until the I/O thread has processed them. The I/O thread services all channels and connections together,
+// so the data of many instances goes out with a single writev() call per client.
+
+class mux_server
+{
+private:
+  enum request_type
+  {
+    REQUEST_ADD_CHANNEL,
+    REQUEST_REMOVE_CHANNEL,
+    REQUEST_STOP
+  };
+
+  struct request
+  {
+    request_type  type;
+    mux_channel * channel;
+  };
+
+  // ---- These members are set during construction and do not change afterwards.
+
+  uint16_t m_tcp_port;
+  bool     m_listen_on_local_addr_only;
+  bool     m_print_informational_messages;
+
+  // ---- These members are protected by s_mutex.
+
+  unsigned m_user_count;
+  uint32_t m_next_channel_id;
+  std::vector< std::string > m_channel_names;
+
+  // ---- These members are only used by the I/O thread, except during construction and destruction.
+
+  int m_listening_socket;
+  int m_epoll_fd;
+  int m_wakeup_fd;  // An eventfd.
+
+  std::vector< mux_channel * > m_channels;
+  std::vector< mux_connection * > m_connections;  // In connection order. Only the first one can send data to the simulation.
+  std::vector< uint64_t > m_write_positions;      // Scratch space for update_io_registration().
+  std::vector< uint64_t > m_wakeup_positions;     // Ditto.
+
+  std::thread m_thread;
+
+  std::mutex m_request_mutex;
+  std::condition_variable m_request_completed;
+  std::vector< request > m_pending_requests;
+  uint64_t m_posted_request_count;
+  uint64_t m_completed_request_count;
+
+  static std::mutex s_mutex;
+  static std::vector< mux_server * > s_servers;
+
+  mux_server ( uint16_t tcp_port, bool listen_on_local_addr_only, bool print_informational_messages );
+  ~mux_server ( void );
+
+  void create_listening_socket ( void );
+  void post_request ( request_type type, mux_channel * channel );
+  bool process_requests ( void );
+  void insert_channel ( mux_channel * channel );
+  void erase_channel ( mux_channel * channel );
+  mux_channel * find_channel ( uint16_t id ) const;
+  void thread_main ( void );
+  void service ( void );
+  void accept_connection ( void );
+  void close_connection ( mux_connection * connection );
+  void skip_overwritten_bytes ( void );
+  void account_lost_bytes ( mux_channel * channel, uint64_t lost_byte_count );
+  void transmit_data ( mux_connection * connection );
+  void unprotect_channels ( const size_t * channel_indexes, unsigned channel_count );
+  void account_sent_bytes ( mux_connection * connection, size_t sent_byte_count, size_t pending_byte_count,
+                            const iovec * frame_segments, const size_t * frame_channel_indexes, unsigned frame_count );
+  bool receive_data ( mux_connection * connection );
+  void parse_input ( mux_connection * connection, bool is_controlling_connection );
+  void release_transmitted_bytes ( void );
+  void update_io_registration ( void );
+  void set_socket_events ( mux_connection * connection, uint32_t events );
+
+public:
+  static mux_server * acquire ( int tcp_port, bool listen_on_local_addr_only, bool print_informational_messages, mux_channel * channel );
+  static void release ( mux_server * server, const mux_channel * channel );
+
+  void add_channel ( mux_channel * channel );
+  void remove_channel ( mux_channel * channel );
+
+  void wake_up ( void );
+};
+
+
+// Where the simulated UART is made available, see the endpoint parameter of uart_dpi_create().
+
+enum transport_type
+{
+  TRANSPORT_NONE,  // Only the capture file gets the transmitted data.
+  TRANSPORT_TCP,
+  TRANSPORT_UNIX,  // A Unix domain stream socket.
+  TRANSPORT_PTY,   // A pseudo-terminal, which behaves like a single client that is always connected.
+  TRANSPORT_SHM,   // A shared memory region that holds the rings, see uart_dpi_shm.h . There is no I/O thread.
+  TRANSPORT_MUX,   // A channel of the multiplexing server, see class mux_server.
+  TRANSPORT_HARNESS  // The C++ testbench, through the routines in uart_dpi.h . There is no I/O thread.
+};
+
+
+// What to do with a client that falls a whole transmit buffer behind.
+
+enum slow_client_policy_type
+{
+  SLOW_CLIENT_WAIT       = 0,  // The default. In lossless transmit mode, the simulation waits for the client.
+                               // Otherwise, the client loses the oldest bytes.
+  SLOW_CLIENT_SKIP       = 1,  // The client skips ahead and loses the bytes in between.
+  SLOW_CLIENT_DISCONNECT = 2
+};
+
+
+// When the clients get the transmitted data. All policies except the first one hold the data back for a while,
+// so that it goes out with fewer system calls and in fewer, larger TCP segments.
+// The held back data is also sent straight away when the simulation has to wait in lossless transmit mode.
+
+enum transmit_flush_policy_type
+{
+  TRANSMIT_FLUSH_IMMEDIATE = 0,  // The default. Data is sent as soon as the I/O thread sees it.
+  TRANSMIT_FLUSH_LINE      = 1,  // Data is sent up to the last end-of-line character.
+  TRANSMIT_FLUSH_SIZE      = 2,  // Data is sent when the flush threshold is reached.
+  TRANSMIT_FLUSH_TIMER     = 3   // Data is sent when the oldest held back byte reaches the flush latency.
+};
+
+
+// Socket options for the client connections. The transmit flush policies decide when the data
+// is handed over to the kernel, and these options decide how the kernel sends it.
+
+enum socket_profile_type
+{
+  SOCKET_PROFILE_DEFAULT     = 0,  // The operating system defaults.
+  SOCKET_PROFILE_INTERACTIVE = 1,  // TCP_NODELAY, so that keystroke echoes do not wait for the acknowledgement of the previous segment.
+  SOCKET_PROFILE_BULK        = 2   // TCP_CORK, so that only full segments go out, and larger socket buffers, see BULK_SOCKET_BUFFER_SIZE.
+};
+
+
+// What a matching finish pattern means, see uart_dpi_get_pattern_match().
+// The values are known to uart_dpi.v .
+
+enum pattern_kind_type
+{
+  PATTERN_KIND_NONE = 0,  // No pattern has matched yet.
+  PATTERN_KIND_PASS = 1,  // One of the finish_pass_patterns.
+  PATTERN_KIND_FAIL = 2   // One of the finish_fail_patterns.
+};
+
+
+// The arguments of uart_dpi_create(), which a simulation checkpoint needs in order to re-create the instance.
+
+struct creation_parameters
+{
+  int tcp_port;
+  std::string endpoint;
+  unsigned char listen_on_local_addr_only;
+  int transmit_buffer_size;
+  int receive_buffer_size;
+  unsigned char lossless_transmit;
+  int transmit_low_watermark;
+  int max_client_count;
+  int slow_client_policy;
+  int transmit_flush_policy;
+  int transmit_flush_threshold;
+  int transmit_flush_latency_ms;
+  int socket_profile;
+  int socket_send_buffer_size;
+  int socket_receive_buffer_size;
+  std::string capture_file_name;
+  std::string transmit_stamp_file_name;
+  unsigned char transmit_stamp_per_byte;
+  std::string finish_pass_patterns;
+  std::string finish_fail_patterns;
+  std::string script_file_name;
+  std::string receive_record_file_name;
+  std::string receive_replay_file_name;
+  std::string stats_file_name;
+  std::string port_name;
+  std::string welcome_message;
+  unsigned char print_informational_messages;
+  std::string informational_message_prefix;
+  int tick_all_index;
+};
+
+
+// An instance in a simulation checkpoint. The client connections are not part of it.
+
+struct instance_checkpoint
+{
+  long long handle;
+  creation_parameters parameters;
+
+  std::string transmit_data;  // What some reader of the transmit buffer has not seen yet.
+  std::string receive_data;   // What the simulation has not read yet.
+
+  uint64_t tick_count;
+  unsigned blocked_tick_count;
+  bool     is_transmit_blocked;
+  unsigned pattern_state;    // See pattern_matcher::get_state().
+  int      pattern_match_kind;  // See pattern_kind_type.
+  bool     is_pattern_match_pending;
+  console_script_state script_state;
+  uint64_t counters[ UART_DPI_STAT_COUNT ];
+};
+
+
+class uart_dpi
+{
+private:
+  // ---- These members are set during construction and do not change afterwards.
+
+  creation_parameters m_parameters;
+  long long m_handle;  // 0 means none yet, see register_handle().
+
+  transport_type m_transport;
+  std::string m_unix_socket_path;
+  std::string m_pty_link_path;  // Empty means no symbolic link.
+  std::string m_shm_name;
+
+  bool     m_lossless_transmit;
+  unsigned m_transmit_low_watermark;
+  unsigned m_max_client_count;
+  slow_client_policy_type m_slow_client_policy;
+  unsigned m_capture_write_threshold;
+
+  transmit_flush_policy_type m_transmit_flush_policy;
+  unsigned m_transmit_flush_threshold;   // Held back data goes out when it reaches this size.
+  unsigned m_transmit_flush_latency_ms;  // Held back data goes out after this time. 0 means no time limit.
+
+  socket_profile_type m_socket_profile;
+  int m_socket_send_buffer_size;     // 0 means the default for the profile.
+  int m_socket_receive_buffer_size;  // Ditto.
+
+  // When replaying, the received data comes from m_replay_file, and the TCP clients can only watch.
+  bool m_is_replaying;
+
+  // ---- These members are only used by the I/O thread, except during construction and destruction.
+
+  uint16_t m_listening_tcp_port;
+  int      m_listening_socket;  // -1 means no listening socket.
+  bool     m_is_unix_socket_bound;  // Whether the Unix socket file is ours to remove.
+  int      m_pty_slave_fd;      // Kept open, so that the pty master does not report a hang-up while no client is attached.
+  bool     m_listen_on_local_addr_only;
+
+  bool m_print_informational_messages;
+  std::string m_informational_message_prefix;
+  bool m_listening_message_already_printed;
+
+  std::string m_welcome_message;
+
+  // In connection order. Only the controlling client can send data to the simulation,
+  // the other clients just watch.
+  std::vector< client_connection * > m_clients;
+  client_connection * m_controlling_client;  // NULL means none.
+
+  bool m_listening_socket_registered;
+
+  // Data received from the clients that are not in control lands here and gets discarded.
+  uint8_t m_discard_buffer[ 256 ];
+
+  // The capture file is like another client that reads the transmit buffer.
+  capture_file m_capture_file;
+  uint64_t m_capture_position;
+
+  // Both threads use it, see the class.
+  transmit_stamp_file m_stamp_file;
+
+  // The clients only send up to this position, see update_transmit_limit().
+  uint64_t m_transmit_limit;
+  uint64_t m_timed_flush_position;  // The end of the transmit buffer when the last flush deadline expired.
+  uint64_t m_flush_deadline;        // When the held back data must go out, see get_monotonic_time_ms().
+                                    // NO_FLUSH_DEADLINE means that no data is being held back.
+
+  #ifdef UART_DPI_USE_IO_URING
+  io_uring_operation m_accept_operation;
+  bool m_is_io_being_removed;
+  #endif
+
+  // ---- These members are shared between the simulation thread and the I/O thread.
+
+  byte_ring m_receive_ring;   // The I/O thread produces, the simulation thread consumes.
+  byte_ring m_transmit_ring;  // The simulation thread produces, the I/O thread consumes.
+
+  // With the shared memory transport, the rings live in this region, and an external process
+  // takes the place of the I/O thread.
+  uart_dpi_shm_header * m_shm_header;  // NULL means no shared memory.
+  size_t m_shm_header_size;
+
+  io_reactor * m_reactor;  // NULL with the shared memory, the multiplexing and the harness transports.
+
+  // With the multiplexing transport, the server's I/O thread takes the place of the I/O reactor.
+  mux_server * m_mux_server;  // NULL means no multiplexing server.
+  mux_channel m_mux_channel;
+
+  // The I/O thread sets these when it stops watching the client sockets for transmit
+  // or receive purposes, see tick(). For the transmit side, the simulation thread must wake up
+  // the I/O thread when the transmit buffer grows past the given position.
+  // NO_TRANSMIT_WAKEUP means that no wake-up is needed.
+  std::atomic< uint64_t > m_transmit_wakeup_position;
+  std::atomic< bool > m_receive_wakeup_needed;
+
+  // With a transmit flush policy other than TRANSMIT_FLUSH_IMMEDIATE, the simulation thread moves
+  // the flush position forward to where the clients may send up to, and must wake up the I/O thread
+  // when it grows past the flush wake-up position. NO_TRANSMIT_WAKEUP means that no wake-up is needed.
+  std::atomic< uint64_t > m_transmit_flush_position;
+  std::atomic< uint64_t > m_flush_wakeup_position;
+  std::atomic< bool > m_io_service_requested;
+
+  // While the script runs, the simulation thread produces the receive buffer instead of the I/O thread,
+  // and no client is in control. Only the simulation thread writes it.
+  std::atomic< bool > m_is_script_receiving;
+
+  // Errors in the I/O thread that should stop the simulation are reported on the next tick.
+  std::atomic< bool > m_io_error;
+  std::string m_io_error_message;  // Written once before m_io_error is set.
+
+  // Written by both threads, but each counter has a single writer.
+  stats_page m_stats;
+
+  // Only written by the simulation thread. The I/O thread needs it for the slow client policy.
+  std::atomic< bool > m_is_transmit_blocked;
+
+  // Set by the simulation thread when it has had to drop new data, because the I/O thread was still reading
+  // the old data it would have overwritten, see report_blocked_overwrite(). Cleared by check_slow_clients().
+  std::atomic< bool > m_is_overwrite_blocked;
+
+  // ---- These members are only used by the simulation thread.
+
+  unsigned m_blocked_tick_count;
+
+  uint64_t m_tick_count;
+  uint64_t m_clock_overhead_ns;  // See tick().
+  receive_record_file m_record_file;
+  uint64_t m_recorded_receive_position;  // See byte_ring::get_write_position().
+  receive_replay_file m_replay_file;
+
+  // The finish_pass_patterns come first, then the finish_fail_patterns.
+  std::vector< std::string > m_finish_patterns;
+  size_t m_finish_pass_pattern_count;
+  pattern_matcher m_pattern_matcher;
+  bool m_is_searching_patterns;  // Until the first match.
+  pattern_kind_type m_pattern_match_kind;  // Only the first match counts.
+  bool m_is_pattern_match_pending;  // The next tick reports the match.
+
+  console_script m_script;
+
+  struct transmit_callback_entry
+  {
+    uart_dpi_transmit_callback * callback;
+    void * context;
+  };
+
+  std::vector< transmit_callback_entry > m_transmit_callbacks;  // See uart_dpi_add_transmit_callback().
+
+  // ---- Support for uart_dpi_tick_all().
+
+  int m_tick_all_index;  // -1 means this instance does not take part.
+
+  static std::mutex s_tick_all_mutex;  // Protects s_tick_all_reserved.
+  static bool s_tick_all_reserved[ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+
+  // uart_dpi_tick_all() reads this table without a lock. An instance only appears in it once fully constructed.
+  static std::atomic< uart_dpi * > s_tick_all_instances[ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+
+  // Incremented after each change to s_tick_all_instances, so that tick_all() knows when to rescan it.
+  static std::atomic< unsigned > s_tick_all_generation;
+
+  // Only touched by tick_all(). The positions in use, so that each clock tick skips the empty ones.
+  static unsigned       s_tick_all_seen_generation;
+  static const int *    s_tick_all_seen_counts;
+  static int            s_tick_all_seen_count;
+  static int            s_tick_all_active_indexes[ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+  static int            s_tick_all_active_count;
+
+  // ---- The obj handles, see from_handle().
+
+  static std::mutex s_handle_mutex;  // Only protects handle allocation, not lookups.
+  static std::atomic< uart_dpi * > s_handles[ UART_DPI_MAX_INSTANCES ];
+
+  void close_client_connection ( client_connection * client );
+  void choose_controlling_client ( void );
+  bool has_listening_socket ( void ) const { return m_transport == TRANSPORT_TCP || m_transport == TRANSPORT_UNIX; }
+  void close_listening_socket ( void );
+  void create_listening_socket ( void );
+  void bind_tcp_socket ( void );
+  void bind_unix_socket ( void );
+  void set_socket_buffer_sizes ( int fd );
+  void configure_client_socket ( int fd );
+  void create_pty ( void );
+  void create_shm_region ( unsigned transmit_buffer_size, unsigned receive_buffer_size );
+  void close_shm_region ( void );
+  void wake_up_shm_reader ( void );
+  void accept_connection ( void );
+  void take_accepted_connection ( int accept_result, const sockaddr_in * remoteAddr, socklen_t remoteAddrLen );
+  client_connection * add_client ( int fd, bool is_socket );
+
+  void check_slow_clients ( void );
+  void account_lost_transmit_bytes ( uint64_t lost_byte_count );
+  void update_transmit_limit ( void );
+  void set_transmit_wakeup_positions ( uint64_t idle_client_position );
+  void release_transmitted_bytes ( void );
+  void update_transmit_protection ( void );
+  int get_transmit_segments ( client_connection * client, iovec * segments, size_t * welcome_message_len );
+  void account_sent_bytes ( client_connection * client, size_t sent_byte_count, size_t welcome_message_len );
+  void transmit_data ( client_connection * client );
+  bool receive_data ( client_connection * client );
+  void write_capture_file ( bool should_flush );
+  uint64_t get_capture_wakeup_position ( void ) const;
+  void update_io_registration ( void );
+
+  #ifdef UART_DPI_USE_IO_URING
+  void service_io_uring ( void );
+  void queue_client_operations ( client_connection * client );
+  void begin_closing_connection ( client_connection * client );
+  #endif
+
+  unsigned record_received_bytes ( void );
+  void replay_received_bytes ( void );
+
+  void publish_to_tick_all ( void );
+  void unregister_from_tick_all ( void );
+
+  void save_checkpoint ( instance_checkpoint * checkpoint ) const;
+  void restore_checkpoint ( const instance_checkpoint & checkpoint );
+  void unregister_handle ( void );
+
+  void update_transmit_flush_position ( const char * data, unsigned byte_count );
+  void add_finish_patterns ( const char * patterns );
+  void find_finish_patterns ( const char * data, unsigned byte_count );
+  void report_pattern_match ( pattern_kind_type kind );
+  void run_script ( void );
+  void wake_up_io_thread ( void );
+  void report_blocked_overwrite ( void );
+  bool process_tick ( int * received_byte_count, svBit * transmit_blocked );
+
+public:
+  uart_dpi ( const creation_parameters & parameters, const instance_checkpoint * checkpoint );
+  ~uart_dpi ( void );
+
+  // The Verilog side only knows the instance by its handle.
+  long long register_handle ( long long requested_handle );
+  static uart_dpi * from_handle ( long long handle );
+  static long long find_handle ( const std::string & port_name );
+
+  // Simulation thread, between clock ticks.
+  static void save_all ( std::string * data );
+  static void restore_all ( const std::string & data );
+
+  // Simulation thread.
+  void send_char ( char character );
+  void send_block ( const char * data, unsigned byte_count, const int * cycle_stamps, int cycle_count );
+  char receive ( void );
+  unsigned receive_block ( char * data, unsigned max_byte_count );
+  bool tick ( int * received_byte_count, svBit * transmit_blocked );
+  static bool tick_all ( int * received_byte_counts, svBit * transmit_blocked_flags, int count );
+  pattern_kind_type get_pattern_match ( void ) const { return m_pattern_match_kind; }
+  void get_transmit_counters ( uint64_t * lost_byte_count, uint64_t * stall_count ) const;
+  void get_stats ( uint64_t * counters, unsigned count ) const;
+
+  // Simulation thread, for the C++ testbench, see uart_dpi.h .
+  void add_transmit_callback ( uart_dpi_transmit_callback * callback, void * context );
+  void remove_transmit_callback ( uart_dpi_transmit_callback * callback, void * context );
+  size_t push_received_bytes ( const iovec * segments, int segment_count );
+  void skip_bytes_lost_by_harness ( void );
+  void peek_transmitted_bytes ( const char ** data, size_t * byte_count );
+  void drain_transmitted_bytes ( size_t byte_count );
+
+  // I/O thread.
+  void service_io ( void );
+  bool take_io_service_request ( void ) { return m_io_service_requested.exchange( false, std::memory_order_acquire ); }
+  bool needs_periodic_service ( void ) const { return m_capture_file.is_open() || m_stamp_file.is_open(); }
+  void service_periodic ( void );
+  uint64_t get_flush_deadline ( void ) const { return m_flush_deadline; }
+  void unregister_io ( void );
+
+  #ifdef UART_DPI_USE_IO_URING
+  void on_io_uring_completion ( io_uring_operation * operation, int result, unsigned flags );
+  bool has_pending_operations ( void ) const;
+  #endif
+};
+
+
+static std::string get_error_message ( const char * const prefix_msg,
+                                       const int errno_val )
+{
+  std::ostringstream str;
+  
+  if ( prefix_msg != NULL )
+    str << prefix_msg;
+  
+  str << "Error code " << errno_val << ": ";
+
+  char buffer[ 2048 ];
+
+  #if (_POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600) && ! _GNU_SOURCE
+  #error "The call to strerror_r() below will not compile properly. The easiest thing to do is to define _GNU_SOURCE when compiling this module."
+  #endif
+  
+  const char * const err_msg = strerror_r( errno_val, buffer, sizeof(buffer) );
+  
+  if ( err_msg == NULL )
+  {
+    str << "<no error message available>";
+  }
+  else
+  {
+    // According to the strerror_r() documentation, if the string lands in the buffer,
+    // it may be truncated, but it always includes a terminating null byte.
+    str << err_msg;
+  }
+  
+  return str.str();
+}
+
+
+static void close_a ( const int fd )
+{
+  for ( ; ; )
+  {
+    const int res = close( fd );
+
+    if ( res == -1 && errno == EINTR )
+        continue;
+
+    assert( res == 0 );
+    
+    break;
+  }
+}
+
+
+static ssize_t writev_eintr ( const int fd,
+                              const iovec * const iov,
+                              const int iovcnt )
+{
+  for ( ; ; )
+  {
+    const ssize_t ret = writev( fd, iov, iovcnt );
+
+    if ( ret == -1 && errno == EINTR )
+      continue;
+
+    return ret;
+  }
+}
+
+
+// Writes all the data to a file, or throws an exception with the given error message prefix.
+
+static void write_all ( const int fd,
+                        const uint8_t * const data,
+                        const size_t byte_count,
+                        const char * const error_msg_prefix )
+{
+  size_t written_byte_count = 0;
+
+  while ( written_byte_count < byte_count )
+  {
+    const ssize_t res = write( fd, data + written_byte_count, byte_count - written_byte_count );
+
+    if ( res == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      throw std::runtime_error( get_error_message( error_msg_prefix, errno ) );
+    }
+
+    written_byte_count += size_t( res );
+  }
+}
+
+
+static ssize_t readv_eintr ( const int fd,
+                             const iovec * const iov,
+                             const int iovcnt )
+{
+  for ( ; ; )
+  {
+    const ssize_t ret = readv( fd, iov, iovcnt );
+
+    if ( ret == -1 && errno == EINTR )
+      continue;
+
+    return ret;
+  }
+}
+
+
+static int accept4_eintr ( const int sockfd,
+                           struct sockaddr * const addr,
+                           socklen_t * const addrlen,
+                           const int flags )
+{
+  for ( ; ; )
+  {
+    const ssize_t ret = accept4( sockfd, addr, addrlen, flags );
+
+    if ( ret == -1 && errno == EINTR )
+      continue;
+
+    return ret;
+  }
+}
+
+
+void uart_dpi::close_client_connection ( client_connection * const client )
+{
+  #ifdef UART_DPI_USE_IO_URING
+  assert( !client->send_operation.is_pending && !client->receive_operation.is_pending );
+  #endif
+
+  // Closing the socket removes it from the epoll set too.
+  close_a( client->socket );
+
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    if ( m_clients[i] == client )
+    {
+      m_clients.erase( m_clients.begin() + i );
+      break;
+    }
+  }
+
+  if ( m_controlling_client == client )
+  {
+    m_controlling_client = NULL;
+    choose_controlling_client();
+  }
+
+  delete client;
+}
+
+
+// If the controlling client goes away, the one that has been connected the longest takes over.
+
+void uart_dpi::choose_controlling_client ( void )
+{
+  if ( m_controlling_client != NULL || m_is_replaying || m_is_script_receiving.load( std::memory_order_acquire ) )
+    return;
+
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    #ifdef UART_DPI_USE_IO_URING
+    if ( m_clients[i]->is_closing )
+      continue;
+    #endif
+
+    m_controlling_client = m_clients[i];
+
+    #ifdef UART_DPI_USE_IO_URING
+    // Anything received after the hand-over should not be discarded.
+    if ( m_controlling_client->receive_operation.is_pending && m_controlling_client->is_receive_discarded )
+    {
+      m_reactor->queue_cancel( &m_controlling_client->receive_operation );
+    }
+    #endif
+
+    break;
+  }
+}
+
+
+static std::string ip_address_to_text ( const in_addr * const addr )
+{
+  char ip_addr_buffer[80];
+  
+  const char * const str = inet_ntop( AF_INET,
+                                      addr,
+                                      ip_addr_buffer,
+                                      sizeof(ip_addr_buffer) );
+  if ( str == NULL )
+  {
+    throw std::runtime_error( get_error_message( "Error formatting the IP address: ", errno ) );
+  }
+
+  assert( strlen(str) <= strlen("123.123.123.123") );
+  assert( strlen(str) <= sizeof(ip_addr_buffer) );
+
+  return str;
+}
+
+
+void uart_dpi::close_listening_socket ( void )
+{
+  assert( m_listening_socket != -1 );
+
+  #ifdef UART_DPI_USE_IO_URING
+  // The pending accept operation keeps the socket open inside the kernel until it is cancelled.
+  if ( m_accept_operation.is_pending )
+  {
+    m_reactor->queue_cancel( &m_accept_operation );
+  }
+  #endif
+
+  close_a( m_listening_socket );
+
+  m_listening_socket = -1;
+  m_listening_socket_registered = false;
+
+  // Clients that try to connect in the meantime then get an error straight away.
+  if ( m_is_unix_socket_bound )
+  {
+    unlink( m_unix_socket_path.c_str() );
+    m_is_unix_socket_bound = false;
+  }
+}
+
+
+void uart_dpi::create_listening_socket ( void )
+{
+  assert( m_listening_socket == -1 );
+
+  m_listening_socket = socket( m_transport == TRANSPORT_UNIX ? PF_UNIX : PF_INET,
+                               SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               0 );
+
+  if ( m_listening_socket == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error creating the listening socket: ", errno ) );
+  }
+
+  try
+  {
+    if ( m_transport == TRANSPORT_UNIX )
+      bind_unix_socket();
+    else
+      bind_tcp_socket();
+
+    // The TCP window scale is negotiated during the handshake, so the receive buffer size
+    // must already be set on the listening socket, from which the connections inherit it.
+    set_socket_buffer_sizes( m_listening_socket );
+
+    if ( listen( m_listening_socket, int( m_max_client_count ) ) == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error listening on the socket: ", errno ) );
+    }
+  }
+  catch ( ... )
+  {
+    close_listening_socket();
+    throw;
+  }
+}
+
+
+void uart_dpi::bind_tcp_socket ( void )
+{
+  // If this process terminates abruptly, the TCP/IP stack does not release
+  // the listening ports immediately, at least under Linux (I've seen comments
+  // about this issue under Windows too). Therefore, if you restart the simulation
+  // whithin a few seconds, you'll get an annoying "address already in use" error message.
+  // The SO_REUSEADDR prevents this from happening.
+  const int set_reuse_to_yes = 1;
+  if ( setsockopt( m_listening_socket,
+                   SOL_SOCKET,
+                   SO_REUSEADDR,
+                   &set_reuse_to_yes,
+                   sizeof(set_reuse_to_yes) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the listen socket options: ", errno ) );
+  }
+  
+  sockaddr_in addr;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( m_listening_tcp_port );
+  addr.sin_addr.s_addr = ntohl( m_listen_on_local_addr_only ? INADDR_LOOPBACK : INADDR_ANY );
+
+  if ( bind( m_listening_socket,
+             (struct sockaddr *)&addr,
+             sizeof(addr) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error binding the socket: ", errno ) );
+  }
+
+  // The listening IP address and listening port do not change, so print this information
+  // only once at the beginning. Printing the message again just clutters
+  // the screen with unnecessary information.
+  if ( !m_listening_message_already_printed )
+  {
+    m_listening_message_already_printed = true;
+
+    if ( m_print_informational_messages )
+    {
+      const std::string addr_str = ip_address_to_text( &addr.sin_addr );
+      
+      printf( "%sListening on IP address %s (%s), TCP port %d.\n",
+              m_informational_message_prefix.c_str(),
+              addr_str.c_str(),
+              m_listen_on_local_addr_only ? "local only" : "all",
+              m_listening_tcp_port );
+      fflush( stdout );
+    }
+  }
+}
+
+
+void uart_dpi::bind_unix_socket ( void )
+{
+  sockaddr_un addr;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+
+  if ( m_unix_socket_path.size() >= sizeof( addr.sun_path ) )
+  {
+    throw std::runtime_error( "The Unix socket path is too long." );
+  }
+
+  strcpy( addr.sun_path, m_unix_socket_path.c_str() );
+
+  // A previous simulation that terminated abruptly may have left its socket file behind.
+  // Anything else with the same name is left alone, and bind() will fail.
+  struct stat file_info;
+
+  if ( lstat( m_unix_socket_path.c_str(), &file_info ) == 0 && S_ISSOCK( file_info.st_mode ) )
+  {
+    unlink( m_unix_socket_path.c_str() );
+  }
+
+  if ( bind( m_listening_socket,
+             (struct sockaddr *)&addr,
+             sizeof(addr) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error binding Unix socket \"" + m_unix_socket_path + "\": " ).c_str(), errno ) );
+  }
+
+  m_is_unix_socket_bound = true;
+
+  if ( !m_listening_message_already_printed )
+  {
+    m_listening_message_already_printed = true;
+
+    if ( m_print_informational_messages )
+    {
+      printf( "%sListening on Unix socket %s.\n",
+              m_informational_message_prefix.c_str(),
+              m_unix_socket_path.c_str() );
+      fflush( stdout );
+    }
+  }
+}
+
+
+// The kernel doubles the values, in order to leave room for its own bookkeeping, and caps them
+// at net.core.wmem_max and net.core.rmem_max .
+
+void uart_dpi::set_socket_buffer_sizes ( const int fd )
+{
+  if ( m_socket_send_buffer_size != 0 &&
+       setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &m_socket_send_buffer_size, sizeof( m_socket_send_buffer_size ) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the socket send buffer size: ", errno ) );
+  }
+
+  if ( m_socket_receive_buffer_size != 0 &&
+       setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &m_socket_receive_buffer_size, sizeof( m_socket_receive_buffer_size ) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the socket receive buffer size: ", errno ) );
+  }
+}
+
+
+// Applies the socket profile to an accepted connection. The TCP options do not exist for Unix sockets.
+
+void uart_dpi::configure_client_socket ( const int fd )
+{
+  set_socket_buffer_sizes( fd );
+
+  if ( m_transport != TRANSPORT_TCP )
+    return;
+
+  const int set_to_yes = 1;
+
+  if ( m_socket_profile == SOCKET_PROFILE_INTERACTIVE &&
+       setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &set_to_yes, sizeof( set_to_yes ) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the TCP_NODELAY socket option: ", errno ) );
+  }
+
+  // The kernel sends a partial segment anyway after 200 ms.
+  if ( m_socket_profile == SOCKET_PROFILE_BULK &&
+       setsockopt( fd, IPPROTO_TCP, TCP_CORK, &set_to_yes, sizeof( set_to_yes ) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the TCP_CORK socket option: ", errno ) );
+  }
+}
+
+
+// The master side of the pseudo-terminal becomes a client that is always connected.
+// This is called during construction, after the I/O backend is known.
+
+void uart_dpi::create_pty ( void )
+{
+  const int master_fd = posix_openpt( O_RDWR | O_NOCTTY | O_CLOEXEC );
+
+  if ( master_fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error creating the pseudo-terminal: ", errno ) );
+  }
+
+  try
+  {
+    char slave_name[ 64 ];
+
+    if ( grantpt( master_fd ) != 0 ||
+         unlockpt( master_fd ) != 0 ||
+         ptsname_r( master_fd, slave_name, sizeof( slave_name ) ) != 0 )
+    {
+      throw std::runtime_error( get_error_message( "Error setting up the pseudo-terminal: ", errno ) );
+    }
+
+    m_pty_slave_fd = open( slave_name, O_RDWR | O_NOCTTY | O_CLOEXEC );
+
+    if ( m_pty_slave_fd == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error opening the pseudo-terminal: ", errno ) );
+    }
+
+    // Without raw mode, the line discipline would echo the transmitted data back as received data,
+    // and translate the end-of-line characters.
+    termios settings;
+
+    if ( tcgetattr( m_pty_slave_fd, &settings ) != 0 )
+    {
+      throw std::runtime_error( get_error_message( "Error reading the pseudo-terminal settings: ", errno ) );
+    }
+
+    cfmakeraw( &settings );
+
+    if ( tcsetattr( m_pty_slave_fd, TCSANOW, &settings ) != 0 )
+    {
+      throw std::runtime_error( get_error_message( "Error changing the pseudo-terminal settings: ", errno ) );
+    }
+
+    // io_uring honours O_NONBLOCK on read and write operations, and would then fail them with EAGAIN
+    // instead of waiting for the pty to become ready.
+    if ( !m_reactor->is_using_io_uring() && fcntl( master_fd, F_SETFL, fcntl( master_fd, F_GETFL ) | O_NONBLOCK ) == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error changing the pseudo-terminal to non-blocking mode: ", errno ) );
+    }
+
+    if ( !m_pty_link_path.empty() )
+    {
+      // Replace the link left behind by a previous simulation, but nothing else.
+      struct stat file_info;
+
+      if ( lstat( m_pty_link_path.c_str(), &file_info ) == 0 && S_ISLNK( file_info.st_mode ) )
+      {
+        unlink( m_pty_link_path.c_str() );
+      }
+
+      if ( symlink( slave_name, m_pty_link_path.c_str() ) != 0 )
+      {
+        throw std::runtime_error( get_error_message( ( "Error creating symbolic link \"" + m_pty_link_path + "\": " ).c_str(), errno ) );
+      }
+    }
+
+    m_stats.set_endpoint( std::string( "pty:" ) + slave_name );
+
+    if ( m_print_informational_messages )
+    {
+      if ( m_pty_link_path.empty() )
+        printf( "%sThe serial port is available at %s.\n", m_informational_message_prefix.c_str(), slave_name );
+      else
+        printf( "%sThe serial port is available at %s (%s).\n", m_informational_message_prefix.c_str(), m_pty_link_path.c_str(), slave_name );
+
+      fflush( stdout );
+    }
+  }
+  catch ( ... )
+  {
+    if ( m_pty_slave_fd != -1 )
+    {
+      close_a( m_pty_slave_fd );
+      m_pty_slave_fd = -1;
+    }
+
+    close_a( master_fd );
+    throw;
+  }
+
+  add_client( master_fd, false );
+}
+
+
+// The rings live in a shared memory region, whose layout is described in uart_dpi_shm.h .
+// A region left behind by a previous simulation with the same name is replaced.
+
+void uart_dpi::create_shm_region ( const unsigned transmit_buffer_size, const unsigned receive_buffer_size )
+{
+  const long page_size = sysconf( _SC_PAGESIZE );
+  static_assert( sizeof( uart_dpi_shm_header ) <= 4096, "The shared memory header does not fit in a page." );
+
+  const size_t header_size = size_t( page_size );
+  const size_t transmit_storage_size = byte_ring::get_storage_size( transmit_buffer_size );
+  const size_t receive_storage_size  = byte_ring::get_storage_size( receive_buffer_size  );
+
+  shm_unlink( m_shm_name.c_str() );
+
+  const int fd = shm_open( m_shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR );
+
+  if ( fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error creating shared memory \"" + m_shm_name + "\": " ).c_str(), errno ) );
+  }
+
+  try
+  {
+    // The new memory is filled with zeros, so all counters and flags start at 0.
+    if ( ftruncate( fd, off_t( header_size + transmit_storage_size + receive_storage_size ) ) == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error setting the shared memory size: ", errno ) );
+    }
+
+    void * const header = mmap( NULL, header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+    if ( header == MAP_FAILED )
+    {
+      throw std::runtime_error( get_error_message( "Error mapping the shared memory: ", errno ) );
+    }
+
+    m_shm_header = (uart_dpi_shm_header *) header;
+    m_shm_header_size = header_size;
+
+    m_shm_header->version               = UART_DPI_SHM_VERSION;
+    m_shm_header->header_size           = uint32_t( header_size );
+    m_shm_header->transmit_size         = transmit_buffer_size;
+    m_shm_header->transmit_storage_size = uint32_t( transmit_storage_size );
+    m_shm_header->receive_size          = receive_buffer_size;
+    m_shm_header->receive_storage_size  = uint32_t( receive_storage_size );
+    m_shm_header->flags                 = m_lossless_transmit ? UART_DPI_SHM_FLAG_LOSSLESS_TRANSMIT : 0;
+
+    m_transmit_ring.map_shared( fd,
+                                off_t( header_size ),
+                                transmit_buffer_size,
+                                &m_shm_header->transmit_write_count,
+                                &m_shm_header->transmit_read_count );
+
+    m_receive_ring.map_shared( fd,
+                               off_t( header_size + transmit_storage_size ),
+                               receive_buffer_size,
+                               &m_shm_header->receive_write_count,
+                               &m_shm_header->receive_read_count );
+
+    // An external process that opens the region too early must not see a half-initialised header.
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memcpy( m_shm_header->signature, UART_DPI_SHM_SIGNATURE, sizeof( m_shm_header->signature ) );
+  }
+  catch ( ... )
+  {
+    if ( m_shm_header != NULL )
+    {
+      munmap( m_shm_header, m_shm_header_size );
+      m_shm_header = NULL;
+    }
+
+    close_a( fd );
+    shm_unlink( m_shm_name.c_str() );
+    throw;
+  }
+
+  // The mappings keep the memory alive.
+  close_a( fd );
+
+  if ( m_print_informational_messages )
+  {
+    printf( "%sThe shared memory is available as \"%s\".\n", m_informational_message_prefix.c_str(), m_shm_name.c_str() );
+    fflush( stdout );
+  }
+}
+
+
+// Tells the external process that the simulation is gone. The rings themselves are unmapped
+// by the byte_ring destructors, and an external process that still has the region mapped keeps it alive.
+
+void uart_dpi::close_shm_region ( void )
+{
+  __atomic_store_n( &m_shm_header->is_closed, 1, __ATOMIC_RELEASE );
+  __atomic_add_fetch( &m_shm_header->transmit_futex, 1, __ATOMIC_RELEASE );
+  syscall( SYS_futex, &m_shm_header->transmit_futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+
+  munmap( m_shm_header, m_shm_header_size );
+  m_shm_header = NULL;
+
+  shm_unlink( m_shm_name.c_str() );
+}
+
+
+// Called on every clock tick. The external process sets transmit_waiting before it checks
+// the transmit buffer one last time and goes to sleep on the futex. Without a full memory barrier here,
+// this tick may miss the flag, but then the next tick will see it, so that the external process
+// is woken up at most one clock tick late. The usual case costs one plain memory load.
+
+void uart_dpi::wake_up_shm_reader ( void )
+{
+  if ( __atomic_load_n( &m_shm_header->transmit_waiting, __ATOMIC_RELAXED ) == 0 ||
+       m_transmit_ring.is_empty() )
+  {
+    return;
+  }
+
+  __atomic_store_n( &m_shm_header->transmit_waiting, 0, __ATOMIC_RELAXED );
+  __atomic_add_fetch( &m_shm_header->transmit_futex, 1, __ATOMIC_RELEASE );
+  syscall( SYS_futex, &m_shm_header->transmit_futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+}
+
+
+void uart_dpi::accept_connection ( void )
+{
+  assert( m_listening_socket != -1 );
+
+  sockaddr_in remoteAddr;
+  socklen_t remoteAddrLen = sizeof( remoteAddr );
+
+  const bool is_tcp = m_transport == TRANSPORT_TCP;
+
+  const int connectionSocket = accept4_eintr( m_listening_socket,
+                                              is_tcp ? (sockaddr *) &remoteAddr : NULL,
+                                              is_tcp ? &remoteAddrLen : NULL,
+                                              SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+  if ( connectionSocket == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+  {
+    // No incoming connection is yet there.
+    return;
+  }
+
+  take_accepted_connection( connectionSocket == -1 ? -errno : connectionSocket,
+                            is_tcp ? &remoteAddr : NULL,
+                            is_tcp ? remoteAddrLen : 0 );
+}
+
+
+// The accept result is either the new connection socket or a negated errno value,
+// like the result of an io_uring accept operation. The remote address is only available for TCP connections.
+
+void uart_dpi::take_accepted_connection ( const int accept_result,
+                                          const sockaddr_in * const remoteAddr,
+                                          const socklen_t remoteAddrLen )
+{
+  const int connectionSocket = accept_result < 0 ? -1 : accept_result;
+
+  // Any errors accepting a connection are considered non-critical and do not normally stop the simulation,
+  // as the remote client can try to reconnect at a later point in time.
+  try
+  {
+    if ( connectionSocket == -1 )
+    {
+      throw std::runtime_error( get_error_message( NULL, -accept_result ) );
+    }
+
+    if ( m_transport == TRANSPORT_UNIX )
+    {
+      if ( m_print_informational_messages )
+      {
+        printf( "%sAccepted an incoming connection on Unix socket %s.\n",
+                m_informational_message_prefix.c_str(),
+                m_unix_socket_path.c_str() );
+        fflush( stdout );
+      }
+    }
+    else
+    {
+      if ( remoteAddrLen > sizeof( *remoteAddr ) )
+      {
+        throw std::runtime_error( "The address buffer is too small." );
+      }
+
+      if ( m_print_informational_messages )
+      {
+        const std::string addr_str = ip_address_to_text( &remoteAddr->sin_addr );
+
+        printf( "%sAccepted an incoming connection from IP address %s, TCP port %d.\n",
+                m_informational_message_prefix.c_str(),
+                addr_str.c_str(),
+                ntohs( remoteAddr->sin_port ) );
+        fflush( stdout );
+      }
+    }
+
+    configure_client_socket( connectionSocket );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr,
+             "%sError accepting a connection on the listening socket: %s\n",
+             ERROR_MSG_PREFIX,
+             e.what() );
+    fflush( stderr );
+    
+    if ( connectionSocket != -1 )
+    {
+      close_a( connectionSocket );
+    }
+
+    return;
+  }
+
+  client_connection * const client = add_client( connectionSocket, true );
+  m_stats.add( UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT, 1 );
+
+  if ( m_controlling_client != client && m_print_informational_messages )
+  {
+    printf( m_is_replaying ? "%sThe received data is being replayed from a file, so the data received from the new client will be discarded.\n"
+            : m_is_script_receiving.load( std::memory_order_relaxed ) ? "%sA script is running, so the data received from the new client will be discarded for now.\n"
+            : "%sAnother client is in control, so the data received from the new one will be discarded.\n",
+            m_informational_message_prefix.c_str() );
+    fflush( stdout );
+  }
+
+  // If somebody else attempts to connect, he should get an error straight away.
+  // However, if the listening socket is still active, the client will land in the accept queue
+  // and he'll hopefully time-out eventually.
+  if ( m_clients.size() >= m_max_client_count )
+  {
+    close_listening_socket();
+  }
+}
+
+
+client_connection * uart_dpi::add_client ( const int fd, const bool is_socket )
+{
+  client_connection * const client = new client_connection();
+
+  client->socket              = fd;
+  client->is_socket           = is_socket;
+  client->welcome_message_pos = m_welcome_message.empty() || !is_socket ? -1 : 0;
+  client->socket_events       = 0;
+  client->is_send_stalled     = false;
+
+  // A new client gets everything still in the transmit buffer. If no other client is connected,
+  // this includes all data sent in the meantime.
+  client->transmit_position   = m_transmit_ring.get_read_position();
+  client->send_start_position = client->transmit_position;
+
+  #ifdef UART_DPI_USE_IO_URING
+  client->send_operation.instance      = this;
+  client->send_operation.client        = client;
+  client->send_operation.type          = io_uring_operation::OPERATION_SEND;
+  client->send_operation.is_pending    = false;
+  client->receive_operation.instance   = this;
+  client->receive_operation.client     = client;
+  client->receive_operation.type       = io_uring_operation::OPERATION_RECEIVE;
+  client->receive_operation.is_pending = false;
+
+  memset( &client->send_msg, 0, sizeof(client->send_msg) );
+  client->send_msg.msg_iov = client->send_segments;
+  client->send_welcome_message_len = 0;
+  memset( &client->receive_msg, 0, sizeof(client->receive_msg) );
+  client->receive_msg.msg_iov = client->receive_segments;
+  client->is_receive_discarded = false;
+
+  client->is_closing = false;
+  #endif
+
+  m_clients.push_back( client );
+
+  choose_controlling_client();
+
+  return client;
+}
+
+
+byte_ring::byte_ring ( void )
+{
+  m_buffer = NULL;
+  m_size   = 0;
+  m_storage_size = 0;
+  m_mask   = 0;
+  m_local_write_count = 0;
+  m_local_read_count  = 0;
+  m_write_count = &m_local_write_count;
+  m_read_count  = &m_local_read_count;
+  m_overwritten_position = 0;
+  m_protected_position   = NO_READ_PROTECTION;
+}
+
+byte_ring::~byte_ring ( void )
+{
+  if ( m_buffer != NULL )
+  {
+    munmap( m_buffer, 2 * size_t( m_storage_size ) );
+  }
+}
+
+// Returns the size of the memory behind a ring of the given capacity, which is a power of two
+// and at least one memory page, so that it can be mapped twice back to back.
+
+size_t byte_ring::get_storage_size ( const unsigned size )
+{
+  assert( size > 0 );
+
+  const long page_size = sysconf( _SC_PAGESIZE );
+  assert( page_size > 0 && ( page_size & ( page_size - 1 ) ) == 0 );
+
+  size_t storage_size = size_t( page_size );
+
+  while ( storage_size < size )
+    storage_size *= 2;
+
+  if ( 2 * storage_size > size_t( 1 ) << 31 )
+    throw std::runtime_error( "The ring buffer size is too big." );
+
+  return storage_size;
+}
+
+// Maps the given file range twice into a reserved address range.
+
+uint8_t * byte_ring::map_twice ( const int fd, const off_t offset, const size_t storage_size )
+{
+  void * const reserved = mmap( NULL, 2 * storage_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+  if ( reserved == MAP_FAILED )
+  {
+    throw std::runtime_error( get_error_message( "Error reserving the ring buffer address range: ", errno ) );
+  }
+
+  uint8_t * const buffer = (uint8_t *) reserved;
+
+  for ( int i = 0; i < 2; ++i )
+  {
+    if ( MAP_FAILED == mmap( buffer + i * storage_size,
+                             storage_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_FIXED,
+                             fd,
+                             offset ) )
+    {
+      const int error_code = errno;
+      munmap( buffer, 2 * storage_size );
+      throw std::runtime_error( get_error_message( "Error mapping the ring buffer memory: ", error_code ) );
+    }
+  }
+
+  return buffer;
+}
+
+void byte_ring::allocate ( const unsigned size )
+{
+  assert( m_buffer == NULL );
+
+  const size_t storage_size = get_storage_size( size );
+
+  // The memfd provides the physical memory, which is then mapped twice into a reserved address range.
+  const int fd = memfd_create( "uart_dpi_ring", MFD_CLOEXEC );
+
+  if ( fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error creating the ring buffer memory: ", errno ) );
+  }
+
+  uint8_t * buffer;
+
+  try
+  {
+    if ( ftruncate( fd, off_t( storage_size ) ) == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error setting the ring buffer memory size: ", errno ) );
+    }
+
+    buffer = map_twice( fd, 0, storage_size );
+  }
+  catch ( ... )
+  {
+    close_a( fd );
+    throw;
+  }
+
+  // The mappings keep the memory alive.
+  close_a( fd );
+
+  m_buffer       = buffer;
+  m_size         = size;
+  m_storage_size = unsigned( storage_size );
+  m_mask         = unsigned( storage_size - 1 );
+}
+
+// Places the ring data at the given offset of a shared memory file, and the counters
+// at the given addresses, which normally lie in the same shared memory.
+// The other side of the ring is then in another process, see uart_dpi_shm.h .
+
+void byte_ring::map_shared ( const int fd,
+                             const off_t offset,
+                             const unsigned size,
+                             uint64_t * const write_count,
+                             uint64_t * const read_count )
+{
+  assert( m_buffer == NULL );
+
+  // The counters are accessed as std::atomic, which must then be a plain 64-bit integer in memory.
+  static_assert( sizeof( std::atomic< uint64_t > ) == sizeof( uint64_t ), "Unexpected std::atomic layout." );
+  static_assert( ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics are not lock free." );
+
+  const size_t storage_size = get_storage_size( size );
+
+  m_buffer       = map_twice( fd, offset, storage_size );
+  m_size         = size;
+  m_storage_size = unsigned( storage_size );
+  m_mask         = unsigned( storage_size - 1 );
+  m_write_count  = reinterpret_cast< std::atomic< uint64_t > * >( write_count );
+  m_read_count   = reinterpret_cast< std::atomic< uint64_t > * >( read_count  );
+}
+
+unsigned byte_ring::get_used_byte_count ( void ) const
+{
+  // Load the read counter first, so that the result is never negative
+  // if the consumer advances it in the meantime.
+  const uint64_t read_count  = m_read_count->load( std::memory_order_acquire );
+  const uint64_t write_count = m_write_count->load( std::memory_order_acquire );
+
+  const uint64_t used = write_count - read_count;
+
+  // The producer may have overwritten unread data, see overwrite_byte().
+  return used > m_size ? m_size : unsigned( used );
+}
+
+// If the buffer is full, the oldest byte gets overwritten. The consumer must then call
+// skip_overwritten_bytes() before reading, and it will lose the overwritten data.
+// If the consumer in another thread is reading the oldest bytes at the same time, see protect_used_segments_from(),
+// the new byte is dropped instead, so that the reader never sees a mixture of old and new data.
+// Returns whether the byte has been stored.
+
+bool byte_ring::overwrite_byte ( const uint8_t data )
+{
+  const uint64_t write_count = m_write_count->load( std::memory_order_relaxed );
+
+  // The slot is still free if the consumer has released the byte it holds.
+  if ( write_count + 1 > m_read_count->load( std::memory_order_acquire ) + m_storage_size &&
+       claim_overwritten_bytes( write_count, 1 ) == 0 )
+  {
+    return false;
+  }
+
+  m_buffer[ write_count & m_mask ] = data;
+
+  m_write_count->store( write_count + 1, std::memory_order_release );
+
+  return true;
+}
+
+// The bulk version of overwrite_byte(). If there are more bytes than the buffer capacity,
+// only the last ones are kept, as if they had been written one by one.
+// If some of the data being overwritten is protected, only the first bytes that fit in front of it are stored,
+// so that the data stays in order. Returns how many bytes have been stored.
+
+unsigned byte_ring::overwrite_bytes ( const uint8_t * const data, const unsigned byte_count )
+{
+  const uint64_t write_count = m_write_count->load( std::memory_order_relaxed );
+
+  unsigned stored_byte_count = byte_count;
+
+  if ( write_count + byte_count > m_read_count->load( std::memory_order_acquire ) + m_storage_size )
+    stored_byte_count = claim_overwritten_bytes( write_count, byte_count );
+
+  // Thanks to the double mapping, there is no need to split the copy at the end of the buffer.
+  if ( stored_byte_count < byte_count )
+  {
+    memcpy( &m_buffer[ write_count & m_mask ], data, stored_byte_count );
+  }
+  else
+  {
+    const unsigned skipped_byte_count = byte_count > m_size ? byte_count - m_size : 0;
+
+    // The slots of the skipped bytes keep their old contents, which must not be read either.
+    if ( skipped_byte_count != 0 )
+      m_overwritten_position.store( write_count + skipped_byte_count, std::memory_order_relaxed );
+
+    memcpy( &m_buffer[ ( write_count + skipped_byte_count ) & m_mask ],
+            data + skipped_byte_count,
+            byte_count - skipped_byte_count );
+  }
+
+  m_write_count->store( write_count + stored_byte_count, std::memory_order_release );
+
+  return stored_byte_count;
+}
+
+// Called by the producer before it overwrites data that the consumer has not released yet.
+// Returns how many of the given bytes can be stored from the write position onwards
+// without overwriting the data that the consumer is reading, see protect_used_segments_from().
+
+unsigned byte_ring::claim_overwritten_bytes ( const uint64_t write_count, const unsigned byte_count )
+{
+  // Storing the bytes overwrites the data before this position. The overwritten position never moves backwards,
+  // because the slots that overwrite_bytes() skipped earlier may still hold old data.
+  const uint64_t overwritten_position = write_count + byte_count - m_storage_size;
+  const uint64_t previous_overwritten_position = m_overwritten_position.load( std::memory_order_relaxed );
+
+  m_overwritten_position.store( std::max( previous_overwritten_position, overwritten_position ), std::memory_order_relaxed );
+
+  // Pairs with the fence in protect_used_segments_from(). Either the consumer sees the new overwritten position,
+  // or this thread sees the consumer's new protected position, or both.
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+
+  // Acquire, so that the consumer's reads of the data it has stopped protecting happen before overwriting it.
+  const uint64_t protected_position = m_protected_position.load( std::memory_order_acquire );
+
+  if ( overwritten_position <= protected_position )
+    return byte_count;
+
+  const uint64_t excess_byte_count = overwritten_position - protected_position;
+  const unsigned stored_byte_count = excess_byte_count >= byte_count ? 0 : byte_count - unsigned( excess_byte_count );
+
+  // Storing fewer bytes overwrites less, at most up to the protected position.
+  m_overwritten_position.store( std::max( previous_overwritten_position, write_count + stored_byte_count - m_storage_size ),
+                                std::memory_order_relaxed );
+
+  return stored_byte_count;
+}
+
+// Fills in the iovec entry that describes the free space and returns how many entries were used (0 or 1).
+// Thanks to the double mapping, the free space is contiguous even if it wraps around the end of the buffer.
+
+int byte_ring::get_free_segments ( iovec * const segments ) const
+{
+  const uint64_t read_count  = m_read_count->load( std::memory_order_acquire );
+  const uint64_t write_count = m_write_count->load( std::memory_order_relaxed );
+
+  assert( write_count - read_count <= m_size );
+  const unsigned free_byte_count = m_size - unsigned( write_count - read_count );
+
+  if ( free_byte_count == 0 )
+    return 0;
+
+  segments[0].iov_base = &m_buffer[ write_count & m_mask ];
+  segments[0].iov_len  = free_byte_count;
+  return 1;
+}
+
+void byte_ring::commit_written_bytes ( const unsigned byte_count )
+{
+  const uint64_t write_count = m_write_count->load( std::memory_order_relaxed );
+
+  assert( write_count + byte_count - m_read_count->load( std::memory_order_relaxed ) <= m_size );
+
+  m_write_count->store( write_count + byte_count, std::memory_order_release );
+}
+
+uint8_t byte_ring::read_byte ( void )
+{
+  assert( !is_empty() );
+
+  const uint64_t read_count = m_read_count->load( std::memory_order_relaxed );
+
+  const uint8_t b = m_buffer[ read_count & m_mask ];
+
+  m_read_count->store( read_count + 1, std::memory_order_release );
+
+  return b;
+}
+
+// Reads as many bytes as available, up to the given maximum, and returns how many were read.
+
+unsigned byte_ring::read_bytes ( uint8_t * const data, const unsigned max_byte_count )
+{
+  const uint64_t read_count = m_read_count->load( std::memory_order_relaxed );
+
+  const unsigned used_byte_count = get_used_byte_count();
+  const unsigned byte_count = used_byte_count < max_byte_count ? used_byte_count : max_byte_count;
+
+  memcpy( data, &m_buffer[ read_count & m_mask ], byte_count );
+
+  m_read_count->store( read_count + byte_count, std::memory_order_release );
+
+  return byte_count;
+}
+
+// Only needed if the producer uses overwrite_byte() or overwrite_bytes(). Returns how many unread bytes
+// the producer has overwritten in the meantime, which are then skipped.
+
+uint64_t byte_ring::skip_overwritten_bytes ( void )
+{
+  const uint64_t write_count = m_write_count->load( std::memory_order_acquire );
+
+  if ( write_count < m_size )
+    return 0;
+
+  return skip_bytes_up_to( write_count - m_size );
+}
+
+// Fills in the iovec entry that describes the data from the given reader position onwards,
+// and returns how many entries were used (0 or 1).
+// Thanks to the double mapping, the data is contiguous even if it wraps around the end of the buffer.
+
+int byte_ring::get_used_segments_from ( const uint64_t read_position, iovec * const segments ) const
+{
+  const uint64_t write_count = m_write_count->load( std::memory_order_acquire );
+
+  assert( read_position >= m_read_count->load( std::memory_order_relaxed ) );
+  assert( read_position <= write_count );
+
+  uint64_t used_byte_count = write_count - read_position;
+
+  if ( used_byte_count == 0 )
+    return 0;
+
+  // The producer may have overwritten unread data in the meantime, see overwrite_byte().
+  if ( used_byte_count > m_size )
+    used_byte_count = m_size;
+
+  segments[0].iov_base = &m_buffer[ read_position & m_mask ];
+  segments[0].iov_len  = size_t( used_byte_count );
+  return 1;
+}
+
+// Like get_used_segments_from() at the read position, but for a thread that is not the one releasing the data,
+// such as when saving a checkpoint. The read position only moves forwards, so it is loaded once, and whatever
+// gets released in the meantime is left out. The caller must make sure that the producer does not overwrite
+// unread data in the meantime.
+
+int byte_ring::get_unread_segments ( iovec * const segments ) const
+{
+  const uint64_t read_count  = m_read_count->load( std::memory_order_acquire );
+  const uint64_t write_count = m_write_count->load( std::memory_order_acquire );
+
+  // The producer may have overwritten unread data, see overwrite_byte().
+  const uint64_t used_byte_count = std::min( write_count - read_count, uint64_t( m_size ) );
+
+  if ( used_byte_count == 0 )
+    return 0;
+
+  segments[0].iov_base = &m_buffer[ ( write_count - used_byte_count ) & m_mask ];
+  segments[0].iov_len  = size_t( used_byte_count );
+  return 1;
+}
+
+// Makes the space up to the given position available to the producer again.
+// The caller must pass the position of the slowest reader. The protected data remains, see skip_bytes_up_to().
+
+void byte_ring::release_bytes_up_to ( const uint64_t read_position )
+{
+  skip_bytes_up_to( read_position );
+}
+
+// Like get_used_segments_from(), but for a reader in another thread, while the producer may be overwriting the data.
+// The data stays protected until the next call to set_protected_position(), and in the meantime,
+// the producer drops new bytes instead of overwriting it. If the producer has already overwritten some of the bytes
+// at the given position, the position moves past them, and the caller must treat them as lost.
+
+int byte_ring::protect_used_segments_from ( uint64_t * const read_position, iovec * const segments )
+{
+  const uint64_t protected_position = m_protected_position.load( std::memory_order_relaxed );
+
+  if ( *read_position < protected_position )
+  {
+    m_protected_position.store( *read_position, std::memory_order_release );
+
+    // Pairs with the fence in claim_overwritten_bytes().
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+  }
+
+  // overwrite_bytes() updates the overwritten position before the write counter,
+  // so loading it afterwards covers all the data up to the write counter.
+  const uint64_t write_count = m_write_count->load( std::memory_order_acquire );
+  const uint64_t overwritten_position = m_overwritten_position.load( std::memory_order_relaxed );
+
+  if ( overwritten_position > *read_position )
+  {
+    *read_position = overwritten_position;
+
+    // Nobody reads the overwritten data, so it does not need protecting.
+    m_protected_position.store( std::min( protected_position, overwritten_position ), std::memory_order_release );
+  }
+
+  if ( *read_position >= write_count )
+    return 0;
+
+  segments[0].iov_base = &m_buffer[ *read_position & m_mask ];
+  segments[0].iov_len  = size_t( std::min( write_count - *read_position, uint64_t( m_size ) ) );
+  return 1;
+}
+
+// Tells the producer which data the reader is still reading, after protect_used_segments_from().
+// The position may only move forwards, and NO_READ_PROTECTION lets the producer overwrite everything again.
+
+void byte_ring::set_protected_position ( const uint64_t read_position )
+{
+  assert( read_position >= m_protected_position.load( std::memory_order_relaxed ) );
+
+  m_protected_position.store( read_position, std::memory_order_release );
+}
+
+// Makes the space up to the given position available to the producer again, like release_bytes_up_to(),
+// but for bytes that the slowest reader has lost. Returns how many bytes were skipped.
+// The space stays taken from the protected position onwards, which the next call catches up with.
+
+uint64_t byte_ring::skip_bytes_up_to ( const uint64_t read_position )
+{
+  const uint64_t read_count = m_read_count->load( std::memory_order_relaxed );
+  const uint64_t new_read_count = std::min( read_position, m_protected_position.load( std::memory_order_relaxed ) );
+
+  if ( new_read_count <= read_count )
+    return 0;
+
+  m_read_count->store( new_read_count, std::memory_order_release );
+
+  return new_read_count - read_count;
+}
+
+
+capture_file::capture_file ( void )
+{
+  m_fd = -1;
+  m_compression = COMPRESSION_NONE;
+  m_is_flush_needed = false;
+
+  #ifdef UART_DPI_USE_ZSTD
+  m_zstd_context = NULL;
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  m_lz4_context = NULL;
+  #endif
+}
+
+capture_file::~capture_file ( void )
+{
+  #ifdef UART_DPI_USE_ZSTD
+  ZSTD_freeCCtx( m_zstd_context );
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  if ( m_lz4_context != NULL )
+    LZ4F_freeCompressionContext( m_lz4_context );
+  #endif
+
+  if ( m_fd != -1 )
+    close_a( m_fd );
+}
+
+
+static bool ends_with ( const std::string & str, const char * const suffix )
+{
+  const size_t suffix_len = strlen( suffix );
+
+  return str.size() >= suffix_len && 0 == str.compare( str.size() - suffix_len, suffix_len, suffix );
+}
+
+
+void capture_file::open ( const std::string & filename )
+{
+  assert( m_fd == -1 );
+
+  if ( ends_with( filename, ".zst" ) )
+  {
+    #ifdef UART_DPI_USE_ZSTD
+    m_compression = COMPRESSION_ZSTD;
+    #else
+    throw std::runtime_error( "The capture file name ends in \".zst\", but zstd support was not compiled in, see UART_DPI_USE_ZSTD." );
+    #endif
+  }
+  else if ( ends_with( filename, ".lz4" ) )
+  {
+    #ifdef UART_DPI_USE_LZ4
+    m_compression = COMPRESSION_LZ4;
+    #else
+    throw std::runtime_error( "The capture file name ends in \".lz4\", but LZ4 support was not compiled in, see UART_DPI_USE_LZ4." );
+    #endif
+  }
+
+  // Create the compression context first, so that a failure does not leave an empty file behind.
+  #ifdef UART_DPI_USE_ZSTD
+  if ( m_compression == COMPRESSION_ZSTD )
+  {
+    m_zstd_context = ZSTD_createCCtx();
+
+    if ( m_zstd_context == NULL )
+      throw std::runtime_error( "Error creating the zstd compression context." );
+  }
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  if ( m_compression == COMPRESSION_LZ4 )
+  {
+    if ( LZ4F_isError( LZ4F_createCompressionContext( &m_lz4_context, LZ4F_VERSION ) ) )
+    {
+      m_lz4_context = NULL;
+      throw std::runtime_error( "Error creating the LZ4 compression context." );
+    }
+  }
+  #endif
+
+  m_fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+
+  if ( m_fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error creating capture file \"" + filename + "\": " ).c_str(), errno ) );
+  }
+
+  #ifdef UART_DPI_USE_LZ4
+  if ( m_compression == COMPRESSION_LZ4 )
+  {
+    m_compressed_data.resize( LZ4F_HEADER_SIZE_MAX );
+
+    const size_t header_len = LZ4F_compressBegin( m_lz4_context, &m_compressed_data[0], m_compressed_data.size(), NULL );
+
+    if ( LZ4F_isError( header_len ) )
+      throw std::runtime_error( std::string( "Error compressing the capture data: " ) + LZ4F_getErrorName( header_len ) );
+
+    write_all( &m_compressed_data[0], header_len );
+  }
+  #endif
+}
+
+
+void capture_file::write_all ( const uint8_t * const data, const size_t byte_count )
+{
+  ::write_all( m_fd, data, byte_count, "Error writing to the capture file: " );
+}
+
+
+#ifdef UART_DPI_USE_ZSTD
+
+void capture_file::compress_zstd ( const uint8_t * const data, const size_t byte_count, const ZSTD_EndDirective end_directive )
+{
+  ZSTD_inBuffer input = { data, byte_count, 0 };
+
+  m_compressed_data.resize( ZSTD_CStreamOutSize() );
+
+  // With ZSTD_e_continue, all input is consumed. Otherwise, a return value of 0 means
+  // that the compressed data has been completely flushed.
+  for ( ; ; )
+  {
+    ZSTD_outBuffer output = { &m_compressed_data[0], m_compressed_data.size(), 0 };
+
+    const size_t remaining = ZSTD_compressStream2( m_zstd_context, &output, &input, end_directive );
+
+    if ( ZSTD_isError( remaining ) )
+      throw std::runtime_error( std::string( "Error compressing the capture data: " ) + ZSTD_getErrorName( remaining ) );
+
+    write_all( &m_compressed_data[0], output.pos );
+
+    if ( end_directive == ZSTD_e_continue ? input.pos == input.size : remaining == 0 )
+      break;
+  }
+}
+
+#endif
+
+
+// Compressed data may stay in the compressor until the next flush() call.
+
+void capture_file::write ( const uint8_t * const data, const size_t byte_count )
+{
+  assert( m_fd != -1 );
+
+  switch ( m_compression )
+  {
+  case COMPRESSION_NONE:
+    write_all( data, byte_count );
+    break;
+
+  #ifdef UART_DPI_USE_ZSTD
+  case COMPRESSION_ZSTD:
+    compress_zstd( data, byte_count, ZSTD_e_continue );
+    m_is_flush_needed = true;
+    break;
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  case COMPRESSION_LZ4:
+    {
+      m_compressed_data.resize( LZ4F_compressBound( byte_count, NULL ) );
+
+      const size_t compressed_len = LZ4F_compressUpdate( m_lz4_context, &m_compressed_data[0], m_compressed_data.size(), data, byte_count, NULL );
+
+      if ( LZ4F_isError( compressed_len ) )
+        throw std::runtime_error( std::string( "Error compressing the capture data: " ) + LZ4F_getErrorName( compressed_len ) );
+
+      write_all( &m_compressed_data[0], compressed_len );
+      m_is_flush_needed = true;
+    }
+    break;
+  #endif
+
+  default:
+    assert( false );
+  }
+}
+
+
+// Writes out whatever the compressor is holding back, so that the file can be inspected
+// while the simulation is running.
+
+void capture_file::flush ( void )
+{
+  assert( m_fd != -1 );
+
+  if ( !m_is_flush_needed )
+    return;
+
+  m_is_flush_needed = false;
+
+  #ifdef UART_DPI_USE_ZSTD
+  if ( m_compression == COMPRESSION_ZSTD )
+    compress_zstd( NULL, 0, ZSTD_e_flush );
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  if ( m_compression == COMPRESSION_LZ4 )
+  {
+    m_compressed_data.resize( LZ4F_compressBound( 0, NULL ) );
+
+    const size_t compressed_len = LZ4F_flush( m_lz4_context, &m_compressed_data[0], m_compressed_data.size(), NULL );
+
+    if ( LZ4F_isError( compressed_len ) )
+      throw std::runtime_error( std::string( "Error compressing the capture data: " ) + LZ4F_getErrorName( compressed_len ) );
+
+    write_all( &m_compressed_data[0], compressed_len );
+  }
+  #endif
+}
+
+
+// Completes the compressed frame and closes the file.
+
+void capture_file::finish ( void )
+{
+  assert( m_fd != -1 );
+
+  #ifdef UART_DPI_USE_ZSTD
+  if ( m_compression == COMPRESSION_ZSTD )
+    compress_zstd( NULL, 0, ZSTD_e_end );
+  #endif
+
+  #ifdef UART_DPI_USE_LZ4
+  if ( m_compression == COMPRESSION_LZ4 )
+  {
+    m_compressed_data.resize( LZ4F_compressBound( 0, NULL ) );
+
+    const size_t compressed_len = LZ4F_compressEnd( m_lz4_context, &m_compressed_data[0], m_compressed_data.size(), NULL );
+
+    if ( LZ4F_isError( compressed_len ) )
+      throw std::runtime_error( std::string( "Error compressing the capture data: " ) + LZ4F_getErrorName( compressed_len ) );
+
+    write_all( &m_compressed_data[0], compressed_len );
+  }
+  #endif
+
+  m_is_flush_needed = false;
+
+  const int fd = m_fd;
+  m_fd = -1;
+
+  if ( close( fd ) == -1 )
+    throw std::runtime_error( get_error_message( "Error closing the capture file: ", errno ) );
+}
+
+
+receive_record_file::receive_record_file ( void )
+{
+  m_fd = -1;
+  m_last_tick = 0;
+}
+
+receive_record_file::~receive_record_file ( void )
+{
+  if ( m_fd != -1 )
+    close_a( m_fd );
+}
+
+
+void receive_record_file::open ( const std::string & filename )
+{
+  assert( m_fd == -1 );
+
+  m_fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+
+  if ( m_fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error creating receive record file \"" + filename + "\": " ).c_str(), errno ) );
+  }
+
+  write_all( m_fd, (const uint8_t *) RECEIVE_RECORD_FILE_SIGNATURE, RECEIVE_RECORD_FILE_SIGNATURE_LEN, "Error writing to the receive record file: " );
+}
+
+
+static void append_leb128 ( std::vector< uint8_t > * const buffer, uint64_t value )
+{
+  while ( value >= 0x80 )
+  {
+    buffer->push_back( uint8_t( value | 0x80 ) );
+    value >>= 7;
+  }
+
+  buffer->push_back( uint8_t( value ) );
+}
+
+
+// Each entry is written straight away with a single system call, so that the file is complete
+// even if the simulation gets killed. The received data normally comes from a human typing,
+// so this does not happen often.
+
+void receive_record_file::record ( const uint64_t tick, const uint8_t * const data, const size_t byte_count )
+{
+  assert( m_fd != -1 );
+  assert( byte_count != 0 );
+  assert( tick >= m_last_tick );
+
+  m_entry.clear();
+  append_leb128( &m_entry, tick - m_last_tick );
+  append_leb128( &m_entry, byte_count );
+  m_entry.insert( m_entry.end(), data, data + byte_count );
+
+  write_all( m_fd, &m_entry[0], m_entry.size(), "Error writing to the receive record file: " );
+
+  m_last_tick = tick;
+}
+
+
+transmit_stamp_file::transmit_stamp_file ( void )
+{
+  m_fd = -1;
+  m_is_per_byte = false;
+  m_wakeup_position = NO_TRANSMIT_WAKEUP;
+  m_entry_tick = 0;
+  m_last_tick = 0;
+  m_lost_byte_count = 0;
+}
+
+transmit_stamp_file::~transmit_stamp_file ( void )
+{
+  if ( m_fd != -1 )
+    close_a( m_fd );
+}
+
+
+void transmit_stamp_file::open ( const std::string & filename, const bool is_per_byte )
+{
+  assert( m_fd == -1 );
+
+  m_ring.allocate( TRANSMIT_STAMP_BUFFER_SIZE );
+  m_entry.reserve( TRANSMIT_STAMP_MAX_ENTRY_SIZE );
+  m_is_per_byte = is_per_byte;
+
+  m_fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+
+  if ( m_fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error creating transmit stamp file \"" + filename + "\": " ).c_str(), errno ) );
+  }
+
+  write_all( m_fd, (const uint8_t *) UART_DPI_STAMP_FILE_SIGNATURE, UART_DPI_STAMP_FILE_SIGNATURE_LEN, "Error writing to the transmit stamp file: " );
+
+  m_wakeup_position = TRANSMIT_STAMP_BUFFER_SIZE / 2 - 1;
+}
+
+
+bool transmit_stamp_file::add ( const uint64_t tick, const uint8_t data )
+{
+  bool should_wake_up = false;
+
+  if ( !m_entry.empty() && ( m_is_per_byte ? tick != m_entry_tick : m_entry.size() >= TRANSMIT_STAMP_MAX_ENTRY_SIZE ) )
+    should_wake_up = close_entry();
+
+  if ( m_entry.empty() )
+    m_entry_tick = tick;
+
+  m_entry.push_back( data );
+
+  if ( !m_is_per_byte && data == '\n' )
+    should_wake_up |= close_entry();
+
+  return should_wake_up;
+}
+
+
+static unsigned encode_leb128 ( uint8_t * const buffer, uint64_t value )
+{
+  unsigned len = 0;
+
+  while ( value >= 0x80 )
+  {
+    buffer[ len++ ] = uint8_t( value | 0x80 );
+    value >>= 7;
+  }
+
+  buffer[ len++ ] = uint8_t( value );
+  return len;
+}
+
+
+// An entry that does not fit in the ring buffer is lost, because the simulation must not wait for the file.
+
+bool transmit_stamp_file::close_entry ( void )
+{
+  if ( m_entry.empty() )
+    return false;
+
+  // Two LEB128-encoded 64-bit numbers.
+  uint8_t header[ 20 ];
+  unsigned header_len = encode_leb128( header, m_entry_tick >= m_last_tick ? m_entry_tick - m_last_tick : 0 );
+  header_len += encode_leb128( header + header_len, m_entry.size() );
+
+  iovec segments[1];
+  const int segment_count = m_ring.get_free_segments( segments );
+
+  if ( segment_count == 0 || segments[0].iov_len < header_len + m_entry.size() )
+  {
+    m_lost_byte_count += m_entry.size();
+    m_entry.clear();
+    return false;
+  }
+
+  uint8_t * const dest = (uint8_t *) segments[0].iov_base;
+  memcpy( dest, header, header_len );
+  memcpy( dest + header_len, &m_entry[0], m_entry.size() );
+  m_ring.commit_written_bytes( unsigned( header_len + m_entry.size() ) );
+
+  m_last_tick = std::max( m_last_tick, m_entry_tick );
+  m_entry.clear();
+
+  if ( m_ring.get_write_position() <= m_wakeup_position.load( std::memory_order_relaxed ) )
+    return false;
+
+  m_wakeup_position.store( NO_TRANSMIT_WAKEUP, std::memory_order_relaxed );
+  return true;
+}
+
+
+// Like the capture file, the data is written in large chunks, and everything else gets written
+// when should_flush is set, see uart_dpi::service_periodic().
+
+void transmit_stamp_file::write ( const bool should_flush )
+{
+  if ( m_fd == -1 )
+    return;
+
+  const unsigned write_threshold = TRANSMIT_STAMP_BUFFER_SIZE / 2;
+
+  const uint64_t read_position = m_ring.get_read_position();
+
+  iovec segments[1];
+  const int segment_count = m_ring.get_used_segments_from( read_position, segments );
+
+  const size_t byte_count = segment_count == 0 ? 0 : segments[0].iov_len;
+
+  if ( byte_count != 0 && ( should_flush || byte_count >= write_threshold ) )
+  {
+    write_all( m_fd, (const uint8_t *) segments[0].iov_base, byte_count, "Error writing to the transmit stamp file: " );
+    m_ring.release_bytes_up_to( read_position + byte_count );
+  }
+
+  m_wakeup_position.store( m_ring.get_read_position() + write_threshold - 1, std::memory_order_relaxed );
+}
+
+
+void transmit_stamp_file::finish ( void )
+{
+  if ( m_fd == -1 )
+    return;
+
+  write( true );
+
+  const int fd = m_fd;
+  m_fd = -1;
+
+  if ( close( fd ) == -1 )
+    throw std::runtime_error( get_error_message( "Error closing the transmit stamp file: ", errno ) );
+}
+
+
+void pattern_matcher::build ( const std::vector< std::string > & patterns )
+{
+  m_transitions.clear();
+  m_matches.clear();
+  m_state = 0;
+
+  if ( patterns.empty() )
+    return;
+
+  // First the trie, where 0 means no transition yet, because no transition leads back to the start state.
+  m_transitions.assign( 256, 0 );
+  m_matches.assign( 1, -1 );
+
+  for ( size_t i = 0; i < patterns.size(); ++i )
+  {
+    const std::string & pattern = patterns[ i ];
+
+    if ( pattern.empty() )
+      throw std::runtime_error( "Empty finish patterns are not allowed." );
+
+    unsigned state = 0;
+
+    for ( size_t j = 0; j < pattern.size(); ++j )
+    {
+      const size_t index = state * 256 + uint8_t( pattern[ j ] );
+
+      if ( m_transitions[ index ] == 0 )
+      {
+        if ( m_matches.size() > UINT16_MAX )
+          throw std::runtime_error( "The finish patterns are too long." );
+
+        m_transitions[ index ] = uint16_t( m_matches.size() );
+        m_transitions.resize( m_transitions.size() + 256, 0 );
+        m_matches.push_back( -1 );
+      }
+
+      state = m_transitions[ index ];
+    }
+
+    // If the same pattern appears twice, the first one wins.
+    if ( m_matches[ state ] == -1 )
+      m_matches[ state ] = int( i );
+  }
+
+  // Then the failure links in breadth-first order, which turn the missing transitions into the ones
+  // the failure state would take. A state also matches what its failure state matches.
+  std::vector< unsigned > failure_states( m_matches.size(), 0 );
+  std::vector< unsigned > queue;
+
+  for ( unsigned c = 0; c < 256; ++c )
+  {
+    if ( m_transitions[ c ] != 0 )
+      queue.push_back( m_transitions[ c ] );
+  }
+
+  for ( size_t i = 0; i < queue.size(); ++i )
+  {
+    const unsigned state = queue[ i ];
+    const unsigned failure_state = failure_states[ state ];
+
+    if ( m_matches[ state ] == -1 )
+      m_matches[ state ] = m_matches[ failure_state ];
+
+    for ( unsigned c = 0; c < 256; ++c )
+    {
+      uint16_t & next_state = m_transitions[ state * 256 + c ];
+
+      if ( next_state == 0 )
+      {
+        next_state = m_transitions[ failure_state * 256 + c ];
+      }
+      else
+      {
+        failure_states[ next_state ] = m_transitions[ failure_state * 256 + c ];
+        queue.push_back( next_state );
+      }
+    }
+  }
+}
+
+
+int pattern_matcher::find ( const uint8_t * const data, const size_t byte_count, size_t * const match_end )
+{
+  const uint16_t * const transitions = &m_transitions[0];
+  unsigned state = m_state;
+
+  for ( size_t i = 0; i < byte_count; ++i )
+  {
+    state = transitions[ state * 256 + data[ i ] ];
+
+    if ( m_matches[ state ] != -1 )
+    {
+      m_state = state;
+
+      if ( match_end != NULL )
+        *match_end = i + 1;
+
+      return m_matches[ state ];
+    }
+  }
+
+  m_state = state;
+  return -1;
+}
+
+
+void pattern_matcher::set_state ( const unsigned state )
+{
+  if ( state >= std::max( m_matches.size(), size_t( 1 ) ) )
+    throw std::runtime_error( "The pattern matcher state is invalid." );
+
+  m_state = state;
+}
+
+
+console_script::console_script ( void )
+{
+  m_state.is_running        = false;
+  m_state.step_index        = 0;
+  m_state.expect_step_index = 0;
+  m_state.pattern_state     = 0;
+  m_state.step_start_tick   = 0;
+  m_state.send_offset       = 0;
+}
+
+
+static bool is_script_space ( const char c )
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+// Parses a double-quoted string with C-like escape sequences, starting at line[ *pos ].
+
+static std::string parse_script_string ( const std::string & line, size_t * const pos )
+{
+  if ( *pos >= line.size() || line[ *pos ] != '"' )
+    throw std::runtime_error( "Expected a double-quoted string." );
+
+  std::string text;
+
+  for ( size_t i = *pos + 1; i < line.size(); ++i )
+  {
+    const char c = line[ i ];
+
+    if ( c == '"' )
+    {
+      *pos = i + 1;
+      return text;
+    }
+
+    if ( c != '\\' )
+    {
+      text += c;
+      continue;
+    }
+
+    if ( ++i == line.size() )
+      break;
+
+    switch ( line[ i ] )
+    {
+    case 'n':  text += '\n';   break;
+    case 'r':  text += '\r';   break;
+    case 't':  text += '\t';   break;
+    case 'e':  text += '\x1B'; break;
+    case '0':  text += '\0';   break;
+    case '\\': text += '\\';   break;
+    case '"':  text += '"';    break;
+
+    case 'x':
+    {
+      unsigned value = 0;
+      unsigned digit_count = 0;
+
+      for ( ; digit_count < 2 && i + 1 < line.size() && isxdigit( (unsigned char) line[ i + 1 ] ); ++digit_count )
+      {
+        const char digit = line[ ++i ];
+        value = value * 16 + unsigned( isdigit( (unsigned char) digit ) ? digit - '0' : tolower( digit ) - 'a' + 10 );
+      }
+
+      if ( digit_count == 0 )
+        throw std::runtime_error( "Invalid \\x escape sequence." );
+
+      text += char( value );
+      break;
+    }
+
+    default:
+      throw std::runtime_error( std::string( "Invalid escape sequence \\" ) + line[ i ] + "." );
+    }
+  }
+
+  throw std::runtime_error( "The string has no closing double quote." );
+}
+
+
+static uint64_t parse_script_tick_count ( const std::string & line, size_t * const pos )
+{
+  size_t end = *pos;
+
+  while ( end < line.size() && isdigit( (unsigned char) line[ end ] ) )
+    ++end;
+
+  if ( end == *pos )
+    throw std::runtime_error( "Expected a number of clock ticks." );
+
+  errno = 0;
+  const unsigned long long value = strtoull( line.c_str() + *pos, NULL, 10 );
+
+  if ( errno != 0 )
+    throw std::runtime_error( "The number of clock ticks is too big." );
+
+  *pos = end;
+  return value;
+}
+
+
+void console_script::parse_line ( const std::string & line, const unsigned line_number, uint64_t * const timeout )
+{
+  size_t pos = 0;
+
+  while ( pos < line.size() && is_script_space( line[ pos ] ) )
+    ++pos;
+
+  if ( pos == line.size() || line[ pos ] == '#' )
+    return;
+
+  const size_t keyword_start = pos;
+
+  while ( pos < line.size() && isalpha( (unsigned char) line[ pos ] ) )
+    ++pos;
+
+  const std::string keyword = line.substr( keyword_start, pos - keyword_start );
+
+  while ( pos < line.size() && is_script_space( line[ pos ] ) )
+    ++pos;
+
+  step new_step;
+  new_step.tick_count  = 0;
+  new_step.line_number = line_number;
+
+  if ( keyword == "expect" )
+  {
+    new_step.type       = STEP_EXPECT;
+    new_step.text       = parse_script_string( line, &pos );
+    new_step.tick_count = *timeout;
+
+    if ( new_step.text.empty() )
+      throw std::runtime_error( "The text to expect cannot be empty." );
+  }
+  else if ( keyword == "send" )
+  {
+    new_step.type = STEP_SEND;
+    new_step.text = parse_script_string( line, &pos );
+  }
+  else if ( keyword == "wait" )
+  {
+    new_step.type       = STEP_WAIT;
+    new_step.tick_count = parse_script_tick_count( line, &pos );
+  }
+  else if ( keyword == "timeout" )
+  {
+    *timeout = parse_script_tick_count( line, &pos );
+  }
+  else
+  {
+    throw std::runtime_error( "Unknown command \"" + keyword + "\"." );
+  }
+
+  while ( pos < line.size() && is_script_space( line[ pos ] ) )
+    ++pos;
+
+  if ( pos != line.size() && line[ pos ] != '#' )
+    throw std::runtime_error( "Unexpected text after the command." );
+
+  if ( keyword != "timeout" )
+    m_steps.push_back( new_step );
+}
+
+
+void console_script::load ( const std::string & filename )
+{
+  assert( !m_state.is_running );
+
+  m_filename = filename;
+
+  FILE * const file = fopen( filename.c_str(), "r" );
+
+  if ( file == NULL )
+    throw std::runtime_error( get_error_message( ( "Error opening script file \"" + filename + "\": " ).c_str(), errno ) );
+
+  std::string line;
+  unsigned line_number = 0;
+  uint64_t timeout = 0;  // The default is to wait forever.
+
+  try
+  {
+    for ( ; ; )
+    {
+      const int c = getc( file );
+
+      if ( c != EOF && c != '\n' )
+      {
+        line += char( c );
+        continue;
+      }
+
+      if ( c == EOF && ferror( file ) )
+        throw std::runtime_error( get_error_message( ( "Error reading script file \"" + filename + "\": " ).c_str(), errno ) );
+
+      if ( c == EOF && line.empty() )
+        break;
+
+      ++line_number;
+
+      try
+      {
+        parse_line( line, line_number, &timeout );
+      }
+      catch ( const std::exception & e )
+      {
+        std::ostringstream str;
+        str << "Error in script file \"" << filename << "\", line " << line_number << ": " << e.what();
+        throw std::runtime_error( str.str() );
+      }
+
+      line.clear();
+
+      if ( c == EOF )
+        break;
+    }
+  }
+  catch ( ... )
+  {
+    fclose( file );
+    throw;
+  }
+
+  fclose( file );
+
+  m_state.is_running = true;
+  begin_step( 0, 0 );
+  prepare_expect_step( 0 );
+}
+
+
+// Starts searching for the text of the first expect step at or after the given one.
+
+void console_script::prepare_expect_step ( const unsigned first_step_index )
+{
+  unsigned i = first_step_index;
+
+  while ( i < m_steps.size() && m_steps[ i ].type != STEP_EXPECT )
+    ++i;
+
+  m_state.expect_step_index = i;
+
+  std::vector< std::string > patterns;
+
+  if ( i < m_steps.size() )
+    patterns.push_back( m_steps[ i ].text );
+
+  m_expect_matcher.build( patterns );
+}
+
+
+void console_script::begin_step ( const unsigned step_index, const uint64_t tick )
+{
+  m_state.step_index      = step_index;
+  m_state.step_start_tick = tick;
+  m_state.send_offset     = 0;
+}
+
+
+// Called after the given data has landed in the transmit buffer. Several expect steps may match
+// in the same block of data, each one starting after the end of the previous match.
+
+void console_script::on_transmit ( const uint8_t * data, size_t byte_count )
+{
+  while ( byte_count != 0 && is_expecting() )
+  {
+    size_t match_end;
+
+    if ( m_expect_matcher.find( data, byte_count, &match_end ) == -1 )
+      return;
+
+    data       += match_end;
+    byte_count -= match_end;
+
+    prepare_expect_step( m_state.expect_step_index + 1 );
+  }
+}
+
+
+// Executes the script as far as possible at the given tick. The steps before
+// m_state.expect_step_index have all been matched already.
+
+console_script::result_type console_script::run ( const uint64_t tick, byte_ring * const receive_ring )
+{
+  if ( !m_state.is_running )
+    return RESULT_RUNNING;
+
+  while ( m_state.step_index < m_steps.size() )
+  {
+    const step & current_step = m_steps[ m_state.step_index ];
+
+    switch ( current_step.type )
+    {
+    case STEP_EXPECT:
+      if ( m_state.step_index >= m_state.expect_step_index )
+      {
+        if ( current_step.tick_count == 0 || tick - m_state.step_start_tick < current_step.tick_count )
+          return RESULT_RUNNING;
+
+        std::ostringstream str;
+        str << "The script in file \"" << m_filename << "\" has timed out at line " << current_step.line_number
+            << ", after waiting " << current_step.tick_count << " clock ticks for the expected text.";
+        m_failure_message = str.str();
+        m_state.is_running = false;
+        return RESULT_FAILED;
+      }
+      break;
+
+    case STEP_SEND:
+    {
+      // Whatever does not fit in the receive buffer goes in on the next ticks.
+      iovec segments[1];
+      const size_t free_byte_count = receive_ring->get_free_segments( segments ) == 0 ? 0 : segments[0].iov_len;
+      const size_t byte_count = std::min( free_byte_count, current_step.text.size() - m_state.send_offset );
+
+      if ( byte_count != 0 )
+      {
+        memcpy( segments[0].iov_base, current_step.text.data() + m_state.send_offset, byte_count );
+        receive_ring->commit_written_bytes( unsigned( byte_count ) );
+        m_state.send_offset += unsigned( byte_count );
+      }
+
+      if ( m_state.send_offset < current_step.text.size() )
+        return RESULT_RUNNING;
+
+      break;
+    }
+
+    case STEP_WAIT:
+      if ( tick - m_state.step_start_tick < current_step.tick_count )
+        return RESULT_RUNNING;
+      break;
+
+    default:
+      assert( false );
+    }
+
+    begin_step( m_state.step_index + 1, tick );
+  }
+
+  m_state.is_running = false;
+  return RESULT_PASSED;
+}
+
+
+console_script_state console_script::get_state ( void ) const
+{
+  console_script_state state = m_state;
+  state.pattern_state = m_expect_matcher.get_state();
+  return state;
+}
+
+
+void console_script::set_state ( const console_script_state & state )
+{
+  if ( ( state.is_running && m_filename.empty() ) ||
+       state.step_index > m_steps.size() || state.expect_step_index > m_steps.size() ||
+       ( state.step_index < m_steps.size() && m_steps[ state.step_index ].type == STEP_SEND &&
+         state.send_offset > m_steps[ state.step_index ].text.size() ) )
+  {
+    throw std::runtime_error( "The script state in the checkpoint does not match the script file." );
+  }
+
+  prepare_expect_step( state.expect_step_index );
+
+  if ( m_state.expect_step_index != state.expect_step_index )
+    throw std::runtime_error( "The script state in the checkpoint does not match the script file." );
+
+  m_expect_matcher.set_state( state.pattern_state );
+  m_state = state;
+}
+
+
+receive_replay_file::receive_replay_file ( void )
+{
+  m_data = NULL;
+  m_size = 0;
+  m_pos  = 0;
+  m_next_tick = NO_REPLAY_TICK;
+  m_next_data = NULL;
+  m_next_byte_count = 0;
+}
+
+receive_replay_file::~receive_replay_file ( void )
+{
+  if ( m_data != NULL )
+    munmap( (void *) m_data, m_size );
+}
+
+
+void receive_replay_file::open ( const std::string & filename )
+{
+  assert( m_data == NULL );
+
+  const int fd = ::open( filename.c_str(), O_RDONLY | O_CLOEXEC );
+
+  if ( fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( ( "Error opening receive replay file \"" + filename + "\": " ).c_str(), errno ) );
+  }
+
+  struct stat file_info;
+
+  if ( fstat( fd, &file_info ) == -1 )
+  {
+    const int saved_errno = errno;
+    close_a( fd );
+    throw std::runtime_error( get_error_message( "Error reading the receive replay file size: ", saved_errno ) );
+  }
+
+  if ( size_t( file_info.st_size ) < RECEIVE_RECORD_FILE_SIGNATURE_LEN )
+  {
+    close_a( fd );
+    throw std::runtime_error( "File \"" + filename + "\" is not a receive record file." );
+  }
+
+  void * const data = mmap( NULL, size_t( file_info.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+  const int saved_errno = errno;
+
+  // The mapping stays valid after closing the file.
+  close_a( fd );
+
+  if ( data == MAP_FAILED )
+  {
+    throw std::runtime_error( get_error_message( "Error mapping the receive replay file: ", saved_errno ) );
+  }
+
+  m_data = (const uint8_t *) data;
+  m_size = size_t( file_info.st_size );
+
+  if ( 0 != memcmp( m_data, RECEIVE_RECORD_FILE_SIGNATURE, RECEIVE_RECORD_FILE_SIGNATURE_LEN ) )
+  {
+    throw std::runtime_error( "File \"" + filename + "\" is not a receive record file." );
+  }
+
+  m_pos = RECEIVE_RECORD_FILE_SIGNATURE_LEN;
+  m_next_tick = 0;
+
+  advance();
+}
+
+
+uint64_t receive_replay_file::read_number ( void )
+{
+  uint64_t value = 0;
+
+  for ( unsigned shift = 0; ; shift += 7 )
+  {
+    if ( m_pos == m_size || shift >= 64 )
+      throw std::runtime_error( "The receive replay file is truncated or corrupt." );
+
+    const uint8_t b = m_data[ m_pos++ ];
+
+    value |= uint64_t( b & 0x7F ) << shift;
+
+    if ( ( b & 0x80 ) == 0 )
+      return value;
+  }
+}
+
+
+// Decodes the next entry. The tick numbers in the file are relative to the previous entry.
+
+void receive_replay_file::advance ( void )
+{
+  assert( m_next_tick != NO_REPLAY_TICK );
+
+  if ( m_pos == m_size )
+  {
+    m_next_tick = NO_REPLAY_TICK;
+    m_next_data = NULL;
+    m_next_byte_count = 0;
+    return;
+  }
+
+  const uint64_t tick_delta = read_number();
+  const uint64_t byte_count = read_number();
+
+  // The first entry may be at tick 0, but the following ones must be at least 1 tick later.
+  if ( byte_count == 0 ||
+       byte_count > m_size - m_pos ||
+       ( tick_delta == 0 && m_next_data != NULL ) ||
+       tick_delta >= NO_REPLAY_TICK - m_next_tick )
+  {
+    throw std::runtime_error( "The receive replay file is truncated or corrupt." );
+  }
+
+  m_next_tick += tick_delta;
+  m_next_data = m_data + m_pos;
+  m_next_byte_count = size_t( byte_count );
+
+  m_pos += size_t( byte_count );
+}
+
+
+stats_page::stats_page ( void )
+{
+  m_stats = NULL;
+}
+
+stats_page::~stats_page ( void )
+{
+  if ( m_stats != NULL )
+  {
+    // The statistics file stays behind, so that it can still be inspected after the simulation.
+    __atomic_store_n( &m_stats->is_closed, 1, __ATOMIC_RELEASE );
+    munmap( m_stats, sizeof( uart_dpi_stats ) );
+  }
+}
+
+
+// A NULL or empty file name means that the counters are only available through uart_dpi_get_stats().
+
+void stats_page::create ( const char * const file_name )
+{
+  assert( m_stats == NULL );
+
+  void * page;
+
+  if ( file_name == NULL || file_name[0] == '\0' )
+  {
+    page = mmap( NULL, sizeof( uart_dpi_stats ), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if ( page == MAP_FAILED )
+    {
+      throw std::runtime_error( get_error_message( "Error allocating the statistics page: ", errno ) );
+    }
+  }
+  else
+  {
+    const int fd = ::open( file_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+
+    if ( fd == -1 )
+    {
+      throw std::runtime_error( get_error_message( ( std::string( "Error creating statistics file \"" ) + file_name + "\": " ).c_str(), errno ) );
+    }
+
+    if ( ftruncate( fd, off_t( sizeof( uart_dpi_stats ) ) ) == -1 )
+    {
+      const int saved_errno = errno;
+      close_a( fd );
+      throw std::runtime_error( get_error_message( "Error setting the statistics file size: ", saved_errno ) );
+    }
+
+    page = mmap( NULL, sizeof( uart_dpi_stats ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    const int saved_errno = errno;
+
+    // The mapping stays valid after closing the file.
+    close_a( fd );
+
+    if ( page == MAP_FAILED )
+    {
+      throw std::runtime_error( get_error_message( "Error mapping the statistics file: ", saved_errno ) );
+    }
+  }
+
+  // The new page is filled with zeros, so all counters start at 0.
+  m_stats = (uart_dpi_stats *) page;
+  m_stats->version = UART_DPI_STATS_VERSION;
+  m_stats->pid     = uint32_t( getpid() );
+
+  // A monitoring tool that opens the file too early must not see a half-initialised header.
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  memcpy( m_stats->signature, UART_DPI_STATS_SIGNATURE, sizeof( m_stats->signature ) );
+}
+
+
+void stats_page::set_endpoint ( const std::string & endpoint )
+{
+  const size_t len = std::min( endpoint.size(), sizeof( m_stats->endpoint ) - 1 );
+
+  memcpy( m_stats->endpoint, endpoint.c_str(), len );
+  m_stats->endpoint[ len ] = '\0';
+}
+
+
+#ifdef UART_DPI_USE_IO_URING
+
+// These values cannot clash with the address of an io_uring_operation.
+static const uint64_t IO_URING_WAKEUP_USER_DATA = 1;
+static const uint64_t IO_URING_CANCEL_USER_DATA = 2;
+static const uint64_t IO_URING_TIMEOUT_USER_DATA = 3;
+
+// The submission queue only needs room for a few operations per instance, and it gets flushed when full.
+static const unsigned IO_URING_ENTRY_COUNT = 256;
+
+
+io_uring_queue::io_uring_queue ( void )
+{
+  m_ring_fd = -1;
+  m_sq_ring = NULL;
+  m_sq_ring_size = 0;
+  m_cq_ring = NULL;
+  m_cq_ring_size = 0;
+  m_sqes = NULL;
+  m_sqes_size = 0;
+}
+
+io_uring_queue::~io_uring_queue ( void )
+{
+  tear_down();
+}
+
+void io_uring_queue::tear_down ( void )
+{
+  if ( m_sqes != NULL )
+    munmap( m_sqes, m_sqes_size );
+
+  if ( m_cq_ring != NULL && m_cq_ring != m_sq_ring )
+    munmap( m_cq_ring, m_cq_ring_size );
+
+  if ( m_sq_ring != NULL )
+    munmap( m_sq_ring, m_sq_ring_size );
+
+  if ( m_ring_fd != -1 )
+    close_a( m_ring_fd );
+
+  m_ring_fd = -1;
+  m_sq_ring = NULL;
+  m_cq_ring = NULL;
+  m_sqes = NULL;
+}
+
+static void * mmap_io_uring ( const int ring_fd, const size_t size, const off_t offset )
+{
+  void * const ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset );
+
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Returns false if io_uring is not available, for example, because the kernel is too old,
+// or because it has been disabled with sysctl kernel.io_uring_disabled or with seccomp.
+
+bool io_uring_queue::set_up ( const unsigned entry_count )
+{
+  assert( m_ring_fd == -1 );
+
+  io_uring_params params;
+  memset( &params, 0, sizeof(params) );
+
+  // The completion queue is larger, because a multishot accept can produce several completions.
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entry_count * 4;
+
+  const int ring_fd = int( syscall( __NR_io_uring_setup, entry_count, &params ) );
+
+  if ( ring_fd == -1 )
+    return false;
+
+  m_ring_fd = ring_fd;
+
+  // IORING_FEAT_RW_CUR_POS means Linux 5.6 or later, which also provides all operations used here.
+  // Without IORING_FEAT_NODROP, completions could get lost if the completion queue overflows.
+  const unsigned REQUIRED_FEATURES = IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+
+  if ( ( params.features & REQUIRED_FEATURES ) != REQUIRED_FEATURES )
+  {
+    tear_down();
+    return false;
+  }
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+
+  const bool is_single_mmap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+
+  if ( is_single_mmap )
+  {
+    if ( m_cq_ring_size > m_sq_ring_size )
+      m_sq_ring_size = m_cq_ring_size;
+
+    m_cq_ring_size = m_sq_ring_size;
+  }
+
+  m_sq_ring = mmap_io_uring( ring_fd, m_sq_ring_size, IORING_OFF_SQ_RING );
+
+  if ( m_sq_ring != NULL )
+    m_cq_ring = is_single_mmap ? m_sq_ring : mmap_io_uring( ring_fd, m_cq_ring_size, IORING_OFF_CQ_RING );
+
+  if ( m_cq_ring != NULL )
+  {
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *) mmap_io_uring( ring_fd, m_sqes_size, IORING_OFF_SQES );
+  }
+
+  if ( m_sqes == NULL )
+  {
+    tear_down();
+    return false;
+  }
+
+  uint8_t * const sq = (uint8_t *) m_sq_ring;
+  m_sq_head        = (unsigned *)( sq + params.sq_off.head );
+  m_sq_tail        = (unsigned *)( sq + params.sq_off.tail );
+  m_sq_ring_mask   = *(unsigned *)( sq + params.sq_off.ring_mask );
+  m_sq_entry_count = params.sq_entries;
+  m_sq_array       = (unsigned *)( sq + params.sq_off.array );
+  m_sqe_tail       = *m_sq_tail;
+
+  uint8_t * const cq = (uint8_t *) m_cq_ring;
+  m_cq_head      = (unsigned *)( cq + params.cq_off.head );
+  m_cq_tail      = (unsigned *)( cq + params.cq_off.tail );
+  m_cq_ring_mask = *(unsigned *)( cq + params.cq_off.ring_mask );
+  m_cqes         = (io_uring_cqe *)( cq + params.cq_off.cqes );
+
+  return true;
+}
+
+// Returns a cleared submission queue entry. It gets submitted on the next call to submit_and_wait().
+
+io_uring_sqe * io_uring_queue::get_sqe ( void )
+{
+  if ( m_sqe_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE ) >= m_sq_entry_count )
+  {
+    enter( 0 );
+
+    if ( m_sqe_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE ) >= m_sq_entry_count )
+      throw std::runtime_error( "The io_uring submission queue is full." );
+  }
+
+  const unsigned index = m_sqe_tail & m_sq_ring_mask;
+
+  io_uring_sqe * const sqe = &m_sqes[ index ];
+  memset( sqe, 0, sizeof(*sqe) );
+
+  m_sq_array[ index ] = index;
+  ++m_sqe_tail;
+
+  return sqe;
+}
+
+// Submits all new entries and waits until there are at least the given number of completions.
+
+void io_uring_queue::enter ( const unsigned wait_count )
+{
+  __atomic_store_n( m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE );
+
+  for ( ; ; )
+  {
+    const unsigned submit_count = m_sqe_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+
+    if ( submit_count == 0 && wait_count == 0 )
+      return;
+
+    const long res = syscall( __NR_io_uring_enter,
+                              m_ring_fd,
+                              submit_count,
+                              wait_count,
+                              wait_count == 0 ? 0 : IORING_ENTER_GETEVENTS,
+                              NULL,
+                              0 );
+    if ( res == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      // The completion queue has overflowed. The caller should reap some completions and try again.
+      if ( errno == EBUSY || errno == EAGAIN )
+        return;
+
+      throw std::runtime_error( get_error_message( "Error submitting io_uring operations: ", errno ) );
+    }
+
+    return;
+  }
+}
+
+bool io_uring_queue::pop_cqe ( io_uring_cqe * const cqe )
+{
+  const unsigned head = *m_cq_head;  // Only this thread writes the head.
+
+  if ( head == __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) )
+    return false;
+
+  const io_uring_cqe * const src = &m_cqes[ head & m_cq_ring_mask ];
+  cqe->user_data = src->user_data;
+  cqe->res       = src->res;
+  cqe->flags     = src->flags;
+
+  __atomic_store_n( m_cq_head, head + 1, __ATOMIC_RELEASE );
+
+  return true;
+}
+
+#endif  // #ifdef UART_DPI_USE_IO_URING
+
+
+std::mutex                uart_dpi::s_tick_all_mutex;
+bool                      uart_dpi::s_tick_all_reserved [ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+std::atomic< uart_dpi * > uart_dpi::s_tick_all_instances[ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+std::atomic< unsigned >   uart_dpi::s_tick_all_generation( 0 );
+unsigned                  uart_dpi::s_tick_all_seen_generation = 0;
+const int *               uart_dpi::s_tick_all_seen_counts = NULL;
+int                       uart_dpi::s_tick_all_seen_count = 0;
+int                       uart_dpi::s_tick_all_active_indexes[ UART_DPI_TICK_ALL_MAX_INSTANCES ];
+int                       uart_dpi::s_tick_all_active_count = 0;
+
+std::mutex                uart_dpi::s_handle_mutex;
+std::atomic< uart_dpi * > uart_dpi::s_handles[ UART_DPI_MAX_INSTANCES ];
+
+std::mutex   io_reactor::s_mutex;
+io_reactor * io_reactor::s_reactor = NULL;
+unsigned     io_reactor::s_instance_count = 0;
+
+std::mutex                  mux_server::s_mutex;
+std::vector< mux_server * > mux_server::s_servers;
+
+
+#ifdef UART_DPI_USE_IO_URING
+
+// The UART_DPI_IO_BACKEND environment variable can force the epoll backend,
+// which is handy when comparing both backends.
+
+static bool should_use_io_uring ( void )
+{
+  const char * const backend = getenv( "UART_DPI_IO_BACKEND" );
+
+  if ( backend == NULL || backend[0] == '\0' || 0 == strcmp( backend, "io_uring" ) )
+    return true;
+
+  if ( 0 == strcmp( backend, "epoll" ) )
+    return false;
+
+  throw std::runtime_error( "Invalid value in environment variable UART_DPI_IO_BACKEND, it should be either \"io_uring\" or \"epoll\"." );
+}
+
+#endif
+
+
+// Returns a timestamp in milliseconds that is only good for measuring time intervals.
+
+static uint64_t get_monotonic_time_ms ( void )
+{
+  timespec ts;
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &ts ) != 0 )
+  {
+    assert( false );
+    return 0;
+  }
+
+  return uint64_t( ts.tv_sec ) * 1000 + uint64_t( ts.tv_nsec ) / 1000000;
+}
+
+
+// The same in nanoseconds, for the performance counters.
+
+static uint64_t get_monotonic_time_ns ( void )
+{
+  timespec ts;
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &ts ) != 0 )
+  {
+    assert( false );
+    return 0;
+  }
+
+  return uint64_t( ts.tv_sec ) * 1000000000 + uint64_t( ts.tv_nsec );
+}
+
+
+// Returns how long it takes to read the clock twice in a row, which is the minimum time any measurement can show.
+
+static uint64_t get_clock_overhead_ns ( void )
+{
+  uint64_t overhead = UINT64_MAX;
+
+  for ( int i = 0; i < 16; ++i )
+  {
+    const uint64_t start_time = get_monotonic_time_ns();
+    overhead = std::min( overhead, get_monotonic_time_ns() - start_time );
+  }
+
+  return overhead;
+}
+
+
+// An I/O thread should not handle any asynchronous signals like SIGINT, leave them to the simulation thread.
+// Synchronous signals like SIGSEGV cannot be blocked in a meaningful way.
+
+template < class owner_type >
+static std::thread start_io_thread ( void ( owner_type::* const thread_main ) ( void ), owner_type * const owner )
+{
+  sigset_t all_signals;
+  sigset_t previous_signals;
+  sigfillset( &all_signals );
+  sigdelset( &all_signals, SIGSEGV );
+  sigdelset( &all_signals, SIGBUS );
+  sigdelset( &all_signals, SIGFPE );
+  sigdelset( &all_signals, SIGILL );
+  sigdelset( &all_signals, SIGTRAP );
+  sigdelset( &all_signals, SIGABRT );
+  pthread_sigmask( SIG_SETMASK, &all_signals, &previous_signals );
+
+  std::thread thread;
+
+  try
+  {
+    thread = std::thread( thread_main, owner );
+  }
+  catch ( ... )
+  {
+    pthread_sigmask( SIG_SETMASK, &previous_signals, NULL );
+    throw;
+  }
+
+  pthread_sigmask( SIG_SETMASK, &previous_signals, NULL );
+
+  return thread;
+}
+
+
+io_reactor::io_reactor ( void )
+{
+  m_posted_request_count    = 0;
+  m_completed_request_count = 0;
+  m_periodic_instance_count = 0;
+  m_next_periodic_service_time = 0;
+  m_next_flush_time = NO_FLUSH_DEADLINE;
+
+  m_epoll_fd = -1;
+
+  #ifdef UART_DPI_USE_IO_URING
+  m_wakeup_counter = 0;
+  m_wake_up_received = false;
+  m_is_multishot_accept_supported = true;
+  m_periodic_timeout_time = UINT64_MAX;
+  #endif
+
+  m_wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+  if ( m_wakeup_fd == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error creating the wake-up eventfd: ", errno ) );
+  }
+
+  try
+  {
+    #ifdef UART_DPI_USE_IO_URING
+    // If io_uring is not available, fall back to epoll.
+    if ( !should_use_io_uring() || !m_io_uring.set_up( IO_URING_ENTRY_COUNT ) )
+    #endif
+    {
+      m_epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+
+      if ( m_epoll_fd == -1 )
+      {
+        throw std::runtime_error( get_error_message( "Error creating the epoll instance: ", errno ) );
+      }
+
+      register_fd( m_wakeup_fd, EPOLLIN, NULL );
+    }
+
+    m_thread = start_io_thread( &io_reactor::thread_main, this );
+  }
+  catch ( ... )
+  {
+    if ( m_epoll_fd != -1 )
+      close_a( m_epoll_fd );
+
+    close_a( m_wakeup_fd );
+    throw;
+  }
+}
+
+
+io_reactor::~io_reactor ( void )
+{
+  post_request( REQUEST_STOP, NULL );
+
+  m_thread.join();
+
+  close_a( m_wakeup_fd );
+
+  if ( m_epoll_fd != -1 )
+    close_a( m_epoll_fd );
+}
+
+
+io_reactor * io_reactor::acquire ( void )
+{
+  std::lock_guard< std::mutex > lock( s_mutex );
+
+  if ( s_reactor == NULL )
+  {
+    s_reactor = new io_reactor();
+  }
+
+  ++s_instance_count;
+
+  return s_reactor;
+}
+
+
+void io_reactor::release ( void )
+{
+  std::lock_guard< std::mutex > lock( s_mutex );
+
+  assert( s_reactor != NULL );
+  assert( s_instance_count > 0 );
+
+  if ( --s_instance_count == 0 )
+  {
+    // Stop the I/O thread when the last instance goes away. If the simulation never calls uart_dpi_destroy(),
+    // the thread just keeps running until the process terminates.
+    delete s_reactor;
+    s_reactor = NULL;
+  }
+}
+
+
+void io_reactor::add_instance ( uart_dpi * const instance )
+{
+  post_request( REQUEST_ADD_INSTANCE, instance );
+}
+
+
+// After this call, the I/O thread does not touch the instance any more.
+
+void io_reactor::remove_instance ( uart_dpi * const instance )
+{
+  post_request( REQUEST_REMOVE_INSTANCE, instance );
+}
+
+
+static void increment_eventfd ( const int fd )
+{
+  const uint64_t one = 1;
+
+  for ( ; ; )
+  {
+    const ssize_t res = write( fd, &one, sizeof(one) );
+
+    if ( res == -1 && errno == EINTR )
+      continue;
+
+    // If the eventfd counter is about to overflow, write() fails with EAGAIN,
+    // but then the I/O thread has not consumed the previous wake-ups yet anyway.
+    assert( res == sizeof(one) || errno == EAGAIN );
+
+    break;
+  }
+}
+
+
+void io_reactor::wake_up ( void )
+{
+  increment_eventfd( m_wakeup_fd );
+}
+
+
+void io_reactor::register_fd ( const int fd, const uint32_t events, uart_dpi * const instance )
+{
+  epoll_event ev;
+  memset( &ev, 0, sizeof(ev) );
+  ev.events   = events;
+  ev.data.ptr = instance;
+
+  if ( epoll_ctl( m_epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error adding a socket to the epoll set: ", errno ) );
+  }
+}
+
+
+void io_reactor::modify_fd ( const int fd, const uint32_t events, uart_dpi * const instance )
+{
+  epoll_event ev;
+  memset( &ev, 0, sizeof(ev) );
+  ev.events   = events;
+  ev.data.ptr = instance;
+
+  if ( epoll_ctl( m_epoll_fd, EPOLL_CTL_MOD, fd, &ev ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error modifying a socket in the epoll set: ", errno ) );
+  }
+}
+
+
+void io_reactor::unregister_fd ( const int fd )
+{
+  if ( epoll_ctl( m_epoll_fd, EPOLL_CTL_DEL, fd, NULL ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error removing a socket from the epoll set: ", errno ) );
+  }
+}
+
+
+// Posts a request for the I/O thread and waits until it has been processed.
+
+void io_reactor::post_request ( const request_type type, uart_dpi * const instance )
+{
+  std::unique_lock< std::mutex > lock( m_request_mutex );
+
+  request r;
+  r.type     = type;
+  r.instance = instance;
+  m_pending_requests.push_back( r );
+
+  const uint64_t request_number = ++m_posted_request_count;
+
+  wake_up();
+
+  while ( m_completed_request_count < request_number )
+  {
+    m_request_completed.wait( lock );
+  }
+}
+
+
+// Returns false if the I/O thread should stop.
+
+bool io_reactor::process_requests ( void )
+{
+  std::vector< request > requests;
+  uint64_t request_count;
+
+  {
+    std::lock_guard< std::mutex > lock( m_request_mutex );
+
+    if ( m_pending_requests.empty() )
+      return true;
+
+    requests.swap( m_pending_requests );
+    request_count = m_posted_request_count;
+  }
+
+  bool keep_running = true;
+
+  for ( size_t i = 0; i < requests.size(); ++i )
+  {
+    uart_dpi * const instance = requests[i].instance;
+
+    switch ( requests[i].type )
+    {
+    case REQUEST_ADD_INSTANCE:
+      m_instances.push_back( instance );
+
+      if ( instance->needs_periodic_service() && m_periodic_instance_count++ == 0 )
+        m_next_periodic_service_time = get_monotonic_time_ms() + PERIODIC_SERVICE_INTERVAL_MS;
+
+      instance->service_io();
+      break;
+
+    case REQUEST_REMOVE_INSTANCE:
+      for ( size_t j = 0; j < m_instances.size(); ++j )
+      {
+        if ( m_instances[j] == instance )
+        {
+          m_instances.erase( m_instances.begin() + j );
+          break;
+        }
+      }
+
+      if ( instance->needs_periodic_service() )
+        --m_periodic_instance_count;
+
+      instance->unregister_io();
+      break;
+
+    case REQUEST_STOP:
+      assert( m_instances.empty() );
+      keep_running = false;
+      break;
+
+    default:
+      assert( false );
+    }
+  }
+
+  {
+    std::lock_guard< std::mutex > lock( m_request_mutex );
+    m_completed_request_count = request_count;
+  }
+
+  m_request_completed.notify_all();
+
+  return keep_running;
+}
+
+
+void io_reactor::service_requested_instances ( void )
+{
+  for ( size_t i = 0; i < m_instances.size(); ++i )
+  {
+    if ( m_instances[i]->take_io_service_request() )
+    {
+      m_instances[i]->service_io();
+    }
+  }
+}
+
+
+// Returns how many milliseconds the I/O thread may wait for events before the next periodic service
+// or flush deadline, or -1 if it may wait forever.
+
+int io_reactor::get_periodic_wait_time ( void ) const
+{
+  uint64_t next_time = m_next_flush_time;
+
+  if ( m_periodic_instance_count != 0 )
+    next_time = std::min( next_time, m_next_periodic_service_time );
+
+  if ( next_time == NO_FLUSH_DEADLINE )
+    return -1;
+
+  const uint64_t now = get_monotonic_time_ms();
+
+  if ( now >= next_time )
+    return 0;
+
+  return int( std::min( next_time - now, uint64_t( INT_MAX ) ) );
+}
+
+
+void io_reactor::service_periodic_instances ( void )
+{
+  if ( get_periodic_wait_time() != 0 )
+    return;
+
+  const uint64_t now = get_monotonic_time_ms();
+
+  // Servicing an instance whose deadline has expired sends its held back data, see uart_dpi::update_transmit_limit().
+  // The other instances schedule their deadlines again.
+  if ( now >= m_next_flush_time )
+  {
+    m_next_flush_time = NO_FLUSH_DEADLINE;
+
+    for ( size_t i = 0; i < m_instances.size(); ++i )
+    {
+      const uint64_t deadline = m_instances[i]->get_flush_deadline();
+
+      if ( deadline <= now )
+        m_instances[i]->service_io();
+      else
+        schedule_flush( deadline );
+    }
+  }
+
+  if ( m_periodic_instance_count == 0 || now < m_next_periodic_service_time )
+    return;
+
+  m_next_periodic_service_time = now + PERIODIC_SERVICE_INTERVAL_MS;
+
+  for ( size_t i = 0; i < m_instances.size(); ++i )
+  {
+    if ( m_instances[i]->needs_periodic_service() )
+    {
+      m_instances[i]->service_periodic();
+    }
+  }
+}
+
+
+void io_reactor::thread_main ( void )
+{
+  #ifdef UART_DPI_USE_IO_URING
+  if ( is_using_io_uring() )
+  {
+    thread_main_io_uring();
+    return;
+  }
+  #endif
+
+  thread_main_epoll();
+}
+
+
+void io_reactor::thread_main_epoll ( void )
+{
+  const int MAX_EVENT_COUNT = 64;
+  epoll_event events[ MAX_EVENT_COUNT ];
+
+  for ( ; ; )
+  {
+    const int event_count = epoll_wait( m_epoll_fd, events, MAX_EVENT_COUNT, get_periodic_wait_time() );
+
+    if ( event_count == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      // This should never happen. There is no simulation thread to report the error to,
+      // and carrying on would probably make this thread spin.
+      fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, get_error_message( "Error waiting for socket events: ", errno ).c_str() );
+      fflush( stderr );
+      abort();
+    }
+
+    bool wake_up_received = false;
+
+    for ( int i = 0; i < event_count; ++i )
+    {
+      uart_dpi * const instance = (uart_dpi *) events[i].data.ptr;
+
+      if ( instance == NULL )
+      {
+        uint64_t counter;
+        const ssize_t res = read( m_wakeup_fd, &counter, sizeof(counter) );
+        assert( res == sizeof(counter) || ( res == -1 && ( errno == EAGAIN || errno == EINTR ) ) );
+        (void) res;
+
+        wake_up_received = true;
+      }
+      else
+      {
+        instance->service_io();
+      }
+    }
+
+    if ( wake_up_received )
+    {
+      service_requested_instances();
+
+      if ( !process_requests() )
+        return;
+    }
+
+    service_periodic_instances();
+  }
+}
+
+
+#ifdef UART_DPI_USE_IO_URING
+
+void io_reactor::thread_main_io_uring ( void )
+{
+  try
+  {
+    queue_wakeup_read();
+
+    for ( ; ; )
+    {
+      // A flush deadline may come before the timeout that is already pending.
+      const int wait_time = get_periodic_wait_time();
+
+      if ( wait_time != -1 && get_monotonic_time_ms() + uint64_t( wait_time ) < m_periodic_timeout_time )
+      {
+        queue_periodic_timeout( wait_time );
+      }
+
+      // Removing an instance reaps completions too, so a wake-up may already be waiting.
+      m_io_uring.submit_and_wait( m_wake_up_received ? 0 : 1 );
+
+      reap_io_uring_completions();
+
+      if ( m_wake_up_received )
+      {
+        m_wake_up_received = false;
+
+        service_requested_instances();
+
+        if ( !process_requests() )
+          return;
+      }
+
+      service_periodic_instances();
+    }
+  }
+  catch ( const std::exception & e )
+  {
+    // This should never happen. There is no simulation thread to report the error to.
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    abort();
+  }
+}
+
+
+void io_reactor::reap_io_uring_completions ( void )
+{
+  io_uring_cqe cqe;
+
+  while ( m_io_uring.pop_cqe( &cqe ) )
+  {
+    if ( cqe.user_data == IO_URING_WAKEUP_USER_DATA )
+    {
+      // The read fails with EAGAIN if the counter has already been drained, which does not matter.
+      m_wake_up_received = true;
+      queue_wakeup_read();
+    }
+    else if ( cqe.user_data == IO_URING_CANCEL_USER_DATA )
+    {
+      // Nothing to do, the cancelled operation completes on its own.
+    }
+    else if ( cqe.user_data == IO_URING_TIMEOUT_USER_DATA )
+    {
+      // The timeout completes with -ETIME. The next periodic service is checked in the main loop.
+      // If an earlier timeout has overtaken a later one, the later one completes for nothing.
+      m_periodic_timeout_time = UINT64_MAX;
+    }
+    else
+    {
+      io_uring_operation * const operation = (io_uring_operation *) uintptr_t( cqe.user_data );
+
+      operation->instance->on_io_uring_completion( operation, cqe.res, cqe.flags );
+    }
+  }
+}
+
+
+void io_reactor::queue_wakeup_read ( void )
+{
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_READ;
+  sqe->fd        = m_wakeup_fd;
+  sqe->addr      = uintptr_t( &m_wakeup_counter );
+  sqe->len       = sizeof( m_wakeup_counter );
+  sqe->off       = uint64_t( -1 );  // An eventfd has no file position.
+  sqe->user_data = IO_URING_WAKEUP_USER_DATA;
+}
+
+
+// Makes submit_and_wait() return in time for the next periodic service or flush deadline.
+
+void io_reactor::queue_periodic_timeout ( const int wait_time )
+{
+  assert( wait_time >= 0 );
+
+  m_periodic_timeout.tv_sec  = wait_time / 1000;
+  m_periodic_timeout.tv_nsec = ( wait_time % 1000 ) * 1000000LL;
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_TIMEOUT;
+  sqe->fd        = -1;
+  sqe->addr      = uintptr_t( &m_periodic_timeout );
+  sqe->len       = 1;
+  sqe->off       = 0;  // Only the timer can complete the timeout, not the number of other completions.
+  sqe->user_data = IO_URING_TIMEOUT_USER_DATA;
+
+  m_periodic_timeout_time = get_monotonic_time_ms() + uint64_t( wait_time );
+}
+
+
+void io_reactor::queue_accept ( const int fd, io_uring_operation * const operation )
+{
+  assert( !operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  // The remote address is not collected here, because all completions of a multishot accept
+  // would share the same address buffer. See getpeername() in uart_dpi::on_io_uring_completion().
+  sqe->opcode       = IORING_OP_ACCEPT;
+  sqe->fd           = fd;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data    = uintptr_t( operation );
+
+  #ifdef IORING_ACCEPT_MULTISHOT
+  if ( m_is_multishot_accept_supported )
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  #endif
+
+  operation->is_pending = true;
+}
+
+
+// Multishot accept needs Linux 5.19 or later. Returns whether it was enabled up to now.
+
+bool io_reactor::disable_multishot_accept ( void )
+{
+  const bool was_supported = m_is_multishot_accept_supported;
+
+  m_is_multishot_accept_supported = false;
+
+  return was_supported;
+}
+
+
+void io_reactor::queue_sendmsg ( const int fd, const msghdr * const msg, io_uring_operation * const operation )
+{
+  assert( !operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_SENDMSG;
+  sqe->fd        = fd;
+  sqe->addr      = uintptr_t( msg );
+  sqe->len       = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = uintptr_t( operation );
+
+  operation->is_pending = true;
+}
+
+
+void io_reactor::queue_recvmsg ( const int fd, msghdr * const msg, io_uring_operation * const operation )
+{
+  assert( !operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_RECVMSG;
+  sqe->fd        = fd;
+  sqe->addr      = uintptr_t( msg );
+  sqe->len       = 1;
+  sqe->user_data = uintptr_t( operation );
+
+  operation->is_pending = true;
+}
+
+
+// For file descriptors that are not sockets, like a pty.
+
+void io_reactor::queue_writev ( const int fd, const iovec * const segments, const int segment_count, io_uring_operation * const operation )
+{
+  assert( !operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_WRITEV;
+  sqe->fd        = fd;
+  sqe->addr      = uintptr_t( segments );
+  sqe->len       = unsigned( segment_count );
+  sqe->off       = uint64_t( -1 );  // A pty has no file position.
+  sqe->user_data = uintptr_t( operation );
+
+  operation->is_pending = true;
+}
+
+
+void io_reactor::queue_readv ( const int fd, const iovec * const segments, const int segment_count, io_uring_operation * const operation )
+{
+  assert( !operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_READV;
+  sqe->fd        = fd;
+  sqe->addr      = uintptr_t( segments );
+  sqe->len       = unsigned( segment_count );
+  sqe->off       = uint64_t( -1 );
+  sqe->user_data = uintptr_t( operation );
+
+  operation->is_pending = true;
+}
+
+
+// The operation completes later with -ECANCELED, unless it manages to complete normally first.
+
+void io_reactor::queue_cancel ( io_uring_operation * const operation )
+{
+  assert( operation->is_pending );
+
+  io_uring_sqe * const sqe = m_io_uring.get_sqe();
+
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->fd        = -1;
+  sqe->addr      = uintptr_t( operation );
+  sqe->user_data = IO_URING_CANCEL_USER_DATA;
+}
+
+
+// Processes completions until the given instance has no operations pending.
+// Completions for other instances are processed as usual in the meantime.
+
+void io_reactor::wait_for_operations ( uart_dpi * const instance )
+{
+  while ( instance->has_pending_operations() )
+  {
+    m_io_uring.submit_and_wait( 1 );
+
+    reap_io_uring_completions();
+  }
+}
+
+#endif  // #ifdef UART_DPI_USE_IO_URING
+
+
+mux_server::mux_server ( const uint16_t tcp_port,
+                         const bool listen_on_local_addr_only,
+                         const bool print_informational_messages )
+{
+  m_tcp_port = tcp_port;
+  m_listen_on_local_addr_only    = listen_on_local_addr_only;
+  m_print_informational_messages = print_informational_messages;
+  m_user_count      = 0;
+  m_next_channel_id = 0;
+  m_listening_socket = -1;
+  m_epoll_fd  = -1;
+  m_wakeup_fd = -1;
+  m_posted_request_count    = 0;
+  m_completed_request_count = 0;
+
+  try
+  {
+    // The listening socket is created here, so that errors like "address already in use"
+    // are reported straight away.
+    create_listening_socket();
+
+    m_wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if ( m_wakeup_fd == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error creating the wake-up eventfd: ", errno ) );
+    }
+
+    m_epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+
+    if ( m_epoll_fd == -1 )
+    {
+      throw std::runtime_error( get_error_message( "Error creating the epoll instance: ", errno ) );
+    }
+
+    const int fds[] = { m_wakeup_fd, m_listening_socket };
+
+    for ( size_t i = 0; i < sizeof( fds ) / sizeof( fds[0] ); ++i )
+    {
+      epoll_event ev;
+      memset( &ev, 0, sizeof(ev) );
+      ev.events  = EPOLLIN;
+      ev.data.fd = fds[i];
+
+      if ( epoll_ctl( m_epoll_fd, EPOLL_CTL_ADD, fds[i], &ev ) == -1 )
+      {
+        throw std::runtime_error( get_error_message( "Error adding a socket to the epoll set: ", errno ) );
+      }
+    }
+
+    m_thread = start_io_thread( &mux_server::thread_main, this );
+  }
+  catch ( ... )
+  {
+    if ( m_epoll_fd != -1 )
+      close_a( m_epoll_fd );
+
+    if ( m_wakeup_fd != -1 )
+      close_a( m_wakeup_fd );
+
+    if ( m_listening_socket != -1 )
+      close_a( m_listening_socket );
+
+    throw;
+  }
+}
+
+
+mux_server::~mux_server ( void )
+{
+  post_request( REQUEST_STOP, NULL );
+
+  m_thread.join();
+
+  while ( !m_connections.empty() )
+  {
+    close_connection( m_connections.back() );
+  }
+
+  close_a( m_listening_socket );
+  close_a( m_epoll_fd );
+  close_a( m_wakeup_fd );
+}
+
+
+void mux_server::create_listening_socket ( void )
+{
+  m_listening_socket = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+  if ( m_listening_socket == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error creating the listening socket: ", errno ) );
+  }
+
+  // See uart_dpi::bind_tcp_socket() about SO_REUSEADDR.
+  const int set_reuse_to_yes = 1;
+  if ( setsockopt( m_listening_socket,
+                   SOL_SOCKET,
+                   SO_REUSEADDR,
+                   &set_reuse_to_yes,
+                   sizeof(set_reuse_to_yes) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error setting the listen socket options: ", errno ) );
+  }
+
+  sockaddr_in addr;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( m_tcp_port );
+  addr.sin_addr.s_addr = ntohl( m_listen_on_local_addr_only ? INADDR_LOOPBACK : INADDR_ANY );
+
+  if ( bind( m_listening_socket,
+             (struct sockaddr *)&addr,
+             sizeof(addr) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error binding the socket: ", errno ) );
+  }
+
+  if ( listen( m_listening_socket, int( MUX_MAX_CONNECTION_COUNT ) ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error listening on the socket: ", errno ) );
+  }
+
+  if ( m_print_informational_messages )
+  {
+    const std::string addr_str = ip_address_to_text( &addr.sin_addr );
+
+    printf( "%sListening on IP address %s (%s), TCP port %d.\n",
+            MUX_MSG_PREFIX,
+            addr_str.c_str(),
+            m_listen_on_local_addr_only ? "local only" : "all",
+            m_tcp_port );
+    fflush( stdout );
+  }
+}
+
+
+// There is one server per TCP port. It gets created for the first channel, and the channel gets its number here.
+
+mux_server * mux_server::acquire ( const int tcp_port,
+                                   const bool listen_on_local_addr_only,
+                                   const bool print_informational_messages,
+                                   mux_channel * const channel )
+{
+  std::lock_guard< std::mutex > lock( s_mutex );
+
+  mux_server * server = NULL;
+
+  for ( size_t i = 0; i < s_servers.size(); ++i )
+  {
+    if ( s_servers[i]->m_tcp_port == tcp_port )
+    {
+      server = s_servers[i];
+      break;
+    }
+  }
+
+  if ( server == NULL )
+  {
+    server = new mux_server( uint16_t( tcp_port ), listen_on_local_addr_only, print_informational_messages );
+
+    try
+    {
+      s_servers.push_back( server );
+    }
+    catch ( ... )
+    {
+      delete server;
+      throw;
+    }
+  }
+  else
+  {
+    if ( server->m_listen_on_local_addr_only != listen_on_local_addr_only )
+      throw std::runtime_error( "Another UART DPI instance uses the same multiplexing TCP port with a different listen_on_local_addr_only parameter." );
+
+    if ( std::find( server->m_channel_names.begin(), server->m_channel_names.end(), channel->name ) != server->m_channel_names.end() )
+      throw std::runtime_error( "Another UART DPI instance uses the same multiplexing channel name \"" + channel->name + "\"." );
+
+    // Channel numbers are not reused, see uart_dpi_mux.h .
+    if ( server->m_next_channel_id > UINT16_MAX )
+      throw std::runtime_error( "The multiplexing server has run out of channel numbers." );
+  }
+
+  server->m_channel_names.push_back( channel->name );
+  channel->id = uint16_t( server->m_next_channel_id++ );
+  ++server->m_user_count;
+
+  return server;
+}
+
+
+void mux_server::release ( mux_server * const server, const mux_channel * const channel )
+{
+  std::lock_guard< std::mutex > lock( s_mutex );
+
+  assert( server->m_user_count > 0 );
+
+  std::vector< std::string > & names = server->m_channel_names;
+  names.erase( std::find( names.begin(), names.end(), channel->name ) );
+
+  if ( --server->m_user_count != 0 )
+    return;
+
+  // Like the I/O reactor, the server stops when the last channel goes away.
+  s_servers.erase( std::find( s_servers.begin(), s_servers.end(), server ) );
+  delete server;
+}
+
+
+void mux_server::add_channel ( mux_channel * const channel )
+{
+  post_request( REQUEST_ADD_CHANNEL, channel );
+}
+
+
+// After this call, the I/O thread does not touch the channel any more.
+
+void mux_server::remove_channel ( mux_channel * const channel )
+{
+  post_request( REQUEST_REMOVE_CHANNEL, channel );
+}
+
+
+void mux_server::wake_up ( void )
+{
+  increment_eventfd( m_wakeup_fd );
+}
+
+
+// Posts a request for the I/O thread and waits until it has been processed.
+
+void mux_server::post_request ( const request_type type, mux_channel * const channel )
+{
+  std::unique_lock< std::mutex > lock( m_request_mutex );
+
+  request r;
+  r.type    = type;
+  r.channel = channel;
+  m_pending_requests.push_back( r );
+
+  const uint64_t request_number = ++m_posted_request_count;
+
+  wake_up();
+
+  while ( m_completed_request_count < request_number )
+  {
+    m_request_completed.wait( lock );
+  }
+}
+
+
+// Returns false if the I/O thread should stop.
+
+bool mux_server::process_requests ( void )
+{
+  std::vector< request > requests;
+  uint64_t request_count;
+
+  {
+    std::lock_guard< std::mutex > lock( m_request_mutex );
+
+    if ( m_pending_requests.empty() )
+      return true;
+
+    requests.swap( m_pending_requests );
+    request_count = m_posted_request_count;
+  }
+
+  bool keep_running = true;
+
+  for ( size_t i = 0; i < requests.size(); ++i )
+  {
+    switch ( requests[i].type )
+    {
+    case REQUEST_ADD_CHANNEL:
+      insert_channel( requests[i].channel );
+      break;
+
+    case REQUEST_REMOVE_CHANNEL:
+      erase_channel( requests[i].channel );
+      break;
+
+    case REQUEST_STOP:
+      assert( m_channels.empty() );
+      keep_running = false;
+      break;
+
+    default:
+      assert( false );
+    }
+  }
+
+  {
+    std::lock_guard< std::mutex > lock( m_request_mutex );
+    m_completed_request_count = request_count;
+  }
+
+  m_request_completed.notify_all();
+
+  return keep_running;
+}
+
+
+static void append_mux_frame ( std::vector< uint8_t > * const output,
+                               const uint8_t type,
+                               const uint16_t channel_id,
+                               const uint8_t * const payload,
+                               const size_t payload_len )
+{
+  assert( payload_len <= UART_DPI_MUX_MAX_PAYLOAD_SIZE );
+
+  uint8_t header[ UART_DPI_MUX_FRAME_HEADER_SIZE ];
+  uart_dpi_mux_encode_header( header, type, channel_id, uint32_t( payload_len ) );
+
+  output->insert( output->end(), header, header + sizeof( header ) );
+  output->insert( output->end(), payload, payload + payload_len );
+}
+
+
+// A client that is already connected gets the new channel's data from the oldest byte still in its transmit buffer,
+// like a new client does.
+
+void mux_server::insert_channel ( mux_channel * const channel )
+{
+  m_channels.push_back( channel );
+
+  for ( size_t i = 0; i < m_connections.size(); ++i )
+  {
+    mux_connection * const connection = m_connections[i];
+
+    append_mux_frame( &connection->pending_output, UART_DPI_MUX_FRAME_OPEN, channel->id,
+                      (const uint8_t *) channel->name.data(), channel->name.size() );
+
+    connection->transmit_positions.push_back( channel->transmit_ring->get_read_position() );
+  }
+}
+
+
+// The transmit buffer goes away with the instance, so the data the clients have not got yet is copied aside.
+// The simulation thread is waiting in the instance's destructor, so there is no new data in the meantime.
+
+void mux_server::erase_channel ( mux_channel * const channel )
+{
+  const std::vector< mux_channel * >::iterator it = std::find( m_channels.begin(), m_channels.end(), channel );
+  assert( it != m_channels.end() );
+  const size_t channel_index = size_t( it - m_channels.begin() );
+
+  skip_overwritten_bytes();
+
+  for ( size_t i = 0; i < m_connections.size(); ++i )
+  {
+    mux_connection * const connection = m_connections[i];
+
+    iovec data;
+
+    if ( channel->transmit_ring->get_used_segments_from( connection->transmit_positions[ channel_index ], &data ) != 0 )
+    {
+      const uint8_t * const bytes = (const uint8_t *) data.iov_base;
+
+      for ( size_t offset = 0; offset < data.iov_len; offset += MUX_FRAME_PAYLOAD_SIZE )
+      {
+        append_mux_frame( &connection->pending_output, UART_DPI_MUX_FRAME_DATA, channel->id,
+                          bytes + offset, std::min( data.iov_len - offset, size_t( MUX_FRAME_PAYLOAD_SIZE ) ) );
+      }
+    }
+
+    append_mux_frame( &connection->pending_output, UART_DPI_MUX_FRAME_CLOSE, channel->id, NULL, 0 );
+
+    connection->transmit_positions.erase( connection->transmit_positions.begin() + channel_index );
+
+    if ( connection->next_channel_index >= connection->transmit_positions.size() )
+      connection->next_channel_index = 0;
+
+    // The rest of the frame payload gets discarded, because the channel is no longer found.
+    if ( connection->is_receive_paused && connection->payload_channel_id == channel->id )
+      connection->is_receive_paused = false;
+  }
+
+  m_channels.erase( it );
+}
+
+
+mux_channel * mux_server::find_channel ( const uint16_t id ) const
+{
+  for ( size_t i = 0; i < m_channels.size(); ++i )
+  {
+    if ( m_channels[i]->id == id )
+      return m_channels[i];
+  }
+
+  return NULL;
+}
+
+
+void mux_server::thread_main ( void )
+{
+  const int MAX_EVENT_COUNT = 64;
+  epoll_event events[ MAX_EVENT_COUNT ];
+
+  for ( ; ; )
+  {
+    const int event_count = epoll_wait( m_epoll_fd, events, MAX_EVENT_COUNT, -1 );
+
+    if ( event_count == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      // See io_reactor::thread_main_epoll().
+      fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, get_error_message( "Error waiting for socket events: ", errno ).c_str() );
+      fflush( stderr );
+      abort();
+    }
+
+    for ( int i = 0; i < event_count; ++i )
+    {
+      if ( events[i].data.fd == m_wakeup_fd )
+      {
+        uint64_t counter;
+        const ssize_t res = read( m_wakeup_fd, &counter, sizeof(counter) );
+        assert( res == sizeof(counter) || ( res == -1 && ( errno == EAGAIN || errno == EINTR ) ) );
+        (void) res;
+
+        if ( !process_requests() )
+          return;
+      }
+    }
+
+    // Whatever happened, all channels and connections are serviced together, so that the data
+    // of several channels goes out in the same send operation.
+    service();
+  }
+}
+
+
+void mux_server::service ( void )
+{
+  for ( size_t i = 0; i < m_channels.size(); ++i )
+  {
+    m_channels[i]->stats->add( UART_DPI_STAT_IO_SERVICE_COUNT, 1 );
+  }
+
+  accept_connection();
+
+  skip_overwritten_bytes();
+
+  for ( size_t i = 0; i < m_connections.size(); )
+  {
+    mux_connection * const connection = m_connections[i];
+
+    bool is_connection_open;
+
+    try
+    {
+      transmit_data( connection );
+
+      is_connection_open = receive_data( connection );
+    }
+    catch ( const std::exception & e )
+    {
+      fprintf( stderr,
+               "%sConnection closed after error: %s\n",
+               ERROR_MSG_PREFIX,
+               e.what() );
+      fflush( stderr );
+
+      // Close the connection. The remote client can reconnect later.
+      is_connection_open = false;
+    }
+
+    if ( is_connection_open )
+      ++i;
+    else
+      close_connection( connection );
+  }
+
+  release_transmitted_bytes();
+
+  update_io_registration();
+}
+
+
+void mux_server::accept_connection ( void )
+{
+  sockaddr_in remote_addr;
+  socklen_t remote_addr_len = sizeof( remote_addr );
+
+  const int connection_socket = accept4_eintr( m_listening_socket,
+                                               (sockaddr *) &remote_addr,
+                                               &remote_addr_len,
+                                               SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+  // Any errors accepting a connection are considered non-critical, as the remote client can try to reconnect later.
+  try
+  {
+    if ( connection_socket == -1 )
+    {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        return;
+
+      throw std::runtime_error( get_error_message( NULL, errno ) );
+    }
+
+    if ( remote_addr_len > sizeof( remote_addr ) )
+    {
+      throw std::runtime_error( "The address buffer is too small." );
+    }
+
+    if ( m_connections.size() >= MUX_MAX_CONNECTION_COUNT )
+    {
+      throw std::runtime_error( "Too many clients are connected already." );
+    }
+
+    if ( m_print_informational_messages )
+    {
+      const std::string addr_str = ip_address_to_text( &remote_addr.sin_addr );
+
+      printf( "%sAccepted an incoming connection from IP address %s, TCP port %d.\n",
+              MUX_MSG_PREFIX,
+              addr_str.c_str(),
+              ntohs( remote_addr.sin_port ) );
+      fflush( stdout );
+    }
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr,
+             "%sError accepting a connection on the multiplexing socket: %s\n",
+             ERROR_MSG_PREFIX,
+             e.what() );
+    fflush( stderr );
+
+    if ( connection_socket != -1 )
+    {
+      close_a( connection_socket );
+    }
+
+    return;
+  }
+
+  mux_connection * const connection = new mux_connection();
+
+  connection->socket             = connection_socket;
+  connection->socket_events      = 0;
+  connection->is_send_stalled    = false;
+  connection->pending_output_pos = 0;
+  connection->next_channel_index = 0;
+  connection->input_pos          = 0;
+  connection->input_len          = 0;
+  connection->header_len         = 0;
+  connection->payload_left       = 0;
+  connection->payload_channel_id = 0;
+  connection->is_receive_paused  = false;
+
+  connection->pending_output.assign( UART_DPI_MUX_SIGNATURE, UART_DPI_MUX_SIGNATURE + UART_DPI_MUX_SIGNATURE_LEN );
+
+  // Like a TCP client of a single instance, the new client gets everything still in the transmit buffers.
+  for ( size_t i = 0; i < m_channels.size(); ++i )
+  {
+    mux_channel * const channel = m_channels[i];
+
+    append_mux_frame( &connection->pending_output, UART_DPI_MUX_FRAME_OPEN, channel->id,
+                      (const uint8_t *) channel->name.data(), channel->name.size() );
+
+    connection->transmit_positions.push_back( channel->transmit_ring->get_read_position() );
+
+    channel->stats->add( UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT, 1 );
+  }
+
+  m_connections.push_back( connection );
+
+  if ( m_connections.size() > 1 && m_print_informational_messages )
+  {
+    printf( "%sAnother client is in control, so the data received from the new one will be discarded.\n", MUX_MSG_PREFIX );
+    fflush( stdout );
+  }
+}
+
+
+void mux_server::close_connection ( mux_connection * const connection )
+{
+  // Closing the socket removes it from the epoll set too.
+  close_a( connection->socket );
+
+  m_connections.erase( std::find( m_connections.begin(), m_connections.end(), connection ) );
+
+  delete connection;
+}
+
+
+// In the default transmit mode, the simulation may have overwritten bytes the clients have not got yet.
+
+void mux_server::skip_overwritten_bytes ( void )
+{
+  for ( size_t i = 0; i < m_channels.size(); ++i )
+  {
+    mux_channel * const channel = m_channels[i];
+
+    const uint64_t lost_byte_count = channel->transmit_ring->skip_overwritten_bytes();
+
+    if ( lost_byte_count == 0 )
+      continue;
+
+    account_lost_bytes( channel, lost_byte_count );
+
+    const uint64_t oldest_position = channel->transmit_ring->get_read_position();
+
+    for ( size_t j = 0; j < m_connections.size(); ++j )
+    {
+      uint64_t * const position = &m_connections[j]->transmit_positions[i];
+
+      if ( *position < oldest_position )
+        *position = oldest_position;
+    }
+  }
+}
+
+
+// Counts the bytes that the slowest client of a channel has lost.
+
+void mux_server::account_lost_bytes ( mux_channel * const channel, const uint64_t lost_byte_count )
+{
+  if ( lost_byte_count == 0 )
+    return;
+
+  channel->stats->add( UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT, lost_byte_count );
+
+  if ( m_print_informational_messages )
+  {
+    printf( "%sThe transmit buffer of channel \"%s\" overflowed, %llu bytes were lost.\n",
+            MUX_MSG_PREFIX,
+            channel->name.c_str(),
+            (unsigned long long) lost_byte_count );
+    fflush( stdout );
+  }
+}
+
+
+void mux_server::transmit_data ( mux_connection * const connection )
+{
+  // The pending output and one DATA frame per channel with data to send go out together with a single writev() call.
+  // Each frame is a header and a piece of the channel's transmit buffer, which is always contiguous,
+  // so the data is never copied, unless the socket only takes part of a frame, see account_sent_bytes().
+  // Like in uart_dpi::transmit_data(), whatever is left over is sent when epoll reports that the socket
+  // is writable again.
+
+  uint8_t headers[ MUX_MAX_FRAMES_PER_SEND ][ UART_DPI_MUX_FRAME_HEADER_SIZE ];
+  size_t  frame_channel_indexes[ MUX_MAX_FRAMES_PER_SEND ];
+  iovec   segments[ 1 + 2 * MUX_MAX_FRAMES_PER_SEND ];
+
+  int    segment_count = 0;
+  size_t byte_count    = 0;
+
+  const size_t pending_byte_count = connection->pending_output.size() - connection->pending_output_pos;
+
+  if ( pending_byte_count != 0 )
+  {
+    segments[0].iov_base = &connection->pending_output[ connection->pending_output_pos ];
+    segments[0].iov_len  = pending_byte_count;
+    segment_count = 1;
+    byte_count    = pending_byte_count;
+  }
+
+  const iovec * const frame_segments = &segments[ segment_count ];
+  unsigned frame_count = 0;
+
+  const size_t channel_count = m_channels.size();
+
+  for ( size_t i = 0; i < channel_count && frame_count < MUX_MAX_FRAMES_PER_SEND; ++i )
+  {
+    const size_t channel_index = ( connection->next_channel_index + i ) % channel_count;
+    mux_channel * const channel = m_channels[ channel_index ];
+
+    iovec * const header_segment = &segments[ segment_count ];
+    iovec * const data_segment   = &segments[ segment_count + 1 ];
+
+    // The data stays protected from the simulation thread until it has been sent, see unprotect_channels().
+    uint64_t * const transmit_position = &connection->transmit_positions[ channel_index ];
+    uint64_t intact_position = *transmit_position;
+
+    const int data_segment_count = channel->transmit_ring->protect_used_segments_from( &intact_position, data_segment );
+
+    if ( intact_position != *transmit_position )
+    {
+      // The simulation thread overwrote the next bytes after skip_overwritten_bytes() had run.
+      account_lost_bytes( channel, channel->transmit_ring->skip_bytes_up_to( intact_position ) );
+      *transmit_position = intact_position;
+    }
+
+    if ( data_segment_count == 0 )
+    {
+      channel->transmit_ring->set_protected_position( NO_READ_PROTECTION );
+      continue;
+    }
+
+    data_segment->iov_len = std::min( data_segment->iov_len, size_t( MUX_FRAME_PAYLOAD_SIZE ) );
+
+    uart_dpi_mux_encode_header( headers[ frame_count ], UART_DPI_MUX_FRAME_DATA, channel->id, uint32_t( data_segment->iov_len ) );
+    header_segment->iov_base = headers[ frame_count ];
+    header_segment->iov_len  = UART_DPI_MUX_FRAME_HEADER_SIZE;
+
+    frame_channel_indexes[ frame_count++ ] = channel_index;
+    segment_count += 2;
+    byte_count    += UART_DPI_MUX_FRAME_HEADER_SIZE + data_segment->iov_len;
+
+    channel->stats->add( UART_DPI_STAT_SEND_CALL_COUNT, 1 );
+  }
+
+  if ( segment_count == 0 )
+  {
+    connection->is_send_stalled = false;
+    return;
+  }
+
+  // The next send starts after the last channel in this one, so that no channel waits for long.
+  if ( frame_count != 0 )
+    connection->next_channel_index = ( frame_channel_indexes[ frame_count - 1 ] + 1 ) % channel_count;
+
+  const ssize_t sent_byte_count = writev_eintr( connection->socket, segments, segment_count );
+
+  if ( sent_byte_count == -1 )
+  {
+    const int error_code = errno;
+
+    unprotect_channels( frame_channel_indexes, frame_count );
+
+    if ( error_code == EAGAIN || error_code == EWOULDBLOCK )
+    {
+      // The TCP send buffer is full.
+      connection->is_send_stalled = true;
+      return;
+    }
+
+    throw std::runtime_error( get_error_message( "Error sending data: ", error_code ) );
+  }
+
+  connection->is_send_stalled = size_t( sent_byte_count ) < byte_count;
+
+  // This copies the rest of a frame that the socket only took in part, so the data is still protected.
+  account_sent_bytes( connection, size_t( sent_byte_count ), pending_byte_count,
+                      frame_segments, frame_channel_indexes, frame_count );
+
+  unprotect_channels( frame_channel_indexes, frame_count );
+}
+
+
+// Lets the simulation threads overwrite the data of the given channels again, see transmit_data().
+
+void mux_server::unprotect_channels ( const size_t * const channel_indexes, const unsigned channel_count )
+{
+  for ( unsigned i = 0; i < channel_count; ++i )
+    m_channels[ channel_indexes[i] ]->transmit_ring->set_protected_position( NO_READ_PROTECTION );
+}
+
+
+// The client must get the rest of a frame that the socket only took in part before anything else.
+// That rest gets copied to the pending output, and the whole frame then counts as sent.
+
+void mux_server::account_sent_bytes ( mux_connection * const connection,
+                                      const size_t sent_byte_count,
+                                      const size_t pending_byte_count,
+                                      const iovec * const frame_segments,
+                                      const size_t * const frame_channel_indexes,
+                                      const unsigned frame_count )
+{
+  size_t remaining = sent_byte_count;
+
+  const size_t sent_pending_byte_count = std::min( remaining, pending_byte_count );
+  connection->pending_output_pos += sent_pending_byte_count;
+  remaining -= sent_pending_byte_count;
+
+  if ( connection->pending_output_pos == connection->pending_output.size() )
+  {
+    connection->pending_output.clear();
+    connection->pending_output_pos = 0;
+  }
+
+  for ( unsigned i = 0; i < frame_count && remaining != 0; ++i )
+  {
+    const iovec & header_segment = frame_segments[ 2 * i ];
+    const iovec & data_segment   = frame_segments[ 2 * i + 1 ];
+
+    const uint8_t * const header_bytes = (const uint8_t *) header_segment.iov_base;
+    const uint8_t * const data_bytes   = (const uint8_t *) data_segment.iov_base;
+
+    std::vector< uint8_t > & pending_output = connection->pending_output;
+
+    if ( remaining < header_segment.iov_len )
+    {
+      pending_output.insert( pending_output.end(), header_bytes + remaining, header_bytes + header_segment.iov_len );
+      pending_output.insert( pending_output.end(), data_bytes, data_bytes + data_segment.iov_len );
+      remaining = 0;
+    }
+    else if ( remaining < header_segment.iov_len + data_segment.iov_len )
+    {
+      pending_output.insert( pending_output.end(), data_bytes + ( remaining - header_segment.iov_len ), data_bytes + data_segment.iov_len );
+      remaining = 0;
+    }
+    else
+    {
+      remaining -= header_segment.iov_len + data_segment.iov_len;
+    }
+
+    connection->transmit_positions[ frame_channel_indexes[ i ] ] += data_segment.iov_len;
+  }
+}
+
+
+// Returns false if the client has closed the connection.
+
+bool mux_server::receive_data ( mux_connection * const connection )
+{
+  // Only the client that has been connected the longest can send data to the simulation.
+  // The other clients are read too, so that we notice when they disconnect, but their data is discarded.
+  const bool is_controlling_connection = connection == m_connections[0];
+
+  // Whatever is left in the input buffer from last time goes first.
+  parse_input( connection, is_controlling_connection );
+
+  // If a receive buffer is full, the socket is not read at all, which provides incoming flow control.
+  if ( connection->is_receive_paused )
+    return true;
+
+  assert( connection->input_pos == connection->input_len );
+
+  iovec segments[1];
+  segments[0].iov_base = connection->input_buffer;
+  segments[0].iov_len  = sizeof( connection->input_buffer );
+
+  const ssize_t received_byte_count = readv_eintr( connection->socket, segments, 1 );
+
+  if ( received_byte_count == 0 )
+  {
+    if ( m_print_informational_messages )
+    {
+      printf( "%sConnection closed at the other end.\n", MUX_MSG_PREFIX );
+      fflush( stdout );
+    }
+    return false;
+  }
+
+  if ( received_byte_count == -1 )
+  {
+    if ( errno == EAGAIN || errno == EWOULDBLOCK )
+    {
+      // No data available yet.
+      return true;
+    }
+
+    throw std::runtime_error( get_error_message( "Error receiving data: ", errno ) );
+  }
+
+  connection->input_pos = 0;
+  connection->input_len = size_t( received_byte_count );
+
+  parse_input( connection, is_controlling_connection );
+
+  return true;
+}
+
+
+// Copies the frame payloads in the input buffer to the receive buffers, each one in as few pieces as possible.
+// If a receive buffer is full, the rest of the input stays in the buffer, and the connection pauses
+// until the simulation has read some data.
+
+void mux_server::parse_input ( mux_connection * const connection, const bool is_controlling_connection )
+{
+  connection->is_receive_paused = false;
+
+  while ( connection->input_pos < connection->input_len )
+  {
+    const uint8_t * const input = &connection->input_buffer[ connection->input_pos ];
+    const size_t input_byte_count = connection->input_len - connection->input_pos;
+
+    if ( connection->payload_left == 0 )
+    {
+      const size_t header_byte_count = std::min( input_byte_count, size_t( UART_DPI_MUX_FRAME_HEADER_SIZE - connection->header_len ) );
+
+      memcpy( &connection->header[ connection->header_len ], input, header_byte_count );
+      connection->header_len += unsigned( header_byte_count );
+      connection->input_pos  += header_byte_count;
+
+      if ( connection->header_len < UART_DPI_MUX_FRAME_HEADER_SIZE )
+        break;
+
+      connection->header_len = 0;
+
+      const uint32_t payload_len = uart_dpi_mux_get_length( connection->header );
+
+      if ( connection->header[0] != UART_DPI_MUX_FRAME_DATA || payload_len > UART_DPI_MUX_MAX_PAYLOAD_SIZE )
+        throw std::runtime_error( "The client has sent an invalid frame." );
+
+      connection->payload_left       = payload_len;
+      connection->payload_channel_id = uart_dpi_mux_get_channel( connection->header );
+      continue;
+    }
+
+    size_t byte_count = std::min( input_byte_count, size_t( connection->payload_left ) );
+
+    // Otherwise, the payload is discarded.
+    mux_channel * const channel = is_controlling_connection ? find_channel( connection->payload_channel_id ) : NULL;
+
+    if ( channel != NULL )
+    {
+      iovec segments[1];
+
+      if ( channel->receive_ring->get_free_segments( segments ) == 0 )
+      {
+        connection->is_receive_paused = true;
+        return;
+      }
+
+      byte_count = std::min( byte_count, segments[0].iov_len );
+
+      memcpy( segments[0].iov_base, input, byte_count );
+      channel->receive_ring->commit_written_bytes( unsigned( byte_count ) );
+    }
+
+    connection->input_pos    += byte_count;
+    connection->payload_left -= uint32_t( byte_count );
+  }
+}
+
+
+// Like in uart_dpi::release_transmitted_bytes(), the data stays in the transmit buffers
+// for the next client while no client is connected.
+
+void mux_server::release_transmitted_bytes ( void )
+{
+  if ( m_connections.empty() )
+    return;
+
+  for ( size_t i = 0; i < m_channels.size(); ++i )
+  {
+    uint64_t slowest_position = m_connections[0]->transmit_positions[i];
+
+    for ( size_t j = 1; j < m_connections.size(); ++j )
+      slowest_position = std::min( slowest_position, m_connections[j]->transmit_positions[i] );
+
+    m_channels[i]->transmit_ring->release_bytes_up_to( slowest_position );
+  }
+}
+
+
+// Tells epoll what each connection is waiting for, and the simulation threads when to wake up
+// the I/O thread, like uart_dpi::update_io_registration() does.
+
+void mux_server::update_io_registration ( void )
+{
+  const size_t channel_count = m_channels.size();
+
+  m_write_positions.resize( channel_count );
+  m_wakeup_positions.assign( channel_count, NO_TRANSMIT_WAKEUP );
+
+  for ( size_t i = 0; i < channel_count; ++i )
+    m_write_positions[i] = m_channels[i]->transmit_ring->get_write_position();
+
+  for ( size_t i = 0; i < m_connections.size(); )
+  {
+    mux_connection * const connection = m_connections[i];
+
+    // If there is still data to send after transmit_data(), the socket's send buffer is full,
+    // or there were more channels with data than fit in one send operation.
+    bool is_transmit_pending = !connection->pending_output.empty();
+
+    for ( size_t j = 0; j < channel_count && !is_transmit_pending; ++j )
+      is_transmit_pending = connection->transmit_positions[j] != m_write_positions[j];
+
+    uint32_t events = 0;
+
+    if ( is_transmit_pending )
+    {
+      events |= EPOLLOUT;
+    }
+    else
+    {
+      for ( size_t j = 0; j < channel_count; ++j )
+        m_wakeup_positions[j] = std::min( m_wakeup_positions[j], connection->transmit_positions[j] );
+    }
+
+    if ( !connection->is_receive_paused )
+      events |= EPOLLIN;
+
+    try
+    {
+      set_socket_events( connection, events );
+      ++i;
+    }
+    catch ( const std::exception & e )
+    {
+      fprintf( stderr,
+               "%sConnection closed after error: %s\n",
+               ERROR_MSG_PREFIX,
+               e.what() );
+      fflush( stderr );
+
+      close_connection( connection );
+    }
+  }
+
+  const mux_connection * const controlling_connection = m_connections.empty() ? NULL : m_connections[0];
+
+  for ( size_t i = 0; i < channel_count; ++i )
+  {
+    mux_channel * const channel = m_channels[i];
+
+    const bool is_receive_buffer_full = controlling_connection != NULL &&
+                                        controlling_connection->is_receive_paused &&
+                                        controlling_connection->payload_channel_id == channel->id;
+
+    channel->transmit_wakeup_position->store( m_wakeup_positions[i] );
+    channel->receive_wakeup_needed   ->store( is_receive_buffer_full );
+  }
+}
+
+
+void mux_server::set_socket_events ( mux_connection * const connection, const uint32_t events )
+{
+  if ( events == connection->socket_events )
+    return;
+
+  epoll_event ev;
+  memset( &ev, 0, sizeof(ev) );
+  ev.events  = events;
+  ev.data.fd = connection->socket;
+
+  // Like in uart_dpi::update_io_registration(), a socket without any events does not stay in the epoll set.
+  const int operation = events == 0 ? EPOLL_CTL_DEL : connection->socket_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+  if ( epoll_ctl( m_epoll_fd, operation, connection->socket, &ev ) == -1 )
+  {
+    throw std::runtime_error( get_error_message( "Error updating a socket in the epoll set: ", errno ) );
+  }
+
+  connection->socket_events = events;
+}
+
+
+// A feature that a transport cannot provide, and whether the parameters ask for it.
+
+struct unsupported_feature
+{
+  bool         is_requested;
+  const char * description;
+};
+
+
+static void reject_unsupported_features ( const char * const transport_name,
+                                          const unsupported_feature * const features,
+                                          const size_t feature_count )
+{
+  for ( size_t i = 0; i < feature_count; ++i )
+  {
+    if ( features[ i ].is_requested )
+      throw std::runtime_error( std::string( "The " ) + transport_name + " transport does not support " + features[ i ].description + "." );
+  }
+}
+
+
+uart_dpi::uart_dpi ( const creation_parameters & parameters,
+                     const instance_checkpoint * const checkpoint )
+{
+  m_parameters = parameters;
+
+  m_handle = 0;
+  m_listening_socket = -1;
+  m_is_unix_socket_bound = false;
+  m_pty_slave_fd = -1;
+  m_listening_message_already_printed = false;
+  m_controlling_client = NULL;
+  m_listening_socket_registered = false;
+  m_reactor = NULL;
+  m_mux_server = NULL;
+  m_shm_header = NULL;
+  m_shm_header_size = 0;
+  m_transmit_wakeup_position = NO_TRANSMIT_WAKEUP;
+  m_receive_wakeup_needed  = false;
+  m_transmit_flush_position = 0;
+  m_flush_wakeup_position = NO_TRANSMIT_WAKEUP;
+  m_transmit_limit = 0;
+  m_timed_flush_position = 0;
+  m_flush_deadline = NO_FLUSH_DEADLINE;
+  m_io_service_requested   = false;
+  m_is_script_receiving = false;
+  m_io_error = false;
+  m_tick_all_index = -1;
+  m_is_transmit_blocked = false;
+  m_is_overwrite_blocked = false;
+  m_blocked_tick_count = 0;
+  m_capture_position = 0;
+  m_tick_count = 0;
+  m_clock_overhead_ns = get_clock_overhead_ns();
+  m_recorded_receive_position = 0;
+  m_is_replaying = false;
+  m_finish_pass_pattern_count = 0;
+  m_is_searching_patterns = false;
+  m_pattern_match_kind = PATTERN_KIND_NONE;
+  m_is_pattern_match_pending = false;
+
+  #ifdef UART_DPI_USE_IO_URING
+  m_accept_operation.instance   = this;
+  m_accept_operation.client     = NULL;
+  m_accept_operation.type       = io_uring_operation::OPERATION_ACCEPT;
+  m_accept_operation.is_pending = false;
+
+  m_is_io_being_removed = false;
+  #endif
+  
+  const bool is_capture_enabled = !parameters.capture_file_name.empty();
+
+  const std::string & endpoint_str = parameters.endpoint;
+  const std::string UNIX_PREFIX = "unix:";
+  const std::string PTY_PREFIX  = "pty:";
+  const std::string SHM_PREFIX  = "shm:";
+  const std::string MUX_PREFIX  = "mux:";
+
+  // An empty endpoint means TCP, and then TCP port 0 means no TCP server,
+  // which only makes sense if the data goes to a capture file.
+  if ( endpoint_str.empty() )
+  {
+    if ( parameters.tcp_port < 0 || parameters.tcp_port > 65535 || ( parameters.tcp_port == 0 && !is_capture_enabled ) )
+    {
+      throw std::runtime_error( "Invalid TCP port." );
+    }
+
+    m_transport = parameters.tcp_port == 0 ? TRANSPORT_NONE : TRANSPORT_TCP;
+  }
+  else if ( endpoint_str.compare( 0, UNIX_PREFIX.size(), UNIX_PREFIX ) == 0 && endpoint_str.size() > UNIX_PREFIX.size() )
+  {
+    m_transport = TRANSPORT_UNIX;
+    m_unix_socket_path = endpoint_str.substr( UNIX_PREFIX.size() );
+  }
+  else if ( endpoint_str == "pty" )
+  {
+    m_transport = TRANSPORT_PTY;
+  }
+  else if ( endpoint_str == "harness" )
+  {
+    m_transport = TRANSPORT_HARNESS;
+  }
+  else if ( endpoint_str.compare( 0, PTY_PREFIX.size(), PTY_PREFIX ) == 0 && endpoint_str.size() > PTY_PREFIX.size() )
+  {
+    m_transport = TRANSPORT_PTY;
+    m_pty_link_path = endpoint_str.substr( PTY_PREFIX.size() );
+  }
+  else if ( endpoint_str.compare( 0, SHM_PREFIX.size(), SHM_PREFIX ) == 0 && endpoint_str.size() > SHM_PREFIX.size() )
+  {
+    m_transport = TRANSPORT_SHM;
+    m_shm_name = endpoint_str.substr( SHM_PREFIX.size() );
+  }
+  else if ( endpoint_str.compare( 0, MUX_PREFIX.size(), MUX_PREFIX ) == 0 && endpoint_str.size() > MUX_PREFIX.size() )
+  {
+    m_transport = TRANSPORT_MUX;
+    m_mux_channel.name = endpoint_str.substr( MUX_PREFIX.size() );
+
+    // The channel name travels in an OPEN frame, see uart_dpi_mux.h .
+    if ( m_mux_channel.name.size() > UART_DPI_MUX_MAX_PAYLOAD_SIZE )
+      throw std::runtime_error( "The multiplexing channel name is too long." );
+
+    // The multiplexing server always needs a TCP port.
+    if ( parameters.tcp_port <= 0 || parameters.tcp_port > 65535 )
+      throw std::runtime_error( "Invalid TCP port." );
+  }
+  else
+  {
+    throw std::runtime_error( "Invalid endpoint parameter." );
+  }
+
+  m_stats.create( parameters.stats_file_name.c_str() );
+
+  // The pseudo-terminal name is only known later, see create_pty().
+  if ( m_transport == TRANSPORT_TCP )
+    m_stats.set_endpoint( "tcp:" + std::to_string( parameters.tcp_port ) );
+  else if ( m_transport == TRANSPORT_NONE )
+    m_stats.set_endpoint( "none" );
+  else if ( m_transport == TRANSPORT_MUX )
+    m_stats.set_endpoint( "mux:" + std::to_string( parameters.tcp_port ) + "/" + m_mux_channel.name );
+  else if ( m_transport != TRANSPORT_PTY )
+    m_stats.set_endpoint( endpoint_str );
+
+  m_welcome_message = parameters.welcome_message;
+    
+  m_listening_tcp_port = parameters.tcp_port;
+
+    
+  switch ( parameters.print_informational_messages )
+  {
+  case 0:
+    m_print_informational_messages = false;
+    break;
+      
+  case 1:
+    m_print_informational_messages = true;
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid print_informational_messages parameter." );
+  }
+
+  m_informational_message_prefix = parameters.informational_message_prefix;
+    
+  switch ( parameters.listen_on_local_addr_only )
+  {
+  case 0:
+    m_listen_on_local_addr_only = false;
+    break;
+
+  case 1:
+    m_listen_on_local_addr_only = true;
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid listen_on_local_addr_only parameter." );
+  }
+
+
+  // The UART FIFO have 16 bytes and the UART trigger level flags range
+  // from 1 to 14, so it's safer to assume the buffer size here is at least 16 bytes.
+  const int MIN_BUFFER_SIZE = 16;
+    
+  if ( parameters.receive_buffer_size < MIN_BUFFER_SIZE )
+    throw std::runtime_error( "Invalid receive buffer size." );
+
+  if ( parameters.transmit_buffer_size < MIN_BUFFER_SIZE )
+    throw std::runtime_error( "Invalid transmit buffer size." );
+
+  switch ( parameters.lossless_transmit )
+  {
+  case 0:
+    m_lossless_transmit = false;
+    break;
+
+  case 1:
+    m_lossless_transmit = true;
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid lossless_transmit parameter." );
+  }
+
+  if ( m_lossless_transmit && parameters.transmit_buffer_size < int( 2 * LOSSLESS_TRANSMIT_RESERVE ) )
+    throw std::runtime_error( "The transmit buffer size is too small for lossless transmit mode." );
+
+  // A value of -1 means half the transmit buffer.
+  if ( parameters.transmit_low_watermark == -1 )
+    m_transmit_low_watermark = parameters.transmit_buffer_size / 2;
+  else if ( parameters.transmit_low_watermark < 0 || parameters.transmit_low_watermark > parameters.transmit_buffer_size - int( LOSSLESS_TRANSMIT_RESERVE ) )
+    throw std::runtime_error( "Invalid transmit_low_watermark parameter." );
+  else
+    m_transmit_low_watermark = unsigned( parameters.transmit_low_watermark );
+
+  if ( parameters.max_client_count < 1 )
+    throw std::runtime_error( "Invalid max_client_count parameter." );
+
+  m_max_client_count = unsigned( parameters.max_client_count );
+
+  switch ( parameters.slow_client_policy )
+  {
+  case SLOW_CLIENT_WAIT:
+  case SLOW_CLIENT_SKIP:
+  case SLOW_CLIENT_DISCONNECT:
+    m_slow_client_policy = slow_client_policy_type( parameters.slow_client_policy );
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid slow_client_policy parameter." );
+  }
+
+  switch ( parameters.transmit_flush_policy )
+  {
+  case TRANSMIT_FLUSH_IMMEDIATE:
+  case TRANSMIT_FLUSH_LINE:
+  case TRANSMIT_FLUSH_SIZE:
+  case TRANSMIT_FLUSH_TIMER:
+    m_transmit_flush_policy = transmit_flush_policy_type( parameters.transmit_flush_policy );
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid transmit_flush_policy parameter." );
+  }
+
+  // A value of -1 means half the transmit buffer, which is also the maximum, so that the oldest bytes
+  // are not lost while they are being held back. The timer policy only flushes at that size as a last resort.
+  if ( parameters.transmit_flush_threshold == -1 || m_transmit_flush_policy == TRANSMIT_FLUSH_TIMER )
+    m_transmit_flush_threshold = unsigned( parameters.transmit_buffer_size ) / 2;
+  else if ( parameters.transmit_flush_threshold < 1 || parameters.transmit_flush_threshold > parameters.transmit_buffer_size / 2 )
+    throw std::runtime_error( "Invalid transmit_flush_threshold parameter." );
+  else
+    m_transmit_flush_threshold = unsigned( parameters.transmit_flush_threshold );
+
+  if ( parameters.transmit_flush_latency_ms < 0 || ( parameters.transmit_flush_latency_ms == 0 && m_transmit_flush_policy == TRANSMIT_FLUSH_TIMER ) )
+    throw std::runtime_error( "Invalid transmit_flush_latency_ms parameter." );
+
+  m_transmit_flush_latency_ms = unsigned( parameters.transmit_flush_latency_ms );
+
+  switch ( parameters.socket_profile )
+  {
+  case SOCKET_PROFILE_DEFAULT:
+  case SOCKET_PROFILE_INTERACTIVE:
+  case SOCKET_PROFILE_BULK:
+    m_socket_profile = socket_profile_type( parameters.socket_profile );
+    break;
+
+  default:
+    throw std::runtime_error( "Invalid socket_profile parameter." );
+  }
+
+  if ( parameters.socket_send_buffer_size < 0 )
+    throw std::runtime_error( "Invalid socket_send_buffer_size parameter." );
+
+  if ( parameters.socket_receive_buffer_size < 0 )
+    throw std::runtime_error( "Invalid socket_receive_buffer_size parameter." );
+
+  m_socket_send_buffer_size    = parameters.socket_send_buffer_size;
+  m_socket_receive_buffer_size = parameters.socket_receive_buffer_size;
+
+  if ( m_socket_profile == SOCKET_PROFILE_BULK )
+  {
+    if ( m_socket_send_buffer_size == 0 )
+      m_socket_send_buffer_size = BULK_SOCKET_BUFFER_SIZE;
+
+    if ( m_socket_receive_buffer_size == 0 )
+      m_socket_receive_buffer_size = BULK_SOCKET_BUFFER_SIZE;
+  }
+
+  // Without clients, there is nothing to hold the data back for. The capture file has its own write policy.
+  if ( m_transport == TRANSPORT_NONE )
+    m_transmit_flush_policy = TRANSMIT_FLUSH_IMMEDIATE;
+
+  const bool is_record_enabled = !parameters.receive_record_file_name.empty();
+  const bool is_replay_enabled = !parameters.receive_replay_file_name.empty();
+  const bool is_stamping_enabled = !parameters.transmit_stamp_file_name.empty();
+  const bool is_script_enabled = !parameters.script_file_name.empty();
+
+  if ( parameters.transmit_stamp_per_byte > 1 )
+    throw std::runtime_error( "Invalid transmit_stamp_per_byte parameter." );
+
+  add_finish_patterns( parameters.finish_pass_patterns.c_str() );
+  m_finish_pass_pattern_count = m_finish_patterns.size();
+  add_finish_patterns( parameters.finish_fail_patterns.c_str() );
+  m_pattern_matcher.build( m_finish_patterns );
+  m_is_searching_patterns = !m_pattern_matcher.is_empty();
+
+  if ( is_script_enabled )
+  {
+    if ( is_replay_enabled )
+      throw std::runtime_error( "A script cannot be used while replaying the received data." );
+
+    m_script.load( parameters.script_file_name.c_str() );
+    m_is_script_receiving = true;
+  }
+
+  const unsupported_feature client_features[] =
+  {
+    { is_capture_enabled,                                 "a capture file" },
+    { is_stamping_enabled,                                "a transmit stamp file" },
+    { is_script_enabled,                                  "a script" },
+    { is_replay_enabled,                                  "replaying the received data" },
+    { m_slow_client_policy != SLOW_CLIENT_WAIT,           "a slow client policy" },
+    { m_transmit_flush_policy != TRANSMIT_FLUSH_IMMEDIATE, "a transmit flush policy" }
+  };
+
+  const size_t client_feature_count = sizeof( client_features ) / sizeof( client_features[0] );
+
+  // Without an I/O thread, nobody would write the capture file or apply the slow client and flush policies,
+  // and the external process is the only one that can write to the receive buffer.
+  if ( m_transport == TRANSPORT_SHM )
+    reject_unsupported_features( "shared memory", client_features, client_feature_count );
+
+  // The C++ testbench is the only reader of the transmit buffer, and the only writer of the receive buffer.
+  if ( m_transport == TRANSPORT_HARNESS )
+    reject_unsupported_features( "harness", client_features, client_feature_count );
+
+  // The multiplexing server only moves data between the rings and its clients. It knows nothing about
+  // the capture file, the replayed data or the slow client and flush policies, which service_io() and the routines
+  // it calls take care of.
+  if ( m_transport == TRANSPORT_MUX )
+    reject_unsupported_features( "multiplexing", client_features, client_feature_count );
+
+  // Shared memory regions and pseudo-terminals have no sockets, and the connections of the multiplexing server
+  // carry the data of several instances.
+  if ( m_transport == TRANSPORT_SHM || m_transport == TRANSPORT_MUX || m_transport == TRANSPORT_PTY || m_transport == TRANSPORT_HARNESS )
+  {
+    if ( m_socket_profile != SOCKET_PROFILE_DEFAULT || m_socket_send_buffer_size != 0 || m_socket_receive_buffer_size != 0 )
+      throw std::runtime_error( "Socket options are only supported with the TCP and Unix socket transports." );
+  }
+
+  // The shared memory region is created last, see below.
+  if ( m_transport != TRANSPORT_SHM )
+  {
+    m_receive_ring.allocate( parameters.receive_buffer_size );
+    m_transmit_ring.allocate( parameters.transmit_buffer_size );
+
+    // Before there is an I/O thread that could touch the rings.
+    if ( checkpoint != NULL )
+      restore_checkpoint( *checkpoint );
+  }
+
+  m_capture_write_threshold = std::min( CAPTURE_WRITE_SIZE, unsigned( parameters.transmit_buffer_size ) / 2 );
+
+  if ( is_capture_enabled )
+  {
+    m_capture_file.open( parameters.capture_file_name.c_str() );
+
+    if ( m_print_informational_messages )
+    {
+      printf( "%sCapturing the transmitted data to file \"%s\".\n", m_informational_message_prefix.c_str(), parameters.capture_file_name.c_str() );
+      fflush( stdout );
+    }
+  }
+
+  if ( is_stamping_enabled )
+  {
+    m_stamp_file.open( parameters.transmit_stamp_file_name.c_str(), parameters.transmit_stamp_per_byte != 0 );
+
+    if ( m_print_informational_messages )
+    {
+      printf( "%sWriting the transmitted data with clock tick stamps to file \"%s\".\n", m_informational_message_prefix.c_str(), parameters.transmit_stamp_file_name.c_str() );
+      fflush( stdout );
+    }
+  }
+
+  if ( is_record_enabled && is_replay_enabled )
+    throw std::runtime_error( "The received data cannot be recorded and replayed at the same time." );
+
+  if ( is_record_enabled )
+  {
+    m_record_file.open( parameters.receive_record_file_name.c_str() );
+
+    if ( m_print_informational_messages )
+    {
+      printf( "%sRecording the received data to file \"%s\".\n", m_informational_message_prefix.c_str(), parameters.receive_record_file_name.c_str() );
+      fflush( stdout );
+    }
+  }
+
+  if ( is_replay_enabled )
+  {
+    m_replay_file.open( parameters.receive_replay_file_name.c_str() );
+    m_is_replaying = true;
+
+    if ( m_print_informational_messages )
+    {
+      printf( "%sReplaying the received data from file \"%s\".\n", m_informational_message_prefix.c_str(), parameters.receive_replay_file_name.c_str() );
+      fflush( stdout );
+    }
+  }
+
+  if ( m_script.is_running() && m_print_informational_messages )
+  {
+    printf( "%sRunning the script in file \"%s\".\n", m_informational_message_prefix.c_str(), parameters.script_file_name.c_str() );
+    fflush( stdout );
+  }
+
+  if ( parameters.tick_all_index < -1 )
+    throw std::runtime_error( "Invalid tick_all_index parameter." );
+
+  if ( parameters.tick_all_index != -1 )
+  {
+    if ( parameters.tick_all_index >= UART_DPI_TICK_ALL_MAX_INSTANCES )
+      throw std::runtime_error( "The tick_all_index parameter is too high, define UART_DPI_TICK_ALL_MAX_INSTANCES when compiling uart_dpi.cpp in order to raise the limit." );
+
+    // The index is only reserved here, see publish_to_tick_all().
+    std::lock_guard< std::mutex > lock( s_tick_all_mutex );
+
+    if ( s_tick_all_reserved[ parameters.tick_all_index ] )
+      throw std::runtime_error( "Another instance is already using the same tick_all_index." );
+
+    s_tick_all_reserved[ parameters.tick_all_index ] = true;
+    m_tick_all_index = parameters.tick_all_index;
+  }
+
+  try
+  {
+    // The external process takes the place of the I/O thread.
+    if ( m_transport == TRANSPORT_SHM )
+    {
+      create_shm_region( unsigned( parameters.transmit_buffer_size ), unsigned( parameters.receive_buffer_size ) );
+
+      if ( checkpoint != NULL )
+        restore_checkpoint( *checkpoint );
+
+      publish_to_tick_all();
+      return;
+    }
+
+    // The C++ testbench takes the place of the I/O thread.
+    if ( m_transport == TRANSPORT_HARNESS )
+    {
+      if ( m_print_informational_messages )
+      {
+        printf( "%sAvailable to the C++ testbench as port \"%s\".\n", m_informational_message_prefix.c_str(), m_parameters.port_name.c_str() );
+        fflush( stdout );
+      }
+
+      publish_to_tick_all();
+      return;
+    }
+
+    // The multiplexing server's I/O thread takes the place of the I/O reactor.
+    if ( m_transport == TRANSPORT_MUX )
+    {
+      m_mux_channel.transmit_ring            = &m_transmit_ring;
+      m_mux_channel.receive_ring             = &m_receive_ring;
+      m_mux_channel.stats                    = &m_stats;
+      m_mux_channel.transmit_wakeup_position = &m_transmit_wakeup_position;
+      m_mux_channel.receive_wakeup_needed    = &m_receive_wakeup_needed;
+
+      m_mux_server = mux_server::acquire( parameters.tcp_port, m_listen_on_local_addr_only, m_print_informational_messages, &m_mux_channel );
+      m_mux_server->add_channel( &m_mux_channel );
+
+      if ( m_print_informational_messages )
+      {
+        printf( "%sAvailable as channel %u \"%s\" on the multiplexing server at TCP port %d.\n",
+                m_informational_message_prefix.c_str(),
+                unsigned( m_mux_channel.id ),
+                m_mux_channel.name.c_str(),
+                parameters.tcp_port );
+        fflush( stdout );
+      }
+
+      publish_to_tick_all();
+      return;
+    }
+
+    // The listening socket is created here, so that errors like "address already in use"
+    // are reported straight away. From now on, the sockets belong to the I/O thread.
+    if ( has_listening_socket() )
+      create_listening_socket();
+
+    try
+    {
+      m_reactor = io_reactor::acquire();
+
+      try
+      {
+        if ( m_transport == TRANSPORT_PTY )
+          create_pty();
+      }
+      catch ( ... )
+      {
+        io_reactor::release();
+        throw;
+      }
+    }
+    catch ( ... )
+    {
+      if ( m_listening_socket != -1 )
+        close_listening_socket();
+
+      throw;
+    }
+  }
+  catch ( ... )
+  {
+    unregister_from_tick_all();
+    throw;
+  }
+
+  m_reactor->add_instance( this );
+  publish_to_tick_all();
+}
+
+
+uart_dpi::~uart_dpi ( void )
+{
+  unregister_handle();
+  unregister_from_tick_all();
+
+  if ( m_shm_header != NULL )
+  {
+    close_shm_region();
+    return;
+  }
+
+  if ( m_mux_server != NULL )
+  {
+    m_mux_server->remove_channel( &m_mux_channel );
+    mux_server::release( m_mux_server, &m_mux_channel );
+    return;
+  }
+
+  if ( m_transport == TRANSPORT_HARNESS )
+    return;
+
+  // The I/O thread writes out the rest of the transmit stamp file when the instance is removed.
+  if ( m_stamp_file.is_open() )
+  {
+    m_stamp_file.close_entry();
+
+    if ( m_stamp_file.get_lost_byte_count() != 0 && m_print_informational_messages )
+    {
+      printf( "%s%llu transmitted bytes are missing from the transmit stamp file, because the disk could not keep up.\n",
+              m_informational_message_prefix.c_str(),
+              (unsigned long long) m_stamp_file.get_lost_byte_count() );
+      fflush( stdout );
+    }
+  }
+
+  m_reactor->remove_instance( this );
+  io_reactor::release();
+
+  if ( m_listening_socket != -1 )
+  {
+    close_listening_socket();
+  }
+
+  while ( !m_clients.empty() )
+  {
+    close_client_connection( m_clients.back() );
+  }
+
+  if ( m_pty_slave_fd != -1 )
+  {
+    close_a( m_pty_slave_fd );
+  }
+
+  if ( !m_pty_link_path.empty() )
+  {
+    unlink( m_pty_link_path.c_str() );
+  }
+}
+
+
+// Deals with the clients that have fallen a whole transmit buffer behind, according to the slow client policy.
+// In the default transmit mode, the simulation may have overwritten bytes such a client has not sent yet.
+// In lossless transmit mode, such a client holds the simulation back instead, see tick().
+
+void uart_dpi::check_slow_clients ( void )
+{
+  account_lost_transmit_bytes( m_transmit_ring.skip_overwritten_bytes() );
+
+  #ifdef UART_DPI_USE_IO_URING
+  const bool is_overwrite_blocked = m_is_overwrite_blocked.exchange( false, std::memory_order_relaxed );
+  #endif
+
+  const uint64_t read_position  = m_transmit_ring.get_read_position();
+  const uint64_t write_position = m_transmit_ring.get_write_position();
+
+  // A pending io_uring send operation keeps the data it is sending in the transmit buffer,
+  // see update_transmit_protection(), but anything older than a whole buffer counts as lost anyway.
+  const uint64_t oldest_position = std::max( read_position, write_position - std::min( write_position, uint64_t( m_transmit_ring.get_size() ) ) );
+
+  // The capture file always waits in lossless transmit mode, and loses the oldest bytes otherwise.
+  if ( m_capture_position < oldest_position )
+    m_capture_position = oldest_position;
+
+  for ( size_t i = 0; i < m_clients.size(); )
+  {
+    client_connection * const client = m_clients[i];
+
+    const bool is_overrun = client->transmit_position < oldest_position;
+
+    // While the simulation is waiting, any client that prevents the transmit buffer from draining
+    // down to the low watermark is holding it back. A client whose socket can take more data is not slow though,
+    // the I/O thread just did not get round to it yet.
+    const bool is_holding_back = m_slow_client_policy != SLOW_CLIENT_WAIT &&
+                                 m_is_transmit_blocked.load( std::memory_order_relaxed ) &&
+                                 client->is_send_stalled &&
+                                 write_position - client->transmit_position > m_transmit_low_watermark;
+
+    #ifdef UART_DPI_USE_IO_URING
+    if ( client->is_closing )
+    {
+      ++i;
+      continue;
+    }
+
+    // In the default transmit mode, a send operation pending on a stalled socket is holding back the transmit buffer
+    // as soon as the simulation has had to drop new data because of it, see update_transmit_protection().
+    const bool is_pinning_data = is_overwrite_blocked &&
+                                 client->send_operation.is_pending &&
+                                 write_position - client->send_start_position > m_transmit_ring.get_size() / 2;
+    #else
+    const bool is_pinning_data = false;
+    #endif
+
+    if ( !is_overrun && !is_holding_back && !is_pinning_data )
+    {
+      ++i;
+      continue;
+    }
+
+    // A pty cannot be disconnected, so it skips ahead instead.
+    if ( m_slow_client_policy == SLOW_CLIENT_DISCONNECT && client->is_socket )
+    {
+      if ( m_print_informational_messages )
+      {
+        printf( "%sDisconnecting a client that fell too far behind.\n", m_informational_message_prefix.c_str() );
+        fflush( stdout );
+      }
+
+      #ifdef UART_DPI_USE_IO_URING
+      if ( m_reactor->is_using_io_uring() )
+      {
+        begin_closing_connection( client );
+        ++i;
+        continue;
+      }
+      #endif
+
+      close_client_connection( client );
+      continue;
+    }
+
+    #ifdef UART_DPI_USE_IO_URING
+    // Otherwise, the simulation thread would keep dropping new data until this client took the old data.
+    if ( ( is_overrun || is_pinning_data ) && client->send_operation.is_pending )
+      m_reactor->queue_cancel( &client->send_operation );
+    #endif
+
+    // In lossless transmit mode, skip everything, so that the simulation can carry on straight away.
+    // Likewise for a client whose pending send operation has made the simulation drop new data.
+    client->transmit_position = is_holding_back || is_pinning_data ? write_position : oldest_position;
+    ++i;
+  }
+}
+
+
+// Works out how far the clients may send, according to the transmit flush policy. The simulation thread
+// moves the flush position forward, see update_transmit_flush_position(), and the I/O thread sends everything else
+// when the flush deadline expires. The deadline starts with the first byte that gets held back.
+
+void uart_dpi::update_transmit_limit ( void )
+{
+  // The flush position must be read first, so that it is never past the write position.
+  const uint64_t flush_position = m_transmit_flush_position.load( std::memory_order_acquire );
+  const uint64_t write_position = m_transmit_ring.get_write_position();
+
+  if ( m_transmit_flush_policy == TRANSMIT_FLUSH_IMMEDIATE )
+  {
+    m_transmit_limit = write_position;
+    return;
+  }
+
+  if ( m_flush_deadline != NO_FLUSH_DEADLINE && get_monotonic_time_ms() >= m_flush_deadline )
+  {
+    m_timed_flush_position = write_position;
+    m_flush_deadline = NO_FLUSH_DEADLINE;
+  }
+
+  m_transmit_limit = std::max( flush_position, m_timed_flush_position );
+
+  if ( m_transmit_limit >= write_position )
+    m_flush_deadline = NO_FLUSH_DEADLINE;
+  else if ( m_flush_deadline == NO_FLUSH_DEADLINE && m_transmit_flush_latency_ms != 0 )
+  {
+    m_flush_deadline = get_monotonic_time_ms() + m_transmit_flush_latency_ms;
+    m_reactor->schedule_flush( m_flush_deadline );
+  }
+}
+
+
+// Tells the simulation thread when to wake up the I/O thread. The idle client position is the lowest
+// transmit position among the clients that have sent everything they may, or NO_TRANSMIT_WAKEUP if there are none.
+
+void uart_dpi::set_transmit_wakeup_positions ( const uint64_t idle_client_position )
+{
+  uint64_t transmit_wakeup_position = get_capture_wakeup_position();
+
+  if ( m_transmit_flush_policy == TRANSMIT_FLUSH_IMMEDIATE )
+  {
+    m_transmit_wakeup_position = std::min( transmit_wakeup_position, idle_client_position );
+    return;
+  }
+
+  // The idle clients wait for the flush position to move forward. However, the first byte that gets held back
+  // must start the flush deadline, see update_transmit_limit().
+  if ( m_flush_deadline == NO_FLUSH_DEADLINE && m_transmit_flush_latency_ms != 0 )
+    transmit_wakeup_position = std::min( transmit_wakeup_position, idle_client_position );
+
+  m_transmit_wakeup_position = transmit_wakeup_position;
+  m_flush_wakeup_position    = idle_client_position;
+}
+
+
+// Counts the bytes that the slowest reader of the transmit buffer has lost.
+
+void uart_dpi::account_lost_transmit_bytes ( const uint64_t lost_byte_count )
+{
+  if ( lost_byte_count == 0 )
+    return;
+
+  m_stats.add( UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT, lost_byte_count );
+
+  if ( m_print_informational_messages )
+  {
+    printf( "%sThe transmit buffer overflowed, %llu bytes were lost.\n",
+            m_informational_message_prefix.c_str(),
+            (unsigned long long) lost_byte_count );
+    fflush( stdout );
+  }
+}
+
+
+// The transmit buffer space only becomes free when the slowest client has sent it,
+// and when it has been written to the capture file, if any.
+// While no client is connected, the data stays in the buffer for the next client,
+// unless there is only the capture file.
+
+void uart_dpi::release_transmitted_bytes ( void )
+{
+  bool     is_any_client_active = false;
+  uint64_t slowest_position = 0;
+
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    const client_connection * const client = m_clients[i];
+
+    #ifdef UART_DPI_USE_IO_URING
+    if ( client->is_closing )
+      continue;
+    #endif
+
+    if ( !is_any_client_active || client->transmit_position < slowest_position )
+    {
+      slowest_position = client->transmit_position;
+      is_any_client_active = true;
+    }
+  }
+
+  if ( !is_any_client_active && m_transport != TRANSPORT_NONE )
+    return;
+
+  if ( m_capture_file.is_open() && ( !is_any_client_active || m_capture_position < slowest_position ) )
+    slowest_position = m_capture_position;
+
+  m_transmit_ring.release_bytes_up_to( slowest_position );
+}
+
+
+// Fills in the iovec entries for the welcome message and the transmit buffer contents,
+// and returns how many entries were used. The caller must provide room for 2 entries.
+
+int uart_dpi::get_transmit_segments ( client_connection * const client,
+                                      iovec * const segments,
+                                      size_t * const welcome_message_len )
+{
+  int segment_count = 0;
+  *welcome_message_len = 0;
+
+  if ( client->welcome_message_pos != -1 )
+  {
+    *welcome_message_len = m_welcome_message.size() - client->welcome_message_pos;
+    assert( *welcome_message_len > 0 );
+
+    segments[0].iov_base = const_cast< char * >( m_welcome_message.data() + client->welcome_message_pos );
+    segments[0].iov_len  = *welcome_message_len;
+    segment_count = 1;
+  }
+
+  // The data stays protected from the simulation thread until it has been sent, see update_transmit_protection().
+  uint64_t intact_position = client->transmit_position;
+
+  const int data_segment_count = m_transmit_ring.protect_used_segments_from( &intact_position, &segments[ segment_count ] );
+
+  if ( intact_position != client->transmit_position )
+  {
+    // The simulation thread overwrote the next bytes after check_slow_clients() had run.
+    account_lost_transmit_bytes( m_transmit_ring.skip_bytes_up_to( intact_position ) );
+    client->transmit_position = intact_position;
+  }
+
+  client->send_start_position = client->transmit_position;
+
+  if ( data_segment_count != 0 && m_transmit_flush_policy == TRANSMIT_FLUSH_IMMEDIATE )
+  {
+    ++segment_count;
+  }
+  else if ( data_segment_count != 0 && client->transmit_position < m_transmit_limit )
+  {
+    // The data after the transmit limit is being held back.
+    segments[ segment_count ].iov_len = std::min( segments[ segment_count ].iov_len, size_t( m_transmit_limit - client->transmit_position ) );
+    ++segment_count;
+  }
+  else
+  {
+    update_transmit_protection();
+  }
+
+  return segment_count;
+}
+
+
+// Lets the simulation thread overwrite the data in the transmit buffer again, after it has been sent,
+// except for the data that pending io_uring send operations are still reading.
+
+void uart_dpi::update_transmit_protection ( void )
+{
+  uint64_t protected_position = NO_READ_PROTECTION;
+
+  #ifdef UART_DPI_USE_IO_URING
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    const client_connection * const client = m_clients[i];
+
+    if ( client->send_operation.is_pending && client->send_start_position < protected_position )
+      protected_position = client->send_start_position;
+  }
+  #endif
+
+  m_transmit_ring.set_protected_position( protected_position );
+}
+
+
+// The welcome message length must be the one get_transmit_segments() returned for the same send operation.
+
+void uart_dpi::account_sent_bytes ( client_connection * const client,
+                                    const size_t sent_byte_count,
+                                    const size_t welcome_message_len )
+{
+  size_t remaining = sent_byte_count;
+
+  if ( client->welcome_message_pos != -1 )
+  {
+    if ( remaining < welcome_message_len )
+    {
+      client->welcome_message_pos += remaining;
+      return;
+    }
+
+    remaining -= welcome_message_len;
+    client->welcome_message_pos = -1;
+  }
+
+  // The client may have skipped ahead in the meantime, see check_slow_clients().
+  const uint64_t sent_position = client->send_start_position + remaining;
+
+  if ( sent_position > client->transmit_position )
+  {
+    client->transmit_position = sent_position;
+  }
+
+  // Simulate an error after sending a fixed number of bytes.
+  if ( false )
+  {
+    static size_t totalCount = 0;
+
+    totalCount += sent_byte_count;
+
+    if ( totalCount >= 40 )
+    {
+      totalCount = 0;
+      throw std::runtime_error( "Simulated error." );
+    }
+  }
+}
+
+
+void uart_dpi::transmit_data ( client_connection * const client )
+{
+  // The welcome message and the transmit buffer contents are sent together with a single writev() call.
+  // The socket is in SOCK_NONBLOCK mode, so, if the TCP send buffer is full, writev() just fails
+  // with EAGAIN, and if it is nearly full, only some of the bytes will be accepted.
+  // Whatever is left over is sent when epoll reports that the socket is writable again.
+
+  iovec segments[2];
+  size_t welcome_message_len;
+
+  const int segment_count = get_transmit_segments( client, segments, &welcome_message_len );
+
+  if ( segment_count == 0 )
+    return;
+
+  m_stats.add( UART_DPI_STAT_SEND_CALL_COUNT, 1 );
+
+  const ssize_t sent_byte_count = writev_eintr( client->socket, segments, segment_count );
+  const int error_code = errno;
+
+  // The kernel has copied whatever it has taken.
+  update_transmit_protection();
+
+  if ( sent_byte_count == -1 )
+  {
+    if ( error_code == EAGAIN || error_code == EWOULDBLOCK )
+    {
+      // The TCP send buffer is full.
+      client->is_send_stalled = true;
+      return;
+    }
+
+    throw std::runtime_error( get_error_message( "Error sending data: ", error_code ) );
+  }
+
+  client->is_send_stalled = size_t( sent_byte_count ) < segments[0].iov_len + ( segment_count > 1 ? segments[1].iov_len : 0 );
+
+  account_sent_bytes( client, size_t( sent_byte_count ), welcome_message_len );
+}
+
+
+// Returns false if the client has closed the connection.
+
+bool uart_dpi::receive_data ( client_connection * const client )
+{
+  // Read straight into the free space of the receive buffer, which is always contiguous.
+  //
+  // If the receive buffer is full, the socket is not read at all,
+  // which provides incoming flow control.
+  //
+  // The clients that are not in control are read too, so that we notice when they disconnect,
+  // but their data is discarded.
+
+  iovec segments[1];
+  int segment_count;
+
+  const bool is_controlling_client = client == m_controlling_client;
+
+  if ( is_controlling_client )
+  {
+    segment_count = m_receive_ring.get_free_segments( segments );
+  }
+  else
+  {
+    segments[0].iov_base = m_discard_buffer;
+    segments[0].iov_len  = sizeof( m_discard_buffer );
+    segment_count = 1;
+  }
+
+  if ( segment_count == 0 )
+    return true;
+
+  m_stats.add( UART_DPI_STAT_RECEIVE_CALL_COUNT, 1 );
+
+  const ssize_t received_byte_count = readv_eintr( client->socket, segments, segment_count );
+
+  if ( received_byte_count == 0 )
+  {
+    if ( m_print_informational_messages )
+    {
+      printf( "%sConnection closed at the other end.\n", m_informational_message_prefix.c_str() );
+      fflush( stdout );
+    }
+    return false;
+  }
+
+  if ( received_byte_count == -1 )
+  {
+    if ( errno == EAGAIN || errno == EWOULDBLOCK )
+    {
+      // No data available yet.
+      return true;
+    }
+
+    throw std::runtime_error( get_error_message( "Error receiving data: ", errno ) );
+  }
+
+  if ( is_controlling_client )
+  {
+    m_receive_ring.commit_written_bytes( unsigned( received_byte_count ) );
+  }
+
+  return true;
+}
+
+
+// The data is written in large chunks, which keeps the system call count low. Everything else
+// gets written when should_flush is set, see service_periodic().
+
+void uart_dpi::write_capture_file ( const bool should_flush )
+{
+  if ( !m_capture_file.is_open() )
+    return;
+
+  iovec segments[1];
+  uint64_t intact_position = m_capture_position;
+
+  const int segment_count = m_transmit_ring.protect_used_segments_from( &intact_position, segments );
+
+  if ( intact_position != m_capture_position )
+  {
+    // The simulation thread overwrote the next bytes after check_slow_clients() had run.
+    account_lost_transmit_bytes( m_transmit_ring.skip_bytes_up_to( intact_position ) );
+    m_capture_position = intact_position;
+  }
+
+  const size_t byte_count = segment_count == 0 ? 0 : segments[0].iov_len;
+
+  try
+  {
+    if ( byte_count != 0 && ( should_flush || byte_count >= m_capture_write_threshold ) )
+    {
+      m_capture_file.write( (const uint8_t *) segments[0].iov_base, byte_count );
+      m_capture_position += byte_count;
+    }
+  }
+  catch ( ... )
+  {
+    update_transmit_protection();
+    throw;
+  }
+
+  update_transmit_protection();
+
+  if ( should_flush )
+  {
+    m_capture_file.flush();
+  }
+}
+
+
+// The simulation thread must wake up the I/O thread when there is enough data for the next
+// capture file write. Smaller amounts are left for the periodic service.
+
+uint64_t uart_dpi::get_capture_wakeup_position ( void ) const
+{
+  if ( !m_capture_file.is_open() )
+    return NO_TRANSMIT_WAKEUP;
+
+  return m_capture_position + m_capture_write_threshold - 1;
+}
+
+
+// The I/O thread calls this every PERIODIC_SERVICE_INTERVAL_MS, see needs_periodic_service().
+
+void uart_dpi::service_periodic ( void )
+{
+  if ( m_io_error.load( std::memory_order_relaxed ) )
+    return;
+
+  try
+  {
+    write_capture_file( true );
+    m_stamp_file.write( true );
+  }
+  catch ( const std::exception & e )
+  {
+    m_io_error_message = e.what();
+    m_io_error.store( true, std::memory_order_release );
+    return;
+  }
+
+  // Release the buffer space and update the wake-up positions.
+  service_io();
+}
+
+
+// Tells epoll what this instance is waiting for, which depends on the connection states
+// and on the ring buffers. This is called by the I/O thread after servicing the sockets.
+
+void uart_dpi::update_io_registration ( void )
+{
+  if ( m_listening_socket != -1 && !m_listening_socket_registered )
+  {
+    m_reactor->register_fd( m_listening_socket, EPOLLIN, this );
+    m_listening_socket_registered = true;
+  }
+
+  const bool     is_receive_buffer_full = m_receive_ring.is_full();
+  const uint64_t transmit_limit = m_transmit_flush_policy == TRANSMIT_FLUSH_IMMEDIATE ? m_transmit_ring.get_write_position()
+                                                                                      : m_transmit_limit;
+
+  uint64_t idle_client_position = NO_TRANSMIT_WAKEUP;
+
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    client_connection * const client = m_clients[i];
+
+    // If there is still data to send after transmit_data(), the socket's send buffer is full.
+    const bool is_transmit_pending = client->welcome_message_pos != -1 ||
+                                     client->transmit_position < transmit_limit;
+
+    uint32_t events = 0;
+
+    if ( is_transmit_pending )
+      events |= EPOLLOUT;
+    else if ( client->transmit_position < idle_client_position )
+      idle_client_position = client->transmit_position;
+
+    if ( client != m_controlling_client || !is_receive_buffer_full )
+      events |= EPOLLIN;
+
+    // Do not keep the socket in the epoll set without any events, because
+    // epoll always reports EPOLLHUP and EPOLLERR, and that would make the I/O thread spin.
+    if ( events != client->socket_events )
+    {
+      if ( events == 0 )
+        m_reactor->unregister_fd( client->socket );
+      else if ( client->socket_events == 0 )
+        m_reactor->register_fd( client->socket, events, this );
+      else
+        m_reactor->modify_fd( client->socket, events, this );
+
+      client->socket_events = events;
+    }
+  }
+
+  // The I/O thread is not watching the ring buffers, so the simulation thread must wake it up
+  // when new data to send arrives, or when there is room again in the receive buffer.
+  set_transmit_wakeup_positions( idle_client_position );
+  m_receive_wakeup_needed = m_controlling_client != NULL && is_receive_buffer_full;
+}
+
+
+void uart_dpi::service_io ( void )
+{
+  m_stats.add( UART_DPI_STAT_IO_SERVICE_COUNT, 1 );
+
+  // After a script has ended, a client can take control.
+  if ( m_controlling_client == NULL )
+    choose_controlling_client();
+
+  #ifdef UART_DPI_USE_IO_URING
+  if ( m_reactor->is_using_io_uring() )
+  {
+    service_io_uring();
+    return;
+  }
+  #endif
+
+  if ( m_io_error.load( std::memory_order_relaxed ) )
+    return;
+
+  try
+  {
+    if ( m_listening_socket != -1 )
+    {
+      accept_connection();
+    }
+
+    check_slow_clients();
+    update_transmit_limit();
+
+    for ( size_t i = 0; i < m_clients.size(); )
+    {
+      client_connection * const client = m_clients[i];
+
+      bool is_connection_open;
+
+      try
+      {
+        transmit_data( client );
+
+        is_connection_open = receive_data( client );
+      }
+      catch ( const std::exception & e )
+      {
+        fprintf( stderr,
+                 "%sConnection closed after error: %s\n",
+                 ERROR_MSG_PREFIX,
+                 e.what() );
+        fflush( stderr );
+
+        // Close the connection. The remote client can reconnect later.
+        is_connection_open = false;
+      }
+
+      if ( is_connection_open )
+        ++i;
+      else
+        close_client_connection( client );
+    }
+
+    write_capture_file( false );
+    m_stamp_file.write( false );
+
+    release_transmitted_bytes();
+
+    if ( m_listening_socket == -1 && has_listening_socket() && m_clients.size() < m_max_client_count )
+    {
+      create_listening_socket();
+    }
+
+    update_io_registration();
+  }
+  catch ( const std::exception & e )
+  {
+    // Let the simulation thread report the error on the next tick.
+    m_io_error_message = e.what();
+    m_io_error.store( true, std::memory_order_release );
+  }
+}
+
+
+void uart_dpi::unregister_io ( void )
+{
+  // Write out everything the simulation has sent, even if an error has stopped it.
+  if ( m_capture_file.is_open() )
+  {
+    try
+    {
+      m_capture_position = std::max( m_capture_position, m_transmit_ring.get_read_position() );
+      write_capture_file( true );
+      m_capture_file.finish();
+    }
+    catch ( const std::exception & e )
+    {
+      fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+      fflush( stderr );
+    }
+  }
+
+  try
+  {
+    m_stamp_file.finish();
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+  }
+
+  try
+  {
+    #ifdef UART_DPI_USE_IO_URING
+    if ( m_reactor->is_using_io_uring() )
+    {
+      m_is_io_being_removed = true;
+
+      if ( m_accept_operation.is_pending )
+        m_reactor->queue_cancel( &m_accept_operation );
+
+      for ( size_t i = 0; i < m_clients.size(); ++i )
+      {
+        if ( m_clients[i]->send_operation.is_pending )
+          m_reactor->queue_cancel( &m_clients[i]->send_operation );
+
+        if ( m_clients[i]->receive_operation.is_pending )
+          m_reactor->queue_cancel( &m_clients[i]->receive_operation );
+      }
+
+      // The kernel may still be accessing the buffers of the pending operations.
+      m_reactor->wait_for_operations( this );
+      return;
+    }
+    #endif
+
+    if ( m_listening_socket_registered )
+    {
+      m_reactor->unregister_fd( m_listening_socket );
+      m_listening_socket_registered = false;
+    }
+
+    for ( size_t i = 0; i < m_clients.size(); ++i )
+    {
+      if ( m_clients[i]->socket_events != 0 )
+      {
+        m_reactor->unregister_fd( m_clients[i]->socket );
+        m_clients[i]->socket_events = 0;
+      }
+    }
+  }
+  catch ( const std::exception & e )
+  {
+    // This should never happen, and the instance is going away anyway.
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+  }
+}
+
+
+#ifdef UART_DPI_USE_IO_URING
+
+// Keeps the right operations queued in the io_uring, which depends on the connection states
+// and on the ring buffers. This is the io_uring counterpart of the epoll-based service_io().
+
+void uart_dpi::service_io_uring ( void )
+{
+  if ( m_io_error.load( std::memory_order_relaxed ) || m_is_io_being_removed )
+  {
+    // Some send operations may have completed.
+    update_transmit_protection();
+    return;
+  }
+
+  try
+  {
+    check_slow_clients();
+    update_transmit_limit();
+
+    for ( size_t i = 0; i < m_clients.size(); )
+    {
+      client_connection * const client = m_clients[i];
+
+      if ( !client->is_closing )
+      {
+        queue_client_operations( client );
+      }
+      else if ( !client->send_operation.is_pending && !client->receive_operation.is_pending )
+      {
+        close_client_connection( client );
+        continue;
+      }
+
+      ++i;
+    }
+
+    write_capture_file( false );
+    m_stamp_file.write( false );
+
+    // Some send operations may have completed before this service, and none may have been queued.
+    update_transmit_protection();
+    release_transmitted_bytes();
+
+    if ( has_listening_socket() && m_clients.size() < m_max_client_count )
+    {
+      if ( m_listening_socket == -1 )
+      {
+        create_listening_socket();
+      }
+
+      // If the accept operation on the previous listening socket is still being cancelled,
+      // its completion will land here again.
+      if ( !m_accept_operation.is_pending )
+      {
+        m_reactor->queue_accept( m_listening_socket, &m_accept_operation );
+      }
+    }
+
+    // If no send operation is pending for a client, the simulation thread must wake this thread up
+    // when new data to send arrives. The controlling client has no receive operation pending
+    // only if the receive buffer is full.
+    uint64_t idle_client_position = NO_TRANSMIT_WAKEUP;
+
+    for ( size_t i = 0; i < m_clients.size(); ++i )
+    {
+      const client_connection * const client = m_clients[i];
+
+      if ( !client->is_closing &&
+           !client->send_operation.is_pending &&
+           client->transmit_position < idle_client_position )
+      {
+        idle_client_position = client->transmit_position;
+      }
+    }
+
+    set_transmit_wakeup_positions( idle_client_position );
+    m_receive_wakeup_needed = m_controlling_client != NULL && !m_controlling_client->receive_operation.is_pending;
+  }
+  catch ( const std::exception & e )
+  {
+    // Let the simulation thread report the error on the next tick.
+    m_io_error_message = e.what();
+    m_io_error.store( true, std::memory_order_release );
+  }
+}
+
+
+// There is at most one send and one receive operation pending per client. While a send operation is pending,
+// the bytes being sent stay protected, so that the simulation thread drops new bytes instead of overwriting them
+// if the transmit buffer overflows, see update_transmit_protection(). A send pending on a stalled socket
+// can therefore make the newest bytes get lost instead of the oldest ones.
+
+void uart_dpi::queue_client_operations ( client_connection * const client )
+{
+  if ( !client->send_operation.is_pending )
+  {
+    const int segment_count = get_transmit_segments( client, client->send_segments, &client->send_welcome_message_len );
+
+    if ( segment_count != 0 )
+    {
+      client->send_msg.msg_iovlen = segment_count;
+      m_stats.add( UART_DPI_STAT_SEND_CALL_COUNT, 1 );
+
+      if ( client->is_socket )
+        m_reactor->queue_sendmsg( client->socket, &client->send_msg, &client->send_operation );
+      else
+        m_reactor->queue_writev( client->socket, client->send_segments, segment_count, &client->send_operation );
+
+      client->is_send_stalled = true;
+    }
+  }
+
+  if ( !client->receive_operation.is_pending )
+  {
+    int segment_count;
+
+    // The clients that are not in control are read too, so that we notice when they disconnect,
+    // but their data is discarded.
+    client->is_receive_discarded = client != m_controlling_client;
+
+    if ( client->is_receive_discarded )
+    {
+      client->receive_segments[0].iov_base = m_discard_buffer;
+      client->receive_segments[0].iov_len  = sizeof( m_discard_buffer );
+      segment_count = 1;
+    }
+    else
+    {
+      segment_count = m_receive_ring.get_free_segments( client->receive_segments );
+    }
+
+    if ( segment_count != 0 )
+    {
+      client->receive_msg.msg_iovlen = segment_count;
+      m_stats.add( UART_DPI_STAT_RECEIVE_CALL_COUNT, 1 );
+
+      if ( client->is_socket )
+        m_reactor->queue_recvmsg( client->socket, &client->receive_msg, &client->receive_operation );
+      else
+        m_reactor->queue_readv( client->socket, client->receive_segments, segment_count, &client->receive_operation );
+    }
+  }
+}
+
+
+// The connection socket cannot be closed while operations are still pending on it,
+// because a new socket could get the same file descriptor number.
+
+void uart_dpi::begin_closing_connection ( client_connection * const client )
+{
+  if ( client->is_closing )
+    return;
+
+  client->is_closing = true;
+
+  if ( client->send_operation.is_pending )
+    m_reactor->queue_cancel( &client->send_operation );
+
+  if ( client->receive_operation.is_pending )
+    m_reactor->queue_cancel( &client->receive_operation );
+
+  if ( m_controlling_client == client )
+  {
+    m_controlling_client = NULL;
+    choose_controlling_client();
+  }
+}
+
+
+void uart_dpi::on_io_uring_completion ( io_uring_operation * const operation,
+                                        const int result,
+                                        const unsigned flags )
+{
+  client_connection * const client = operation->client;
+
+  m_stats.add( UART_DPI_STAT_IO_SERVICE_COUNT, 1 );
+
+  try
+  {
+    switch ( operation->type )
+    {
+    case io_uring_operation::OPERATION_ACCEPT:
+      // A multishot accept stays pending until a completion comes without the IORING_CQE_F_MORE flag.
+      if ( ( flags & IORING_CQE_F_MORE ) == 0 )
+        operation->is_pending = false;
+
+      if ( result >= 0 )
+      {
+        // A multishot accept may complete again before its cancellation takes effect.
+        if ( m_clients.size() >= m_max_client_count || m_is_io_being_removed || m_io_error.load( std::memory_order_relaxed ) )
+        {
+          close_a( result );
+          break;
+        }
+
+        if ( m_transport == TRANSPORT_UNIX )
+        {
+          take_accepted_connection( result, NULL, 0 );
+          break;
+        }
+
+        sockaddr_in remoteAddr;
+        socklen_t remoteAddrLen = sizeof( remoteAddr );
+
+        if ( getpeername( result, (sockaddr *) &remoteAddr, &remoteAddrLen ) == -1 )
+        {
+          const int errno_val = errno;
+          close_a( result );
+          take_accepted_connection( -errno_val, NULL, 0 );
+          break;
+        }
+
+        take_accepted_connection( result, &remoteAddr, remoteAddrLen );
+      }
+      else if ( result == -EINVAL && m_reactor->disable_multishot_accept() )
+      {
+        // The kernel does not support multishot accept. service_io_uring() queues a normal accept instead.
+      }
+      else if ( result != -ECANCELED )
+      {
+        take_accepted_connection( result, NULL, 0 );
+      }
+      break;
+
+    case io_uring_operation::OPERATION_SEND:
+      operation->is_pending = false;
+      client->is_send_stalled = false;
+
+      if ( client->is_closing || m_is_io_being_removed )
+        break;
+
+      // See check_slow_clients().
+      if ( result == -ECANCELED )
+        break;
+
+      if ( result < 0 )
+        throw std::runtime_error( get_error_message( "Error sending data: ", -result ) );
+
+      account_sent_bytes( client, size_t( result ), client->send_welcome_message_len );
+      break;
+
+    case io_uring_operation::OPERATION_RECEIVE:
+      operation->is_pending = false;
+
+      if ( client->is_closing || m_is_io_being_removed )
+        break;
+
+      if ( result == 0 )
+      {
+        if ( m_print_informational_messages )
+        {
+          printf( "%sConnection closed at the other end.\n", m_informational_message_prefix.c_str() );
+          fflush( stdout );
+        }
+        begin_closing_connection( client );
+        break;
+      }
+
+      // See the hand-over in choose_controlling_client().
+      if ( result == -ECANCELED )
+        break;
+
+      if ( result < 0 )
+        throw std::runtime_error( get_error_message( "Error receiving data: ", -result ) );
+
+      if ( !client->is_receive_discarded )
+        m_receive_ring.commit_written_bytes( unsigned( result ) );
+      break;
+
+    default:
+      assert( false );
+    }
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr,
+             "%sConnection closed after error: %s\n",
+             ERROR_MSG_PREFIX,
+             e.what() );
+    fflush( stderr );
+
+    // Close the connection. The remote client can reconnect later.
+    if ( client != NULL )
+      begin_closing_connection( client );
+  }
+
+  service_io_uring();
+}
+
+
+bool uart_dpi::has_pending_operations ( void ) const
+{
+  if ( m_accept_operation.is_pending )
+    return true;
+
+  for ( size_t i = 0; i < m_clients.size(); ++i )
+  {
+    if ( m_clients[i]->send_operation.is_pending || m_clients[i]->receive_operation.is_pending )
+      return true;
+  }
+
+  return false;
+}
+
+#endif  // #ifdef UART_DPI_USE_IO_URING
+
+
+// Records the bytes that have become visible to the simulation since the last tick,
+// and returns how many bytes there are in the receive buffer.
+// The simulation only ever reads as many bytes as the last tick reported,
+// so the bytes to record are still in the buffer.
+
+unsigned uart_dpi::record_received_bytes ( void )
+{
+  const uint64_t write_position = m_receive_ring.get_write_position();
+
+  if ( write_position != m_recorded_receive_position )
+  {
+    iovec segments[1];
+    const int segment_count = m_receive_ring.get_used_segments_from( m_recorded_receive_position, segments );
+    assert( segment_count == 1 );
+    (void) segment_count;
+
+    const size_t byte_count = size_t( write_position - m_recorded_receive_position );
+    assert( byte_count <= segments[0].iov_len );
+
+    m_record_file.record( m_tick_count, (const uint8_t *) segments[0].iov_base, byte_count );
+    m_recorded_receive_position = write_position;
+  }
+
+  return unsigned( write_position - m_receive_ring.get_read_position() );
+}
+
+
+// The simulation thread writes the replayed bytes into the receive buffer itself.
+// The I/O thread does not write to it while replaying, because no client is in control.
+
+void uart_dpi::replay_received_bytes ( void )
+{
+  const size_t byte_count = m_replay_file.get_next_byte_count();
+
+  iovec segments[1];
+  const int segment_count = m_receive_ring.get_free_segments( segments );
+
+  // The simulation consumes the received data exactly like it did when recording,
+  // so this can only happen if the simulation has changed, or the receive buffer is now smaller.
+  if ( segment_count == 0 || segments[0].iov_len < byte_count )
+    throw std::runtime_error( "The receive buffer is too small for the replayed data. The simulation has probably diverged from the recorded one." );
+
+  memcpy( segments[0].iov_base, m_replay_file.get_next_data(), byte_count );
+  m_receive_ring.commit_written_bytes( unsigned( byte_count ) );
+
+  m_replay_file.advance();
+
+  if ( m_replay_file.get_next_tick() == NO_REPLAY_TICK && m_print_informational_messages )
+  {
+    printf( "%sAll recorded data has been replayed.\n", m_informational_message_prefix.c_str() );
+    fflush( stdout );
+  }
+}
+
+
+// Returns whether a finish pattern has matched since the previous tick. See also TICK_TIME_SAMPLE_INTERVAL.
+
+bool uart_dpi::tick ( int * const received_byte_count, svBit * const transmit_blocked )
+{
+  const bool is_timed = ( m_tick_count & ( TICK_TIME_SAMPLE_INTERVAL - 1 ) ) == 0;
+  const uint64_t start_time = is_timed ? get_monotonic_time_ns() : 0;
+
+  const bool is_pattern_matched = process_tick( received_byte_count, transmit_blocked );
+
+  if ( is_timed )
+  {
+    // A tick takes just a few nanoseconds, so reading the clock is not negligible in comparison.
+    const uint64_t elapsed_time = get_monotonic_time_ns() - start_time;
+    const uint64_t tick_time = elapsed_time > m_clock_overhead_ns ? elapsed_time - m_clock_overhead_ns : 0;
+
+    if ( tick_time <= TICK_TIME_SAMPLE_MAX_NS )
+      m_stats.add( UART_DPI_STAT_TICK_TIME_NS, tick_time * TICK_TIME_SAMPLE_INTERVAL );
+  }
+
+  return is_pattern_matched;
+}
+
+
+void uart_dpi::wake_up_io_thread ( void )
+{
+  // The multiplexing server services all its channels whenever it wakes up.
+  if ( m_mux_server != NULL )
+  {
+    m_mux_server->wake_up();
+    return;
+  }
+
+  m_io_service_requested.store( true, std::memory_order_release );
+  m_reactor->wake_up();
+}
+
+
+// The I/O thread was still reading the oldest data in the transmit buffer, so new data has been dropped instead.
+// With io_uring, that can last until a stalled client takes the data, unless check_slow_clients() steps in.
+
+void uart_dpi::report_blocked_overwrite ( void )
+{
+  if ( !m_is_overwrite_blocked.exchange( true, std::memory_order_relaxed ) )
+    wake_up_io_thread();
+}
+
+
+bool uart_dpi::process_tick ( int * const received_byte_count, svBit * const transmit_blocked )
+{
+  // All socket work happens in the I/O thread, so a tick is normally just a few atomic loads.
+
+  if ( m_io_error.load( std::memory_order_acquire ) )
+  {
+    throw std::runtime_error( m_io_error_message );
+  }
+
+  // The lost wake-up race, where the I/O thread sets one of these just after
+  // the check below, is harmless: the next tick will catch it.
+  if ( m_transmit_ring.get_write_position() > m_transmit_wakeup_position.load( std::memory_order_relaxed ) ||
+       m_transmit_flush_position.load( std::memory_order_relaxed ) > m_flush_wakeup_position.load( std::memory_order_relaxed ) ||
+       ( m_receive_wakeup_needed.load( std::memory_order_relaxed ) && !m_receive_ring.is_full() ) )
+  {
+    m_transmit_wakeup_position.store( NO_TRANSMIT_WAKEUP, std::memory_order_relaxed );
+    m_flush_wakeup_position   .store( NO_TRANSMIT_WAKEUP, std::memory_order_relaxed );
+    m_receive_wakeup_needed   .store( false, std::memory_order_relaxed );
+
+    wake_up_io_thread();
+  }
+
+  if ( m_shm_header != NULL )
+  {
+    wake_up_shm_reader();
+  }
+
+  if ( m_script.is_running() )
+  {
+    run_script();
+  }
+
+  // When not replaying, this is just a comparison against NO_REPLAY_TICK.
+  if ( m_tick_count == m_replay_file.get_next_tick() )
+  {
+    replay_received_bytes();
+  }
+
+  if ( m_record_file.is_open() )
+    *received_byte_count = int( record_received_bytes() );
+  else
+    *received_byte_count = int( m_receive_ring.get_used_byte_count() );
+
+  ++m_tick_count;
+  m_stats.set( UART_DPI_STAT_TICK_COUNT, m_tick_count );
+
+  m_stats.update_peak( UART_DPI_STAT_RECEIVE_PEAK_BYTE_COUNT, unsigned( *received_byte_count ) );
+
+  // In lossless transmit mode, block the simulation when the transmit buffer is nearly full,
+  // and let it carry on when the I/O thread has drained the buffer down to the low watermark.
+  if ( m_lossless_transmit )
+  {
+    const unsigned used_byte_count = m_transmit_ring.get_used_byte_count();
+
+    bool should_check_slow_clients = false;
+
+    if ( m_is_transmit_blocked.load( std::memory_order_relaxed ) )
+    {
+      if ( used_byte_count <= m_transmit_low_watermark )
+        m_is_transmit_blocked.store( false, std::memory_order_relaxed );
+      else
+        should_check_slow_clients = ++m_blocked_tick_count % SLOW_CLIENT_CHECK_TICK_COUNT == 0;
+    }
+    else if ( m_transmit_ring.get_size() - used_byte_count < LOSSLESS_TRANSMIT_RESERVE )
+    {
+      m_is_transmit_blocked.store( true, std::memory_order_relaxed );
+      m_blocked_tick_count = 0;
+      m_stats.add( UART_DPI_STAT_TRANSMIT_STALL_COUNT, 1 );
+      should_check_slow_clients = true;
+
+      // Holding any data back now would only make the simulation wait longer.
+      // The flush wake-up position lets the next tick wake up the I/O thread.
+      if ( m_transmit_flush_policy != TRANSMIT_FLUSH_IMMEDIATE )
+        m_transmit_flush_position.store( m_transmit_ring.get_write_position(), std::memory_order_release );
+    }
+
+    // The slowest client may not be sending anything at all, so the I/O thread
+    // would not otherwise get round to applying the slow client policy.
+    if ( should_check_slow_clients && m_slow_client_policy != SLOW_CLIENT_WAIT )
+    {
+      wake_up_io_thread();
+    }
+  }
+
+  *transmit_blocked = m_is_transmit_blocked.load( std::memory_order_relaxed ) ? 1 : 0;
+
+  const bool is_pattern_matched = m_is_pattern_match_pending;
+  m_is_pattern_match_pending = false;
+  return is_pattern_matched;
+}
+
+
+// Ticks all instances that have a tick_all_index, which saves one DPI call per instance and clock cycle.
+// The results of each instance land at its tick_all_index position,
+// and positions without an instance get a count of 0 and are not blocked.
+// Returns whether a finish pattern has matched in any of the instances since the previous tick.
+//
+// The arrays are the ones in uart_dpi_pkg, which keep their contents between calls. Therefore, the empty
+// positions only need to be cleared when the set of instances changes, and each clock tick only visits
+// the positions in use, so its cost does not depend on UART_DPI_TICK_ALL_MAX_INSTANCES.
+
+bool uart_dpi::tick_all ( int * const received_byte_counts, svBit * const transmit_blocked_flags, const int count )
+{
+  // Instances are normally created and destroyed in 'initial' and 'final' sections,
+  // but even if another simulation thread registers one in the meantime, the table does not move,
+  // and the generation changes after the table does, so the next call picks the change up.
+  const unsigned generation = s_tick_all_generation.load( std::memory_order_acquire );
+
+  if ( generation != s_tick_all_seen_generation ||
+       received_byte_counts != s_tick_all_seen_counts ||
+       count != s_tick_all_seen_count )
+  {
+    s_tick_all_seen_generation = generation;
+    s_tick_all_seen_counts     = received_byte_counts;
+    s_tick_all_seen_count      = count;
+    s_tick_all_active_count    = 0;
+
+    for ( int i = 0; i < count; ++i )
+    {
+      received_byte_counts[ i ] = 0;
+      transmit_blocked_flags[ i ] = 0;
+
+      if ( i < UART_DPI_TICK_ALL_MAX_INSTANCES && s_tick_all_instances[ i ].load( std::memory_order_relaxed ) != NULL )
+        s_tick_all_active_indexes[ s_tick_all_active_count++ ] = i;
+    }
+  }
+
+  bool is_pattern_matched = false;
+
+  for ( int j = 0; j < s_tick_all_active_count; ++j )
+  {
+    const int i = s_tick_all_active_indexes[ j ];
+    uart_dpi * const instance = s_tick_all_instances[ i ].load( std::memory_order_acquire );
+
+    if ( instance == NULL )
+    {
+      // Unregistered since the last scan, which the next call notices.
+      received_byte_counts[ i ] = 0;
+      transmit_blocked_flags[ i ] = 0;
+    }
+    else
+    {
+      is_pattern_matched |= instance->tick( &received_byte_counts[ i ], &transmit_blocked_flags[ i ] );
+    }
+  }
+
+  return is_pattern_matched;
+}
+
+
+// With Verilator's --threads option, uart_dpi_tick_all() may already be running on another thread
+// while an instance is being created. The release store makes sure that it sees all members initialised.
+
+void uart_dpi::publish_to_tick_all ( void )
+{
+  if ( m_tick_all_index == -1 )
+    return;
+
+  s_tick_all_instances[ m_tick_all_index ].store( this, std::memory_order_release );
+  s_tick_all_generation.fetch_add( 1, std::memory_order_release );
+}
+
+
+void uart_dpi::unregister_from_tick_all ( void )
+{
+  if ( m_tick_all_index == -1 )
+    return;
+
+  s_tick_all_instances[ m_tick_all_index ].store( NULL, std::memory_order_relaxed );
+  s_tick_all_generation.fetch_add( 1, std::memory_order_release );
+
+  std::lock_guard< std::mutex > lock( s_tick_all_mutex );
+
+  assert( s_tick_all_reserved[ m_tick_all_index ] );
+  s_tick_all_reserved[ m_tick_all_index ] = false;
+  m_tick_all_index = -1;
+}
+
+
+// The obj value that the Verilog side keeps is a handle, and not a pointer, so that it remains valid
+// when the simulation is restored from a checkpoint in another process, see restore_all().
+// Handle 0 means no instance. A requested handle of 0 means any free handle.
+
+long long uart_dpi::register_handle ( const long long requested_handle )
+{
+  assert( m_handle == 0 );
+
+  std::lock_guard< std::mutex > lock( s_handle_mutex );
+
+  long long handle = requested_handle;
+
+  if ( handle == 0 )
+  {
+    for ( long long i = 1; i <= UART_DPI_MAX_INSTANCES && handle == 0; ++i )
+    {
+      if ( s_handles[ i - 1 ].load( std::memory_order_relaxed ) == NULL )
+        handle = i;
+    }
+
+    if ( handle == 0 )
+      throw std::runtime_error( "Too many instances, define UART_DPI_MAX_INSTANCES when compiling uart_dpi.cpp in order to raise the limit." );
+  }
+  else if ( handle < 1 || handle > UART_DPI_MAX_INSTANCES || s_handles[ handle - 1 ].load( std::memory_order_relaxed ) != NULL )
+  {
+    throw std::runtime_error( "The instance handle in the checkpoint is invalid or already in use." );
+  }
+
+  // Another simulation thread may look the instance up straight away, see from_handle().
+  s_handles[ handle - 1 ].store( this, std::memory_order_release );
+  m_handle = handle;
+  return handle;
+}
+
+
+void uart_dpi::unregister_handle ( void )
+{
+  if ( m_handle == 0 )
+    return;
+
+  std::lock_guard< std::mutex > lock( s_handle_mutex );
+
+  assert( s_handles[ m_handle - 1 ].load( std::memory_order_relaxed ) == this );
+  s_handles[ m_handle - 1 ].store( NULL, std::memory_order_relaxed );
+  m_handle = 0;
+}
+
+
+// Returns NULL if the handle is invalid.
+
+uart_dpi * uart_dpi::from_handle ( const long long handle )
+{
+  if ( handle < 1 || handle > UART_DPI_MAX_INSTANCES )
+    return NULL;
+
+  return s_handles[ handle - 1 ].load( std::memory_order_acquire );
+}
+
+
+// Returns 0 if no instance has the given port_name. Like from_handle(), it does not protect against
+// another simulation thread destroying the instance in the meantime.
+
+long long uart_dpi::find_handle ( const std::string & port_name )
+{
+  for ( long long i = 1; i <= UART_DPI_MAX_INSTANCES; ++i )
+  {
+    const uart_dpi * const instance = s_handles[ i - 1 ].load( std::memory_order_acquire );
+
+    if ( instance != NULL && instance->m_parameters.port_name == port_name )
+      return i;
+  }
+
+  return 0;
+}
+
+
+// Copies whatever the given reader has not consumed yet. Bytes that the producer has already
+// overwritten are not included, see byte_ring::overwrite_byte().
+
+static std::string copy_unread_bytes ( const byte_ring & ring )
+{
+  iovec segments[1];
+
+  if ( ring.get_unread_segments( segments ) == 0 )
+    return std::string();
+
+  return std::string( (const char *) segments[0].iov_base, segments[0].iov_len );
+}
+
+
+void uart_dpi::save_checkpoint ( instance_checkpoint * const checkpoint ) const
+{
+  // The recorded or replayed data is tied to the tick count of the simulation run that started from scratch.
+  if ( m_record_file.is_open() || m_is_replaying )
+    throw std::runtime_error( "Simulation checkpoints are not supported while recording or replaying the received data." );
+
+  checkpoint->handle     = m_handle;
+  checkpoint->parameters = m_parameters;
+
+  // The simulation thread is the producer of the transmit buffer, so its contents cannot change in the meantime,
+  // but the I/O thread may release some of it, which then does not belong to this checkpoint any more.
+  // The I/O thread may add to the receive buffer, but that data then belongs to the next checkpoint.
+  checkpoint->transmit_data = copy_unread_bytes( m_transmit_ring );
+  checkpoint->receive_data  = copy_unread_bytes( m_receive_ring );
+
+  checkpoint->tick_count          = m_tick_count;
+  checkpoint->blocked_tick_count  = m_blocked_tick_count;
+  checkpoint->is_transmit_blocked = m_is_transmit_blocked.load( std::memory_order_relaxed );
+  checkpoint->pattern_state       = m_pattern_matcher.get_state();
+  checkpoint->pattern_match_kind  = m_pattern_match_kind;
+  checkpoint->is_pattern_match_pending = m_is_pattern_match_pending;
+  checkpoint->script_state        = m_script.get_state();
+
+  get_stats( checkpoint->counters, UART_DPI_STAT_COUNT );
+}
+
+
+// Called during construction, before anybody else can access the buffers.
+
+void uart_dpi::restore_checkpoint ( const instance_checkpoint & checkpoint )
+{
+  if ( checkpoint.transmit_data.size() > m_transmit_ring.get_size() ||
+       checkpoint.receive_data.size()  > m_receive_ring.get_size() )
+  {
+    throw std::runtime_error( "The checkpoint data does not fit in the buffers." );
+  }
+
+  m_transmit_ring.overwrite_bytes( (const uint8_t *) checkpoint.transmit_data.data(), unsigned( checkpoint.transmit_data.size() ) );
+
+  // The data was held back long enough before the checkpoint.
+  m_transmit_flush_position.store( m_transmit_ring.get_write_position(), std::memory_order_relaxed );
+
+  if ( !checkpoint.receive_data.empty() )
+  {
+    iovec segments[1];
+    const int segment_count = m_receive_ring.get_free_segments( segments );
+    assert( segment_count == 1 && segments[0].iov_len >= checkpoint.receive_data.size() );
+    (void) segment_count;
+
+    memcpy( segments[0].iov_base, checkpoint.receive_data.data(), checkpoint.receive_data.size() );
+    m_receive_ring.commit_written_bytes( unsigned( checkpoint.receive_data.size() ) );
+  }
+
+  m_tick_count         = checkpoint.tick_count;
+  m_blocked_tick_count = checkpoint.blocked_tick_count;
+  m_is_transmit_blocked.store( checkpoint.is_transmit_blocked, std::memory_order_relaxed );
+
+  if ( checkpoint.pattern_match_kind < PATTERN_KIND_NONE || checkpoint.pattern_match_kind > PATTERN_KIND_FAIL )
+    throw std::runtime_error( "The checkpoint data is truncated or corrupt." );
+
+  m_pattern_matcher.set_state( checkpoint.pattern_state );
+  m_pattern_match_kind = pattern_kind_type( checkpoint.pattern_match_kind );
+  m_is_pattern_match_pending = checkpoint.is_pattern_match_pending;
+  m_is_searching_patterns = m_is_searching_patterns && m_pattern_match_kind == PATTERN_KIND_NONE;
+
+  m_script.set_state( checkpoint.script_state );
+  m_is_script_receiving = m_script.is_running();
+
+  for ( unsigned i = 0; i < UART_DPI_STAT_COUNT; ++i )
+    m_stats.set( uart_dpi_stat_index( i ), checkpoint.counters[ i ] );
+}
+
+
+// The checkpoint data is a sequence of native-endian 64-bit integers and length-prefixed strings.
+// It is only meant to be restored on the same kind of host, like the rest of a Verilator checkpoint.
+
+static void append_checkpoint_integer ( std::string * const data, const int64_t value )
+{
+  data->append( (const char *) &value, sizeof( value ) );
+}
+
+
+static void append_checkpoint_string ( std::string * const data, const std::string & value )
+{
+  append_checkpoint_integer( data, int64_t( value.size() ) );
+  data->append( value );
+}
+
+
+static void append_checkpoint_parameters ( std::string * const data, const creation_parameters & p )
+{
+  append_checkpoint_integer( data, p.tcp_port );
+  append_checkpoint_string ( data, p.endpoint );
+  append_checkpoint_integer( data, p.listen_on_local_addr_only );
+  append_checkpoint_integer( data, p.transmit_buffer_size );
+  append_checkpoint_integer( data, p.receive_buffer_size );
+  append_checkpoint_integer( data, p.lossless_transmit );
+  append_checkpoint_integer( data, p.transmit_low_watermark );
+  append_checkpoint_integer( data, p.max_client_count );
+  append_checkpoint_integer( data, p.slow_client_policy );
+  append_checkpoint_integer( data, p.transmit_flush_policy );
+  append_checkpoint_integer( data, p.transmit_flush_threshold );
+  append_checkpoint_integer( data, p.transmit_flush_latency_ms );
+  append_checkpoint_integer( data, p.socket_profile );
+  append_checkpoint_integer( data, p.socket_send_buffer_size );
+  append_checkpoint_integer( data, p.socket_receive_buffer_size );
+  append_checkpoint_string ( data, p.capture_file_name );
+  append_checkpoint_string ( data, p.transmit_stamp_file_name );
+  append_checkpoint_integer( data, p.transmit_stamp_per_byte );
+  append_checkpoint_string ( data, p.finish_pass_patterns );
+  append_checkpoint_string ( data, p.finish_fail_patterns );
+  append_checkpoint_string ( data, p.script_file_name );
+  append_checkpoint_string ( data, p.receive_record_file_name );
+  append_checkpoint_string ( data, p.receive_replay_file_name );
+  append_checkpoint_string ( data, p.stats_file_name );
+  append_checkpoint_string ( data, p.port_name );
+  append_checkpoint_string ( data, p.welcome_message );
+  append_checkpoint_integer( data, p.print_informational_messages );
+  append_checkpoint_string ( data, p.informational_message_prefix );
+  append_checkpoint_integer( data, p.tick_all_index );
+}
+
+
+class checkpoint_reader
+{
+private:
+  const std::string & m_data;
+  size_t m_pos;
+
+  void check_available ( const size_t byte_count ) const
+  {
+    if ( m_data.size() - m_pos < byte_count )
+      throw std::runtime_error( "The checkpoint data is truncated or corrupt." );
+  }
+
+public:
+  checkpoint_reader ( const std::string & data, const size_t pos )
+    : m_data( data ),
+      m_pos( pos )
+  {
+  }
+
+  int64_t read_integer ( void )
+  {
+    int64_t value;
+    check_available( sizeof( value ) );
+    memcpy( &value, m_data.data() + m_pos, sizeof( value ) );
+    m_pos += sizeof( value );
+    return value;
+  }
+
+  std::string read_string ( void )
+  {
+    const int64_t len = read_integer();
+
+    if ( len < 0 )
+      throw std::runtime_error( "The checkpoint data is truncated or corrupt." );
+
+    check_available( size_t( len ) );
+    const std::string value = m_data.substr( m_pos, size_t( len ) );
+    m_pos += size_t( len );
+    return value;
+  }
+
+  // The counterpart of append_checkpoint_parameters().
+  creation_parameters read_parameters ( void )
+  {
+    creation_parameters p;
+    p.tcp_port                     = int( read_integer() );
+    p.endpoint                     = read_string();
+    p.listen_on_local_addr_only    = (unsigned char) read_integer();
+    p.transmit_buffer_size         = int( read_integer() );
+    p.receive_buffer_size          = int( read_integer() );
+    p.lossless_transmit            = (unsigned char) read_integer();
+    p.transmit_low_watermark       = int( read_integer() );
+    p.max_client_count             = int( read_integer() );
+    p.slow_client_policy           = int( read_integer() );
+    p.transmit_flush_policy        = int( read_integer() );
+    p.transmit_flush_threshold     = int( read_integer() );
+    p.transmit_flush_latency_ms    = int( read_integer() );
+    p.socket_profile               = int( read_integer() );
+    p.socket_send_buffer_size      = int( read_integer() );
+    p.socket_receive_buffer_size   = int( read_integer() );
+    p.capture_file_name            = read_string();
+    p.transmit_stamp_file_name     = read_string();
+    p.transmit_stamp_per_byte      = (unsigned char) read_integer();
+    p.finish_pass_patterns         = read_string();
+    p.finish_fail_patterns         = read_string();
+    p.script_file_name             = read_string();
+    p.receive_record_file_name     = read_string();
+    p.receive_replay_file_name     = read_string();
+    p.stats_file_name              = read_string();
+    p.port_name                    = read_string();
+    p.welcome_message              = read_string();
+    p.print_informational_messages = (unsigned char) read_integer();
+    p.informational_message_prefix = read_string();
+    p.tick_all_index               = int( read_integer() );
+    return p;
+  }
+
+  bool is_at_end ( void ) const { return m_pos == m_data.size(); }
+};
+
+
+void uart_dpi::save_all ( std::string * const data )
+{
+  data->assign( CHECKPOINT_SIGNATURE, CHECKPOINT_SIGNATURE_LEN );
+
+  std::vector< const uart_dpi * > instances;
+
+  for ( unsigned i = 0; i < UART_DPI_MAX_INSTANCES; ++i )
+  {
+    const uart_dpi * const instance = s_handles[ i ].load( std::memory_order_acquire );
+
+    if ( instance != NULL )
+      instances.push_back( instance );
+  }
+
+  append_checkpoint_integer( data, int64_t( instances.size() ) );
+
+  for ( size_t i = 0; i < instances.size(); ++i )
+  {
+    instance_checkpoint checkpoint;
+    instances[ i ]->save_checkpoint( &checkpoint );
+
+    append_checkpoint_integer( data, checkpoint.handle );
+    append_checkpoint_parameters( data, checkpoint.parameters );
+
+    append_checkpoint_string ( data, checkpoint.transmit_data );
+    append_checkpoint_string ( data, checkpoint.receive_data );
+    append_checkpoint_integer( data, int64_t( checkpoint.tick_count ) );
+    append_checkpoint_integer( data, checkpoint.blocked_tick_count );
+    append_checkpoint_integer( data, checkpoint.is_transmit_blocked ? 1 : 0 );
+    append_checkpoint_integer( data, checkpoint.pattern_state );
+    append_checkpoint_integer( data, checkpoint.pattern_match_kind );
+    append_checkpoint_integer( data, checkpoint.is_pattern_match_pending ? 1 : 0 );
+    append_checkpoint_integer( data, checkpoint.script_state.is_running ? 1 : 0 );
+    append_checkpoint_integer( data, checkpoint.script_state.step_index );
+    append_checkpoint_integer( data, checkpoint.script_state.expect_step_index );
+    append_checkpoint_integer( data, checkpoint.script_state.pattern_state );
+    append_checkpoint_integer( data, int64_t( checkpoint.script_state.step_start_tick ) );
+    append_checkpoint_integer( data, checkpoint.script_state.send_offset );
+
+    for ( unsigned j = 0; j < UART_DPI_STAT_COUNT; ++j )
+      append_checkpoint_integer( data, int64_t( checkpoint.counters[ j ] ) );
+  }
+}
+
+
+// Destroys all existing instances, which the simulation may have created before restoring the checkpoint,
+// and re-creates the ones in the checkpoint with the same handles. The TCP clients must connect again.
+//
+// The new instances need the TCP ports, channel names, handles and so on of the old ones, so they cannot be
+// created first. If the checkpoint data is corrupt, the existing instances remain untouched. But if re-creating
+// an instance fails, for example, because another process has taken its TCP port, the ones re-created so far
+// get destroyed again, so the simulation is left without any instances, and should stop.
+
+void uart_dpi::restore_all ( const std::string & data )
+{
+  if ( data.compare( 0, CHECKPOINT_SIGNATURE_LEN, CHECKPOINT_SIGNATURE ) != 0 )
+    throw std::runtime_error( "The checkpoint data has an invalid signature." );
+
+  // Parse everything first, so that corrupt checkpoint data does not leave the simulation without its instances.
+  checkpoint_reader reader( data, CHECKPOINT_SIGNATURE_LEN );
+
+  const int64_t instance_count = reader.read_integer();
+
+  if ( instance_count < 0 || instance_count > UART_DPI_MAX_INSTANCES )
+    throw std::runtime_error( "The checkpoint data is truncated or corrupt." );
+
+  std::vector< instance_checkpoint > checkpoints( static_cast< size_t >( instance_count ) );
+
+  for ( size_t i = 0; i < checkpoints.size(); ++i )
+  {
+    instance_checkpoint & checkpoint = checkpoints[ i ];
+
+    checkpoint.handle     = reader.read_integer();
+    checkpoint.parameters = reader.read_parameters();
+
+    checkpoint.transmit_data       = reader.read_string();
+    checkpoint.receive_data        = reader.read_string();
+    checkpoint.tick_count          = uint64_t( reader.read_integer() );
+    checkpoint.blocked_tick_count  = unsigned( reader.read_integer() );
+    checkpoint.is_transmit_blocked = reader.read_integer() != 0;
+    checkpoint.pattern_state       = unsigned( reader.read_integer() );
+    checkpoint.pattern_match_kind  = int( reader.read_integer() );
+    checkpoint.is_pattern_match_pending = reader.read_integer() != 0;
+    checkpoint.script_state.is_running        = reader.read_integer() != 0;
+    checkpoint.script_state.step_index        = unsigned( reader.read_integer() );
+    checkpoint.script_state.expect_step_index = unsigned( reader.read_integer() );
+    checkpoint.script_state.pattern_state     = unsigned( reader.read_integer() );
+    checkpoint.script_state.step_start_tick   = uint64_t( reader.read_integer() );
+    checkpoint.script_state.send_offset       = unsigned( reader.read_integer() );
+
+    for ( unsigned j = 0; j < UART_DPI_STAT_COUNT; ++j )
+      checkpoint.counters[ j ] = uint64_t( reader.read_integer() );
+  }
+
+  if ( !reader.is_at_end() )
+    throw std::runtime_error( "The checkpoint data is truncated or corrupt." );
+
+  // The old instances release their TCP ports and tick_all_index positions.
+  for ( unsigned i = 0; i < UART_DPI_MAX_INSTANCES; ++i )
+    delete s_handles[ i ].load( std::memory_order_acquire );
+
+  try
+  {
+    for ( size_t i = 0; i < checkpoints.size(); ++i )
+    {
+      uart_dpi * const instance = new uart_dpi( checkpoints[ i ].parameters, &checkpoints[ i ] );
+      try
+      {
+        instance->register_handle( checkpoints[ i ].handle );
+      }
+      catch ( ... )
+      {
+        delete instance;
+        throw;
+      }
+    }
+  }
+  catch ( ... )
+  {
+    // A partial set of instances would leave some handles in the Verilog state dangling, and others working.
+    for ( unsigned i = 0; i < UART_DPI_MAX_INSTANCES; ++i )
+      delete s_handles[ i ].load( std::memory_order_acquire );
+
+    throw;
+  }
+}
+
+
+void uart_dpi::send_char ( const char character )
+{
+  const unsigned used_byte_count = m_transmit_ring.get_used_byte_count();
+
+  if ( used_byte_count >= m_transmit_ring.get_size() )
+  {
+    // In lossless transmit mode, the simulation should have waited, see tick().
+    if ( m_lossless_transmit )
+      throw std::runtime_error( "The transmit buffer is full." );
+
+    // Otherwise, the oldest byte gets discarded, or this one, if the I/O thread is sending the oldest one.
+    m_stats.add( UART_DPI_STAT_DROPPED_BYTE_COUNT, 1 );
+  }
+  else
+  {
+    m_stats.update_peak( UART_DPI_STAT_TRANSMIT_PEAK_BYTE_COUNT, used_byte_count + 1 );
+  }
+
+  const bool is_stored = m_transmit_ring.overwrite_byte( uint8_t( character ) );
+  m_stats.add( UART_DPI_STAT_TRANSMITTED_BYTE_COUNT, 1 );
+
+  if ( !is_stored )
+    report_blocked_overwrite();
+  else if ( m_transmit_flush_policy != TRANSMIT_FLUSH_IMMEDIATE )
+    update_transmit_flush_position( &character, 1 );
+
+  if ( m_stamp_file.is_open() && m_stamp_file.add( m_tick_count, uint8_t( character ) ) )
+    wake_up_io_thread();
+
+  if ( m_is_searching_patterns )
+    find_finish_patterns( &character, 1 );
+
+  if ( m_script.is_expecting() )
+    m_script.on_transmit( (const uint8_t *) &character, 1 );
+
+  for ( size_t i = 0; i < m_transmit_callbacks.size(); ++i )
+    m_transmit_callbacks[i].callback( m_transmit_callbacks[i].context, &character, 1 );
+}
+
+
+// If cycle_stamps is not NULL, it holds a stamp per byte from a counter that the caller increments
+// on every clock tick, and cycle_count is the current counter value. They date the bytes in the transmit stamp file.
+// Otherwise, the bytes get the current tick.
+
+void uart_dpi::send_block ( const char * const data,
+                            const unsigned byte_count,
+                            const int * const cycle_stamps,
+                            const int cycle_count )
+{
+  const unsigned free_byte_count = m_transmit_ring.get_size() - m_transmit_ring.get_used_byte_count();
+
+  if ( m_lossless_transmit && free_byte_count < byte_count )
+    throw std::runtime_error( "The transmit buffer is full." );
+
+  // If the transmit buffer is full, the oldest bytes get discarded. While the I/O thread is sending them,
+  // some of the newest bytes get discarded instead, and the count of discarded bytes stays the same.
+  if ( free_byte_count < byte_count )
+    m_stats.add( UART_DPI_STAT_DROPPED_BYTE_COUNT, byte_count - free_byte_count );
+
+  m_stats.update_peak( UART_DPI_STAT_TRANSMIT_PEAK_BYTE_COUNT, std::min( m_transmit_ring.get_size(), m_transmit_ring.get_size() - free_byte_count + byte_count ) );
+
+  const unsigned stored_byte_count = m_transmit_ring.overwrite_bytes( (const uint8_t *) data, byte_count );
+  m_stats.add( UART_DPI_STAT_TRANSMITTED_BYTE_COUNT, byte_count );
+
+  if ( stored_byte_count != byte_count )
+    report_blocked_overwrite();
+
+  if ( m_transmit_flush_policy != TRANSMIT_FLUSH_IMMEDIATE && stored_byte_count != 0 )
+    update_transmit_flush_position( data, stored_byte_count );
+
+  if ( m_stamp_file.is_open() )
+  {
+    bool should_wake_up = false;
+
+    for ( unsigned i = 0; i < byte_count; ++i )
+    {
+      // The counter may wrap around.
+      const uint64_t age = cycle_stamps == NULL ? 0 : unsigned( cycle_count ) - unsigned( cycle_stamps[ i ] );
+      const uint64_t tick = age < m_tick_count ? m_tick_count - age : 0;
+
+      should_wake_up |= m_stamp_file.add( tick, uint8_t( data[ i ] ) );
+    }
+
+    if ( should_wake_up )
+      wake_up_io_thread();
+  }
+
+  if ( m_is_searching_patterns )
+    find_finish_patterns( data, byte_count );
+
+  if ( m_script.is_expecting() )
+    m_script.on_transmit( (const uint8_t *) data, byte_count );
+
+  for ( size_t i = 0; i < m_transmit_callbacks.size(); ++i )
+    m_transmit_callbacks[i].callback( m_transmit_callbacks[i].context, data, byte_count );
+}
+
+
+// Called after the given data has landed in the transmit buffer. See transmit_flush_policy_type.
+
+void uart_dpi::update_transmit_flush_position ( const char * const data, const unsigned byte_count )
+{
+  const uint64_t write_position = m_transmit_ring.get_write_position();
+
+  // Only this thread writes the flush position.
+  uint64_t flush_position = m_transmit_flush_position.load( std::memory_order_relaxed );
+
+  if ( m_transmit_flush_policy == TRANSMIT_FLUSH_LINE )
+  {
+    const char * const last_eol = (const char *) memrchr( data, '\n', byte_count );
+
+    if ( last_eol != NULL )
+      flush_position = write_position - ( data + byte_count - ( last_eol + 1 ) );
+  }
+
+  if ( write_position - flush_position >= m_transmit_flush_threshold )
+    flush_position = write_position;
+
+  m_transmit_flush_position.store( flush_position, std::memory_order_release );
+}
+
+
+// Splits a finish_pass_patterns or finish_fail_patterns parameter at the FINISH_PATTERN_SEPARATOR characters.
+
+void uart_dpi::add_finish_patterns ( const char * const patterns )
+{
+  if ( patterns == NULL || patterns[0] == '\0' )
+    return;
+
+  std::istringstream stream( patterns );
+  std::string pattern;
+
+  while ( std::getline( stream, pattern, FINISH_PATTERN_SEPARATOR ) )
+  {
+    if ( !pattern.empty() )
+      m_finish_patterns.push_back( pattern );
+  }
+}
+
+
+// Called after the given data has landed in the transmit buffer. The match is reported on the next tick,
+// and the transmitted data is no longer searched afterwards.
+
+void uart_dpi::find_finish_patterns ( const char * const data, const unsigned byte_count )
+{
+  const int pattern_index = m_pattern_matcher.find( (const uint8_t *) data, byte_count, NULL );
+
+  if ( pattern_index == -1 )
+    return;
+
+  m_is_searching_patterns = false;
+
+  const pattern_kind_type kind = size_t( pattern_index ) < m_finish_pass_pattern_count ? PATTERN_KIND_PASS : PATTERN_KIND_FAIL;
+
+  if ( m_print_informational_messages )
+  {
+    printf( "%sThe transmitted data matched finish %s pattern \"%s\" at clock tick %llu.\n",
+            m_informational_message_prefix.c_str(),
+            kind == PATTERN_KIND_PASS ? "pass" : "fail",
+            m_finish_patterns[ pattern_index ].c_str(),
+            (unsigned long long) m_tick_count );
+    fflush( stdout );
+  }
+
+  report_pattern_match( kind );
+}
+
+
+// A finish pattern or the script has decided the outcome of the simulation. Only the first outcome counts,
+// and the next tick reports it.
+
+void uart_dpi::report_pattern_match ( const pattern_kind_type kind )
+{
+  if ( m_pattern_match_kind != PATTERN_KIND_NONE )
+    return;
+
+  m_pattern_match_kind = kind;
+  m_is_pattern_match_pending = true;
+}
+
+
+// The script's outcome is reported like a finish pattern, a pass if it completes, and a fail if it times out.
+
+void uart_dpi::run_script ( void )
+{
+  const console_script::result_type result = m_script.run( m_tick_count, &m_receive_ring );
+
+  if ( result == console_script::RESULT_RUNNING )
+    return;
+
+  // The release store hands the receive buffer back to the I/O thread, which lets a client take control.
+  m_is_script_receiving.store( false, std::memory_order_release );
+  wake_up_io_thread();
+
+  if ( result == console_script::RESULT_PASSED )
+  {
+    if ( m_print_informational_messages )
+    {
+      printf( "%sThe script has completed at clock tick %llu.\n",
+              m_informational_message_prefix.c_str(),
+              (unsigned long long) m_tick_count );
+      fflush( stdout );
+    }
+
+    report_pattern_match( PATTERN_KIND_PASS );
+  }
+  else
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, m_script.get_failure_message().c_str() );
+    fflush( stderr );
+
+    report_pattern_match( PATTERN_KIND_FAIL );
+  }
+}
+
+
+void uart_dpi::get_transmit_counters ( uint64_t * const lost_byte_count, uint64_t * const stall_count ) const
+{
+  *lost_byte_count = m_stats.get( UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT );
+  *stall_count     = m_stats.get( UART_DPI_STAT_TRANSMIT_STALL_COUNT );
 }
 
-uint8_t uart_dpi::deque_receive_byte ( void )
+
+void uart_dpi::get_stats ( uint64_t * const counters, const unsigned count ) const
 {
-  assert( !is_receive_buffer_empty() );
-  
-  assert( m_receive_read_pointer < m_receive_buffer_size );
-  const uint8_t b = m_receive_buffer[ m_receive_read_pointer ];
+  for ( unsigned i = 0; i < count && i < UART_DPI_STAT_COUNT; ++i )
+    counters[ i ] = m_stats.get( uart_dpi_stat_index( i ) );
+}
 
-  ++m_receive_read_pointer;
-  m_receive_read_pointer %= m_receive_buffer_size;
-  return b;
+
+char uart_dpi::receive ( void )
+{
+  if ( m_receive_ring.is_empty() )
+  {
+    throw std::runtime_error( "The receive buffer is empty." );
+  }
+
+  m_stats.add( UART_DPI_STAT_RECEIVED_BYTE_COUNT, 1 );
+
+  return char( m_receive_ring.read_byte() );
+}
+
+
+unsigned uart_dpi::receive_block ( char * const data, const unsigned max_byte_count )
+{
+  const unsigned byte_count = m_receive_ring.read_bytes( (uint8_t *) data, max_byte_count );
+
+  m_stats.add( UART_DPI_STAT_RECEIVED_BYTE_COUNT, byte_count );
+
+  return byte_count;
+}
+
+
+void uart_dpi::add_transmit_callback ( uart_dpi_transmit_callback * const callback, void * const context )
+{
+  if ( callback == NULL )
+    throw std::runtime_error( "Invalid callback parameter." );
+
+  transmit_callback_entry entry;
+  entry.callback = callback;
+  entry.context  = context;
+  m_transmit_callbacks.push_back( entry );
 }
 
-int uart_dpi::get_received_byte_count ( void )
+
+void uart_dpi::remove_transmit_callback ( uart_dpi_transmit_callback * const callback, void * const context )
 {
-  if ( m_receive_read_pointer <= m_receive_write_pointer )
+  for ( size_t i = 0; i < m_transmit_callbacks.size(); ++i )
   {
-    // any space between the first read and
-    // the first write is available.  In this case i
-    // is all in one piece.
-    return m_receive_write_pointer - m_receive_read_pointer;
+    if ( m_transmit_callbacks[i].callback == callback && m_transmit_callbacks[i].context == context )
+    {
+      m_transmit_callbacks.erase( m_transmit_callbacks.begin() + i );
+      return;
+    }
   }
 
-  const int ret = m_receive_buffer_size - ( m_receive_read_pointer - m_receive_write_pointer );
-  assert( ret > 0 );
-  return ret;
+  throw std::runtime_error( "The transmit callback is not registered." );
 }
 
 
-bool uart_dpi::is_transmit_buffer_full ( void )
+// With the harness transport, the simulation thread is the only producer of the receive buffer,
+// so the testbench can write into it directly. Returns how many bytes fitted.
+
+size_t uart_dpi::push_received_bytes ( const iovec * const segments, const int segment_count )
 {
-    return ((m_transmit_write_pointer + 1) % m_transmit_buffer_size) == m_transmit_read_pointer;
+  if ( m_transport != TRANSPORT_HARNESS )
+    throw std::runtime_error( "Only instances with endpoint \"harness\" accept received data from the C++ testbench." );
+
+  size_t pushed_byte_count = 0;
+
+  for ( int i = 0; i < segment_count; ++i )
+  {
+    iovec free_segments[1];
+    const size_t free_byte_count = m_receive_ring.get_free_segments( free_segments ) == 0 ? 0 : free_segments[0].iov_len;
+    const size_t byte_count = std::min( free_byte_count, segments[i].iov_len );
+
+    if ( byte_count == 0 )
+      break;
+
+    memcpy( free_segments[0].iov_base, segments[i].iov_base, byte_count );
+    m_receive_ring.commit_written_bytes( unsigned( byte_count ) );
+    pushed_byte_count += byte_count;
+
+    if ( byte_count < segments[i].iov_len )
+      break;
+  }
+
+  return pushed_byte_count;
 }
 
-bool uart_dpi::is_transmit_buffer_empty ( void )
+
+// With the harness transport, the simulation thread is also the only consumer of the transmit buffer.
+// The testbench takes the place of the clients, so the bytes that a full buffer has overwritten before
+// the testbench drained them count as lost, like in check_slow_clients(). There is no I/O thread
+// that could write the counter at the same time.
+
+void uart_dpi::skip_bytes_lost_by_harness ( void )
 {
-    return m_transmit_read_pointer == m_transmit_write_pointer;
+  const uint64_t lost_byte_count = m_transmit_ring.skip_overwritten_bytes();
+
+  if ( lost_byte_count != 0 )
+  {
+    m_stats.add( UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT, lost_byte_count );
+  }
 }
 
-uint8_t uart_dpi::deque_transmit_byte ( void )
+
+void uart_dpi::peek_transmitted_bytes ( const char ** const data, size_t * const byte_count )
 {
-  assert( !is_transmit_buffer_empty() );
+  if ( m_transport != TRANSPORT_HARNESS )
+    throw std::runtime_error( "Only instances with endpoint \"harness\" let the C++ testbench drain the transmitted data." );
 
-  assert( m_transmit_read_pointer < m_transmit_buffer_size );
-  const uint8_t b = m_transmit_buffer[ m_transmit_read_pointer ];
+  skip_bytes_lost_by_harness();
 
-  ++m_transmit_read_pointer;
-  m_transmit_read_pointer %= m_transmit_buffer_size;
-  return b;
+  iovec segments[1];
+
+  if ( m_transmit_ring.get_used_segments_from( m_transmit_ring.get_read_position(), segments ) == 0 )
+  {
+    *data = NULL;
+    *byte_count = 0;
+    return;
+  }
+
+  *data = (const char *) segments[0].iov_base;
+  *byte_count = segments[0].iov_len;
 }
 
 
-uart_dpi::uart_dpi ( const int tcp_port,
-                     const unsigned char listen_on_local_addr_only,
-                     const int transmit_buffer_size,
-                     const int receive_buffer_size,
-                     const char * const welcome_message,
-                     const unsigned char print_informational_messages,
-                     const char * const informational_message_prefix)
+void uart_dpi::drain_transmitted_bytes ( const size_t byte_count )
 {
-  m_listening_socket = -1;
-  m_listening_message_already_printed = false;
-  m_connectionSocket = -1;
-  m_transmit_buffer = NULL;
-  m_receive_buffer  = NULL;
+  if ( m_transport != TRANSPORT_HARNESS )
+    throw std::runtime_error( "Only instances with endpoint \"harness\" let the C++ testbench drain the transmitted data." );
+
+  skip_bytes_lost_by_harness();
+
+  const uint64_t read_position = m_transmit_ring.get_read_position();
+
+  if ( byte_count > m_transmit_ring.get_write_position() - read_position )
+    throw std::runtime_error( "Cannot drain more bytes than have been transmitted." );
+
+  m_transmit_ring.release_bytes_up_to( read_position + byte_count );
+}
+
+
+// ---------------------------- DPI interface ----------------------------
+
+int uart_dpi_create ( const int tcp_port,
+                      const char * const endpoint,
+                      const unsigned char listen_on_local_addr_only,
+                      const int transmit_buffer_size,
+                      const int receive_buffer_size,
+                      const unsigned char lossless_transmit,
+                      const int transmit_low_watermark,
+                      const int max_client_count,
+                      const int slow_client_policy,
+                      const int transmit_flush_policy,
+                      const int transmit_flush_threshold,
+                      const int transmit_flush_latency_ms,
+                      const int socket_profile,
+                      const int socket_send_buffer_size,
+                      const int socket_receive_buffer_size,
+                      const char * const capture_file_name,
+                      const char * const transmit_stamp_file_name,
+                      const unsigned char transmit_stamp_per_byte,
+                      const char * const finish_pass_patterns,
+                      const char * const finish_fail_patterns,
+                      const char * const script_file_name,
+                      const char * const receive_record_file_name,
+                      const char * const receive_replay_file_name,
+                      const char * const stats_file_name,
+                      const char * const port_name,
+                      const char * const welcome_message,
+                      const unsigned char print_informational_messages,
+                      const char * const informational_message_prefix,
+                      const int tick_all_index,
+                      long long * const obj )
+{
+  *obj = 0;  // In case of error, return the equivalent of NULL.
+             // Otherwise, the 'final' Verilog section must check whether uart_dpi_create() failed before calling uart_dpi_destroy().
+
+  uart_dpi * this_obj = NULL;
   
-  if ( tcp_port == 0 )
+  try
   {
-    throw std::runtime_error( "Invalid TCP port." );
+    creation_parameters parameters;
+    parameters.tcp_port                     = tcp_port;
+    parameters.endpoint                     = endpoint ? endpoint : "";
+    parameters.listen_on_local_addr_only    = listen_on_local_addr_only;
+    parameters.transmit_buffer_size         = transmit_buffer_size;
+    parameters.receive_buffer_size          = receive_buffer_size;
+    parameters.lossless_transmit            = lossless_transmit;
+    parameters.transmit_low_watermark       = transmit_low_watermark;
+    parameters.max_client_count             = max_client_count;
+    parameters.slow_client_policy           = slow_client_policy;
+    parameters.transmit_flush_policy        = transmit_flush_policy;
+    parameters.transmit_flush_threshold     = transmit_flush_threshold;
+    parameters.transmit_flush_latency_ms    = transmit_flush_latency_ms;
+    parameters.socket_profile               = socket_profile;
+    parameters.socket_send_buffer_size      = socket_send_buffer_size;
+    parameters.socket_receive_buffer_size   = socket_receive_buffer_size;
+    parameters.capture_file_name            = capture_file_name ? capture_file_name : "";
+    parameters.transmit_stamp_file_name     = transmit_stamp_file_name ? transmit_stamp_file_name : "";
+    parameters.transmit_stamp_per_byte      = transmit_stamp_per_byte;
+    parameters.finish_pass_patterns         = finish_pass_patterns ? finish_pass_patterns : "";
+    parameters.finish_fail_patterns         = finish_fail_patterns ? finish_fail_patterns : "";
+    parameters.script_file_name             = script_file_name ? script_file_name : "";
+    parameters.receive_record_file_name     = receive_record_file_name ? receive_record_file_name : "";
+    parameters.receive_replay_file_name     = receive_replay_file_name ? receive_replay_file_name : "";
+    parameters.stats_file_name              = stats_file_name ? stats_file_name : "";
+    parameters.port_name                    = port_name ? port_name : "";
+    parameters.welcome_message              = welcome_message ? welcome_message : "";
+    parameters.print_informational_messages = print_informational_messages;
+    parameters.informational_message_prefix = informational_message_prefix ? informational_message_prefix : "";
+    parameters.tick_all_index               = tick_all_index;
+
+    this_obj = new uart_dpi( parameters, NULL );
+
+    *obj = this_obj->register_handle( 0 );
   }
+  catch ( const std::exception & e )
+  {
+    // We should return this error string to the caller,
+    // but Verilog does not have good support for variable-length strings.
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
 
-  m_welcome_message = welcome_message ? welcome_message : "";
+    delete this_obj;
     
-  m_listening_tcp_port = tcp_port;
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
 
+    delete this_obj;
     
-  switch ( print_informational_messages )
+    return RET_FAILURE;
+  }
+
+  return RET_SUCCESS;
+}
+
+
+void uart_dpi_destroy ( const long long obj )
+{
+  const uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+  
+  delete this_obj;
+}
+
+
+int uart_dpi_send ( const long long obj, const char character )
+{
+  try
   {
-  case 0:
-    m_print_informational_messages = false;
-    break;
-      
-  case 1:
-    m_print_informational_messages = true;
-    break;
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-  default:
-    throw std::runtime_error( "Invalid print_informational_messages parameter." );
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
+
+    this_obj->send_char( character );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
   }
+  
+  return RET_SUCCESS;
+}
 
-  m_informational_message_prefix = informational_message_prefix ? informational_message_prefix : "";
-    
-  switch ( listen_on_local_addr_only )
+
+int uart_dpi_receive ( const long long obj, char * const character )
+{
+  try
   {
-  case 0:
-    m_listen_on_local_addr_only = false;
-    break;
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-  case 1:
-    m_listen_on_local_addr_only = true;
-    break;
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-  default:
-    throw std::runtime_error( "Invalid listen_on_local_addr_only parameter." );
+    *character = this_obj->receive();
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
   }
+  
+  return RET_SUCCESS;
+}
 
 
-  // The UART FIFO have 16 bytes and the UART trigger level flags range
-  // from 1 to 14, so it's safer to assume the buffer size here is at least 16 bytes.
-  const int MIN_BUFFER_SIZE = 16;
-    
-  if ( receive_buffer_size < MIN_BUFFER_SIZE )
-    throw std::runtime_error( "Invalid receive buffer size." );
+// Sends the first 'count' bytes of the given array, which saves one DPI call per byte.
 
-  m_receive_buffer_size = receive_buffer_size + 1;  // One slot remains unused.
-      
-  if ( transmit_buffer_size < MIN_BUFFER_SIZE )
-    throw std::runtime_error( "Invalid transmit buffer size." );
+int uart_dpi_send_block ( const long long obj,
+                          const svOpenArrayHandle data,
+                          const int count )
+{
+  try
+  {
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-  m_transmit_buffer_size = transmit_buffer_size + 1;  // One slot remains unused.
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-  m_receive_buffer = (uint8_t *) malloc( m_receive_buffer_size );
-  if ( m_receive_buffer == NULL )
-    throw std::runtime_error( "Out of memory allocating the receive buffer." );
-    
-  m_transmit_buffer = (uint8_t *) malloc( m_transmit_buffer_size );
-  if ( m_transmit_buffer == NULL )
-    throw std::runtime_error( "Out of memory allocating the transmit buffer." );
-
-  m_receive_write_pointer  = 0;
-  m_receive_read_pointer   = 0;
-  m_transmit_write_pointer = 0;
-  m_transmit_read_pointer  = 0;
-  
-  create_listening_socket();
+    if ( count < 0 || count > svSize( data, 1 ) )
+      throw std::runtime_error( "Invalid count parameter." );
+
+    const char * const bytes = (const char *) svGetArrayPtr( data );
+
+    if ( bytes == NULL )
+      throw std::runtime_error( "The data array is not stored contiguously." );
+
+    this_obj->send_block( bytes, unsigned( count ), NULL, 0 );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+
+  return RET_SUCCESS;
+}
+
+
+// Like uart_dpi_send_block(), but each byte comes with the value that a cycle counter had when
+// the byte was written, and 'cycle_count' is the current value of that counter. The counter must be incremented
+// on every clock tick. This way, the transmit stamp file gets the tick at which each byte was written,
+// and not the tick at which the block was sent.
+
+int uart_dpi_send_block_stamped ( const long long obj,
+                                  const svOpenArrayHandle data,
+                                  const svOpenArrayHandle cycle_stamps,
+                                  const int count,
+                                  const int cycle_count )
+{
+  try
+  {
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
+
+    if ( count < 0 || count > svSize( data, 1 ) || count > svSize( cycle_stamps, 1 ) )
+      throw std::runtime_error( "Invalid count parameter." );
+
+    const char * const bytes = (const char *) svGetArrayPtr( data );
+    const int * const stamps = (const int *) svGetArrayPtr( cycle_stamps );
+
+    if ( bytes == NULL || stamps == NULL )
+      throw std::runtime_error( "The data or cycle_stamps array is not stored contiguously." );
+
+    this_obj->send_block( bytes, unsigned( count ), stamps, cycle_count );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+
+  return RET_SUCCESS;
+}
+
+
+// Receives up to 'max_count' bytes into the given array. Unlike uart_dpi_receive(),
+// receiving nothing because the receive buffer is empty is not an error.
+
+int uart_dpi_receive_block ( const long long obj,
+                             const svOpenArrayHandle data,
+                             const int max_count,
+                             int * const received_count )
+{
+  *received_count = 0;
+
+  try
+  {
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
+
+    if ( max_count < 0 || max_count > svSize( data, 1 ) )
+      throw std::runtime_error( "Invalid max_count parameter." );
+
+    char * const bytes = (char *) svGetArrayPtr( data );
+
+    if ( bytes == NULL )
+      throw std::runtime_error( "The data array is not stored contiguously." );
+
+    *received_count = int( this_obj->receive_block( bytes, unsigned( max_count ) ) );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+
+  return RET_SUCCESS;
 }
 
 
-uart_dpi::~uart_dpi ( void )
+int uart_dpi_tick ( const long long obj,
+                    int * const received_byte_count,
+                    svBit * const transmit_blocked )
 {
-  if ( m_listening_socket != -1 )
+  try
   {
-    close_listening_socket();
-  }
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-  if ( m_connectionSocket != -1 )
+    if ( this_obj->tick( received_byte_count, transmit_blocked ) )
+      return RET_PATTERN_MATCHED;
+  }
+  catch ( const std::exception & e )
   {
-    close_current_connection();
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
   }
-
-  free( m_transmit_buffer );
-      
-  free( m_receive_buffer );
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  
+  return RET_SUCCESS;
 }
 
 
-void uart_dpi::transmit_data ( void )
+int uart_dpi_tick_all ( const svOpenArrayHandle received_byte_counts,
+                        const svOpenArrayHandle transmit_blocked_flags )
 {
-  // POSSIBLE OPTIMISATION: We could send a block of bytes at once, not just a single byte at a time.
-
-  while ( !is_transmit_buffer_empty() || m_welcome_message_pos != -1 )
+  try
   {
-    int poll_res;
-    
-    for ( ; ; )
-    {
-      pollfd polled_fd;
-
-      polled_fd.fd      = m_connectionSocket;
-      polled_fd.events  = POLLOUT | POLLERR;
-      polled_fd.revents = 0;
-
-      poll_res = poll( &polled_fd, 1, 0 );
+    int * const counts = (int *) svGetArrayPtr( received_byte_counts );
+    svBit * const flags = (svBit *) svGetArrayPtr( transmit_blocked_flags );
 
-      if ( poll_res == -1 )
-      {
-        if ( errno == EINTR )
-          continue;
+    if ( counts == NULL || flags == NULL )
+      throw std::runtime_error( "The tick_all arrays are not stored contiguously." );
 
-        throw std::runtime_error( get_error_message( "Error polling the connection socket: ", errno ) );
-      }
+    const int count = svSize( received_byte_counts, 1 );
 
-      break;
-    }
+    if ( svSize( transmit_blocked_flags, 1 ) != count )
+      throw std::runtime_error( "The tick_all arrays have different sizes." );
 
-    if ( poll_res == 0 )
-      break;
+    if ( uart_dpi::tick_all( counts, flags, count ) )
+      return RET_PATTERN_MATCHED;
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
 
-    assert( poll_res == 1 );
+  return RET_SUCCESS;
+}
 
-    uint8_t byte_to_send;
 
-    if ( m_welcome_message_pos != -1 )
-    {
-      byte_to_send = m_welcome_message[ m_welcome_message_pos ];
+// After uart_dpi_tick() or uart_dpi_tick_all() has returned RET_PATTERN_MATCHED, tells which kind of pattern
+// has matched in this instance, see pattern_kind_type. The result stays the same for the rest of the simulation.
 
-      ++m_welcome_message_pos;
+int uart_dpi_get_pattern_match ( const long long obj,
+                                 int * const pattern_kind )
+{
+  *pattern_kind = PATTERN_KIND_NONE;
 
-      if ( m_welcome_message[ m_welcome_message_pos ] == 0 )
-        m_welcome_message_pos = -1;
-    }
-    else
-    {
-      byte_to_send = deque_transmit_byte();
-    }
-      
-    send_byte( byte_to_send );
+  try
+  {
+    const uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-    // Simulate an error after sending a fixed number of bytes.
-    if ( false )
-    {
-      static int totalCount = 0;
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-      if ( ++totalCount == 40 )
-      {
-        totalCount = 0;
-        throw std::runtime_error( "Simulated error." );
-      }
-    }
+    *pattern_kind = this_obj->get_pattern_match();
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
   }
+
+  return RET_SUCCESS;
 }
 
 
-void uart_dpi::receive_data ( void )
+int uart_dpi_get_transmit_counters ( const long long obj,
+                                     long long * const lost_byte_count,
+                                     long long * const stall_count )
 {
-  // POSSIBLE OPTIMISATION: We could receive a block of bytes at once, not just a single byte at a time.
+  *lost_byte_count = 0;
+  *stall_count     = 0;
 
-  while ( !is_receive_buffer_full() )
+  try
   {
-    int poll_res;
-    
-    for ( ; ; )
-    {
-      pollfd polled_fd;
+    const uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-      polled_fd.fd      = m_connectionSocket;
-      polled_fd.events  = POLLIN | POLLERR;
-      polled_fd.revents = 0;
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-      poll_res = poll( &polled_fd, 1, 0 );
+    uint64_t lost;
+    uint64_t stalls;
+    this_obj->get_transmit_counters( &lost, &stalls );
 
-      if ( poll_res == -1 )
-      {
-        if ( errno == EINTR )
-          continue;
-        
-        throw std::runtime_error( get_error_message( "Error polling the connection socket: ", errno ) );
-      }
-      
-      break;
-    }
+    *lost_byte_count = (long long) lost;
+    *stall_count     = (long long) stalls;
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
 
-    if ( poll_res == 0 )
-      return;
+  return RET_SUCCESS;
+}
 
-    assert( poll_res == 1 );
 
-    uint8_t received_data;
+// Fills the given array with the performance counters, in the order of enum uart_dpi_stat_index.
+// If the array is shorter than UART_DPI_STAT_COUNT, only the first counters are returned,
+// and if it is longer, the rest of the array is left alone.
 
-    const ssize_t received_byte_count = recv_eintr( m_connectionSocket,
-                                                    &received_data,
-                                                    1, // Receive just 1 byte.
-                                                    0  // No special flags.
-                                                    );
-    if ( received_byte_count == 0 )
-    {
-      if ( m_print_informational_messages )
-      {
-        printf( "%sConnection closed at the other end.\n", m_informational_message_prefix.c_str() );
-        fflush( stdout );
-      }
-      close_current_connection();
-      return;
-    }
-    
-    if ( received_byte_count == -1 )
-    {
-      if ( errno == EAGAIN || errno == EWOULDBLOCK )
-      {
-        // No data available yet.
-        return;
-      }
+int uart_dpi_get_stats ( const long long obj,
+                         const svOpenArrayHandle counters )
+{
+  try
+  {
+    const uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
-      throw std::runtime_error( get_error_message( "Error receiving data: ", errno ) );
-    }
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-    assert( received_byte_count == 1 );
+    long long * const values = (long long *) svGetArrayPtr( counters );
 
-    // printf( "Received char: %c\n", received_data );
-          
-    enqueue_receive_byte( received_data );
-  }
-}
+    if ( values == NULL )
+      throw std::runtime_error( "The stats array is not stored contiguously." );
 
+    static_assert( sizeof( long long ) == sizeof( uint64_t ), "Unexpected long long size." );
 
-void uart_dpi::tick ( int * const received_byte_count )
-{
-    accept_eventual_incoming_connection();
-    
-    if ( m_connectionSocket != -1 )
-    {
-      try
-      {
-        transmit_data();
-        receive_data();
-      }
-      catch ( const std::exception & e )
-      {
-        fprintf( stderr,
-                 "%sConnection closed after error: %s\n",
-                 ERROR_MSG_PREFIX,
-                 e.what() );
-        fflush( stderr );
-    
-        // Close the connection. The remote client can reconnect later.
-        close_current_connection();
-      }
-    }
+    this_obj->get_stats( (uint64_t *) values, unsigned( svSize( counters, 1 ) ) );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
 
-    *received_byte_count = get_received_byte_count();
+  return RET_SUCCESS;
 }
 
 
-void uart_dpi::send_char ( const char character )
+int uart_dpi_save_checkpoint ( std::string * const data )
 {
-  if ( is_transmit_buffer_full() )
+  try
   {
-    deque_transmit_byte();
-    assert( ! is_transmit_buffer_full() );
+    uart_dpi::save_all( data );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%sError saving a simulation checkpoint: %s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
   }
 
-  assert( m_transmit_write_pointer < m_transmit_buffer_size );
-  m_transmit_buffer[ m_transmit_write_pointer ] = character;
-
-  ++m_transmit_write_pointer;
-  m_transmit_write_pointer %= m_transmit_buffer_size;
+  return RET_SUCCESS;
 }
 
 
-char uart_dpi::receive ( void )
+int uart_dpi_restore_checkpoint ( const std::string & data )
 {
-  if ( is_receive_buffer_empty() )
+  try
   {
-    throw std::runtime_error( "The receive buffer is empty." );
+    uart_dpi::restore_all( data );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%sError restoring a simulation checkpoint: %s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
   }
 
-  return deque_receive_byte();
+  return RET_SUCCESS;
 }
 
 
-// ---------------------------- DPI interface ----------------------------
+// ---------------------------- C++ testbench interface, see uart_dpi.h ----------------------------
 
-int uart_dpi_create ( const int tcp_port,
-                      const unsigned char listen_on_local_addr_only,
-                      const int transmit_buffer_size,
-                      const int receive_buffer_size,
-                      const char * const welcome_message,
-                      const unsigned char print_informational_messages,
-                      const char * const informational_message_prefix,
-                      long long * const obj )
+long long uart_dpi_find_instance ( const char * const port_name )
 {
-  *obj = 0;  // In case of error, return the equivalent of NULL.
-             // Otherwise, the 'final' Verilog section must check whether uart_dpi_create() failed before calling uart_dpi_destroy().
+  if ( port_name == NULL )
+    return 0;
 
-  uart_dpi * this_obj = NULL;
-  
+  return uart_dpi::find_handle( port_name );
+}
+
+
+int uart_dpi_add_transmit_callback ( const long long obj,
+                                     uart_dpi_transmit_callback * const callback,
+                                     void * const context )
+{
   try
   {
-    this_obj = new uart_dpi( tcp_port,
-                             listen_on_local_addr_only,
-                             transmit_buffer_size,
-                             receive_buffer_size,
-                             welcome_message,
-                             print_informational_messages,
-                             informational_message_prefix );
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
 
-    // Here there was something else in the past, that's the reason
-    // behind the delete in the catch section.
+    this_obj->add_transmit_callback( callback, context );
   }
   catch ( const std::exception & e )
   {
-    // We should return this error string to the caller,
-    // but Verilog does not have good support for variable-length strings.
     fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
     fflush( stderr );
-
-    delete this_obj;
-    
     return RET_FAILURE;
   }
   catch ( ... )
   {
     fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
     fflush( stderr );
-
-    delete this_obj;
-    
     return RET_FAILURE;
   }
 
-  assert( sizeof(*obj) >= sizeof(this_obj) );
-  *obj = (long long)this_obj;
   return RET_SUCCESS;
 }
 
 
-void uart_dpi_destroy ( const long long obj )
+int uart_dpi_remove_transmit_callback ( const long long obj,
+                                        uart_dpi_transmit_callback * const callback,
+                                        void * const context )
 {
-  const uart_dpi * const this_obj = (uart_dpi *)obj;
-  
-  delete this_obj;
+  try
+  {
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
+
+    if ( this_obj == NULL )
+      throw std::runtime_error( "Invalid obj parameter." );
+
+    this_obj->remove_transmit_callback( callback, context );
+  }
+  catch ( const std::exception & e )
+  {
+    fprintf( stderr, "%s%s\n", ERROR_MSG_PREFIX, e.what() );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+  catch ( ... )
+  {
+    fprintf( stderr, "%sUnexpected C++ exception.\n", ERROR_MSG_PREFIX );
+    fflush( stderr );
+    return RET_FAILURE;
+  }
+
+  return RET_SUCCESS;
 }
 
 
-int uart_dpi_send ( const long long obj, const char character )
+int uart_dpi_push_received ( const long long obj,
+                             const iovec * const segments,
+                             const int segment_count,
+                             size_t * const pushed_byte_count )
 {
+  *pushed_byte_count = 0;
+
   try
   {
-    uart_dpi * const this_obj = (uart_dpi *)obj;
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
     if ( this_obj == NULL )
       throw std::runtime_error( "Invalid obj parameter." );
 
-    this_obj->send_char( character );
+    if ( segment_count < 0 )
+      throw std::runtime_error( "Invalid segment_count parameter." );
+
+    *pushed_byte_count = this_obj->push_received_bytes( segments, segment_count );
   }
   catch ( const std::exception & e )
   {
@@ -917,21 +9022,26 @@ int uart_dpi_send ( const long long obj, const char character )
     fflush( stderr );
     return RET_FAILURE;
   }
-  
+
   return RET_SUCCESS;
 }
 
 
-int uart_dpi_receive ( const long long obj, char * const character )
+int uart_dpi_peek_transmitted ( const long long obj,
+                                const char ** const data,
+                                size_t * const byte_count )
 {
+  *data = NULL;
+  *byte_count = 0;
+
   try
   {
-    uart_dpi * const this_obj = (uart_dpi *)obj;
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
     if ( this_obj == NULL )
       throw std::runtime_error( "Invalid obj parameter." );
 
-    *character = this_obj->receive();
+    this_obj->peek_transmitted_bytes( data, byte_count );
   }
   catch ( const std::exception & e )
   {
@@ -945,22 +9055,22 @@ int uart_dpi_receive ( const long long obj, char * const character )
     fflush( stderr );
     return RET_FAILURE;
   }
-  
+
   return RET_SUCCESS;
 }
 
 
-int uart_dpi_tick ( const long long obj,
-                    int * const received_byte_count )
+int uart_dpi_drain_transmitted ( const long long obj,
+                                 const size_t byte_count )
 {
   try
   {
-    uart_dpi * const this_obj = (uart_dpi *)obj;
+    uart_dpi * const this_obj = uart_dpi::from_handle( obj );
 
     if ( this_obj == NULL )
       throw std::runtime_error( "Invalid obj parameter." );
 
-    this_obj->tick( received_byte_count );
+    this_obj->drain_transmitted_bytes( byte_count );
   }
   catch ( const std::exception & e )
   {
@@ -974,6 +9084,6 @@ int uart_dpi_tick ( const long long obj,
     fflush( stderr );
     return RET_FAILURE;
   }
-  
+
   return RET_SUCCESS;
 }
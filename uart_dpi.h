@@ -0,0 +1,71 @@
+// C++ interface of the UART DPI module for Verilator testbenches, see section "C++ testbench interface" in README.pod.
+//
+// The Verilog side creates the instances. The testbench finds them by the port_name parameter afterwards,
+// and then uses the obj handle with the routines below:
+//
+//   const long long uart0 = uart_dpi_find_instance( "UART0" );
+//
+//   uart_dpi_add_transmit_callback( uart0, &on_uart0_output, &my_checker );
+//
+//   const char text[] = "help\n";
+//   size_t pushed_byte_count;
+//   uart_dpi_push_received( uart0, text, sizeof( text ) - 1, &pushed_byte_count );
+//
+// Transmit callbacks work with any endpoint. Pushing received data and draining the transmitted data
+// need endpoint "harness", where the testbench takes the place of the TCP clients.
+//
+// All routines must be called from the simulation thread that evaluates the instance, between two evaluations
+// of the model. They return 0 on success. Otherwise, they print an error message and return a non-zero value,
+// like the DPI routines.
+//
+// This header also provides the simulation checkpoint routines, see uart_dpi_checkpoint.h .
+// Restoring a checkpoint re-creates the instances, so register the transmit callbacks again afterwards.
+
+#ifndef UART_DPI_H_INCLUDED
+#define UART_DPI_H_INCLUDED
+
+#include "uart_dpi_checkpoint.h"
+
+#include <stddef.h>
+#include <sys/uio.h>  // For iovec.
+
+
+// Returns the obj handle of the instance with the given port_name, or 0 if there is none.
+// If several instances have the same port_name, the one with the lowest handle is returned.
+long long uart_dpi_find_instance ( const char * port_name );
+
+
+// Called with each piece of data that the simulated software transmits, straight from the caller's buffer,
+// as soon as the data lands in the transmit buffer. The data is only valid during the call.
+// A callback must not add or remove callbacks, or create or destroy instances.
+typedef void uart_dpi_transmit_callback ( void * context, const char * data, size_t byte_count );
+
+int uart_dpi_add_transmit_callback    ( long long obj, uart_dpi_transmit_callback * callback, void * context );
+int uart_dpi_remove_transmit_callback ( long long obj, uart_dpi_transmit_callback * callback, void * context );
+
+
+// Endpoint "harness" only. Writes as much of the given data into the receive buffer as fits,
+// as if a client had typed it, and returns how much that was in pushed_byte_count.
+int uart_dpi_push_received ( long long obj, const iovec * segments, int segment_count, size_t * pushed_byte_count );
+
+inline int uart_dpi_push_received ( const long long obj, const char * const data, const size_t byte_count, size_t * const pushed_byte_count )
+{
+  iovec segment;
+  segment.iov_base = const_cast< char * >( data );
+  segment.iov_len  = byte_count;
+
+  return uart_dpi_push_received( obj, &segment, 1, pushed_byte_count );
+}
+
+
+// Endpoint "harness" only. Returns the transmitted data that has not been drained yet, without copying it.
+// The data is contiguous, even if it wraps around the end of the transmit buffer, and remains valid
+// until the next call to uart_dpi_drain_transmitted() or the next evaluation of the model.
+int uart_dpi_peek_transmitted ( long long obj, const char ** data, size_t * byte_count );
+
+// Makes room in the transmit buffer again. The byte count cannot be higher than what
+// uart_dpi_peek_transmitted() returned. In lossless transmit mode, the simulation waits until
+// the testbench drains the data, like it would wait for a slow client.
+int uart_dpi_drain_transmitted ( long long obj, size_t byte_count );
+
+#endif  // Include this header file only once.
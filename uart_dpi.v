@@ -88,6 +88,45 @@
 `define UART_DPI_IIR_THRE 3'b001 // Transmitter Holding Register empty
 `define UART_DPI_IIR_MS   3'b000 // Modem Status
 
+// Maximum number of UART DPI instances that can be ticked together by module uart_dpi_tick_all.
+`ifndef UART_DPI_TICK_ALL_MAX_INSTANCES
+  `define UART_DPI_TICK_ALL_MAX_INSTANCES 256
+`endif
+
+
+package uart_dpi_pkg;
+
+   // Written by module uart_dpi_tick_all, read by each uart_dpi instance at its tick_all_index position.
+   int tick_all_received_byte_counts  [`UART_DPI_TICK_ALL_MAX_INSTANCES];
+   bit tick_all_transmit_blocked_flags [`UART_DPI_TICK_ALL_MAX_INSTANCES];
+   bit tick_all_pattern_matched;  // A finish pattern has matched in one of the instances.
+
+   // Returned by uart_dpi_tick() and uart_dpi_tick_all() when a finish pattern has matched.
+   localparam UART_DPI_RET_PATTERN_MATCHED = 2;
+
+   // Values returned by uart_dpi_get_pattern_match().
+   localparam UART_DPI_PATTERN_KIND_NONE = 0;
+   localparam UART_DPI_PATTERN_KIND_PASS = 1;
+   localparam UART_DPI_PATTERN_KIND_FAIL = 2;
+
+   // Indices into the array filled by uart_dpi_get_stats(), see uart_dpi_stats.h .
+   localparam UART_DPI_STAT_TICK_COUNT                = 0;
+   localparam UART_DPI_STAT_TICK_TIME_NS              = 1;
+   localparam UART_DPI_STAT_TRANSMITTED_BYTE_COUNT    = 2;
+   localparam UART_DPI_STAT_RECEIVED_BYTE_COUNT       = 3;
+   localparam UART_DPI_STAT_DROPPED_BYTE_COUNT        = 4;
+   localparam UART_DPI_STAT_TRANSMIT_STALL_COUNT      = 5;
+   localparam UART_DPI_STAT_TRANSMIT_PEAK_BYTE_COUNT  = 6;
+   localparam UART_DPI_STAT_RECEIVE_PEAK_BYTE_COUNT   = 7;
+   localparam UART_DPI_STAT_IO_SERVICE_COUNT          = 8;
+   localparam UART_DPI_STAT_SEND_CALL_COUNT           = 9;
+   localparam UART_DPI_STAT_RECEIVE_CALL_COUNT        = 10;
+   localparam UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT = 11;
+   localparam UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT    = 12;
+   localparam UART_DPI_STAT_COUNT                     = 13;
+
+endpackage
+
 
 module uart_dpi
                #(
@@ -104,6 +143,16 @@ module uart_dpi
                  welcome_message = "Welcome to the UART DPI simulated serial interface.\n\r",
                  character_timeout_clk_count = 100,  // See the README file on how to calculate this accurately, should you need it.
 
+                 // Where the UART is made available. If empty, it listens on TCP port tcp_port. Otherwise, tcp_port is ignored, except for "mux", and:
+                 //   "unix:/path/to/socket"  listens on a Unix domain socket.
+                 //   "pty" or "pty:/path/to/link"  creates a pseudo-terminal like /dev/pts/5, optionally with a symbolic link to it.
+                 //   "shm:/name"  creates a shared memory region with shm_open() for an external test harness on the same host.
+                 //   "mux" or "mux:name"  becomes a channel of the multiplexing server on TCP port tcp_port, which all such
+                 //                        instances share. The channel name defaults to port_name. See the README file.
+                 //   "harness"  no socket at all, a C++ testbench exchanges the data in-process through uart_dpi.h ,
+                 //              and finds the instance by its port_name. See the README file.
+                 parameter endpoint = "",
+
                  // Whether the TCP server listens on localhost / 127.0.0.1 only. Otherwise,
                  // it listens on all IP addresses, which means any computer
                  // in the network can connect to the UART DPI module.
@@ -112,10 +161,95 @@ module uart_dpi
                  parameter receive_buffer_size  = (100 * 1024),
                  parameter transmit_buffer_size = (100 * 1024),
 
+                 // What happens when the transmit buffer fills up:
+                 //   0: The oldest bytes are discarded. The simulated SoC never waits.
+                 //   1: Lossless mode. Writes to the THR get Wishbone wait states until the transmit buffer
+                 //      has drained down to transmit_low_watermark bytes.
+                 //   2: Lossless mode like 1, but LSR.THRE and LSR.TEMT are also cleared in the meantime,
+                 //      and the THRE interrupt triggers again afterwards.
+                 parameter transmit_flow_control = 0,
+                 parameter transmit_low_watermark = -1,  // In bytes, -1 means half the transmit buffer.
+
+                 // How many TCP clients can be connected at the same time. They all get the transmitted data,
+                 // but only the first one to connect can send data to the simulated UART.
+                 parameter max_client_count = 1,
+
+                 // What to do with a client that falls too far behind:
+                 //   0: Nothing. In lossless transmit mode, the simulation waits for it.
+                 //   1: The client skips ahead and loses the data in between.
+                 //   2: The client gets disconnected.
+                 parameter slow_client_policy = 0,
+
+                 // When the clients get the transmitted data, see the README file:
+                 //   0: Straight away.
+                 //   1: Line-buffered, up to the last end-of-line character (\n).
+                 //   2: When transmit_flush_threshold bytes have accumulated.
+                 //   3: When the oldest byte has waited for transmit_flush_latency_ms.
+                 // With policies 1 and 2, no data waits longer than transmit_flush_latency_ms either, unless it is 0.
+                 parameter transmit_flush_policy = 0,
+                 parameter transmit_flush_threshold = -1,  // In bytes, -1 means half the transmit buffer, which is also the maximum.
+                 parameter transmit_flush_latency_ms = 100,
+
+                 // Socket options for the client connections:
+                 //   0: The operating system defaults.
+                 //   1: Interactive, for consoles. Sets TCP_NODELAY for the lowest keystroke latency.
+                 //   2: Bulk, for log channels. Sets TCP_CORK and 1 MiB socket buffers, for fewer and larger TCP segments.
+                 // The buffer sizes set SO_SNDBUF and SO_RCVBUF, 0 means the default for the profile.
+                 parameter socket_profile = 0,
+                 parameter socket_send_buffer_size = 0,
+                 parameter socket_receive_buffer_size = 0,
+
+                 // If not empty, the transmitted data is also written to this file. A file name ending in ".zst" or ".lz4"
+                 // means compressed data, see the README file. With a tcp_port of 0, there is no TCP server
+                 // and the data only goes to the file.
+                 parameter capture_file_name = "",
+
+                 // If not empty, the plusarg with this name overrides capture_file_name at run time.
+                 // For example, with capture_plusarg = "uart0_capture", pass +uart0_capture=uart0.log to the simulator.
+                 parameter capture_plusarg = "",
+
+                 // If not empty, the transmitted data is also written to this file, together with the clock cycle
+                 // at which the software wrote each line (or each byte, with transmit_stamp_per_byte = 1).
+                 // Tool uart_dpi_stamps prints it. See the README file.
+                 parameter transmit_stamp_file_name = "",
+                 parameter transmit_stamp_per_byte = 0,
+
+                 // The simulation finishes early when the transmitted data contains one of these patterns,
+                 // separated by '|', for example "TEST FAILED|Kernel panic". A pass pattern calls $finish,
+                 // and a fail pattern calls $fatal, so that the simulator exits with a non-zero status.
+                 // The patterns only match the first time. See the README file.
+                 parameter finish_pass_patterns = "",
+                 parameter finish_fail_patterns = "",
+
+                 // How many clock cycles to carry on after a match, so that the rest of the message gets out.
+                 // With -1, the simulation does not finish, and the testbench can check variable pattern_match_kind instead.
+                 parameter finish_delay_clk_count = 0,
+
+                 // If not empty, this script file types into the console instead of the TCP clients,
+                 // for example, it waits for "login:" and then sends "root\n". Its end counts as a pass pattern match,
+                 // and a timeout as a fail pattern match, see finish_delay_clk_count. See the README file.
+                 parameter script_file_name = "",
+
+                 // If not empty, the received data is recorded to this file, together with the clock cycle
+                 // at which each byte arrived. A later simulation can then replay the same data
+                 // at the same clock cycles from the file, instead of taking it from the TCP clients.
+                 // See the README file for the conditions.
+                 parameter receive_record_file_name = "",
+                 parameter receive_replay_file_name = "",
+
+                 // If not empty, the performance counters are kept in this memory-mapped file,
+                 // where an external tool can watch them while the simulation runs. See the README file.
+                 parameter stats_file_name = "",
+
                  // Whether the C++ side prints informational messages to stdout.
                  // Error messages cannot be turned off and get printed to stderr.
                  parameter print_informational_messages = 1,
 
+                 // By default, each instance calls the C++ side on every clock cycle. If you have many instances,
+                 // you can instantiate module uart_dpi_tick_all once instead, and give each instance
+                 // a different tick_all_index, starting from 0. All such instances must use the same clock.
+                 parameter tick_all_index = -1,
+
                  TRACE_DATA = 0
                 )
                 ( input  wire wb_clk_i,
@@ -135,19 +269,54 @@ module uart_dpi
                   output wire       int_o  // UART interrupt request
                 );
 
+   // None of these imports is "pure", because they all have side effects, and none is "context", because none
+   // calls back into Verilog. With Verilator's --threads option, add --threads-dpi all, so that instances
+   // on different threads can call them at the same time. See the README file for details.
    import "DPI-C" function int uart_dpi_create ( input integer  tcp_port,
+                                                 input string   endpoint,
                                                  input bit      listen_on_local_addr_only,
                                                  input int      transmit_buffer_size,
                                                  input int      receive_buffer_size,
+                                                 input bit      lossless_transmit,
+                                                 input int      transmit_low_watermark,
+                                                 input int      max_client_count,
+                                                 input int      slow_client_policy,
+                                                 input int      transmit_flush_policy,
+                                                 input int      transmit_flush_threshold,
+                                                 input int      transmit_flush_latency_ms,
+                                                 input int      socket_profile,
+                                                 input int      socket_send_buffer_size,
+                                                 input int      socket_receive_buffer_size,
+                                                 input string   capture_file_name,
+                                                 input string   transmit_stamp_file_name,
+                                                 input bit      transmit_stamp_per_byte,
+                                                 input string   finish_pass_patterns,
+                                                 input string   finish_fail_patterns,
+                                                 input string   script_file_name,
+                                                 input string   receive_record_file_name,
+                                                 input string   receive_replay_file_name,
+                                                 input string   stats_file_name,
+                                                 input string   port_name,
                                                  input string   welcome_message,
                                                  input bit      print_informational_messages,
                                                  input string   informational_message_prefix,
+                                                 input int      tick_all_index,
                                                  output longint obj );
 
-   import "DPI-C" function int uart_dpi_send    ( input longint obj, input  byte character );
-   import "DPI-C" function int uart_dpi_receive ( input longint obj, output byte character );
+   // These transfer several bytes with a single DPI call, see the staging buffers below.
+   import "DPI-C" function int uart_dpi_send_block    ( input longint obj, input  byte data[], input int count );
+   import "DPI-C" function int uart_dpi_send_block_stamped ( input longint obj, input byte data[], input int cycle_stamps[],
+                                                             input int count, input int cycle_count );
+   import "DPI-C" function int uart_dpi_receive_block ( input longint obj, output byte data[], input int max_count, output int received_count );
+
+   import "DPI-C" function int uart_dpi_tick ( input longint obj, output int received_byte_count, output bit transmit_blocked );
+
+   import "DPI-C" function int uart_dpi_get_pattern_match ( input longint obj, output int pattern_kind );
 
-   import "DPI-C" function int uart_dpi_tick ( input longint obj, output int received_byte_count );
+   import "DPI-C" function int uart_dpi_get_transmit_counters ( input longint obj, output longint lost_byte_count, output longint stall_count );
+
+   // Fills the array with the performance counters, see task get_stats below.
+   import "DPI-C" function int uart_dpi_get_stats ( input longint obj, output longint counters[] );
 
    // It is not necessary to call uart_dpi_destroy(). However, calling it
    // will release all resources associated with the UART DPI instance, and that can help
@@ -169,6 +338,11 @@ module uart_dpi
    localparam UART_DPI_REG_DL_LS = 0; // Divisor latch, same address as UART_DPI_REG_THR.
    localparam UART_DPI_REG_DL_MS = 1; // Divisor latch, same address as UART_DPI_REG_IER.
 
+   // Values for the transmit_flow_control parameter.
+   localparam TRANSMIT_FLOW_CONTROL_NONE        = 0;
+   localparam TRANSMIT_FLOW_CONTROL_WAIT_STATES = 1;
+   localparam TRANSMIT_FLOW_CONTROL_LSR         = 2;
+
 
    // ---- UART registers begin.
    reg [7:0] uart_reg_lcr;
@@ -180,7 +354,8 @@ module uart_dpi
    //  ---- UART registers end.
 
    longint   obj;  // There can be several instances of this module, and each one has a diferent obj value,
-                   // which is a pointer to a class instance on the C++ side.
+                   // which is a handle to a class instance on the C++ side. It is not a pointer,
+                   // so that it remains valid when a simulation checkpoint is restored.
 
    // The simulated UART is always ready to take new data to send, therefore
    // the THRE interrupt always triggers when enabled. This interrupt flag must be
@@ -188,6 +363,38 @@ module uart_dpi
    // as soon as the UART client sends the next data byte.
    bit       transmitter_holding_register_empty_interrupt_pending;
    int       last_rcvr_fifo_read_clk_counter;  // For the Character Timeout.
+   bit       was_transmit_blocked;  // For the THRE interrupt in lossless transmit mode.
+
+   // A copy of the first bytes in the C++ receive buffer, so that most RBR reads do not need a DPI call.
+   // When the client reads from an empty shadow FIFO, it gets refilled in one go.
+   // The UART client sees the sum of both buffers, so the shadow FIFO does not change
+   // the LSR.DR flag, the trigger levels or the character timeout.
+   localparam RX_SHADOW_FIFO_SIZE = 16;
+   byte      rx_shadow_fifo [RX_SHADOW_FIFO_SIZE];
+   int       rx_shadow_fifo_pos;    // Index of the next byte to return.
+   int       rx_shadow_fifo_count;  // Bytes left from rx_shadow_fifo_pos onwards.
+
+   // Bytes written to the THR are collected here and sent to the C++ side in one go, when the buffer is full
+   // or when the client has not written anything for character_timeout_clk_count clock cycles.
+   localparam TX_STAGING_BUFFER_SIZE = 16;
+   byte      tx_staging_buffer [TX_STAGING_BUFFER_SIZE];
+   int       tx_staging_count;
+   int       tx_staging_flush_clk_counter;
+
+   // With a transmit stamp file, each staged byte remembers the clock cycle it was written at,
+   // so that the staging delay does not show in the stamps.
+   bit       tx_stamps_enabled;
+   int       tx_cycle_count;  // Incremented on every clock cycle, may wrap around.
+   int       tx_staging_cycles [TX_STAGING_BUFFER_SIZE];
+
+   // One of uart_dpi_pkg::UART_DPI_PATTERN_KIND_xxx, set when a finish pattern matches.
+   // A testbench can read it with a hierarchical reference, like uart_dpi_instance2.pattern_match_kind .
+   int       pattern_match_kind;
+   int       pattern_finish_clk_counter;
+
+
+   // Avoids an out-of-range constant index when tick_all_index is -1.
+   localparam TICK_ALL_ARRAY_INDEX = tick_all_index < 0 ? 0 : tick_all_index;
 
 
    `define UART_DPI_ERROR_PREFIX       { port_name, " error: " }
@@ -256,6 +463,82 @@ module uart_dpi
    endfunction;
 
 
+   task automatic flush_tx_staging_buffer;
+      begin
+         if ( tx_staging_count != 0 )
+           begin
+              if ( tx_stamps_enabled )
+                begin
+                   if ( 0 != uart_dpi_send_block_stamped( obj, tx_staging_buffer, tx_staging_cycles, tx_staging_count, tx_cycle_count ) )
+                     begin
+                        $display( "%sError sending data.", `UART_DPI_ERROR_PREFIX );
+                        $finish;
+                     end;
+                end
+              else if ( 0 != uart_dpi_send_block( obj, tx_staging_buffer, tx_staging_count ) )
+                begin
+                   $display( "%sError sending data.", `UART_DPI_ERROR_PREFIX );
+                   $finish;
+                end;
+
+              tx_staging_count = 0;
+           end;
+      end
+   endtask
+
+
+   task automatic take_pattern_match;
+      begin
+         int pattern_kind;
+
+         if ( 0 != uart_dpi_get_pattern_match( obj, pattern_kind ) )
+           begin
+              $display( "%sError calling uart_dpi_get_pattern_match().", `UART_DPI_ERROR_PREFIX );
+              $finish;
+           end;
+
+         if ( pattern_match_kind == uart_dpi_pkg::UART_DPI_PATTERN_KIND_NONE && pattern_kind != uart_dpi_pkg::UART_DPI_PATTERN_KIND_NONE )
+           begin
+              pattern_match_kind = pattern_kind;
+              pattern_finish_clk_counter = finish_delay_clk_count;
+           end;
+      end
+   endtask
+
+
+   task automatic finish_on_pattern_match;
+      begin
+         if ( pattern_match_kind == uart_dpi_pkg::UART_DPI_PATTERN_KIND_PASS )
+           $finish;
+         else
+           begin
+              // The simulator may not run the 'final' sections after $fatal,
+              // so send the staged bytes and write out the files now.
+              flush_tx_staging_buffer;
+              uart_dpi_destroy( obj );
+              obj = 0;
+              $fatal( 1, "%sThe transmitted data matched a finish fail pattern, or the script failed.", `UART_DPI_ERROR_PREFIX );
+           end;
+      end
+   endtask
+
+
+   // Lets a testbench read the performance counters of this instance with a hierarchical call, for example:
+   //   longint counters[ uart_dpi_pkg::UART_DPI_STAT_COUNT ];
+   //   uart_dpi_instance2.get_stats( counters );
+   //   $display( "Transmitted bytes: %0d", counters[ uart_dpi_pkg::UART_DPI_STAT_TRANSMITTED_BYTE_COUNT ] );
+   task automatic get_stats;
+      output longint counters[ uart_dpi_pkg::UART_DPI_STAT_COUNT ];
+      begin
+         if ( 0 != uart_dpi_get_stats( obj, counters ) )
+           begin
+              $display( "%sError reading the performance counters.", `UART_DPI_ERROR_PREFIX );
+              $finish;
+           end;
+      end
+   endtask
+
+
    task automatic wishbone_write;
       input [7:0] data_to_write;
       begin
@@ -281,11 +564,13 @@ module uart_dpi
                                  data_to_write,
                                  data_to_write );
 
-                     if ( 0 != uart_dpi_send( obj, data_to_write ) )
-                       begin
-                          $display( "%sError sending data.", `UART_DPI_ERROR_PREFIX );
-                          $finish;
-                       end;
+                     tx_staging_buffer[ tx_staging_count ] = data_to_write;
+                     tx_staging_cycles[ tx_staging_count ] = tx_cycle_count;
+                     tx_staging_count = tx_staging_count + 1;
+                     tx_staging_flush_clk_counter = character_timeout_clk_count;
+
+                     if ( tx_staging_count == TX_STAGING_BUFFER_SIZE )
+                       flush_tx_staging_buffer;
 
                      // On the real UART, sending a byte clears the THRE interrupt, which will
                      // be enabled later when the character has been moved out of the
@@ -437,6 +722,7 @@ module uart_dpi
 
    task automatic wishbone_read;
       input  int received_byte_count;
+      input  bit transmitter_holding_register_empty;
       input  bit receive_data_available_interrupt_pending;
       input  bit character_timeout_interrupt_pending;
       output bit [7:0] data_to_return;
@@ -451,7 +737,7 @@ module uart_dpi
                end
              else
                begin
-                  if ( received_byte_count == 0 )
+                  if ( rx_shadow_fifo_count + received_byte_count == 0 )
                     begin
                        // Reading when the FIFO is empty is most probably an error in the client software,
                        // at least for the purposes of this simulated UART.
@@ -463,10 +749,31 @@ module uart_dpi
                        $finish;
                        data_to_return = 0;  // Prevents C++ compilation warning under Verilator.
                     end
-                  else if ( 0 != uart_dpi_receive( obj, data_to_return ) )
+                  else
                     begin
-                       $display( "%sError receiving data.", `UART_DPI_ERROR_PREFIX );
-                       $finish;
+                       if ( rx_shadow_fifo_count == 0 )
+                         begin
+                            int refill_count;
+                            int refilled_count;
+
+                            refill_count = received_byte_count < RX_SHADOW_FIFO_SIZE ? received_byte_count : RX_SHADOW_FIFO_SIZE;
+
+                            // Only this module removes bytes from the C++ receive buffer,
+                            // so all bytes reported by the last tick must be there.
+                            if ( 0 != uart_dpi_receive_block( obj, rx_shadow_fifo, refill_count, refilled_count ) ||
+                                 refilled_count != refill_count )
+                              begin
+                                 $display( "%sError receiving data.", `UART_DPI_ERROR_PREFIX );
+                                 $finish;
+                              end;
+
+                            rx_shadow_fifo_pos   = 0;
+                            rx_shadow_fifo_count = refilled_count;
+                         end;
+
+                       data_to_return = rx_shadow_fifo[ rx_shadow_fifo_pos ];
+                       rx_shadow_fifo_pos   = rx_shadow_fifo_pos + 1;
+                       rx_shadow_fifo_count = rx_shadow_fifo_count - 1;
                     end;
 
                   if ( TRACE_DATA )
@@ -511,7 +818,7 @@ module uart_dpi
                   begin
                      data_to_return[ `UART_DPI_IIR_II ] = `UART_DPI_IIR_TI;
                   end
-                else if ( transmitter_holding_register_empty_interrupt_pending )
+                else if ( transmitter_holding_register_empty_interrupt_pending && transmitter_holding_register_empty )
                   begin
                      data_to_return[ `UART_DPI_IIR_II ] = `UART_DPI_IIR_THRE;
                   end
@@ -549,11 +856,14 @@ module uart_dpi
 
            UART_DPI_REG_LSR:
              begin
-                // Always say we can accept a new byte. This simulated UART
-                // appears unnaturally fast to the user.
+                // Unless the transmit buffer is full in lossless transmit mode, always say we can accept
+                // a new byte. This simulated UART appears unnaturally fast to the user.
                 // If this causes problems, we could add some delay like character_timeout_clk_count.
-                data_to_return = (1 << `UART_DPI_LSR_THRE) |
-                                 (1 << `UART_DPI_LSR_TEMT) ;
+                data_to_return = 0;
+
+                if ( transmitter_holding_register_empty )
+                  data_to_return |= (1 << `UART_DPI_LSR_THRE) |
+                                    (1 << `UART_DPI_LSR_TEMT) ;
 
                 // There are never bit-level errors like these:
                 //   UART_DPI_LSR_PE   Parity Error
@@ -567,7 +877,7 @@ module uart_dpi
                 // gives up, you will not notice at this side, but the client
                 // will hopefully print an error message on its side.
 
-                if ( received_byte_count > 0 )
+                if ( rx_shadow_fifo_count + received_byte_count > 0 )
                   data_to_return |= (1 << `UART_DPI_LSR_DR);
              end
 
@@ -602,21 +912,66 @@ module uart_dpi
 
          transmitter_holding_register_empty_interrupt_pending = 0;
          last_rcvr_fifo_read_clk_counter = 0;
+         was_transmit_blocked = 0;
+
+         // These buffers are part of the data queues on the C++ side, which wb_rst_i does not clear either.
+         rx_shadow_fifo_pos   = 0;
+         rx_shadow_fifo_count = 0;
+         tx_staging_count     = 0;
+         tx_staging_flush_clk_counter = 0;
       end
    endtask
 
 
    always @(posedge wb_clk_i)
    begin
-      int received_byte_count;
+      int received_byte_count;  // Only counts the bytes in the C++ receive buffer.
+      int rx_byte_count;        // Counts the bytes in the shadow FIFO too.
+      bit transmit_blocked;     // Only set in lossless transmit mode.
+      int tick_result;
 
       // The TCP socket continues to be served even during reset.
-      if ( 0 != uart_dpi_tick( obj, received_byte_count ) )
+      if ( tick_all_index != -1 )
+        begin
+           // Module uart_dpi_tick_all has already ticked this instance on the falling clock edge.
+           received_byte_count = uart_dpi_pkg::tick_all_received_byte_counts  [ TICK_ALL_ARRAY_INDEX ];
+           transmit_blocked    = uart_dpi_pkg::tick_all_transmit_blocked_flags[ TICK_ALL_ARRAY_INDEX ];
+
+           // The match may have happened in another instance.
+           tick_result = uart_dpi_pkg::tick_all_pattern_matched ? uart_dpi_pkg::UART_DPI_RET_PATTERN_MATCHED : 0;
+        end
+      else
+        tick_result = uart_dpi_tick( obj, received_byte_count, transmit_blocked );
+
+      if ( tick_result == uart_dpi_pkg::UART_DPI_RET_PATTERN_MATCHED )
+        take_pattern_match;
+      else if ( tick_result != 0 )
         begin
            $display( "%sError calling uart_dpi_tick().", `UART_DPI_ERROR_PREFIX );
            $finish;
         end;
 
+      if ( pattern_match_kind != uart_dpi_pkg::UART_DPI_PATTERN_KIND_NONE && finish_delay_clk_count >= 0 )
+        begin
+           if ( pattern_finish_clk_counter == 0 )
+             finish_on_pattern_match;
+           else
+             pattern_finish_clk_counter = pattern_finish_clk_counter - 1;
+        end;
+
+      rx_byte_count = rx_shadow_fifo_count + received_byte_count;
+
+      tx_cycle_count = tx_cycle_count + 1;
+
+      // Send any staged bytes once the client stops writing for a while, even during reset.
+      if ( tx_staging_count != 0 )
+        begin
+           if ( tx_staging_flush_clk_counter == 0 )
+             flush_tx_staging_buffer;
+           else
+             tx_staging_flush_clk_counter = tx_staging_flush_clk_counter - 1;
+        end;
+
       if ( wb_rst_i )
         begin
            // NOTE: If you modify the reset logic, please update the initial_reset task too.
@@ -637,30 +992,42 @@ module uart_dpi
 
            transmitter_holding_register_empty_interrupt_pending <= 0;
            last_rcvr_fifo_read_clk_counter <= 0;
+           was_transmit_blocked <= 0;
 	    end
       else
         begin
            bit receive_data_available_interrupt_pending;
            bit character_timeout_interrupt_pending;
            bit is_interrupt_pending;
+           bit transmitter_holding_register_empty;
+           bit is_transmit_write_held;
 
            if ( last_rcvr_fifo_read_clk_counter != 0 )
              last_rcvr_fifo_read_clk_counter <= last_rcvr_fifo_read_clk_counter - 1;
 
+           transmitter_holding_register_empty = !( transmit_flow_control == TRANSMIT_FLOW_CONTROL_LSR && transmit_blocked );
+
+           // Like a real UART, trigger the THRE interrupt when the transmitter becomes ready again.
+           // The Wishbone logic below may override this.
+           was_transmit_blocked <= transmit_blocked;
+
+           if ( was_transmit_blocked && !transmit_blocked )
+             transmitter_holding_register_empty_interrupt_pending <= uart_reg_ier[ `UART_DPI_IER_THRE ];
+
 
            // Calculate the interrupt request signal, which is independent of the Wishbone bus.
 
            receive_data_available_interrupt_pending = uart_reg_ier[ `UART_DPI_IER_RDA ] &&
-                                                      ( received_byte_count >= get_trigger_level( uart_reg_fcr ) );
+                                                      ( rx_byte_count >= get_trigger_level( uart_reg_fcr ) );
 
            character_timeout_interrupt_pending = uart_reg_ier[ `UART_DPI_IER_RDA ] &&
-                                                 ( received_byte_count >= 1 ) &&
+                                                 ( rx_byte_count >= 1 ) &&
                                                  ( last_rcvr_fifo_read_clk_counter == 0 ) &&
                                                  uart_reg_fcr[`UART_DPI_FCR_FIFO_ENABLE_BIT];
 
            is_interrupt_pending = receive_data_available_interrupt_pending |
                                   character_timeout_interrupt_pending |
-                                  transmitter_holding_register_empty_interrupt_pending;
+                                  ( transmitter_holding_register_empty_interrupt_pending & transmitter_holding_register_empty );
 
            int_o <= is_interrupt_pending;
 
@@ -670,10 +1037,18 @@ module uart_dpi
            wb_ack_o <= 0;
            wb_err_o <= 0;
 
+           // In lossless transmit mode, writing to the THR while the transmit buffer is full inserts
+           // wait states (wb_ack_o stays low) until the I/O thread has drained the buffer.
+           is_transmit_write_held = transmit_blocked &&
+                                    wb_we_i &&
+                                    wb_adr_i == UART_DPI_REG_THR &&
+                                    !uart_reg_lcr[ `UART_DPI_LCR_DL ];
+
            if ( wb_cyc_i  &&
                 wb_stb_i  &&
                 !wb_ack_o && // If we answered in the last cycle, finish the transaction in this one by clearing wb_ack_o.
-                !wb_err_o
+                !wb_err_o &&
+                !is_transmit_write_held
              )
              begin
                 // We can always answer straight away, without delays. By default,
@@ -700,6 +1075,7 @@ module uart_dpi
                      bit [7:0] data_to_return;
 
                      wishbone_read( received_byte_count,
+                                    transmitter_holding_register_empty,
                                     receive_data_available_interrupt_pending,
                                     character_timeout_interrupt_pending,
                                     data_to_return );
@@ -717,15 +1093,52 @@ module uart_dpi
 
    initial
      begin
+        string capture_file = capture_file_name;
+        string plusarg_name = capture_plusarg;
+        string endpoint_str = endpoint;
+        string stamp_file = transmit_stamp_file_name;
+
         obj = 0;
+        tx_stamps_enabled = stamp_file.len() != 0;
+        tx_cycle_count = 0;
+        pattern_match_kind = uart_dpi_pkg::UART_DPI_PATTERN_KIND_NONE;
+        pattern_finish_clk_counter = 0;
+
+        if ( plusarg_name.len() != 0 )
+          void'( $value$plusargs( { plusarg_name, "=%s" }, capture_file ) );
+
+        if ( endpoint_str == "mux" )
+          endpoint_str = { "mux:", port_name };
 
         if ( 0 != uart_dpi_create( tcp_port,
+                                   endpoint_str,
                                    listen_on_local_addr_only,
                                    transmit_buffer_size,
                                    receive_buffer_size,
+                                   transmit_flow_control != TRANSMIT_FLOW_CONTROL_NONE,
+                                   transmit_low_watermark,
+                                   max_client_count,
+                                   slow_client_policy,
+                                   transmit_flush_policy,
+                                   transmit_flush_threshold,
+                                   transmit_flush_latency_ms,
+                                   socket_profile,
+                                   socket_send_buffer_size,
+                                   socket_receive_buffer_size,
+                                   capture_file,
+                                   transmit_stamp_file_name,
+                                   transmit_stamp_per_byte != 0,
+                                   finish_pass_patterns,
+                                   finish_fail_patterns,
+                                   script_file_name,
+                                   receive_record_file_name,
+                                   receive_replay_file_name,
+                                   stats_file_name,
+                                   port_name,
                                    welcome_message,
                                    print_informational_messages,
                                    `UART_DPI_INFORMATION_PREFIX,
+                                   tick_all_index,
                                    obj ) )
           begin
              $display( "%sError creating the object instance.", `UART_DPI_ERROR_PREFIX );
@@ -737,8 +1150,56 @@ module uart_dpi
 
    final
      begin
+        flush_tx_staging_buffer;
+
+        if ( print_informational_messages && obj != 0 )
+          begin
+             longint lost_byte_count;
+             longint stall_count;
+
+             if ( 0 == uart_dpi_get_transmit_counters( obj, lost_byte_count, stall_count ) )
+               begin
+                  if ( lost_byte_count != 0 )
+                    $display( "%s%0d transmitted bytes were lost because the transmit buffer was full.",
+                              `UART_DPI_INFORMATION_PREFIX, lost_byte_count );
+
+                  if ( stall_count != 0 )
+                    $display( "%sThe transmitter stalled %0d time(s) because the transmit buffer was full.",
+                              `UART_DPI_INFORMATION_PREFIX, stall_count );
+               end
+          end
+
         // This is optional, but can help find resource or memory leaks in other parts of the software.
         uart_dpi_destroy( obj );
      end
 
 endmodule
+
+
+// Ticks all uart_dpi instances that have a tick_all_index parameter with a single DPI call per clock cycle,
+// instead of one DPI call per instance. Instantiate this module only once.
+//
+// The instances are ticked on the falling clock edge, so that the received byte counts are stable
+// when the uart_dpi instances read them on the next rising edge.
+
+module uart_dpi_tick_all ( input wire clk_i );
+
+   import "DPI-C" function int uart_dpi_tick_all ( output int received_byte_counts[], output bit transmit_blocked_flags[] );
+
+   always @(negedge clk_i)
+   begin
+      int tick_result;
+
+      tick_result = uart_dpi_tick_all( uart_dpi_pkg::tick_all_received_byte_counts,
+                                       uart_dpi_pkg::tick_all_transmit_blocked_flags );
+
+      uart_dpi_pkg::tick_all_pattern_matched = tick_result == uart_dpi_pkg::UART_DPI_RET_PATTERN_MATCHED;
+
+      if ( tick_result != 0 && !uart_dpi_pkg::tick_all_pattern_matched )
+        begin
+           $display( "UART DPI error: Error calling uart_dpi_tick_all()." );
+           $finish;
+        end;
+   end;
+
+endmodule
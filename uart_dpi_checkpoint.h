@@ -0,0 +1,100 @@
+// Simulation checkpoints for the UART DPI module, see section "Simulation checkpoints" in README.pod.
+//
+// Verilator's --savable option saves and restores the Verilog state, but not the C++ objects behind
+// the uart_dpi instances. Save their state into the same stream right after the model, and restore it
+// right after the model, from the simulation thread between two evaluations of the model:
+//
+//   VerilatedSave os;
+//   os.open( "snapshot.bin" );
+//   os << *contextp << *topp;
+//   uart_dpi_save_checkpoint_to( os );
+//
+//   VerilatedRestore is;
+//   is.open( "snapshot.bin" );
+//   is >> *contextp >> *topp;
+//   uart_dpi_restore_checkpoint_from( is );
+//
+// Restoring destroys any existing instances and re-creates the ones in the checkpoint with the same obj handles,
+// so that the restored Verilog state refers to them. The client connections are not restored.
+// If the checkpoint data is corrupt, the existing instances remain. If re-creating an instance fails,
+// no instances remain at all, and the simulation should stop.
+
+#ifndef UART_DPI_CHECKPOINT_H_INCLUDED
+#define UART_DPI_CHECKPOINT_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <new>
+#include <string>
+
+// uart_dpi_restore_checkpoint_from() rejects a length prefix above this limit, which protects against
+// a corrupt or truncated stream. Define this symbol before including this header in order to raise the limit.
+#ifndef UART_DPI_MAX_CHECKPOINT_SIZE
+  #define UART_DPI_MAX_CHECKPOINT_SIZE ( uint64_t( 1 ) << 30 )
+#endif
+
+// These routines return 0 on success. Otherwise, they print an error message and return a non-zero value,
+// like the DPI routines.
+int uart_dpi_save_checkpoint ( std::string * data );
+int uart_dpi_restore_checkpoint ( const std::string & data );
+
+
+// For Verilator's VerilatedSerialize and VerilatedDeserialize, or any other stream class
+// with the same write() and read() methods. The data is stored with a 64-bit length prefix.
+
+template< typename serialize_type >
+int uart_dpi_save_checkpoint_to ( serialize_type & os )
+{
+  std::string data;
+
+  const int res = uart_dpi_save_checkpoint( &data );
+
+  if ( res != 0 )
+    return res;
+
+  const uint64_t len = data.size();
+  os.write( &len, sizeof( len ) );
+  os.write( data.data(), data.size() );
+  return 0;
+}
+
+
+template< typename deserialize_type >
+int uart_dpi_restore_checkpoint_from ( deserialize_type & is )
+{
+  uint64_t len;
+  is.read( &len, sizeof( len ) );
+
+  if ( len > UART_DPI_MAX_CHECKPOINT_SIZE || len > SIZE_MAX )
+  {
+    fprintf( stderr, "Error in the UART DPI module: Error restoring a simulation checkpoint: "
+                     "The checkpoint data length of %llu bytes is too high, the stream is probably corrupt. "
+                     "Define UART_DPI_MAX_CHECKPOINT_SIZE in order to raise the limit.\n",
+             (unsigned long long) len );
+    fflush( stderr );
+    return 1;
+  }
+
+  std::string data;
+
+  try
+  {
+    data.resize( size_t( len ) );
+  }
+  catch ( const std::bad_alloc & )
+  {
+    fprintf( stderr, "Error in the UART DPI module: Error restoring a simulation checkpoint: "
+                     "Not enough memory for %llu bytes of checkpoint data.\n",
+             (unsigned long long) len );
+    fflush( stderr );
+    return 1;
+  }
+
+  if ( len != 0 )
+    is.read( &data[0], data.size() );
+
+  return uart_dpi_restore_checkpoint( data );
+}
+
+#endif  // Include this header file only once.
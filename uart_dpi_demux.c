@@ -0,0 +1,558 @@
+// Client for the multiplexing server of the UART DPI module, see section "Multiplexing several UARTs over one TCP port"
+// in README.pod. It connects to the server and splits its stream back out into the separate channels:
+//
+//   uart_dpi_demux [--host <IPv4 address>] <tcp port>
+//
+//     Prints the data of all channels to stdout, line by line, each line prefixed with the channel name in brackets.
+//
+//   uart_dpi_demux [--host <IPv4 address>] --pty-dir <directory> <tcp port>
+//
+//     Creates a pseudo-terminal per channel, with a symbolic link to it in the given directory, named after the channel.
+//     Any terminal program can then attach to a channel, like with the "pty" endpoint of a single UART DPI instance,
+//     and whatever it types goes to that channel. A terminal program that is not attached or too slow
+//     loses the data that does not fit in the pseudo-terminal's buffer. The link is removed when the channel closes.
+//
+// The default host is 127.0.0.1. The tool runs until the simulation closes the connection, or until interrupted.
+// Compile it with GCC or Clang on Linux, for example:
+//   gcc -O2 -o uart_dpi_demux uart_dpi_demux.c
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+
+#include "uart_dpi_mux.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+// The largest frame, plus room for the start of the next one.
+#define RECEIVE_BUFFER_SIZE  ( 2 * ( UART_DPI_MUX_FRAME_HEADER_SIZE + UART_DPI_MUX_MAX_PAYLOAD_SIZE ) )
+
+// How much of a terminal program's input goes into a single DATA frame.
+#define PTY_READ_SIZE  4096
+
+
+typedef struct
+{
+  uint16_t id;
+  char *   name;
+
+  // Without --pty-dir, the current line.
+  char *   line;
+  size_t   line_len;
+  size_t   line_capacity;
+
+  // With --pty-dir.
+  int      pty_master_fd;
+  int      pty_slave_fd;  // Kept open, so that the master does not report a hang-up while no terminal program is attached.
+  char *   link_path;
+  uint64_t dropped_byte_count;
+} demux_channel;
+
+
+static const char * s_pty_dir = NULL;  // NULL means printing to stdout.
+
+static demux_channel * s_channels = NULL;
+static size_t s_channel_count = 0;
+
+static volatile sig_atomic_t s_is_interrupted = 0;
+
+
+static void fail ( const char * const message )
+{
+  fprintf( stderr, "uart_dpi_demux: %s\n", message );
+  exit( 1 );
+}
+
+
+static void fail_errno ( const char * const message )
+{
+  fprintf( stderr, "uart_dpi_demux: %s: %s\n", message, strerror( errno ) );
+  exit( 1 );
+}
+
+
+static void * checked_realloc ( void * const ptr, const size_t size )
+{
+  void * const new_ptr = realloc( ptr, size );
+
+  if ( new_ptr == NULL && size != 0 )
+    fail( "Out of memory." );
+
+  return new_ptr;
+}
+
+
+static void on_signal ( const int signal_number )
+{
+  (void) signal_number;
+  s_is_interrupted = 1;
+}
+
+
+static void write_all ( const int fd, const uint8_t * const data, const size_t byte_count )
+{
+  size_t written_byte_count = 0;
+
+  while ( written_byte_count < byte_count )
+  {
+    const ssize_t res = write( fd, data + written_byte_count, byte_count - written_byte_count );
+
+    if ( res == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      fail_errno( "Error sending data" );
+    }
+
+    written_byte_count += (size_t) res;
+  }
+}
+
+
+static demux_channel * find_channel ( const uint16_t id )
+{
+  for ( size_t i = 0; i < s_channel_count; ++i )
+  {
+    if ( s_channels[ i ].id == id )
+      return &s_channels[ i ];
+  }
+
+  return NULL;
+}
+
+
+// ---------------------------- Printing to stdout ----------------------------
+
+static void print_line ( const demux_channel * const channel, const char * const data, size_t byte_count )
+{
+  // Most UART consoles end their lines with "\r\n".
+  if ( byte_count != 0 && data[ byte_count - 1 ] == '\r' )
+    --byte_count;
+
+  printf( "[%s] %.*s\n", channel->name, (int) byte_count, data );
+}
+
+
+// Whole lines are printed straight from the payload, only the rest is copied to the channel's line buffer.
+
+static void print_data ( demux_channel * const channel, const char * data, size_t byte_count )
+{
+  for ( ; ; )
+  {
+    const char * const newline = (const char *) memchr( data, '\n', byte_count );
+
+    if ( newline == NULL )
+      break;
+
+    const size_t line_len = (size_t) ( newline - data );
+
+    if ( channel->line_len == 0 )
+    {
+      print_line( channel, data, line_len );
+    }
+    else
+    {
+      channel->line = (char *) checked_realloc( channel->line, channel->line_len + line_len );
+      memcpy( channel->line + channel->line_len, data, line_len );
+      print_line( channel, channel->line, channel->line_len + line_len );
+      channel->line_len = 0;
+    }
+
+    data       += line_len + 1;
+    byte_count -= line_len + 1;
+  }
+
+  if ( byte_count != 0 )
+  {
+    if ( channel->line_len + byte_count > channel->line_capacity )
+    {
+      channel->line_capacity = 2 * ( channel->line_len + byte_count );
+      channel->line = (char *) checked_realloc( channel->line, channel->line_capacity );
+    }
+
+    memcpy( channel->line + channel->line_len, data, byte_count );
+    channel->line_len += byte_count;
+  }
+
+  fflush( stdout );
+}
+
+
+// ---------------------------- Pseudo-terminals ----------------------------
+
+static void create_pty ( demux_channel * const channel )
+{
+  channel->pty_master_fd = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC );
+
+  if ( channel->pty_master_fd == -1 || grantpt( channel->pty_master_fd ) != 0 || unlockpt( channel->pty_master_fd ) != 0 )
+    fail_errno( "Error creating a pseudo-terminal" );
+
+  const char * const slave_name = ptsname( channel->pty_master_fd );
+
+  if ( slave_name == NULL )
+    fail_errno( "Error getting the pseudo-terminal name" );
+
+  channel->pty_slave_fd = open( slave_name, O_RDWR | O_NOCTTY | O_CLOEXEC );
+
+  if ( channel->pty_slave_fd == -1 )
+    fail_errno( "Error opening the pseudo-terminal" );
+
+  // Raw mode, like the "pty" endpoint of the UART DPI module.
+  struct termios attributes;
+
+  if ( tcgetattr( channel->pty_slave_fd, &attributes ) != 0 )
+    fail_errno( "Error getting the pseudo-terminal attributes" );
+
+  cfmakeraw( &attributes );
+
+  if ( tcsetattr( channel->pty_slave_fd, TCSANOW, &attributes ) != 0 )
+    fail_errno( "Error setting the pseudo-terminal attributes" );
+
+  // The channel name may contain anything, so only a few safe characters make it into the link name.
+  const size_t name_len = strlen( channel->name );
+  const size_t dir_len  = strlen( s_pty_dir );
+
+  channel->link_path = (char *) checked_realloc( NULL, dir_len + 1 + name_len + 1 );
+  memcpy( channel->link_path, s_pty_dir, dir_len );
+  channel->link_path[ dir_len ] = '/';
+
+  for ( size_t i = 0; i < name_len; ++i )
+  {
+    const char c = channel->name[ i ];
+    const int is_safe = ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ||
+                        c == '-' || c == '_' || c == '.';
+
+    channel->link_path[ dir_len + 1 + i ] = is_safe ? c : '_';
+  }
+
+  channel->link_path[ dir_len + 1 + name_len ] = '\0';
+
+  // A link left behind by a previous run is replaced, but nothing else.
+  struct stat file_info;
+
+  if ( lstat( channel->link_path, &file_info ) == 0 && S_ISLNK( file_info.st_mode ) )
+    unlink( channel->link_path );
+
+  if ( symlink( slave_name, channel->link_path ) != 0 )
+  {
+    fprintf( stderr, "uart_dpi_demux: Error creating symbolic link \"%s\": %s\n", channel->link_path, strerror( errno ) );
+    exit( 1 );
+  }
+
+  fprintf( stderr, "uart_dpi_demux: Channel \"%s\" is available at %s (%s).\n", channel->name, channel->link_path, slave_name );
+}
+
+
+// The simulation must not wait for a terminal program, so whatever does not fit in the pseudo-terminal's buffer is lost.
+
+static void write_to_pty ( demux_channel * const channel, const uint8_t * const data, const size_t byte_count )
+{
+  size_t written_byte_count = 0;
+
+  while ( written_byte_count < byte_count )
+  {
+    const ssize_t res = write( channel->pty_master_fd, data + written_byte_count, byte_count - written_byte_count );
+
+    if ( res == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      if ( errno != EAGAIN && errno != EWOULDBLOCK )
+        fail_errno( "Error writing to a pseudo-terminal" );
+
+      channel->dropped_byte_count += byte_count - written_byte_count;
+      return;
+    }
+
+    written_byte_count += (size_t) res;
+  }
+}
+
+
+// Sends whatever the terminal program has typed as a DATA frame.
+
+static void forward_pty_input ( const int socket_fd, const demux_channel * const channel )
+{
+  uint8_t frame[ UART_DPI_MUX_FRAME_HEADER_SIZE + PTY_READ_SIZE ];
+
+  const ssize_t res = read( channel->pty_master_fd, frame + UART_DPI_MUX_FRAME_HEADER_SIZE, PTY_READ_SIZE );
+
+  if ( res <= 0 )
+  {
+    if ( res == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == EIO ) )
+      return;
+
+    fail_errno( "Error reading from a pseudo-terminal" );
+  }
+
+  uart_dpi_mux_encode_header( frame, UART_DPI_MUX_FRAME_DATA, channel->id, (uint32_t) res );
+  write_all( socket_fd, frame, UART_DPI_MUX_FRAME_HEADER_SIZE + (size_t) res );
+}
+
+
+// ---------------------------- Frame handling ----------------------------
+
+static void open_channel ( const uint16_t id, const uint8_t * const name, const size_t name_len )
+{
+  if ( find_channel( id ) != NULL )
+    fail( "The server has opened the same channel twice." );
+
+  s_channels = (demux_channel *) checked_realloc( s_channels, ( s_channel_count + 1 ) * sizeof( demux_channel ) );
+
+  demux_channel * const channel = &s_channels[ s_channel_count++ ];
+  memset( channel, 0, sizeof( *channel ) );
+
+  channel->id   = id;
+  channel->name = (char *) checked_realloc( NULL, name_len + 1 );
+  memcpy( channel->name, name, name_len );
+  channel->name[ name_len ] = '\0';
+
+  channel->pty_master_fd = -1;
+  channel->pty_slave_fd  = -1;
+
+  if ( s_pty_dir != NULL )
+    create_pty( channel );
+}
+
+
+static void close_channel ( demux_channel * const channel )
+{
+  if ( channel->line_len != 0 )
+  {
+    print_line( channel, channel->line, channel->line_len );
+    fflush( stdout );
+  }
+
+  if ( channel->pty_master_fd != -1 )
+  {
+    unlink( channel->link_path );
+    close( channel->pty_slave_fd );
+    close( channel->pty_master_fd );
+
+    if ( channel->dropped_byte_count != 0 )
+    {
+      fprintf( stderr, "uart_dpi_demux: Channel \"%s\" lost %llu bytes, because no terminal program was reading them.\n",
+               channel->name, (unsigned long long) channel->dropped_byte_count );
+    }
+  }
+
+  free( channel->name );
+  free( channel->line );
+  free( channel->link_path );
+
+  *channel = s_channels[ --s_channel_count ];
+}
+
+
+static void process_frame ( const uint8_t * const header, const uint8_t * const payload )
+{
+  const uint16_t id          = uart_dpi_mux_get_channel( header );
+  const uint32_t payload_len = uart_dpi_mux_get_length( header );
+
+  demux_channel * const channel = find_channel( id );
+
+  switch ( header[0] )
+  {
+  case UART_DPI_MUX_FRAME_OPEN:
+    open_channel( id, payload, payload_len );
+    break;
+
+  case UART_DPI_MUX_FRAME_DATA:
+    if ( channel == NULL )
+      fail( "The server has sent data for an unknown channel." );
+
+    if ( s_pty_dir != NULL )
+      write_to_pty( channel, payload, payload_len );
+    else
+      print_data( channel, (const char *) payload, payload_len );
+    break;
+
+  case UART_DPI_MUX_FRAME_CLOSE:
+    if ( channel != NULL )
+      close_channel( channel );
+    break;
+
+  default:
+    fail( "The server has sent an invalid frame." );
+  }
+}
+
+
+// Processes all complete frames in the buffer, and returns how many bytes they took.
+
+static size_t process_frames ( const uint8_t * const data, const size_t byte_count )
+{
+  size_t pos = 0;
+
+  while ( byte_count - pos >= UART_DPI_MUX_FRAME_HEADER_SIZE )
+  {
+    const uint8_t * const header = data + pos;
+    const uint32_t payload_len = uart_dpi_mux_get_length( header );
+
+    if ( payload_len > UART_DPI_MUX_MAX_PAYLOAD_SIZE )
+      fail( "The server has sent an invalid frame." );
+
+    if ( byte_count - pos - UART_DPI_MUX_FRAME_HEADER_SIZE < payload_len )
+      break;
+
+    process_frame( header, header + UART_DPI_MUX_FRAME_HEADER_SIZE );
+    pos += UART_DPI_MUX_FRAME_HEADER_SIZE + payload_len;
+  }
+
+  return pos;
+}
+
+
+static int connect_to_server ( const char * const host, const int tcp_port )
+{
+  struct sockaddr_in addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons( (uint16_t) tcp_port );
+
+  if ( inet_pton( AF_INET, host, &addr.sin_addr ) != 1 )
+    fail( "Invalid IPv4 address." );
+
+  const int socket_fd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+  if ( socket_fd == -1 )
+    fail_errno( "Error creating the socket" );
+
+  if ( connect( socket_fd, (const struct sockaddr *) &addr, sizeof( addr ) ) != 0 )
+    fail_errno( "Error connecting to the multiplexing server" );
+
+  return socket_fd;
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  const char * host = "127.0.0.1";
+  int tcp_port = 0;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    if ( 0 == strcmp( argv[ i ], "--host" ) && i + 1 < argc )
+      host = argv[ ++i ];
+    else if ( 0 == strcmp( argv[ i ], "--pty-dir" ) && i + 1 < argc )
+      s_pty_dir = argv[ ++i ];
+    else if ( tcp_port == 0 && argv[ i ][ 0 ] != '-' )
+      tcp_port = atoi( argv[ i ] );
+    else
+      fail( "Usage: uart_dpi_demux [--host <IPv4 address>] [--pty-dir <directory>] <tcp port>" );
+  }
+
+  if ( tcp_port <= 0 || tcp_port > 65535 )
+    fail( "Invalid TCP port." );
+
+  // Without SA_RESTART, so that poll() returns straight away.
+  struct sigaction action;
+  memset( &action, 0, sizeof( action ) );
+  action.sa_handler = on_signal;
+  sigaction( SIGINT,  &action, NULL );
+  sigaction( SIGTERM, &action, NULL );
+  sigaction( SIGHUP,  &action, NULL );
+
+  signal( SIGPIPE, SIG_IGN );
+
+  const int socket_fd = connect_to_server( host, tcp_port );
+
+  static uint8_t buffer[ RECEIVE_BUFFER_SIZE ];
+  size_t buffer_len = 0;
+  int is_signature_received = 0;
+
+  struct pollfd * poll_fds = NULL;
+
+  while ( !s_is_interrupted )
+  {
+    poll_fds = (struct pollfd *) checked_realloc( poll_fds, ( 1 + s_channel_count ) * sizeof( struct pollfd ) );
+
+    poll_fds[0].fd     = socket_fd;
+    poll_fds[0].events = POLLIN;
+
+    for ( size_t i = 0; i < s_channel_count; ++i )
+    {
+      poll_fds[ 1 + i ].fd     = s_channels[ i ].pty_master_fd;  // Ignored if -1.
+      poll_fds[ 1 + i ].events = POLLIN;
+    }
+
+    const size_t poll_fd_count = 1 + s_channel_count;
+
+    if ( poll( poll_fds, poll_fd_count, -1 ) == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      fail_errno( "Error waiting for data" );
+    }
+
+    // The channel list changes while processing the socket data, so the terminal input goes first.
+    for ( size_t i = 1; i < poll_fd_count; ++i )
+    {
+      if ( poll_fds[ i ].revents & POLLIN )
+        forward_pty_input( socket_fd, &s_channels[ i - 1 ] );
+    }
+
+    if ( poll_fds[0].revents == 0 )
+      continue;
+
+    const ssize_t res = read( socket_fd, buffer + buffer_len, sizeof( buffer ) - buffer_len );
+
+    if ( res == -1 )
+    {
+      if ( errno == EINTR )
+        continue;
+
+      fail_errno( "Error receiving data" );
+    }
+
+    if ( res == 0 )
+      break;
+
+    buffer_len += (size_t) res;
+
+    size_t pos = 0;
+
+    if ( !is_signature_received )
+    {
+      if ( buffer_len < UART_DPI_MUX_SIGNATURE_LEN )
+        continue;
+
+      if ( 0 != memcmp( buffer, UART_DPI_MUX_SIGNATURE, UART_DPI_MUX_SIGNATURE_LEN ) )
+        fail( "The server is not a UART DPI multiplexing server, or has an incompatible version." );
+
+      is_signature_received = 1;
+      pos = UART_DPI_MUX_SIGNATURE_LEN;
+    }
+
+    pos += process_frames( buffer + pos, buffer_len - pos );
+
+    // The rest of an incomplete frame moves to the beginning of the buffer, which always has room for a whole frame.
+    memmove( buffer, buffer + pos, buffer_len - pos );
+    buffer_len -= pos;
+  }
+
+  while ( s_channel_count != 0 )
+    close_channel( &s_channels[ s_channel_count - 1 ] );
+
+  free( s_channels );
+  free( poll_fds );
+  close( socket_fd );
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+// Wire protocol of the multiplexing server of the UART DPI module, see section "Multiplexing several UARTs
+// over one TCP port" in README.pod.
+//
+// All UART DPI instances in a simulation process whose endpoint is "mux:<name>" and that have the same tcp_port
+// share a single listening TCP socket. Each instance is a channel with the given name. Right after a client
+// connects, the server sends UART_DPI_MUX_SIGNATURE, and then a stream of frames. Each frame has a fixed-size header,
+// followed by the payload:
+//
+//   Offset 0  type      1 byte, see enum uart_dpi_mux_frame_type.
+//   Offset 1  reserved  1 byte, always 0.
+//   Offset 2  channel   16-bit unsigned integer, little endian.
+//   Offset 4  length    32-bit unsigned integer, little endian. The payload size in bytes.
+//
+// The server announces each channel with an OPEN frame, whose payload is the channel name, before any DATA frames
+// for that channel. A CLOSE frame, without payload, means that the UART DPI instance has been destroyed.
+// Channel numbers are not reused while the server is running.
+//
+// The client only sends DATA frames, and their payload lands in the channel's receive buffer.
+// Only the client that has been connected the longest can send data, the data from the other clients is discarded.
+// A frame from the client for an unknown channel is discarded too.
+//
+// This file is plain C, so that a client can include it too.
+
+#ifndef UART_DPI_MUX_H_INCLUDED
+#define UART_DPI_MUX_H_INCLUDED
+
+#include <stdint.h>
+
+#define UART_DPI_MUX_SIGNATURE      "UARTMUX1"
+#define UART_DPI_MUX_SIGNATURE_LEN  8
+
+#define UART_DPI_MUX_FRAME_HEADER_SIZE  8
+
+// Neither side may send a frame with a larger payload.
+#define UART_DPI_MUX_MAX_PAYLOAD_SIZE  ( 64 * 1024 )
+
+enum uart_dpi_mux_frame_type
+{
+  UART_DPI_MUX_FRAME_DATA  = 'D',
+  UART_DPI_MUX_FRAME_OPEN  = 'O',
+  UART_DPI_MUX_FRAME_CLOSE = 'C'
+};
+
+static inline void uart_dpi_mux_encode_header ( uint8_t * const header,
+                                                const uint8_t type,
+                                                const uint16_t channel,
+                                                const uint32_t length )
+{
+  header[0] = type;
+  header[1] = 0;
+  header[2] = (uint8_t) ( channel );
+  header[3] = (uint8_t) ( channel >> 8 );
+  header[4] = (uint8_t) ( length );
+  header[5] = (uint8_t) ( length >> 8 );
+  header[6] = (uint8_t) ( length >> 16 );
+  header[7] = (uint8_t) ( length >> 24 );
+}
+
+static inline uint16_t uart_dpi_mux_get_channel ( const uint8_t * const header )
+{
+  return (uint16_t) ( header[2] | ( header[3] << 8 ) );
+}
+
+static inline uint32_t uart_dpi_mux_get_length ( const uint8_t * const header )
+{
+  return (uint32_t) header[4] |
+         ( (uint32_t) header[5] << 8 ) |
+         ( (uint32_t) header[6] << 16 ) |
+         ( (uint32_t) header[7] << 24 );
+}
+
+#endif  // Include this header file only once.
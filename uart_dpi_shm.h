@@ -0,0 +1,61 @@
+// Shared memory layout of the UART DPI module, see section "Shared memory transport" in README.pod.
+//
+// The simulation creates the region with shm_open() when the endpoint is "shm:/name".
+// The region starts with the header below, which is padded to one memory page.
+// The transmit ring data follows the header, and the receive ring data follows the transmit ring data.
+// "Transmit" and "receive" are seen from the simulation side, like everywhere else in the UART DPI module.
+//
+// Each ring has a single producer and a single consumer. The counters are free-running 64-bit byte counts,
+// and byte number N lives at offset (N % storage_size) in the ring data. The producer writes the data
+// and then stores its counter with release semantics. The consumer loads the counter with acquire semantics,
+// reads the data and then stores its own counter with release semantics.
+// The counters live on separate cache lines, so that the two sides do not keep stealing them from each other.
+//
+// This file is plain C, so that an external test harness can include it too.
+
+#ifndef UART_DPI_SHM_H_INCLUDED
+#define UART_DPI_SHM_H_INCLUDED
+
+#include <stdint.h>
+
+#define UART_DPI_SHM_SIGNATURE "UARTSHM1"
+#define UART_DPI_SHM_VERSION   1
+
+// Flags in uart_dpi_shm_header::flags.
+#define UART_DPI_SHM_FLAG_LOSSLESS_TRANSMIT  0x01  // Otherwise the simulation overwrites unread transmit data.
+
+typedef struct
+{
+  // Offset 0, written once by the simulation before the signature.
+  char     signature[ 8 ];         // UART_DPI_SHM_SIGNATURE, without the null terminator.
+  uint32_t version;                // UART_DPI_SHM_VERSION.
+  uint32_t header_size;            // The offset of the transmit ring data.
+  uint32_t transmit_size;          // The transmit ring capacity.
+  uint32_t transmit_storage_size;  // A power of two, the receive ring data starts at header_size + transmit_storage_size.
+  uint32_t receive_size;           // The receive ring capacity.
+  uint32_t receive_storage_size;   // A power of two.
+  uint32_t flags;
+  uint32_t is_closed;              // Set by the simulation when it destroys the UART instance.
+  uint8_t  reserved1[ 24 ];
+
+  // Offset 64, the transmit ring: the simulation writes and the external harness reads.
+  uint64_t transmit_write_count;
+  uint8_t  reserved2[ 56 ];
+  uint64_t transmit_read_count;
+  uint8_t  reserved3[ 56 ];
+
+  // Offset 192, the receive ring: the external harness writes and the simulation reads.
+  uint64_t receive_write_count;
+  uint8_t  reserved4[ 56 ];
+  uint64_t receive_read_count;
+  uint8_t  reserved5[ 56 ];
+
+  // Offset 320, optional wake-ups for a harness waiting for transmit data.
+  // The harness sets transmit_waiting to 1 and waits on transmit_futex with FUTEX_WAIT.
+  // The simulation checks transmit_waiting on every clock tick. When there is transmit data,
+  // it clears the flag, increments transmit_futex and calls FUTEX_WAKE.
+  uint32_t transmit_futex;
+  uint32_t transmit_waiting;
+} uart_dpi_shm_header;
+
+#endif  // Include this header file only once.
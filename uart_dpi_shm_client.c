@@ -0,0 +1,219 @@
+// Reference client library for the shared memory transport of the UART DPI module, see uart_dpi_shm_client.h .
+//
+// Compile this file with GCC or Clang on Linux, for example:
+//   gcc -O2 -c uart_dpi_shm_client.c
+// Linking may need -lrt on older glibc versions, for shm_open().
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
+
+#include "uart_dpi_shm_client.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+static size_t min_size ( const size_t a, const size_t b )
+{
+  return a < b ? a : b;
+}
+
+
+// Copies between a linear buffer and a ring, which may wrap around once.
+
+static void copy_from_ring ( uint8_t * const dest, const uint8_t * const ring, const uint64_t storage_size,
+                             const uint64_t position, const size_t byte_count )
+{
+  const size_t offset = (size_t) ( position & ( storage_size - 1 ) );
+  const size_t first_part = min_size( byte_count, (size_t) storage_size - offset );
+
+  memcpy( dest, ring + offset, first_part );
+  memcpy( dest + first_part, ring, byte_count - first_part );
+}
+
+static void copy_to_ring ( uint8_t * const ring, const uint64_t storage_size,
+                           const uint64_t position, const uint8_t * const src, const size_t byte_count )
+{
+  const size_t offset = (size_t) ( position & ( storage_size - 1 ) );
+  const size_t first_part = min_size( byte_count, (size_t) storage_size - offset );
+
+  memcpy( ring + offset, src, first_part );
+  memcpy( ring, src + first_part, byte_count - first_part );
+}
+
+
+int uart_dpi_shm_open ( uart_dpi_shm_client * const client, const char * const name )
+{
+  memset( client, 0, sizeof( *client ) );
+
+  const int fd = shm_open( name, O_RDWR | O_CLOEXEC, 0 );
+
+  if ( fd == -1 )
+    return errno;
+
+  struct stat file_info;
+
+  if ( fstat( fd, &file_info ) != 0 )
+  {
+    const int error_code = errno;
+    close( fd );
+    return error_code;
+  }
+
+  if ( (size_t) file_info.st_size < sizeof( uart_dpi_shm_header ) )
+  {
+    close( fd );
+    return EPROTO;
+  }
+
+  void * const region = mmap( NULL, (size_t) file_info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  const int mmap_error_code = errno;
+
+  // The mapping keeps the memory alive.
+  close( fd );
+
+  if ( region == MAP_FAILED )
+    return mmap_error_code;
+
+  uart_dpi_shm_header * const header = (uart_dpi_shm_header *) region;
+
+  // The simulation writes the signature last.
+  const int is_signature_ok = 0 == memcmp( header->signature, UART_DPI_SHM_SIGNATURE, sizeof( header->signature ) );
+  __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+  if ( !is_signature_ok ||
+       header->version != UART_DPI_SHM_VERSION ||
+       (uint64_t) header->header_size + header->transmit_storage_size + header->receive_storage_size > (uint64_t) file_info.st_size )
+  {
+    munmap( region, (size_t) file_info.st_size );
+    return EPROTO;
+  }
+
+  client->header        = header;
+  client->map_size      = (size_t) file_info.st_size;
+  client->transmit_data = (uint8_t *) region + header->header_size;
+  client->receive_data  = client->transmit_data + header->transmit_storage_size;
+
+  return 0;
+}
+
+
+void uart_dpi_shm_close ( uart_dpi_shm_client * const client )
+{
+  if ( client->header != NULL )
+  {
+    munmap( client->header, client->map_size );
+    client->header = NULL;
+  }
+}
+
+
+size_t uart_dpi_shm_read ( uart_dpi_shm_client * const client, void * const data, const size_t max_byte_count )
+{
+  uart_dpi_shm_header * const header = client->header;
+  const uint64_t size = header->transmit_size;
+
+  uint64_t read_count = __atomic_load_n( &header->transmit_read_count, __ATOMIC_RELAXED );
+  const uint64_t write_count = __atomic_load_n( &header->transmit_write_count, __ATOMIC_ACQUIRE );
+
+  // If the simulation is not in lossless transmit mode, it may have overwritten unread data.
+  if ( write_count - read_count > size )
+  {
+    client->lost_byte_count += write_count - size - read_count;
+    read_count = write_count - size;
+  }
+
+  size_t byte_count = min_size( max_byte_count, (size_t) ( write_count - read_count ) );
+
+  copy_from_ring( (uint8_t *) data, client->transmit_data, header->transmit_storage_size, read_count, byte_count );
+
+  // The simulation may also have overwritten the oldest bytes while they were being copied.
+  if ( ( header->flags & UART_DPI_SHM_FLAG_LOSSLESS_TRANSMIT ) == 0 )
+  {
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    const uint64_t new_write_count = __atomic_load_n( &header->transmit_write_count, __ATOMIC_RELAXED );
+
+    if ( new_write_count - read_count > size )
+    {
+      const size_t overwritten = min_size( byte_count, (size_t) ( new_write_count - size - read_count ) );
+
+      memmove( data, (uint8_t *) data + overwritten, byte_count - overwritten );
+      byte_count -= overwritten;
+      read_count += overwritten;
+      client->lost_byte_count += overwritten;
+    }
+  }
+
+  __atomic_store_n( &header->transmit_read_count, read_count + byte_count, __ATOMIC_RELEASE );
+
+  return byte_count;
+}
+
+
+size_t uart_dpi_shm_write ( uart_dpi_shm_client * const client, const void * const data, const size_t byte_count )
+{
+  uart_dpi_shm_header * const header = client->header;
+
+  const uint64_t write_count = __atomic_load_n( &header->receive_write_count, __ATOMIC_RELAXED );
+  const uint64_t read_count  = __atomic_load_n( &header->receive_read_count , __ATOMIC_ACQUIRE );
+
+  const size_t free_byte_count = (size_t) ( header->receive_size - ( write_count - read_count ) );
+  const size_t written = min_size( byte_count, free_byte_count );
+
+  copy_to_ring( client->receive_data, header->receive_storage_size, write_count, (const uint8_t *) data, written );
+
+  __atomic_store_n( &header->receive_write_count, write_count + written, __ATOMIC_RELEASE );
+
+  return written;
+}
+
+
+static int is_transmit_data_available ( const uart_dpi_shm_header * const header )
+{
+  return __atomic_load_n( &header->transmit_write_count, __ATOMIC_ACQUIRE ) !=
+         __atomic_load_n( &header->transmit_read_count , __ATOMIC_RELAXED );
+}
+
+
+int uart_dpi_shm_wait ( uart_dpi_shm_client * const client, const int timeout_ms )
+{
+  uart_dpi_shm_header * const header = client->header;
+
+  if ( __atomic_load_n( &header->is_closed, __ATOMIC_ACQUIRE ) )
+    return -1;
+
+  // Any wake-up after this point changes the futex value, so that FUTEX_WAIT below does not sleep.
+  const uint32_t futex_value = __atomic_load_n( &header->transmit_futex, __ATOMIC_ACQUIRE );
+
+  __atomic_store_n( &header->transmit_waiting, 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+  if ( !is_transmit_data_available( header ) )
+  {
+    struct timespec timeout;
+
+    if ( timeout_ms >= 0 )
+    {
+      timeout.tv_sec  = timeout_ms / 1000;
+      timeout.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+    }
+
+    // A shared futex, because the simulation lives in another process.
+    syscall( SYS_futex, &header->transmit_futex, FUTEX_WAIT, futex_value, timeout_ms >= 0 ? &timeout : NULL, NULL, 0 );
+  }
+
+  __atomic_store_n( &header->transmit_waiting, 0, __ATOMIC_RELAXED );
+
+  if ( is_transmit_data_available( header ) )
+    return 1;
+
+  return __atomic_load_n( &header->is_closed, __ATOMIC_ACQUIRE ) ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+// Reference client library for the shared memory transport of the UART DPI module.
+//
+// An external test harness on the same host uses these routines to exchange data with the simulated UART
+// without any system calls, except for uart_dpi_shm_wait(). See section "Shared memory transport" in README.pod.
+//
+// "Transmit" and "receive" are seen from the simulation side, so the harness reads the transmitted data
+// and writes the received data. Only one thread may read, and only one thread may write, at a time.
+
+#ifndef UART_DPI_SHM_CLIENT_H_INCLUDED
+#define UART_DPI_SHM_CLIENT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uart_dpi_shm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+  uart_dpi_shm_header * header;  // NULL means not open.
+  size_t    map_size;
+  uint8_t * transmit_data;
+  uint8_t * receive_data;
+
+  // How many transmitted bytes the simulation overwrote before they could be read.
+  // Only possible if the simulation is not in lossless transmit mode.
+  uint64_t  lost_byte_count;
+} uart_dpi_shm_client;
+
+// Returns 0 on success, or an errno value. EPROTO means that the region does not have the expected
+// signature or version, which can also happen if the simulation has not finished creating it yet.
+int uart_dpi_shm_open ( uart_dpi_shm_client * client, const char * name );
+
+void uart_dpi_shm_close ( uart_dpi_shm_client * client );
+
+// Reads the data the simulation has transmitted so far, up to max_byte_count bytes. Returns the number of bytes read.
+size_t uart_dpi_shm_read ( uart_dpi_shm_client * client, void * data, size_t max_byte_count );
+
+// Sends data to the simulation, as much as fits in the receive buffer. Returns the number of bytes written.
+size_t uart_dpi_shm_write ( uart_dpi_shm_client * client, const void * data, size_t byte_count );
+
+// Waits until there is transmitted data to read. A negative timeout means no timeout.
+// Returns 1 if there is data, 0 on timeout and -1 if the simulation has closed the region.
+// The wait may also end early without data, and then the return value is 0 too.
+int uart_dpi_shm_wait ( uart_dpi_shm_client * client, int timeout_ms );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // Include this header file only once.
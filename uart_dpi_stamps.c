@@ -0,0 +1,267 @@
+// Prints a transmit stamp file of the UART DPI module, see section "Cycle-stamped transmit data" in README.pod:
+//
+//   uart_dpi_stamps [--top <count>] <file>
+//
+//     Prints each line of the transmitted text, prefixed with the clock tick at which the software wrote
+//     its first byte, and with the number of ticks since the previous line. This shows where the simulated
+//     software spends its time, like timestamps on a real serial console, but exact and free of host jitter.
+//
+//     With --top, it prints the given number of largest gaps between lines at the end, together with
+//     the line numbers, which is usually the quickest way to find the slow parts of a boot log.
+//
+// Compile it with GCC or Clang on Linux, for example:
+//   gcc -O2 -o uart_dpi_stamps uart_dpi_stamps.c
+
+#include "uart_dpi_stamps.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+
+typedef struct
+{
+  uint64_t delta;
+  uint64_t tick;
+  uint64_t line_number;
+} stamp_gap;
+
+
+static const char * s_filename = NULL;
+
+static char * s_line = NULL;
+static size_t s_line_len = 0;
+static size_t s_line_capacity = 0;
+static uint64_t s_line_tick = 0;
+
+static uint64_t s_line_number = 0;
+static uint64_t s_previous_line_tick = 0;
+
+static stamp_gap * s_top_gaps = NULL;  // Sorted by decreasing delta.
+static size_t s_top_gap_count = 0;
+static size_t s_max_top_gap_count = 0;
+
+
+static void fail ( const char * const message )
+{
+  fprintf( stderr, "uart_dpi_stamps: %s\n", message );
+  exit( 1 );
+}
+
+
+static void * checked_realloc ( void * const ptr, const size_t size )
+{
+  void * const new_ptr = realloc( ptr, size );
+
+  if ( new_ptr == NULL && size != 0 )
+    fail( "Out of memory." );
+
+  return new_ptr;
+}
+
+
+// Returns 0 at the end of the file, which is only valid before the first byte of a number.
+
+static int read_leb128 ( FILE * const file, uint64_t * const value )
+{
+  *value = 0;
+
+  for ( unsigned shift = 0; ; shift += 7 )
+  {
+    const int c = getc( file );
+
+    if ( c == EOF )
+    {
+      if ( shift == 0 && !ferror( file ) )
+        return 0;
+
+      return -1;
+    }
+
+    if ( shift > 63 )
+      fail( "The file is corrupt." );
+
+    *value |= (uint64_t) ( c & 0x7F ) << shift;
+
+    if ( ( c & 0x80 ) == 0 )
+      return 1;
+  }
+}
+
+
+static void add_gap ( const uint64_t delta )
+{
+  if ( s_max_top_gap_count == 0 )
+    return;
+
+  if ( s_top_gap_count == s_max_top_gap_count && delta <= s_top_gaps[ s_top_gap_count - 1 ].delta )
+    return;
+
+  size_t pos = s_top_gap_count == s_max_top_gap_count ? s_top_gap_count - 1 : s_top_gap_count++;
+
+  while ( pos != 0 && s_top_gaps[ pos - 1 ].delta < delta )
+  {
+    s_top_gaps[ pos ] = s_top_gaps[ pos - 1 ];
+    --pos;
+  }
+
+  s_top_gaps[ pos ].delta       = delta;
+  s_top_gaps[ pos ].tick        = s_line_tick;
+  s_top_gaps[ pos ].line_number = s_line_number;
+}
+
+
+static void print_line ( void )
+{
+  size_t byte_count = s_line_len;
+
+  // Most UART consoles end their lines with "\r\n".
+  if ( byte_count != 0 && s_line[ byte_count - 1 ] == '\r' )
+    --byte_count;
+
+  ++s_line_number;
+
+  const uint64_t delta = s_line_tick - s_previous_line_tick;
+
+  if ( s_line_number != 1 )
+    add_gap( delta );
+
+  printf( "%14llu %+12lld  %.*s\n",
+          (unsigned long long) s_line_tick,
+          s_line_number == 1 ? 0LL : (long long) delta,
+          (int) byte_count,
+          s_line != NULL ? s_line : "" );
+
+  s_previous_line_tick = s_line_tick;
+  s_line_len = 0;
+}
+
+
+static void add_byte ( const uint64_t tick, const char c )
+{
+  if ( s_line_len == 0 )
+    s_line_tick = tick;
+
+  if ( c == '\n' )
+  {
+    print_line();
+    return;
+  }
+
+  if ( s_line_len == s_line_capacity )
+  {
+    s_line_capacity = s_line_capacity == 0 ? 256 : 2 * s_line_capacity;
+    s_line = (char *) checked_realloc( s_line, s_line_capacity );
+  }
+
+  s_line[ s_line_len++ ] = c;
+}
+
+
+int main ( const int argc, char ** const argv )
+{
+  for ( int i = 1; i < argc; ++i )
+  {
+    if ( 0 == strcmp( argv[ i ], "--top" ) && i + 1 < argc )
+      s_max_top_gap_count = (size_t) atoi( argv[ ++i ] );
+    else if ( s_filename == NULL && argv[ i ][ 0 ] != '-' )
+      s_filename = argv[ i ];
+    else
+      fail( "Usage: uart_dpi_stamps [--top <count>] <file>" );
+  }
+
+  if ( s_filename == NULL )
+    fail( "Usage: uart_dpi_stamps [--top <count>] <file>" );
+
+  FILE * const file = fopen( s_filename, "rb" );
+
+  if ( file == NULL )
+  {
+    fprintf( stderr, "uart_dpi_stamps: Error opening file \"%s\": %s\n", s_filename, strerror( errno ) );
+    exit( 1 );
+  }
+
+  s_top_gaps = (stamp_gap *) checked_realloc( NULL, s_max_top_gap_count * sizeof( stamp_gap ) );
+
+  char signature[ UART_DPI_STAMP_FILE_SIGNATURE_LEN ];
+
+  if ( fread( signature, 1, sizeof( signature ), file ) != sizeof( signature ) ||
+       0 != memcmp( signature, UART_DPI_STAMP_FILE_SIGNATURE, UART_DPI_STAMP_FILE_SIGNATURE_LEN ) )
+  {
+    fail( "The file is not a UART DPI transmit stamp file, or has an incompatible version." );
+  }
+
+  uint64_t tick = 0;
+  int is_truncated = 0;
+
+  for ( ; ; )
+  {
+    uint64_t tick_delta;
+    uint64_t byte_count;
+
+    const int res = read_leb128( file, &tick_delta );
+
+    if ( res == 0 )
+      break;
+
+    if ( res < 0 || read_leb128( file, &byte_count ) <= 0 )
+    {
+      is_truncated = 1;
+      break;
+    }
+
+    tick += tick_delta;
+
+    for ( uint64_t i = 0; i < byte_count; ++i )
+    {
+      const int c = getc( file );
+
+      if ( c == EOF )
+      {
+        is_truncated = 1;
+        break;
+      }
+
+      add_byte( tick, (char) c );
+    }
+
+    if ( is_truncated )
+      break;
+  }
+
+  if ( ferror( file ) )
+  {
+    fprintf( stderr, "uart_dpi_stamps: Error reading file \"%s\": %s\n", s_filename, strerror( errno ) );
+    exit( 1 );
+  }
+
+  fclose( file );
+
+  // The last line, if the simulation did not end it.
+  if ( s_line_len != 0 )
+    print_line();
+
+  // The simulator may have been killed before the UART DPI module could write all of its data.
+  if ( is_truncated )
+    fprintf( stderr, "uart_dpi_stamps: The file ends in the middle of an entry.\n" );
+
+  if ( s_top_gap_count != 0 )
+  {
+    printf( "\nLargest gaps before a line:\n" );
+
+    for ( size_t i = 0; i < s_top_gap_count; ++i )
+    {
+      printf( "  %12llu ticks before line %llu, at tick %llu\n",
+              (unsigned long long) s_top_gaps[ i ].delta,
+              (unsigned long long) s_top_gaps[ i ].line_number,
+              (unsigned long long) s_top_gaps[ i ].tick );
+    }
+  }
+
+  free( s_line );
+  free( s_top_gaps );
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+// File format of the transmit stamp files of the UART DPI module, see section "Cycle-stamped transmit data"
+// in README.pod.
+//
+// A transmit stamp file records which clock tick each piece of the transmitted data was written at
+// by the simulated software. The file starts with UART_DPI_STAMP_FILE_SIGNATURE, followed by a sequence of entries:
+//
+//   tick delta   LEB128-encoded unsigned integer. The clock tick at which the first byte of the entry was written,
+//                relative to the previous entry, or to tick 0 for the first entry.
+//   byte count   LEB128-encoded unsigned integer, never 0.
+//   data         The transmitted bytes.
+//
+// By default, there is one entry per line of text, which ends with the end-of-line character (\n).
+// Very long lines, and the last line if it was not complete, span several entries.
+// With transmit_stamp_per_byte, there is one entry per clock tick that wrote data instead.
+//
+// If the simulation writes data faster than the file can take it, whole entries are left out.
+// Their tick deltas are then included in the next entry.
+//
+// This file is plain C, so that a tool can include it too.
+
+#ifndef UART_DPI_STAMPS_H_INCLUDED
+#define UART_DPI_STAMPS_H_INCLUDED
+
+#define UART_DPI_STAMP_FILE_SIGNATURE      "UARTTS01"
+#define UART_DPI_STAMP_FILE_SIGNATURE_LEN  8
+
+#endif  // Include this header file only once.
@@ -0,0 +1,63 @@
+// Statistics file layout of the UART DPI module, see section "Performance counters" in README.pod.
+//
+// If a UART DPI instance has a statistics file, the simulation keeps its counters directly in that file,
+// which is mapped into memory. An external monitoring tool can map the same file read-only and look at the counters
+// at any time, without any system calls or other interaction with the simulation.
+//
+// Each counter has a single writer and only ever grows, except for the peak values, which are also monotonic.
+// A reader should load each counter as an aligned 64-bit value, but needs no locking.
+//
+// The same counters are available from Verilog with uart_dpi_get_stats(), in the order given by the indices below.
+//
+// This file is plain C, so that an external monitoring tool can include it too.
+
+#ifndef UART_DPI_STATS_H_INCLUDED
+#define UART_DPI_STATS_H_INCLUDED
+
+#include <stdint.h>
+
+#define UART_DPI_STATS_SIGNATURE "UARTST01"
+#define UART_DPI_STATS_VERSION   1
+
+enum uart_dpi_stat_index
+{
+  // Written by the simulation thread.
+  UART_DPI_STAT_TICK_COUNT                = 0,
+  UART_DPI_STAT_TICK_TIME_NS              = 1,   // Estimated from a sample of the clock ticks, see README.pod .
+  UART_DPI_STAT_TRANSMITTED_BYTE_COUNT    = 2,   // Bytes the simulated UART has sent.
+  UART_DPI_STAT_RECEIVED_BYTE_COUNT       = 3,   // Bytes the simulated UART has read.
+  UART_DPI_STAT_DROPPED_BYTE_COUNT        = 4,   // Bytes that overwrote unread ones in a full transmit buffer.
+  UART_DPI_STAT_TRANSMIT_STALL_COUNT      = 5,   // Only in lossless transmit mode.
+  UART_DPI_STAT_TRANSMIT_PEAK_BYTE_COUNT  = 6,   // The highest transmit buffer occupancy.
+  UART_DPI_STAT_RECEIVE_PEAK_BYTE_COUNT   = 7,   // The highest receive buffer occupancy seen on a clock tick.
+
+  // Written by the background I/O thread, which is the multiplexing server's own one with endpoint "mux".
+  // Endpoints "shm" and "harness" have no I/O thread, so these stay at zero, except for the lost byte count
+  // with endpoint "harness", which the simulation thread writes, as the testbench drains the data on that thread.
+  // These start on a separate cache line.
+  UART_DPI_STAT_IO_SERVICE_COUNT          = 8,   // How often the I/O thread woke up for this instance.
+  UART_DPI_STAT_SEND_CALL_COUNT           = 9,   // writev() calls or io_uring send operations.
+  UART_DPI_STAT_RECEIVE_CALL_COUNT        = 10,  // readv() calls or io_uring receive operations.
+  UART_DPI_STAT_ACCEPTED_CONNECTION_COUNT = 11,
+  UART_DPI_STAT_CLIENT_LOST_BYTE_COUNT    = 12,  // Bytes that slow clients have lost.
+
+  UART_DPI_STAT_COUNT                     = 13
+};
+
+typedef struct
+{
+  // Offset 0, written once by the simulation before the signature.
+  char     signature[ 8 ];  // UART_DPI_STATS_SIGNATURE, without the null terminator.
+  uint32_t version;         // UART_DPI_STATS_VERSION.
+  uint32_t pid;             // The simulation process.
+  uint32_t is_closed;       // Set when the simulation destroys the UART DPI instance.
+  uint8_t  reserved1[ 44 ];
+
+  // Offset 64. Where the UART is available, like "tcp:5678" or "pty:/dev/pts/5", null terminated.
+  char     endpoint[ 128 ];
+
+  // Offset 192, see enum uart_dpi_stat_index.
+  uint64_t counters[ UART_DPI_STAT_COUNT ];
+} uart_dpi_stats;
+
+#endif  // Include this header file only once.